@@ -0,0 +1,231 @@
+/****************************************************************************/
+// gcc -O1 test_psum_stream.c -lm -lrt -o test_psum_stream
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#define MAX_SIZE 2000000
+
+/* Data arrives in chunks of CHUNK elements. We ingest chunks until the
+   history reaches MAX_SIZE, and record timings every SAMPLE_EVERY chunks. */
+#define CHUNK 10000
+#define NUM_CHUNKS (MAX_SIZE/CHUNK)
+#define SAMPLE_EVERY 10
+
+#define NUM_TESTS (NUM_CHUNKS/SAMPLE_EVERY)
+
+/* Running state of a prefix sum that is fed one chunk at a time. "carry" is
+   the last prefix value emitted, so the next chunk continues from there. */
+typedef struct {
+  float carry;
+  long int total;    /* number of elements ingested so far */
+} psum_state_rec, *psum_state_ptr;
+
+/* Prototypes */
+void psum1(float a[], float p[], long int n);
+void psum2(float a[], float p[], long int n);
+psum_state_ptr new_psum_state(void);
+void reset_psum_state(psum_state_ptr s);
+long int get_psum_total(psum_state_ptr s);
+void psum_stream(psum_state_ptr s, float a[], float p[], long int n);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2;
+  }
+  return quasi_random;
+}
+
+/****************************************************************************/
+int main(int argc, char *argv[])
+{
+  float *in, *out, *ref;
+  long int x, c, i, n;
+  long int errors;
+  double wd;
+  struct timespec time_start, time_stop;
+  double time_recompute[NUM_TESTS], time_stream[NUM_TESTS];
+  psum_state_ptr s;
+
+  // initialize
+  in = (float *) malloc(MAX_SIZE * sizeof(*in));
+  out = (float *) malloc(MAX_SIZE * sizeof(*out));
+  ref = (float *) malloc(MAX_SIZE * sizeof(*ref));
+  if (!in || !out || !ref) {
+    fprintf(stderr, "COULDN'T ALLOCATE %ld BYTES STORAGE\n",
+                                        3L * MAX_SIZE * (long)sizeof(float));
+    exit(-1);
+  }
+  for (x = 0; x < MAX_SIZE; x++) {
+    in[x] = (float)(x % 100);
+  }
+  s = new_psum_state();
+
+  wd = wakeup_delay();
+
+  /* The old way: every time a chunk arrives, psum1() is run again over the
+     whole history, so the cost of each chunk grows with the history. */
+  for (c = 0; c < NUM_CHUNKS; c++) {
+    n = (c+1) * CHUNK;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+    psum1(in, ref, n);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    if (c % SAMPLE_EVERY == 0) {
+      time_recompute[c/SAMPLE_EVERY] = interval(time_start, time_stop);
+    }
+  }
+
+  /* The streaming way: each chunk is scanned once, continuing from the
+     carried state, and written straight into its place in the output. */
+  reset_psum_state(s);
+  for (c = 0; c < NUM_CHUNKS; c++) {
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+    psum_stream(s, &in[c*CHUNK], &out[c*CHUNK], CHUNK);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    if (c % SAMPLE_EVERY == 0) {
+      time_stream[c/SAMPLE_EVERY] = interval(time_start, time_stop);
+    }
+  }
+
+  /* Both methods do the additions in the same order, so the results must
+     match exactly, not just within a tolerance. */
+  errors = 0;
+  for (i = 0; i < get_psum_total(s); i++) {
+    if (out[i] != ref[i]) errors++;
+  }
+
+  /* output per-chunk latency */
+  printf("history, recompute, stream\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    printf("%ld, %f, %f\n", (x*SAMPLE_EVERY+1) * (long)CHUNK,
+                                    time_recompute[x], time_stream[x]);
+  }
+
+  printf("Streamed %ld elements in chunks of %d, %ld mismatches vs psum1\n",
+                                    get_psum_total(s), CHUNK, errors);
+  /* Here we print things to prevent overzealous optimization */
+  printf("The biggest psum output value is: %f\n", out[MAX_SIZE-1]);
+  printf("Wakeup delay calculated the value %f\n", wd);
+
+  return 0;
+} /* end of main() */
+
+void psum1(float a[], float p[], long int n)
+{
+  long int i;
+
+  p[0] = a[0];
+  for (i = 1; i < n; i++) {
+    p[i] = p[i-1] + a[i];
+  }
+}
+
+void psum2(float a[], float p[], long int n)
+{
+  long int i;
+
+  p[0] = a[0];
+  for (i = 1; i < n-1; i+=2) {
+    float mid_val = p[i-1] + a[i];
+    p[i] = mid_val;
+    p[i+1] = mid_val + a[i+1];
+  }
+
+  /* For odd n, finish remaining element */
+  if (i < n) {
+    p[i] = p[i-1] + a[i];
+  }
+}
+
+/****************************************************************************/
+/* Create a streaming prefix-sum state, starting from an empty history */
+psum_state_ptr new_psum_state(void)
+{
+  psum_state_ptr result = (psum_state_ptr) malloc(sizeof(psum_state_rec));
+  if (!result) return NULL;  /* Couldn't allocate storage */
+  reset_psum_state(result);
+  return result;
+}
+
+/* Forget the history, so the next chunk starts a new prefix sum */
+void reset_psum_state(psum_state_ptr s)
+{
+  s->carry = 0.0f;
+  s->total = 0;
+}
+
+/* Return how many elements have been ingested since the last reset */
+long int get_psum_total(psum_state_ptr s)
+{
+  return s->total;
+}
+
+/* Prefix sum of one chunk, continuing from the carried state. The output
+   goes directly into p[0..n-1] (which is usually the chunk's slot in a
+   larger caller-owned buffer), and the work is proportional to n only.
+   The loop is unrolled by 2 the same way as psum2(). */
+void psum_stream(psum_state_ptr s, float a[], float p[], long int n)
+{
+  long int i;
+  float acc = s->carry;
+
+  for (i = 0; i < n-1; i+=2) {
+    float mid_val = acc + a[i];
+    p[i] = mid_val;
+    acc = mid_val + a[i+1];
+    p[i+1] = acc;
+  }
+
+  /* For odd n, finish remaining element */
+  if (i < n) {
+    acc = acc + a[i];
+    p[i] = acc;
+  }
+
+  s->carry = acc;
+  s->total += n;
+}
@@ -0,0 +1,207 @@
+/* gemm.h -- packed-panel double precision GEMM (C += A * B)
+
+   Header-only, BLIS style. Needs -mavx2 -mfma, and arena.h included
+   first.
+
+   C (M x N) += A (M x K) * B (K x N), all row-major with leading
+   dimensions lda, ldb, ldc. Loops, from the outside in:
+
+     jc: NC columns of B and C        B panel (KC x NC) lives in L3
+     pc: KC rows of B / columns of A  pack B(pc.., jc..) -> Bp
+     ic: MC rows of A and C           pack A(ic.., pc..) -> Ap, lives in L2
+     jr: NR columns                   one micro-panel of Bp, in L1
+     ir: MR rows                      micro-kernel: MR x NR block of C
+
+   Packing copies a block into contiguous, 64-byte aligned memory, in the
+   order the micro-kernel reads it: Ap is MC/MR micro-panels of MR rows,
+   each stored column by column (MR values for k, then MR for k+1, ...);
+   Bp is NC/NR micro-panels of NR columns, each stored row by row. The
+   micro-kernel then reads both with unit stride, and the edges of the
+   matrix are zero-padded in the packed copy so the kernel never needs a
+   special case for K.
+
+   The micro-kernel keeps the whole MR x NR = 6 x 8 block of C in 12 ymm
+   registers; each k step loads 2 vectors of Bp, broadcasts 6 values of Ap
+   and does 12 FMAs. Partial blocks at the right and bottom edges of C go
+   through a 6 x 8 scratch block.
+
+   gemm() allocates the packing buffers from default_arena() for the
+   duration of the call. gemm_blocked() takes them from the caller (e.g.
+   one set per thread), sized by GEMM_AP_SIZE / GEMM_BP_SIZE doubles.
+ */
+
+#ifndef _GEMM_H_
+#define _GEMM_H_
+
+#include <immintrin.h>
+
+#define GEMM_MR 6
+#define GEMM_NR 8
+#define GEMM_MC 96      /* multiple of MR; Ap = 96 x 256 x 8 = 192 KB */
+#define GEMM_KC 256
+#define GEMM_NC 2048    /* multiple of NR; Bp = 256 x 2048 x 8 = 4 MB */
+
+#define GEMM_AP_SIZE ((long)GEMM_MC * GEMM_KC)
+#define GEMM_BP_SIZE ((long)GEMM_KC * GEMM_NC)
+
+/* Pack the mc x kc block of A at a into MR-row micro-panels */
+static inline void gemm_pack_a(long int mc, long int kc, const double *a,
+                               long int lda, double *ap)
+{
+  long int i, k, ir, m;
+
+  for (ir = 0; ir < mc; ir += GEMM_MR) {
+    m = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+    for (k = 0; k < kc; k++) {
+      for (i = 0; i < m; i++) ap[i] = a[(ir+i)*lda + k];
+      for (; i < GEMM_MR; i++) ap[i] = 0.0;
+      ap += GEMM_MR;
+    }
+  }
+}
+
+/* Pack the kc x nc block of B at b into NR-column micro-panels */
+static inline void gemm_pack_b(long int kc, long int nc, const double *b,
+                               long int ldb, double *bp)
+{
+  long int j, k, jr, n;
+
+  for (jr = 0; jr < nc; jr += GEMM_NR) {
+    n = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+    for (k = 0; k < kc; k++) {
+      for (j = 0; j < n; j++) bp[j] = b[k*ldb + jr+j];
+      for (; j < GEMM_NR; j++) bp[j] = 0.0;
+      bp += GEMM_NR;
+    }
+  }
+}
+
+/* c (6 x 8, leading dimension ldc) += ap (6 x kc micro-panel) times
+   bp (kc x 8 micro-panel). bp must be 32-byte aligned. */
+static inline void gemm_ukernel(long int kc, const double *ap,
+                                const double *bp, double *c, long int ldc)
+{
+  __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+  __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+  __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+  __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+  __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+  __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+  __m256d b0, b1, a;
+  long int k;
+
+  for (k = 0; k < kc; k++) {
+    b0 = _mm256_load_pd(&bp[0]);
+    b1 = _mm256_load_pd(&bp[4]);
+    a = _mm256_broadcast_sd(&ap[0]);
+    c00 = _mm256_fmadd_pd(a, b0, c00);  c01 = _mm256_fmadd_pd(a, b1, c01);
+    a = _mm256_broadcast_sd(&ap[1]);
+    c10 = _mm256_fmadd_pd(a, b0, c10);  c11 = _mm256_fmadd_pd(a, b1, c11);
+    a = _mm256_broadcast_sd(&ap[2]);
+    c20 = _mm256_fmadd_pd(a, b0, c20);  c21 = _mm256_fmadd_pd(a, b1, c21);
+    a = _mm256_broadcast_sd(&ap[3]);
+    c30 = _mm256_fmadd_pd(a, b0, c30);  c31 = _mm256_fmadd_pd(a, b1, c31);
+    a = _mm256_broadcast_sd(&ap[4]);
+    c40 = _mm256_fmadd_pd(a, b0, c40);  c41 = _mm256_fmadd_pd(a, b1, c41);
+    a = _mm256_broadcast_sd(&ap[5]);
+    c50 = _mm256_fmadd_pd(a, b0, c50);  c51 = _mm256_fmadd_pd(a, b1, c51);
+    ap += GEMM_MR;
+    bp += GEMM_NR;
+  }
+
+#define GEMM_ACC_ROW(i, lo, hi)                                           \
+  _mm256_storeu_pd(&c[(i)*ldc],                                           \
+                   _mm256_add_pd(_mm256_loadu_pd(&c[(i)*ldc]), lo));      \
+  _mm256_storeu_pd(&c[(i)*ldc + 4],                                       \
+                   _mm256_add_pd(_mm256_loadu_pd(&c[(i)*ldc + 4]), hi));
+  GEMM_ACC_ROW(0, c00, c01)
+  GEMM_ACC_ROW(1, c10, c11)
+  GEMM_ACC_ROW(2, c20, c21)
+  GEMM_ACC_ROW(3, c30, c31)
+  GEMM_ACC_ROW(4, c40, c41)
+  GEMM_ACC_ROW(5, c50, c51)
+#undef GEMM_ACC_ROW
+}
+
+/* Same for an m x n (m <= 6, n <= 8) block at the edge of C: the kernel
+   works on a zeroed scratch block, and only m x n of it is added to c */
+static inline void gemm_ukernel_edge(long int kc, const double *ap,
+                                     const double *bp, double *c,
+                                     long int ldc, long int m, long int n)
+{
+  double tmp[GEMM_MR * GEMM_NR] __attribute__ ((aligned (32)));
+  long int i, j;
+
+  for (i = 0; i < GEMM_MR * GEMM_NR; i++) tmp[i] = 0.0;
+  gemm_ukernel(kc, ap, bp, tmp, GEMM_NR);
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      c[i*ldc + j] += tmp[i*GEMM_NR + j];
+}
+
+/* One packed mc x kc block of A times one packed kc x nc panel of B, into
+   the mc x nc block of C at c */
+static inline void gemm_macro(long int mc, long int nc, long int kc,
+                              const double *ap, const double *bp,
+                              double *c, long int ldc)
+{
+  long int ir, jr, m, n;
+
+  for (jr = 0; jr < nc; jr += GEMM_NR) {
+    n = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+    for (ir = 0; ir < mc; ir += GEMM_MR) {
+      m = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+      if (m == GEMM_MR && n == GEMM_NR)
+        gemm_ukernel(kc, &ap[ir*kc], &bp[jr*kc], &c[ir*ldc + jr], ldc);
+      else
+        gemm_ukernel_edge(kc, &ap[ir*kc], &bp[jr*kc], &c[ir*ldc + jr], ldc,
+                          m, n);
+    }
+  }
+}
+
+/* C += A * B with caller-supplied packing buffers: ap holds GEMM_AP_SIZE
+   doubles and bp GEMM_BP_SIZE, both 64-byte aligned */
+static inline void gemm_blocked(long int M, long int N, long int K,
+                                const double *a, long int lda,
+                                const double *b, long int ldb,
+                                double *c, long int ldc,
+                                double *ap, double *bp)
+{
+  long int jc, pc, ic, nc, kc, mc;
+
+  for (jc = 0; jc < N; jc += GEMM_NC) {
+    nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+    for (pc = 0; pc < K; pc += GEMM_KC) {
+      kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+      gemm_pack_b(kc, nc, &b[pc*ldb + jc], ldb, bp);
+      for (ic = 0; ic < M; ic += GEMM_MC) {
+        mc = (M - ic < GEMM_MC) ? M - ic : GEMM_MC;
+        gemm_pack_a(mc, kc, &a[ic*lda + pc], lda, ap);
+        gemm_macro(mc, nc, kc, ap, bp, &c[ic*ldc + jc], ldc);
+      }
+    }
+  }
+}
+
+/* C += A * B, packing buffers from default_arena() */
+static inline void gemm(long int M, long int N, long int K,
+                        const double *a, long int lda,
+                        const double *b, long int ldb,
+                        double *c, long int ldc)
+{
+  arena_mark_t mark = arena_mark(default_arena());
+  double *ap = (double *) arena_alloc(default_arena(),
+                                      GEMM_AP_SIZE * sizeof(double));
+  double *bp = (double *) arena_alloc(default_arena(),
+                                      GEMM_BP_SIZE * sizeof(double));
+
+  if (!ap || !bp) {
+    printf("COULDN'T ALLOCATE gemm packing buffers\n");
+    exit(-1);
+  }
+  gemm_blocked(M, N, K, a, lda, b, ldb, c, ldc, ap, bp);
+  arena_release(default_arena(), mark);
+}
+
+#endif /* _GEMM_H_ */
@@ -0,0 +1,222 @@
+/* layout.h -- tiled and Morton (Z-order) matrix storage
+
+   Header-only. Include after arena.h, mat.h and the typedef of data_t
+   (mat_ptr is the row-major matrix that these convert from and to).
+
+   Row-major storage (new_mat, new_matrix, new_array) keeps a row together
+   and spreads a column over one cache line per element, which is why the
+   loop orders of MMM differ so much. An lmat cuts the matrix into
+   LAYOUT_TB x LAYOUT_TB tiles (32 x 32 doubles = 8 KB, a quarter of L1),
+   each stored contiguously and row-major inside, so any access pattern
+   that stays in a tile -- rows or columns -- stays in 8 KB. The tiles
+   themselves are stored in one of two orders:
+
+     LAYOUT_TILED    tile (ti,tj) at ti * tiles_across + tj (row-major)
+     LAYOUT_MORTON   tile (ti,tj) at the Morton code of (ti,tj): the bits
+                     of ti and tj interleaved, tj in the even bits, ti in
+                     the odd ones. Consecutive tiles then form 2 x 2, 4 x 4,
+                     8 x 8 ... squares, so neighbours in both directions
+                     are close in memory at every scale.
+
+   A plain Morton code needs storage for the square of the longer side, so
+   for a non-square grid of tiles only the low mbits bits of each index
+   are interleaved, where 2^mbits is the shorter side rounded up to a
+   power of two. The remaining high bits of the longer index go above
+   them: the grid is a row (or column) of 2^mbits x 2^mbits Morton
+   squares, one after the other, and a 10000 x 64 matrix takes 626 tiles
+   of storage rather than 133762.
+
+   Element (i,j) is at tile(i / TB, j / TB) + (i % TB) * TB + j % TB.
+   Sizes that aren't multiples of TB are padded to whole tiles, and the
+   padding is kept at zero, so kernels can work on whole tiles. For a
+   Morton matrix whose tile counts aren't powers of two some codes below
+   the largest one are unused (less than 3x the tiles in use), and their
+   tiles are never touched.
+
+     lmat_ptr t = new_lmat(n, n, LAYOUT_MORTON);
+     lmat_from_mat(t, a);            // row-major -> Morton
+     data_t *tile = lmat_tile(t, 2, 3);
+     lmat_to_mat(t, a);              // and back
+
+   Storage comes from default_arena(), like new_mat().
+ */
+
+#ifndef _LAYOUT_H_
+#define _LAYOUT_H_
+
+#define LAYOUT_TILED 1
+#define LAYOUT_MORTON 2
+
+#define LAYOUT_TB 32                       /* tile side, in elements */
+#define LAYOUT_TILE (LAYOUT_TB * LAYOUT_TB)  /* elements per tile */
+
+typedef struct {
+  long int rows;
+  long int cols;
+  long int tr;       /* tiles down */
+  long int tc;       /* tiles across */
+  long int ntiles;   /* tiles of storage (more than tr * tc for Morton) */
+  int layout;        /* LAYOUT_TILED or LAYOUT_MORTON */
+  int mbits;         /* Morton: bits of ti and tj that are interleaved */
+  data_t *data;
+} lmat_rec, *lmat_ptr;
+
+/* spread the low 32 bits of x out to the even bits */
+static inline unsigned long int morton_spread(unsigned long int x)
+{
+  x &= 0xffffffffUL;
+  x = (x | (x << 16)) & 0x0000ffff0000ffffUL;
+  x = (x | (x << 8))  & 0x00ff00ff00ff00ffUL;
+  x = (x | (x << 4))  & 0x0f0f0f0f0f0f0f0fUL;
+  x = (x | (x << 2))  & 0x3333333333333333UL;
+  x = (x | (x << 1))  & 0x5555555555555555UL;
+  return x;
+}
+
+/* and back: the even bits of x, packed */
+static inline unsigned long int morton_compact(unsigned long int x)
+{
+  x &= 0x5555555555555555UL;
+  x = (x | (x >> 1))  & 0x3333333333333333UL;
+  x = (x | (x >> 2))  & 0x0f0f0f0f0f0f0f0fUL;
+  x = (x | (x >> 4))  & 0x00ff00ff00ff00ffUL;
+  x = (x | (x >> 8))  & 0x0000ffff0000ffffUL;
+  x = (x | (x >> 16)) & 0x00000000ffffffffUL;
+  return x;
+}
+
+static inline long int morton_encode(long int ti, long int tj)
+{
+  return (long int)((morton_spread(ti) << 1) | morton_spread(tj));
+}
+
+static inline void morton_decode(long int code, long int *ti, long int *tj)
+{
+  *ti = (long int) morton_compact((unsigned long int) code >> 1);
+  *tj = (long int) morton_compact((unsigned long int) code);
+}
+
+/* Morton position of tile (ti,tj): the low mbits bits of ti and tj
+   interleaved, the high bits of the longer dimension above them */
+static inline long int lmat_morton_index(lmat_ptr m, long int ti,
+                                         long int tj)
+{
+  long int low = (1L << m->mbits) - 1;
+
+  if (m->tr > m->tc)
+    return ((ti >> m->mbits) << 2*m->mbits) | morton_encode(ti & low, tj);
+  return ((tj >> m->mbits) << 2*m->mbits) | morton_encode(ti, tj & low);
+}
+
+/* position of tile (ti,tj) in storage, in tiles */
+static inline long int lmat_tile_index(lmat_ptr m, long int ti, long int tj)
+{
+  return (m->layout == LAYOUT_MORTON) ? lmat_morton_index(m, ti, tj)
+                                      : ti * m->tc + tj;
+}
+
+/* tile (ti,tj) at storage position idx; 0 if that position is unused
+   (Morton padding) */
+static inline int lmat_tile_at(lmat_ptr m, long int idx, long int *ti,
+                               long int *tj)
+{
+  long int high;
+
+  if (m->layout == LAYOUT_MORTON) {
+    high = (idx >> 2*m->mbits) << m->mbits;
+    morton_decode(idx & ((1L << 2*m->mbits) - 1), ti, tj);
+    if (m->tr > m->tc) *ti += high;
+    else *tj += high;
+  }
+  else {
+    *ti = idx / m->tc;
+    *tj = idx % m->tc;
+  }
+  return *ti < m->tr && *tj < m->tc;
+}
+
+static inline data_t *lmat_tile(lmat_ptr m, long int ti, long int tj)
+{
+  return m->data + lmat_tile_index(m, ti, tj) * LAYOUT_TILE;
+}
+
+static inline data_t *lmat_at(lmat_ptr m, long int i, long int j)
+{
+  return lmat_tile(m, i / LAYOUT_TB, j / LAYOUT_TB)
+         + (i % LAYOUT_TB) * LAYOUT_TB + j % LAYOUT_TB;
+}
+
+/* Create a rows x cols matrix in the given layout, zeroed. Returns NULL
+   if there is no memory. */
+static inline lmat_ptr new_lmat(long int rows, long int cols, int layout)
+{
+  lmat_ptr result = (lmat_ptr) malloc(sizeof(lmat_rec));
+  if (!result) return NULL;  /* Couldn't allocate storage */
+  result->rows = rows;
+  result->cols = cols;
+  result->tr = (rows + LAYOUT_TB - 1) / LAYOUT_TB;
+  result->tc = (cols + LAYOUT_TB - 1) / LAYOUT_TB;
+  result->layout = layout;
+  result->mbits = 0;
+  while ((1L << result->mbits) < result->tr &&
+         (1L << result->mbits) < result->tc) result->mbits++;
+  result->data = NULL;
+  result->ntiles = (rows > 0 && cols > 0)
+    ? lmat_tile_index(result, result->tr - 1, result->tc - 1) + 1 : 0;
+
+  if (result->ntiles) {
+    result->data = (data_t *) arena_calloc(default_arena(),
+                                           result->ntiles * LAYOUT_TILE,
+                                           sizeof(data_t));
+    if (!result->data) {
+      printf("\n COULDN'T ALLOCATE %ld BYTES STORAGE \n",
+             result->ntiles * LAYOUT_TILE * (long) sizeof(data_t));
+      free((void *) result);
+      return NULL;  /* Couldn't allocate storage */
+    }
+  }
+
+  return result;
+}
+
+/* row-major m -> t (same size), tile by tile; padding set to zero */
+static inline void lmat_from_mat(lmat_ptr t, mat_ptr m)
+{
+  long int ti, tj, ii, jj, i, j;
+  data_t *tile;
+
+  for (ti = 0; ti < t->tr; ti++)
+    for (tj = 0; tj < t->tc; tj++) {
+      tile = lmat_tile(t, ti, tj);
+      for (ii = 0; ii < LAYOUT_TB; ii++)
+        for (jj = 0; jj < LAYOUT_TB; jj++) {
+          i = ti * LAYOUT_TB + ii;
+          j = tj * LAYOUT_TB + jj;
+          tile[ii*LAYOUT_TB + jj] = (i < t->rows && j < t->cols)
+                                    ? m->data[i*m->ld + j] : 0;
+        }
+    }
+}
+
+/* t -> row-major m (same size) */
+static inline void lmat_to_mat(lmat_ptr t, mat_ptr m)
+{
+  long int ti, tj, ii, jj, i, j;
+  data_t *tile;
+
+  for (ti = 0; ti < t->tr; ti++)
+    for (tj = 0; tj < t->tc; tj++) {
+      tile = lmat_tile(t, ti, tj);
+      for (ii = 0; ii < LAYOUT_TB; ii++) {
+        i = ti * LAYOUT_TB + ii;
+        if (i >= t->rows) break;
+        for (jj = 0; jj < LAYOUT_TB; jj++) {
+          j = tj * LAYOUT_TB + jj;
+          if (j >= t->cols) break;
+          m->data[i*m->ld + j] = tile[ii*LAYOUT_TB + jj];
+        }
+      }
+    }
+}
+
+#endif /* _LAYOUT_H_ */
@@ -0,0 +1,130 @@
+/* mmm_fixed.h -- small square MMM kernels specialized on the size
+
+   Header-only. Needs -mavx2 -mfma.
+
+   The MMM loops read the row length at run time, so the compiler can't
+   unroll them completely or keep a tile of C in registers: it doesn't know
+   how many registers a row needs. Here each supported size N gets its own
+   function, generated by MMM_FIXED_KERNEL(N, R), in which every loop bound
+   is a constant. GCC unrolls all of it into a straight run of FMAs on
+   register accumulators:
+
+     for each group of R rows of C:
+       load the R x N tile of C              R * N/4 ymm registers
+       for k = 0 .. N-1:                     unrolled
+         load row k of B                     N/4 ymm registers
+         for each of the R rows:
+           broadcast a(i,k), FMA into the tile
+       store the tile
+
+   R is picked per size so the tile plus one row of B fits in the 16 ymm
+   registers (tile of 4 to 9 registers). Each row of B is loaded once per
+   group of R rows instead of once per row.
+
+   All kernels compute C += A * B for N x N matrices with leading
+   dimensions lda, ldb, ldc (unaligned access is fine). The sizes are
+   4, 8, 12, 16, 24 and 32 (multiples of 4, one ymm = 4 doubles).
+
+   mmm_fixed_lookup(n) returns the kernel for size n, or NULL; use it to
+   look the size up once for a whole batch. mmm_fixed(n, ...) looks it up
+   on every call and falls back to mmm_small_generic, the same kij loop as
+   mmm_kij, for the other sizes.
+ */
+
+#ifndef _MMM_FIXED_H_
+#define _MMM_FIXED_H_
+
+#include <immintrin.h>
+
+typedef void (*mmm_fixed_fn)(const double *a, long int lda,
+                             const double *b, long int ldb,
+                             double *c, long int ldc);
+
+/* C += A * B for N x N, R rows of C at a time. N % 4 == 0, N % R == 0. */
+#define MMM_FIXED_KERNEL(N, R)                                              \
+static inline void mmm_fixed_##N(const double *a, long int lda,            \
+                                 const double *b, long int ldb,            \
+                                 double *c, long int ldc)                  \
+{                                                                           \
+  __m256d acc[R][(N)/4], brow[(N)/4], av;                                   \
+  long int i, r, j, k;                                                      \
+                                                                            \
+  for (i = 0; i < (N); i += (R)) {                                          \
+    _Pragma("GCC unroll 8")                                                 \
+    for (r = 0; r < (R); r++) {                                             \
+      _Pragma("GCC unroll 8")                                               \
+      for (j = 0; j < (N)/4; j++)                                           \
+        acc[r][j] = _mm256_loadu_pd(&c[(i+r)*ldc + 4*j]);                   \
+    }                                                                       \
+    _Pragma("GCC unroll 32")                                                \
+    for (k = 0; k < (N); k++) {                                             \
+      _Pragma("GCC unroll 8")                                               \
+      for (j = 0; j < (N)/4; j++)                                           \
+        brow[j] = _mm256_loadu_pd(&b[k*ldb + 4*j]);                         \
+      _Pragma("GCC unroll 8")                                               \
+      for (r = 0; r < (R); r++) {                                           \
+        av = _mm256_broadcast_sd(&a[(i+r)*lda + k]);                        \
+        _Pragma("GCC unroll 8")                                             \
+        for (j = 0; j < (N)/4; j++)                                         \
+          acc[r][j] = _mm256_fmadd_pd(av, brow[j], acc[r][j]);              \
+      }                                                                     \
+    }                                                                       \
+    _Pragma("GCC unroll 8")                                                 \
+    for (r = 0; r < (R); r++) {                                             \
+      _Pragma("GCC unroll 8")                                               \
+      for (j = 0; j < (N)/4; j++)                                           \
+        _mm256_storeu_pd(&c[(i+r)*ldc + 4*j], acc[r][j]);                   \
+    }                                                                       \
+  }                                                                         \
+}
+
+MMM_FIXED_KERNEL(4, 4)     /* whole C in 4 registers */
+MMM_FIXED_KERNEL(8, 4)     /* 4 x 8 tile, 8 registers */
+MMM_FIXED_KERNEL(12, 3)    /* 3 x 12, 9 */
+MMM_FIXED_KERNEL(16, 2)    /* 2 x 16, 8 */
+MMM_FIXED_KERNEL(24, 1)    /* 1 x 24, 6 */
+MMM_FIXED_KERNEL(32, 1)    /* 1 x 32, 8 */
+
+/* C += A * B for any n x n, with n read at run time */
+static inline void mmm_small_generic(long int n, const double *a,
+                                     long int lda, const double *b,
+                                     long int ldb, double *c, long int ldc)
+{
+  long int i, j, k;
+  double r;
+
+  for (k = 0; k < n; k++)
+    for (i = 0; i < n; i++) {
+      r = a[i*lda + k];
+      for (j = 0; j < n; j++)
+        c[i*ldc + j] += r * b[k*ldb + j];
+    }
+}
+
+/* The specialized kernel for n, or NULL if there isn't one */
+static inline mmm_fixed_fn mmm_fixed_lookup(long int n)
+{
+  switch (n) {
+    case 4:  return mmm_fixed_4;
+    case 8:  return mmm_fixed_8;
+    case 12: return mmm_fixed_12;
+    case 16: return mmm_fixed_16;
+    case 24: return mmm_fixed_24;
+    case 32: return mmm_fixed_32;
+    default: return NULL;
+  }
+}
+
+/* C += A * B (n x n): the specialized kernel if there is one, else the
+   generic loop */
+static inline void mmm_fixed(long int n, const double *a, long int lda,
+                             const double *b, long int ldb, double *c,
+                             long int ldc)
+{
+  mmm_fixed_fn f = mmm_fixed_lookup(n);
+
+  if (f) f(a, lda, b, ldb, c, ldc);
+  else mmm_small_generic(n, a, lda, b, ldb, c, ldc);
+}
+
+#endif /* _MMM_FIXED_H_ */
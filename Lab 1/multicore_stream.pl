@@ -97,10 +97,12 @@ sub one_run
     unlink($fp);
   }
   # Run a lot of tests in parallel (note '&' at end of command, so
-  # we are running them all in the background
+  # we are running them all in the background. Ask for regular stores:
+  # mb defaults to "auto", which switches to streaming stores for big
+  # sizes, and the results would not be comparable with earlier runs.
   for($i=0; $i<$nt; $i++) {
     $fp = "$tmp/output-$i.txt";
-    system("./mb $memsize > $fp &");
+    system("./mb $memsize regular > $fp &");
   }
   # Wait until all of them have written to their output file(s)
   $waiting = 1;
@@ -0,0 +1,399 @@
+/* qgemm.h -- quantized integer GEMM: u8 x s8 -> s32 and s16 x s16 -> s32
+
+   Header-only. Include after arena.h. Kernels, picked at compile time:
+
+     -mavx2 -mavx512vnni -mavx512vl   VNNI: vpdpbusd / vpdpwssd
+     -mavx2                           AVX2: vpmaddubsw + vpmaddwd / vpmaddwd
+     (neither)                        the scalar loops
+
+   Both compute C += A * B with int32 C, row-major with leading dimensions
+   in elements:
+
+     qgemm_u8s8   A uint8 (activations), B int8 (weights)
+     qgemm_s16    A and B int16
+
+   The vector kernels work on 4 (u8s8) or 2 (s16) consecutive k at once:
+   the 4 bytes a(i,k..k+3) are broadcast as one 32-bit value, and B is
+   packed so that each 32-bit lane holds b(k..k+3, j) for one column j.
+   vpdpbusd multiplies the 4 byte pairs of every lane and adds them into
+   the lane's int32 accumulator; without VNNI, vpmaddubsw adds pairs of
+   products into int16 and vpmaddwd with ones adds the two int16 into
+   int32. The micro-kernel does QGEMM_MR x QGEMM_NR = 4 x 16 of C in 8 ymm
+   accumulators. B is packed once into 16-column panels (a panel stays in
+   L1 while all of packed A goes past it), A into 4-row panels, both
+   zero-padded at the edges; the buffers come from default_arena().
+
+   Ranges:
+     - vpmaddubsw saturates each int16 pair sum, so on the AVX2 path the
+       weights must be within +-QGEMM_S8_MAX = 63 (255 * 63 * 2 < 32767).
+       With VNNI (and in the scalar code) they can use all of +-127.
+     - int32 accumulators: for s16, the caller keeps K * max|a| * max|b|
+       below 2^31 (quantize_s16() takes the bound to use).
+
+   Quantization helpers (float in, integers out):
+     quantize_u8    affine: x ~ scale * (q - zero), q in 0..255
+     quantize_s8    symmetric: x ~ scale * q, |q| <= maxq
+     quantize_s16   symmetric, same
+     qgemm_col_sums_s8   column sums of B, for the zero point of A
+     dequantize_s32      C (float) = sa * sb * (C - zero_a * colsum_b)
+ */
+
+#ifndef _QGEMM_H_
+#define _QGEMM_H_
+
+#include <stdint.h>
+#include <math.h>
+#include <immintrin.h>
+
+#define QGEMM_MR 4
+#define QGEMM_NR 16    /* two ymm of int32 */
+
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+#define QGEMM_VNNI 1
+#define QGEMM_PATH "AVX-512 VNNI (256-bit)"
+#define QGEMM_S8_MAX 127
+#elif defined(__AVX2__)
+#define QGEMM_AVX2 1
+#define QGEMM_PATH "AVX2 maddubs/madd"
+#define QGEMM_S8_MAX 63
+#else
+#define QGEMM_PATH "scalar"
+#define QGEMM_S8_MAX 127
+#endif
+
+/* -=-=-=-=- quantization -=-=-=-=- */
+
+/* q = round(x / scale) + zero over [min(x), max(x)] (widened to include
+   0, so that 0 is exact); returns scale, zero point in *zero */
+static inline float quantize_u8(long int n, const float *x, uint8_t *q,
+                                int32_t *zero)
+{
+  float lo = 0.0f, hi = 0.0f, scale;
+  long int i;
+  int32_t z, v;
+
+  for (i = 0; i < n; i++) {
+    if (x[i] < lo) lo = x[i];
+    if (x[i] > hi) hi = x[i];
+  }
+  scale = (hi > lo) ? (hi - lo) / 255.0f : 1.0f;
+  z = (int32_t) lrintf(-lo / scale);
+  for (i = 0; i < n; i++) {
+    v = (int32_t) lrintf(x[i] / scale) + z;
+    q[i] = (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+  }
+  *zero = z;
+  return scale;
+}
+
+/* q = round(x / scale), scale = max|x| / maxq; returns scale */
+static inline float quantize_s8(long int n, const float *x, int8_t *q,
+                                int maxq)
+{
+  float amax = 0.0f, scale;
+  long int i;
+
+  for (i = 0; i < n; i++)
+    if (fabsf(x[i]) > amax) amax = fabsf(x[i]);
+  scale = (amax > 0.0f) ? amax / maxq : 1.0f;
+  for (i = 0; i < n; i++) q[i] = (int8_t) lrintf(x[i] / scale);
+  return scale;
+}
+
+static inline float quantize_s16(long int n, const float *x, int16_t *q,
+                                 int maxq)
+{
+  float amax = 0.0f, scale;
+  long int i;
+
+  for (i = 0; i < n; i++)
+    if (fabsf(x[i]) > amax) amax = fabsf(x[i]);
+  scale = (amax > 0.0f) ? amax / maxq : 1.0f;
+  for (i = 0; i < n; i++) q[i] = (int16_t) lrintf(x[i] / scale);
+  return scale;
+}
+
+/* sums[j] = sum over k of b(k,j), K x N */
+static inline void qgemm_col_sums_s8(long int K, long int N, const int8_t *b,
+                                     long int ldb, int32_t *sums)
+{
+  long int k, j;
+
+  for (j = 0; j < N; j++) sums[j] = 0;
+  for (k = 0; k < K; k++)
+    for (j = 0; j < N; j++) sums[j] += b[k*ldb + j];
+}
+
+/* out(i,j) = scale * (c(i,j) - zero * colsum[j]); colsum may be NULL
+   when zero is 0 */
+static inline void dequantize_s32(long int M, long int N, const int32_t *c,
+                                  long int ldc, float scale, int32_t zero,
+                                  const int32_t *colsum, float *out,
+                                  long int ldo)
+{
+  long int i, j;
+
+  for (i = 0; i < M; i++)
+    for (j = 0; j < N; j++)
+      out[i*ldo + j] = scale * (float)(c[i*ldc + j]
+                                       - (zero ? zero * colsum[j] : 0));
+}
+
+/* -=-=-=-=- scalar reference kernels -=-=-=-=- */
+
+static inline void qgemm_u8s8_ref(long int M, long int N, long int K,
+                                  const uint8_t *a, long int lda,
+                                  const int8_t *b, long int ldb,
+                                  int32_t *c, long int ldc)
+{
+  long int i, j, k;
+  int32_t r;
+
+  for (i = 0; i < M; i++)
+    for (k = 0; k < K; k++) {
+      r = a[i*lda + k];
+      for (j = 0; j < N; j++)
+        c[i*ldc + j] += r * b[k*ldb + j];
+    }
+}
+
+static inline void qgemm_s16_ref(long int M, long int N, long int K,
+                                 const int16_t *a, long int lda,
+                                 const int16_t *b, long int ldb,
+                                 int32_t *c, long int ldc)
+{
+  long int i, j, k;
+  int32_t r;
+
+  for (i = 0; i < M; i++)
+    for (k = 0; k < K; k++) {
+      r = a[i*lda + k];
+      for (j = 0; j < N; j++)
+        c[i*ldc + j] += r * b[k*ldb + j];
+    }
+}
+
+#if defined(QGEMM_VNNI) || defined(QGEMM_AVX2)
+
+/* -=-=-=-=- packing -=-=-=-=- */
+
+/* A (mr <= MR rows) -> groups of G k's: ap[(g*MR + r)*G + t] = a(r, g*G+t).
+   G is 4 for u8, 2 for s16; esize is the element size in bytes. */
+static inline void qgemm_pack_a(long int mr, long int K, const void *a,
+                                long int lda, void *ap, int G, int esize)
+{
+  long int g, r, t, kg = (K + G - 1) / G;
+  const char *src = (const char *) a;
+  char *dst = (char *) ap;
+
+  for (g = 0; g < kg; g++)
+    for (r = 0; r < QGEMM_MR; r++)
+      for (t = 0; t < G; t++) {
+        char *d = &dst[((g*QGEMM_MR + r)*G + t) * esize];
+        if (r < mr && g*G + t < K)
+          memcpy(d, &src[(r*lda + g*G + t) * esize], esize);
+        else
+          memset(d, 0, esize);
+      }
+}
+
+/* B (nr <= NR columns) -> bp[(g*NR + j)*G + t] = b(g*G+t, j) */
+static inline void qgemm_pack_b(long int nr, long int K, const void *b,
+                                long int ldb, void *bp, int G, int esize)
+{
+  long int g, j, t, kg = (K + G - 1) / G;
+  const char *src = (const char *) b;
+  char *dst = (char *) bp;
+
+  for (g = 0; g < kg; g++)
+    for (j = 0; j < QGEMM_NR; j++)
+      for (t = 0; t < G; t++) {
+        char *d = &dst[((g*QGEMM_NR + j)*G + t) * esize];
+        if (j < nr && g*G + t < K)
+          memcpy(d, &src[((g*G + t)*ldb + j) * esize], esize);
+        else
+          memset(d, 0, esize);
+      }
+}
+
+/* -=-=-=-=- micro-kernels: 4 x 16 of C += packed A * packed B -=-=-=-=- */
+
+/* kg groups of 4 k; each 32-bit lane of ap/bp holds 4 bytes */
+static inline void qgemm_ukernel_u8s8(long int kg, const uint8_t *ap,
+                                      const int8_t *bp, int32_t *c,
+                                      long int ldc)
+{
+  __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+  __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+  __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+  __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+  __m256i b0, b1, a;
+  int32_t a4;
+  long int g;
+#ifndef QGEMM_VNNI
+  const __m256i ones = _mm256_set1_epi16(1);
+#endif
+
+#ifdef QGEMM_VNNI
+#define QGEMM_DOT(acc, a, b) acc = _mm256_dpbusd_epi32(acc, a, b)
+#else
+#define QGEMM_DOT(acc, a, b)                                              \
+  acc = _mm256_add_epi32(acc,                                             \
+          _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), ones))
+#endif
+
+  for (g = 0; g < kg; g++) {
+    b0 = _mm256_load_si256((const __m256i *) &bp[0]);
+    b1 = _mm256_load_si256((const __m256i *) &bp[32]);
+    memcpy(&a4, &ap[0], 4);  a = _mm256_set1_epi32(a4);
+    QGEMM_DOT(c00, a, b0);  QGEMM_DOT(c01, a, b1);
+    memcpy(&a4, &ap[4], 4);  a = _mm256_set1_epi32(a4);
+    QGEMM_DOT(c10, a, b0);  QGEMM_DOT(c11, a, b1);
+    memcpy(&a4, &ap[8], 4);  a = _mm256_set1_epi32(a4);
+    QGEMM_DOT(c20, a, b0);  QGEMM_DOT(c21, a, b1);
+    memcpy(&a4, &ap[12], 4);  a = _mm256_set1_epi32(a4);
+    QGEMM_DOT(c30, a, b0);  QGEMM_DOT(c31, a, b1);
+    ap += 4 * QGEMM_MR;
+    bp += 4 * QGEMM_NR;
+  }
+#undef QGEMM_DOT
+
+#define QGEMM_ACC_ROW(i, lo, hi)                                          \
+  _mm256_storeu_si256((__m256i *) &c[(i)*ldc],                            \
+    _mm256_add_epi32(_mm256_loadu_si256((__m256i *) &c[(i)*ldc]), lo));   \
+  _mm256_storeu_si256((__m256i *) &c[(i)*ldc + 8],                        \
+    _mm256_add_epi32(_mm256_loadu_si256((__m256i *) &c[(i)*ldc + 8]), hi));
+  QGEMM_ACC_ROW(0, c00, c01)
+  QGEMM_ACC_ROW(1, c10, c11)
+  QGEMM_ACC_ROW(2, c20, c21)
+  QGEMM_ACC_ROW(3, c30, c31)
+}
+
+/* kg groups of 2 k; each 32-bit lane holds 2 int16 */
+static inline void qgemm_ukernel_s16(long int kg, const int16_t *ap,
+                                     const int16_t *bp, int32_t *c,
+                                     long int ldc)
+{
+  __m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+  __m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+  __m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+  __m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+  __m256i b0, b1, a;
+  int32_t a2;
+  long int g;
+
+#ifdef QGEMM_VNNI
+#define QGEMM_DOT(acc, a, b) acc = _mm256_dpwssd_epi32(acc, a, b)
+#else
+#define QGEMM_DOT(acc, a, b) acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a, b))
+#endif
+
+  for (g = 0; g < kg; g++) {
+    b0 = _mm256_load_si256((const __m256i *) &bp[0]);
+    b1 = _mm256_load_si256((const __m256i *) &bp[16]);
+    memcpy(&a2, &ap[0], 4);  a = _mm256_set1_epi32(a2);
+    QGEMM_DOT(c00, a, b0);  QGEMM_DOT(c01, a, b1);
+    memcpy(&a2, &ap[2], 4);  a = _mm256_set1_epi32(a2);
+    QGEMM_DOT(c10, a, b0);  QGEMM_DOT(c11, a, b1);
+    memcpy(&a2, &ap[4], 4);  a = _mm256_set1_epi32(a2);
+    QGEMM_DOT(c20, a, b0);  QGEMM_DOT(c21, a, b1);
+    memcpy(&a2, &ap[6], 4);  a = _mm256_set1_epi32(a2);
+    QGEMM_DOT(c30, a, b0);  QGEMM_DOT(c31, a, b1);
+    ap += 2 * QGEMM_MR;
+    bp += 2 * QGEMM_NR;
+  }
+#undef QGEMM_DOT
+
+  QGEMM_ACC_ROW(0, c00, c01)
+  QGEMM_ACC_ROW(1, c10, c11)
+  QGEMM_ACC_ROW(2, c20, c21)
+  QGEMM_ACC_ROW(3, c30, c31)
+#undef QGEMM_ACC_ROW
+}
+
+/* -=-=-=-=- drivers -=-=-=-=- */
+
+/* Pack all of A and B, then run the kernel for every 4 x 16 block of C,
+   16-column panel by panel. Edge blocks go through a scratch block. */
+static inline void qgemm_run(long int M, long int N, long int K,
+                             const void *a, long int lda,
+                             const void *b, long int ldb,
+                             int32_t *c, long int ldc, int G, int esize)
+{
+  arena_mark_t mark = arena_mark(default_arena());
+  long int kg = (K + G - 1) / G;
+  long int a_panel = kg * G * QGEMM_MR * esize;   /* bytes per panel */
+  long int b_panel = kg * G * QGEMM_NR * esize;
+  long int mp = (M + QGEMM_MR - 1) / QGEMM_MR;
+  long int np = (N + QGEMM_NR - 1) / QGEMM_NR;
+  char *ap = (char *) arena_alloc(default_arena(), mp * a_panel);
+  char *bp = (char *) arena_alloc(default_arena(), np * b_panel);
+  int32_t tmp[QGEMM_MR * QGEMM_NR];
+  long int ir, jr, i, j, m, n;
+
+  if (!ap || !bp) {
+    printf("COULDN'T ALLOCATE qgemm packing buffers\n");
+    exit(-1);
+  }
+  for (ir = 0; ir < mp; ir++) {
+    m = (M - ir*QGEMM_MR < QGEMM_MR) ? M - ir*QGEMM_MR : QGEMM_MR;
+    qgemm_pack_a(m, K, (const char *) a + ir*QGEMM_MR*lda*esize, lda,
+                 &ap[ir * a_panel], G, esize);
+  }
+  for (jr = 0; jr < np; jr++) {
+    n = (N - jr*QGEMM_NR < QGEMM_NR) ? N - jr*QGEMM_NR : QGEMM_NR;
+    qgemm_pack_b(n, K, (const char *) b + jr*QGEMM_NR*esize, ldb,
+                 &bp[jr * b_panel], G, esize);
+  }
+
+  for (jr = 0; jr < np; jr++) {
+    n = (N - jr*QGEMM_NR < QGEMM_NR) ? N - jr*QGEMM_NR : QGEMM_NR;
+    for (ir = 0; ir < mp; ir++) {
+      m = (M - ir*QGEMM_MR < QGEMM_MR) ? M - ir*QGEMM_MR : QGEMM_MR;
+      int32_t *cb = &c[ir*QGEMM_MR*ldc + jr*QGEMM_NR];
+      int32_t *dst = (m == QGEMM_MR && n == QGEMM_NR) ? cb : tmp;
+      long int ldd = (dst == cb) ? ldc : QGEMM_NR;
+
+      if (dst == tmp) memset(tmp, 0, sizeof(tmp));
+      if (G == 4)
+        qgemm_ukernel_u8s8(kg, (const uint8_t *) &ap[ir * a_panel],
+                           (const int8_t *) &bp[jr * b_panel], dst, ldd);
+      else
+        qgemm_ukernel_s16(kg, (const int16_t *) &ap[ir * a_panel],
+                          (const int16_t *) &bp[jr * b_panel], dst, ldd);
+      if (dst == tmp)
+        for (i = 0; i < m; i++)
+          for (j = 0; j < n; j++)
+            cb[i*ldc + j] += tmp[i*QGEMM_NR + j];
+    }
+  }
+
+  arena_release(default_arena(), mark);
+}
+
+/* C += A * B, u8 x s8 -> s32 */
+static inline void qgemm_u8s8(long int M, long int N, long int K,
+                              const uint8_t *a, long int lda,
+                              const int8_t *b, long int ldb,
+                              int32_t *c, long int ldc)
+{
+  qgemm_run(M, N, K, a, lda, b, ldb, c, ldc, 4, 1);
+}
+
+/* C += A * B, s16 x s16 -> s32 */
+static inline void qgemm_s16(long int M, long int N, long int K,
+                             const int16_t *a, long int lda,
+                             const int16_t *b, long int ldb,
+                             int32_t *c, long int ldc)
+{
+  qgemm_run(M, N, K, a, lda, b, ldb, c, ldc, 2, 2);
+}
+
+#else  /* no AVX2: the scalar loops */
+
+#define qgemm_u8s8 qgemm_u8s8_ref
+#define qgemm_s16 qgemm_s16_ref
+
+#endif
+
+#endif /* _QGEMM_H_ */
@@ -14,6 +14,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <math.h>
+#include "arena.h"
 
 #define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
                        for example a 3.2 GhZ GPU, this would be 3.2 */
@@ -33,20 +34,13 @@
 
 typedef double data_t;
 
-/* Create abstract data type for allocated array */
-typedef struct {
-  long int row_len;
-  data_t *data;
-} array_rec, *array_ptr;
+/* M x N arrays with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
 
 /* Prototypes of functions in this program */
-array_ptr new_array(long int row_len);
-int set_row_length(array_ptr v, long int row_len);
-long int get_row_length(array_ptr v);
-int init_array(array_ptr v, long int row_len);
-data_t *get_array_start(array_ptr v);
-data_t combine2D(array_ptr v);
-data_t combine2D_rev(array_ptr v);
+data_t combine2D(mat_ptr v, int bsize);
+data_t combine2D_rev(mat_ptr v);
+long int check_combine2D(void);
 
 
 /* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
@@ -122,17 +116,23 @@ int main(int argc, char *argv[])
 
   printf("2D Combine tests\n\n");
 
+  if (check_combine2D()) {
+    printf("check_combine2D: wrong sums\n");
+    exit(-1);
+  }
+
   final_answer = wakeup_delay();
 
   /* declare and initialize the array structure */
   x = NUM_TESTS-1;
   alloc_size = (long)A*x*x + B*x + C;
-  array_ptr v0 = new_array(alloc_size);
-  init_array(v0, alloc_size);
+  mat_ptr v0 = new_mat(alloc_size, alloc_size);
+  if (!v0) exit(-1);
+  init_mat(v0);
 
   OPTION = 0;
   for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<alloc_size); x++) {
-    set_row_length(v0, n);
+    set_mat_size(v0, n, n);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
     final_answer += combine2D(v0, 64);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
@@ -141,9 +141,9 @@ int main(int argc, char *argv[])
 
   OPTION++;
   for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<alloc_size); x++) {
-    set_row_length(v0, n);
+    set_mat_size(v0, n, n);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
-    final_answer += combine2D_rev(v0, 64);
+    final_answer += combine2D_rev(v0);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
     time_stamp[OPTION][x] = interval(time_start, time_stop);
   }
@@ -168,90 +168,25 @@ int main(int argc, char *argv[])
 } /* end main */
 /*********************************/
 
-/* Create 2D array of specified size-per-dimension. The row_len parameter
-   is both the width (row length or number of columns) and the height
-   (column height or number of rows) */
-array_ptr new_array(long int row_len)
-{
-  long int i;
-
-  /* Allocate and declare header structure */
-  array_ptr result = (array_ptr) malloc(sizeof(array_rec));
-  if (!result) {
-    /* Couldn't allocate storage */
-    printf("\nCOULDN'T ALLOCATE %ld BYTES STORAGE\n", sizeof(result));
-    exit(-1);
-  }
-  result->row_len = row_len;
-
-  /* Allocate and declare array */
-  if (row_len > 0) {
-    data_t *data = (data_t *) calloc(row_len*row_len, sizeof(data_t));
-    if (!data) {
-      /* Couldn't allocate storage */
-      free((void *) result);
-      printf("\nCOULDN'T ALLOCATE %e BYTES STORAGE (row_len=%ld)\n",
-                     (double)row_len * row_len * sizeof(data_t), row_len);
-      exit(-1);
-    }
-    result->data = data;
-  }
-  else result->data = NULL;
-
-  return result;
-}
-
-/* Set row-length of array (must already be allocated with new_array and
-   size used when allocating must be big enough) */
-int set_row_length(array_ptr v, long int row_len)
-{
-  v->row_len = row_len;
-  return 1;
-}
-
-/* Return row length of array (which is also the number of columns) */
-long int get_row_length(array_ptr v)
-{
-  return v->row_len;
-}
-
-/* initialize 2D array */
-int init_array(array_ptr v, long int row_len)
-{
-  long int i;
-
-  if (row_len > 0) {
-    v->row_len = row_len;
-    for (i = 0; i < row_len*row_len; i++) {
-      v->data[i] = (data_t)(i);
-    }
-    return 1;
-  }
-  else return 0;
-}
-
-data_t *get_array_start(array_ptr v)
-{
-  return v->data;
-}
-
 /************************************/
 
 /* Combine2D: Use operator "OP" (defined above as either + or *) to
-   add or multiply all elements in the array. Accumulate the result
-   in a local variable "accumulator", which becomes the return value. */
-data_t combine2D(array_ptr v, int bsize)
+   add or multiply all elements in the array, in bsize x bsize blocks.
+   Accumulate the result in a local variable "accumulator", which becomes
+   the return value. v can be any rows x cols matrix or view. */
+data_t combine2D(mat_ptr v, int bsize)
 {
   long int i, j, ii, jj;
-  long int length = get_row_length(v);
-  data_t *data = get_array_start(v);
+  long int rows = get_mat_rows(v), cols = get_mat_cols(v);
+  long int ld = get_mat_ld(v);
+  data_t *data = get_mat_start(v);
   data_t accumulator = IDENT;
 
-  for (ii = 0; ii < length; ii += bsize) {
-    for (jj = 0; jj < length; jj += bsize) {
-      for (i = ii; ii + bsize && i < length; i++) {
-        for (j = jj; j < jj + bsize && j < length; j++) {
-          accumulator = accumulator OP data[i * length + j];
+  for (ii = 0; ii < rows; ii += bsize) {
+    for (jj = 0; jj < cols; jj += bsize) {
+      for (i = ii; i < ii + bsize && i < rows; i++) {
+        for (j = jj; j < jj + bsize && j < cols; j++) {
+          accumulator = accumulator OP data[i * ld + j];
         }
       }
     }
@@ -262,21 +197,60 @@ data_t combine2D(array_ptr v, int bsize)
 }
 
 /* Combine2D_rev:  Like combine2D but the loops are interchanged. */
-data_t combine2D_rev(array_ptr v)
+data_t combine2D_rev(mat_ptr v)
 {
-  long int i, j, ii, jj;
-  long int length = get_row_length(v);
-  data_t *data = get_array_start(v);
+  long int i, j;
+  long int rows = get_mat_rows(v), cols = get_mat_cols(v);
+  long int ld = get_mat_ld(v);
+  data_t *data = get_mat_start(v);
   data_t accumulator = IDENT;
 
   /* Start with 0 or 1 (for adding or multiplying respectively) */
 
-  for (j = 0; j < length; j++) {
-    for (i = 0; i < length; i++) {
-      accumulator = accumulator OP data[i*length+j];
+  for (j = 0; j < cols; j++) {
+    for (i = 0; i < rows; i++) {
+      accumulator = accumulator OP data[i*ld+j];
     }
   }
 
   /* Return the answer */
   return accumulator;
 }
+
+/* Both combines on rectangular views (square, tall and skinny, short and
+   wide, and block sizes that don't divide them), against the sum worked
+   out directly. Assumes OP is +; the elements are small integers, so every
+   order gives exactly the same sum. Returns the number of wrong sums. */
+long int check_combine2D(void)
+{
+  static const long int shapes[][2] = {
+    {1, 1}, {7, 5}, {64, 64}, {2000, 3}, {3, 2000}, {1000, 17}
+  };
+  const int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+  mat_ptr m;
+  mat_rec v;
+  long int s, i, j, rows, cols, errors = 0;
+  data_t expect;
+  arena_mark_t mark = arena_mark(default_arena());
+
+  m = new_mat(2010, 2010);
+  if (!m) exit(-1);
+  init_mat(m);
+
+  for (s = 0; s < nshapes; s++) {
+    rows = shapes[s][0];
+    cols = shapes[s][1];
+    v = mat_view(m, 4, 6, rows, cols);
+    expect = IDENT;
+    for (i = 0; i < rows; i++)
+      for (j = 0; j < cols; j++)
+        expect = expect OP m->data[(i+4)*m->ld + j+6];
+    if (combine2D(&v, 64) != expect) errors++;
+    if (combine2D(&v, 7) != expect) errors++;
+    if (combine2D_rev(&v) != expect) errors++;
+  }
+
+  free(m);
+  arena_release(default_arena(), mark);
+  return errors;
+}
@@ -0,0 +1,419 @@
+/*****************************************************************************/
+// gcc -O3 -mavx2 -mfma test_gemm.c -lrt -o test_gemm
+
+/*
+  Packed-panel GEMM (gemm.h) against the loop orders from test_mmm_inter.c
+  (mmm_ijk, mmm_kij, mmm_jki) and the blocked versions from test_mmm.c
+  (bmm_ijk, bmm_kij, bmm_jki, block size BSIZE), all on mat_ptr matrices
+  and all computing C += A * B.
+
+  Results are in cycles, as in the other MMM tests, followed by GFLOPs
+  (2 N^3 flops per multiply) and the fraction of the peak
+  CPNS * PEAK_FLOPS_PER_CYCLE: 2 FMA units x 4 doubles x 2 flops = 16 per
+  cycle for AVX2.
+
+  Before timing, gemm() and the bmm_* are checked against mmm_ijk on
+  rectangular views that aren't multiples of the micro-kernel or block
+  sizes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "arena.h"
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GhZ GPU, this would be 3.2 */
+#define PEAK_FLOPS_PER_CYCLE 16   /* double, AVX2 + 2 FMA units */
+
+/* We want to test a wide range of work sizes. We will generate these
+   using the quadratic formula:  A x^2 + B x + C                     */
+#define A   24  /* coefficient of x^2 */
+#define B   40  /* coefficient of x */
+#define C   64  /* constant term */
+
+#define NUM_TESTS 7   /* Number of different sizes to test */
+
+#define OPTIONS 7
+#define IDENT 0
+
+#define BSIZE 32      /* block size for the bmm_* */
+
+typedef double data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+#include "gemm.h"
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c);
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c);
+void mmm_jki(mat_ptr a, mat_ptr b, mat_ptr c);
+void bmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c, int bsize);
+void bmm_kij(mat_ptr a, mat_ptr b, mat_ptr c, int bsize);
+void bmm_jki(mat_ptr a, mat_ptr b, mat_ptr c, int bsize);
+void gemm_mat(mat_ptr a, mat_ptr b, mat_ptr c);
+long int check_gemm(void);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  double wakeup_answer;
+  long int x, n, alloc_size, errors;
+
+  x = NUM_TESTS-1;
+  alloc_size = A*x*x + B*x + C;
+
+  printf("Packed GEMM tests \n\n");
+
+  errors = check_gemm();
+  printf("check_gemm: %ld errors\n", errors);
+  if (errors) return -1;
+
+  wakeup_answer = wakeup_delay();
+
+  printf("Doing MMM %d different ways,\n", OPTIONS);
+  printf("for %d different matrix sizes from %d to %ld\n",
+                                                     NUM_TESTS, C, alloc_size);
+  printf("This may take a while!\n\n");
+
+  /* declare and initialize the matrix structure */
+  mat_ptr a0 = new_mat(alloc_size, alloc_size);
+  mat_ptr b0 = new_mat(alloc_size, alloc_size);
+  mat_ptr c0 = new_mat(alloc_size, alloc_size);
+  if (!a0 || !b0 || !c0) exit(-1);
+  init_mat(a0);
+  init_mat(b0);
+
+  for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+    for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
+      printf(" OPT %d, iter %ld, size %ld\n", OPTION, x, n);
+      set_mat_size(a0, n, n);
+      set_mat_size(b0, n, n);
+      set_mat_size(c0, n, n);
+      fill_mat(c0, IDENT);
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      switch (OPTION) {
+        case 0: mmm_ijk(a0, b0, c0); break;
+        case 1: mmm_kij(a0, b0, c0); break;
+        case 2: mmm_jki(a0, b0, c0); break;
+        case 3: bmm_ijk(a0, b0, c0, BSIZE); break;
+        case 4: bmm_kij(a0, b0, c0, BSIZE); break;
+        case 5: bmm_jki(a0, b0, c0, BSIZE); break;
+        case 6: gemm_mat(a0, b0, c0); break;
+      }
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop);
+    }
+  }
+
+  printf("Done collecting measurements.\n\n");
+
+  printf("row_len, ijk, kij, jki, bmm_ijk, bmm_kij, bmm_jki, gemm\n");
+  {
+    int i, j;
+    for (i = 0; i < NUM_TESTS; i++) {
+      printf("%d, ", A*i*i + B*i + C);
+      for (j = 0; j < OPTIONS; j++) {
+        if (j != 0) {
+          printf(", ");
+        }
+        printf("%ld", (long int) ((double)(CPNS) * 1.0e9 * time_stamp[j][i]));
+      }
+      printf("\n");
+    }
+  }
+  printf("\n");
+
+  printf("GFLOPs; peak is %.1f\n", (double)(CPNS) * PEAK_FLOPS_PER_CYCLE);
+  printf("row_len, ijk, kij, jki, bmm_ijk, bmm_kij, bmm_jki, gemm, "
+         "gemm %% of peak\n");
+  {
+    int i, j;
+    double flops;
+    for (i = 0; i < NUM_TESTS; i++) {
+      n = A*i*i + B*i + C;
+      flops = 2.0 * n * n * n;
+      printf("%ld", n);
+      for (j = 0; j < OPTIONS; j++) {
+        printf(", %.2f", flops / time_stamp[j][i] * 1.0e-9);
+      }
+      printf(", %.1f\n", 100.0 * flops / time_stamp[OPTIONS-1][i] * 1.0e-9
+                         / ((double)(CPNS) * PEAK_FLOPS_PER_CYCLE));
+    }
+  }
+  printf("\n");
+
+  printf("Wakeup delay computed: %g \n", wakeup_answer);
+
+  return 0;
+} /* end main */
+
+/*************************************************/
+
+/* mmm: c += a * b, where a is M x K, b is K x N and c is M x N
+   (as in test_mmm_inter.c) */
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t sum;
+
+  for (i = 0; i < M; i++) {
+    for (j = 0; j < N; j++) {
+      sum = IDENT;
+      for (k = 0; k < K; k++) {
+        sum += a0[i*lda+k] * b0[k*ldb+j];
+      }
+      c0[i*ldc+j] += sum;
+    }
+  }
+}
+
+/* mmm */
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+  for (k = 0; k < K; k++) {
+    for (i = 0; i < M; i++) {
+      r = a0[i*lda+k];
+      for (j = 0; j < N; j++) {
+        c0[i*ldc+j] += r*b0[k*ldb+j];
+      }
+    }
+  }
+}
+
+/* mmm */
+void mmm_jki(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+  for (j = 0; j < N; j++) {
+    for (k = 0; k < K; k++) {
+      r = b0[k*ldb+j];
+      for (i = 0; i < M; i++) {
+        c0[i*ldc+j] += a0[i*lda+k]*r;
+      }
+    }
+  }
+}
+
+/* bmm (as in test_mmm.c, but c += a * b and any M x K x N) */
+void bmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c, int bsize)
+{
+  long int i, j, k, kk, jj;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t sum;
+
+  for (kk = 0; kk < K; kk += bsize) {
+    for (jj = 0; jj < N; jj += bsize) {
+      for (i = 0; i < M; i++) {
+        for (j = jj; j < jj + bsize && j < N; j++) {
+          sum = c0[i*ldc + j];
+          for (k = kk; k < kk + bsize && k < K; k++) {
+            sum += a0[i*lda + k] * b0[k*ldb + j];
+          }
+          c0[i*ldc + j] = sum;
+        }
+      }
+    }
+  }
+}
+
+/* bmm */
+void bmm_kij(mat_ptr a, mat_ptr b, mat_ptr c, int bsize)
+{
+  long int i, j, k, kk, ii;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+  for (kk = 0; kk < K; kk += bsize) {
+    for (ii = 0; ii < M; ii += bsize) {
+      for (k = kk; k < kk + bsize && k < K; k++) {
+        for (i = ii; i < ii + bsize && i < M; i++) {
+          r = a0[i*lda + k];
+          for (j = 0; j < N; j++) {
+            c0[i*ldc + j] += r * b0[k*ldb + j];
+          }
+        }
+      }
+    }
+  }
+}
+
+/* bmm */
+void bmm_jki(mat_ptr a, mat_ptr b, mat_ptr c, int bsize)
+{
+  long int i, j, k, jj, kk;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+  for (jj = 0; jj < N; jj += bsize) {
+    for (kk = 0; kk < K; kk += bsize) {
+      for (j = jj; j < jj + bsize && j < N; j++) {
+        for (k = kk; k < kk + bsize && k < K; k++) {
+          r = b0[k*ldb + j];
+          for (i = 0; i < M; i++) {
+            c0[i*ldc + j] += a0[i*lda + k] * r;
+          }
+        }
+      }
+    }
+  }
+}
+
+/* packed-panel GEMM from gemm.h */
+void gemm_mat(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  gemm(get_mat_rows(a), get_mat_cols(b), get_mat_cols(a),
+       get_mat_start(a), get_mat_ld(a), get_mat_start(b), get_mat_ld(b),
+       get_mat_start(c), get_mat_ld(c));
+}
+
+/* Check the bmm_* and gemm against mmm_ijk. The shapes cross the micro-
+   kernel (6 x 8), cache block (96, 256, 2048) and BSIZE boundaries, and a,
+   b and c are views into bigger matrices, so everything outside the c
+   view must stay untouched. The inputs come from init_mat_check(), so
+   the results must match exactly. Returns the number of wrong elements. */
+long int check_gemm(void)
+{
+  static const long int shapes[][3] = {   /* M, K, N */
+    {1, 1, 1}, {6, 8, 8}, {5, 3, 7}, {13, 300, 17}, {97, 257, 9},
+    {200, 20, 2050}, {1000, 16, 8}, {8, 600, 1000}
+  };
+  const int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+  const long int big = 2060;
+  mat_ptr a, b, c, ref;
+  mat_rec av, bv, cv, rv;
+  long int s, M, K, N, errors = 0;
+  int m;
+  arena_mark_t mark = arena_mark(default_arena());
+
+  a = new_mat(big, big);
+  b = new_mat(big, big);
+  c = new_mat(big, big);
+  ref = new_mat(big, big);
+  if (!a || !b || !c || !ref) exit(-1);
+  init_mat_check(a, b);
+
+  for (s = 0; s < nshapes; s++) {
+    M = shapes[s][0];
+    K = shapes[s][1];
+    N = shapes[s][2];
+    av = mat_view(a, 3, 5, M, K);
+    bv = mat_view(b, 1, 2, K, N);
+    cv = mat_view(c, 2, 1, M, N);
+    rv = mat_view(ref, 2, 1, M, N);
+    fill_mat(ref, 1);
+    mmm_ijk(&av, &bv, &rv);
+    for (m = 0; m < 4; m++) {
+      fill_mat(c, 1);
+      if (m == 0) bmm_ijk(&av, &bv, &cv, BSIZE);
+      if (m == 1) bmm_kij(&av, &bv, &cv, BSIZE);
+      if (m == 2) bmm_jki(&av, &bv, &cv, BSIZE);
+      if (m == 3) gemm_mat(&av, &bv, &cv);
+      errors += count_mat_diff(c, ref);
+    }
+  }
+
+  free(a); free(b); free(c); free(ref);
+  arena_release(default_arena(), mark);
+  return errors;
+}
@@ -0,0 +1,623 @@
+/*****************************************************************************/
+// gcc -O3 -mavx2 test_layout.c -lrt -o test_layout
+
+/*
+  Row-major against tiled and Morton (Z-order) storage (layout.h), on the
+  three access patterns of the labs:
+
+    MMM        C += A * B in the ijk, kij and jki loop orders. Row-major
+               is test_mmm_inter.c; the tiled versions run the same loop
+               order inside 32 x 32 tiles (C tiles in storage order, k
+               tiles inside).
+    transpose  dst = src^T; the tiled versions transpose tile (ti,tj) of
+               src into tile (tj,ti) of dst.
+    SOR        fixed number of sweeps of the SOR update from Lab 5, in
+               row (ij) and column (ji) order. The tiled versions visit
+               the tiles in storage order and do ij or ji inside a tile,
+               so a Gauss-Seidel sweep updates the points in a different
+               order than row-major does (it converges the same way).
+
+  Column-heavy orders (jki, transpose, SOR ji) touch a new cache line for
+  every element in row-major storage, but stay inside one 8 KB tile in
+  the tiled layouts.
+
+  Results are in cycles per inner operation: per multiply-add for MMM,
+  per element for transpose and per point per sweep for SOR. Conversion
+  from row-major is timed too, per element.
+
+  Before timing, check_layout compares every tiled kernel with its
+  row-major equivalent on sizes that aren't multiples of the tile,
+  square, tall and wide.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "arena.h"
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GhZ GPU, this would be 3.2 */
+
+#define NUM_TESTS 3
+
+static const long int mmm_sizes[NUM_TESTS] = {256, 512, 1000};
+static const long int big_sizes[NUM_TESTS] = {1000, 2048, 4096};
+
+#define SOR_SWEEPS 5
+#define MINVAL   0.0
+#define MAXVAL  10.0
+#define OMEGA 1.58       /* as in Lab 5 */
+
+#define IDENT 0
+
+typedef double data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+#include "layout.h"
+
+#define TB LAYOUT_TB
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c);
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c);
+void mmm_jki(mat_ptr a, mat_ptr b, mat_ptr c);
+void lmmm(lmat_ptr a, lmat_ptr b, lmat_ptr c, int order);
+void transpose(mat_ptr src, mat_ptr dst);
+void ltranspose(lmat_ptr src, lmat_ptr dst);
+double sor_sweep(mat_ptr m, int ji);
+double sor_sweep_order(mat_ptr m, lmat_ptr order, int ji);
+double lsor_sweep(lmat_ptr m, int ji);
+long int check_layout(void);
+double fRand(double fMin, double fMax);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/* cycles per operation for a timed interval */
+static double cyc(struct timespec start, struct timespec stop, double ops)
+{
+  return (double)(CPNS) * 1.0e9 * interval(start, stop) / ops;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  struct timespec t0, t1;
+  double wakeup_answer, ops;
+  long int x, n, i, s, errors;
+  int lay, order;
+  arena_mark_t mark;
+  mat_ptr a, b, c;
+  lmat_ptr la, lb, lc;
+
+  printf("Tiled and Morton layout tests (tile %d x %d)\n\n", TB, TB);
+
+  errors = check_layout();
+  printf("check_layout: %ld errors\n", errors);
+  if (errors) return -1;
+
+  wakeup_answer = wakeup_delay();
+
+  /* MMM */
+  printf("\nMMM, cycles per multiply-add\n");
+  printf("size, ijk, kij, jki, tiled ijk, tiled kij, tiled jki, "
+         "morton ijk, morton kij, morton jki\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    n = mmm_sizes[x];
+    ops = (double) n * n * n;
+    mark = arena_mark(default_arena());
+    a = new_mat(n, n);
+    b = new_mat(n, n);
+    c = new_mat(n, n);
+    if (!a || !b || !c) exit(-1);
+    init_mat(a);
+    init_mat(b);
+    printf("%ld", n);
+    for (order = 0; order < 3; order++) {
+      fill_mat(c, IDENT);
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
+      switch (order) {
+        case 0: mmm_ijk(a, b, c); break;
+        case 1: mmm_kij(a, b, c); break;
+        case 2: mmm_jki(a, b, c); break;
+      }
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
+      printf(", %.2f", cyc(t0, t1, ops));
+    }
+    for (lay = LAYOUT_TILED; lay <= LAYOUT_MORTON; lay++) {
+      la = new_lmat(n, n, lay);
+      lb = new_lmat(n, n, lay);
+      lc = new_lmat(n, n, lay);
+      if (!la || !lb || !lc) exit(-1);
+      lmat_from_mat(la, a);
+      lmat_from_mat(lb, b);
+      for (order = 0; order < 3; order++) {
+        for (i = 0; i < lc->ntiles * LAYOUT_TILE; i++) lc->data[i] = IDENT;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
+        lmmm(la, lb, lc, order);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
+        printf(", %.2f", cyc(t0, t1, ops));
+      }
+      free(la); free(lb); free(lc);
+    }
+    printf("\n");
+    free(a); free(b); free(c);
+    arena_release(default_arena(), mark);
+  }
+
+  /* transpose and conversion */
+  printf("\nTranspose and conversion, cycles per element\n");
+  printf("size, transpose, tiled, morton, to tiled, to morton\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    n = big_sizes[x];
+    ops = (double) n * n;
+    mark = arena_mark(default_arena());
+    a = new_mat(n, n);
+    b = new_mat(n, n);
+    if (!a || !b) exit(-1);
+    init_mat(a);
+    fill_mat(b, IDENT);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
+    transpose(a, b);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
+    printf("%ld, %.2f", n, cyc(t0, t1, ops));
+    {
+      double conv[3];
+      for (lay = LAYOUT_TILED; lay <= LAYOUT_MORTON; lay++) {
+        la = new_lmat(n, n, lay);
+        lb = new_lmat(n, n, lay);
+        if (!la || !lb) exit(-1);
+        for (i = 0; i < lb->ntiles * LAYOUT_TILE; i++) lb->data[i] = IDENT;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
+        lmat_from_mat(la, a);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
+        conv[lay] = cyc(t0, t1, ops);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
+        ltranspose(la, lb);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
+        printf(", %.2f", cyc(t0, t1, ops));
+        free(la); free(lb);
+      }
+      printf(", %.2f, %.2f\n", conv[LAYOUT_TILED], conv[LAYOUT_MORTON]);
+    }
+    free(a); free(b);
+    arena_release(default_arena(), mark);
+  }
+
+  /* SOR */
+  printf("\nSOR, %d sweeps, cycles per point per sweep\n", SOR_SWEEPS);
+  printf("size, ij, ji, tiled ij, tiled ji, morton ij, morton ji\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    n = big_sizes[x];
+    ops = (double)(n - 2) * (n - 2) * SOR_SWEEPS;
+    mark = arena_mark(default_arena());
+    a = new_mat(n, n);
+    b = new_mat(n, n);
+    if (!a || !b) exit(-1);
+    srandom(1);
+    for (i = 0; i < n; i++)
+      for (s = 0; s < n; s++) a->data[i*a->ld + s] = fRand(MINVAL, MAXVAL);
+    printf("%ld", n);
+    for (order = 0; order < 2; order++) {
+      for (i = 0; i < n; i++)
+        for (s = 0; s < n; s++) b->data[i*b->ld + s] = a->data[i*a->ld + s];
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
+      for (s = 0; s < SOR_SWEEPS; s++) sor_sweep(b, order);
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
+      printf(", %.2f", cyc(t0, t1, ops));
+    }
+    for (lay = LAYOUT_TILED; lay <= LAYOUT_MORTON; lay++) {
+      la = new_lmat(n, n, lay);
+      if (!la) exit(-1);
+      for (order = 0; order < 2; order++) {
+        lmat_from_mat(la, a);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t0);
+        for (s = 0; s < SOR_SWEEPS; s++) lsor_sweep(la, order);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1);
+        printf(", %.2f", cyc(t0, t1, ops));
+      }
+      free(la);
+    }
+    printf("\n");
+    free(a); free(b);
+    arena_release(default_arena(), mark);
+  }
+
+  printf("\nWakeup delay computed: %g \n", wakeup_answer);
+
+  return 0;
+} /* end main */
+
+/*************************************************/
+
+/* mmm: c += a * b, where a is M x K, b is K x N and c is M x N
+   (as in test_mmm_inter.c) */
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t sum;
+
+  for (i = 0; i < M; i++) {
+    for (j = 0; j < N; j++) {
+      sum = IDENT;
+      for (k = 0; k < K; k++) {
+        sum += a0[i*lda+k] * b0[k*ldb+j];
+      }
+      c0[i*ldc+j] += sum;
+    }
+  }
+}
+
+/* mmm */
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+  for (k = 0; k < K; k++) {
+    for (i = 0; i < M; i++) {
+      r = a0[i*lda+k];
+      for (j = 0; j < N; j++) {
+        c0[i*ldc+j] += r*b0[k*ldb+j];
+      }
+    }
+  }
+}
+
+/* mmm */
+void mmm_jki(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+  for (j = 0; j < N; j++) {
+    for (k = 0; k < K; k++) {
+      r = b0[k*ldb+j];
+      for (i = 0; i < M; i++) {
+        c0[i*ldc+j] += a0[i*lda+k]*r;
+      }
+    }
+  }
+}
+
+/* c += a * b on one tile each, TB x TB, in the given loop order */
+static inline void tile_mmm(const data_t *a, const data_t *b, data_t *c,
+                            int order)
+{
+  long int i, j, k;
+  data_t r, sum;
+
+  switch (order) {
+    case 0:   /* ijk */
+      for (i = 0; i < TB; i++)
+        for (j = 0; j < TB; j++) {
+          sum = IDENT;
+          for (k = 0; k < TB; k++) sum += a[i*TB+k] * b[k*TB+j];
+          c[i*TB+j] += sum;
+        }
+      break;
+    case 1:   /* kij */
+      for (k = 0; k < TB; k++)
+        for (i = 0; i < TB; i++) {
+          r = a[i*TB+k];
+          for (j = 0; j < TB; j++) c[i*TB+j] += r * b[k*TB+j];
+        }
+      break;
+    case 2:   /* jki */
+      for (j = 0; j < TB; j++)
+        for (k = 0; k < TB; k++) {
+          r = b[k*TB+j];
+          for (i = 0; i < TB; i++) c[i*TB+j] += a[i*TB+k] * r;
+        }
+      break;
+  }
+}
+
+/* c += a * b on lmats of the same layout; the tiles of c in storage
+   order, and for each the row of a tiles times the column of b tiles. The
+   padding is zero, so whole tiles can be used. */
+void lmmm(lmat_ptr a, lmat_ptr b, lmat_ptr c, int order)
+{
+  long int idx, ti, tj, tk;
+
+  for (idx = 0; idx < c->ntiles; idx++) {
+    if (!lmat_tile_at(c, idx, &ti, &tj)) continue;
+    for (tk = 0; tk < a->tc; tk++)
+      tile_mmm(lmat_tile(a, ti, tk), lmat_tile(b, tk, tj),
+               &c->data[idx * LAYOUT_TILE], order);
+  }
+}
+
+/* dst = src^T, reading src by rows (as in Lab 3) */
+void transpose(mat_ptr src, mat_ptr dst)
+{
+  long int i, j;
+  long int rows = get_mat_rows(src), cols = get_mat_cols(src);
+  long int lds = get_mat_ld(src), ldd = get_mat_ld(dst);
+  data_t *s0 = get_mat_start(src);
+  data_t *d0 = get_mat_start(dst);
+
+  for (i = 0; i < rows; i++)
+    for (j = 0; j < cols; j++)
+      d0[j*ldd + i] = s0[i*lds + j];
+}
+
+/* dst = src^T, tile (ti,tj) of src into tile (tj,ti) of dst; src tiles in
+   storage order */
+void ltranspose(lmat_ptr src, lmat_ptr dst)
+{
+  long int idx, ti, tj, ii, jj;
+  data_t *s, *d;
+
+  for (idx = 0; idx < src->ntiles; idx++) {
+    if (!lmat_tile_at(src, idx, &ti, &tj)) continue;
+    s = &src->data[idx * LAYOUT_TILE];
+    d = lmat_tile(dst, tj, ti);
+    for (ii = 0; ii < TB; ii++)
+      for (jj = 0; jj < TB; jj++)
+        d[jj*TB + ii] = s[ii*TB + jj];
+  }
+}
+
+/* the SOR update of Lab 5 on one point; returns |change| */
+static inline double sor_point(data_t *p, data_t up, data_t down,
+                               data_t right, data_t left)
+{
+  double change = *p - .25 * (up + down + right + left);
+  *p -= change * OMEGA;
+  return (change < 0) ? -change : change;
+}
+
+/* One SOR sweep over the interior of row-major m, by rows (ji = 0) or
+   columns (ji = 1), as SOR() and SOR_ji() in Lab 5. Returns the total
+   change. */
+double sor_sweep(mat_ptr m, int ji)
+{
+  long int i, j, n = get_mat_rows(m), ld = get_mat_ld(m);
+  data_t *d = get_mat_start(m);
+  double total_change = 0;
+
+  if (!ji) {
+    for (i = 1; i < n-1; i++)
+      for (j = 1; j < n-1; j++)
+        total_change += sor_point(&d[i*ld+j], d[(i-1)*ld+j], d[(i+1)*ld+j],
+                                  d[i*ld+j+1], d[i*ld+j-1]);
+  } else {
+    for (j = 1; j < n-1; j++)
+      for (i = 1; i < n-1; i++)
+        total_change += sor_point(&d[i*ld+j], d[(i-1)*ld+j], d[(i+1)*ld+j],
+                                  d[i*ld+j+1], d[i*ld+j-1]);
+  }
+  return total_change;
+}
+
+/* The same sweep on row-major m, but visiting the points in the order
+   lsor_sweep() does on an lmat of the given layout (used by the check) */
+double sor_sweep_order(mat_ptr m, lmat_ptr order, int ji)
+{
+  long int idx, ti, tj, ii, jj, i, j, n = get_mat_rows(m), ld = get_mat_ld(m);
+  data_t *d = get_mat_start(m);
+  double total_change = 0;
+
+  for (idx = 0; idx < order->ntiles; idx++) {
+    if (!lmat_tile_at(order, idx, &ti, &tj)) continue;
+    for (ii = 0; ii < TB; ii++)
+      for (jj = 0; jj < TB; jj++) {
+        i = ti*TB + (ji ? jj : ii);
+        j = tj*TB + (ji ? ii : jj);
+        if (i < 1 || i >= n-1 || j < 1 || j >= n-1) continue;
+        total_change += sor_point(&d[i*ld+j], d[(i-1)*ld+j], d[(i+1)*ld+j],
+                                  d[i*ld+j+1], d[i*ld+j-1]);
+      }
+  }
+  return total_change;
+}
+
+/* One SOR sweep over the interior of square lmat m: tiles in storage
+   order, rows (ji = 0) or columns (ji = 1) inside each tile. Neighbours
+   inside the tile are at fixed offsets; across its edge, lmat_at(). */
+double lsor_sweep(lmat_ptr m, int ji)
+{
+  long int idx, ti, tj, ii, jj, i, j, n = m->rows;
+  long int ilo, ihi, jlo, jhi;
+  data_t *t, *p, up, down, right, left;
+  double total_change = 0;
+
+  for (idx = 0; idx < m->ntiles; idx++) {
+    if (!lmat_tile_at(m, idx, &ti, &tj)) continue;
+    t = &m->data[idx * LAYOUT_TILE];
+    /* the interior points of this tile */
+    ilo = (ti == 0) ? 1 : 0;
+    jlo = (tj == 0) ? 1 : 0;
+    ihi = (n - 1 - ti*TB < TB) ? n - 1 - ti*TB : TB;
+    jhi = (n - 1 - tj*TB < TB) ? n - 1 - tj*TB : TB;
+    for (ii = 0; ii < TB; ii++)
+      for (jj = 0; jj < TB; jj++) {
+        long int r = ji ? jj : ii, s = ji ? ii : jj;
+        if (r < ilo || r >= ihi || s < jlo || s >= jhi) continue;
+        i = ti*TB + r;
+        j = tj*TB + s;
+        p = &t[r*TB + s];
+        up = (r > 0) ? p[-TB] : *lmat_at(m, i-1, j);
+        down = (r < TB-1) ? p[TB] : *lmat_at(m, i+1, j);
+        right = (s < TB-1) ? p[1] : *lmat_at(m, i, j+1);
+        left = (s > 0) ? p[-1] : *lmat_at(m, i, j-1);
+        total_change += sor_point(p, up, down, right, left);
+      }
+  }
+  return total_change;
+}
+
+/* Every tiled kernel against its row-major equivalent, for both layouts,
+   on sizes that aren't multiples of the tile: square ones, then tall and
+   wide ones, whose Morton order has a row or column of Morton squares
+   (layout.h). MMM and transpose use init_mat_check() data, so the
+   results must be identical; the SOR sweeps (square sizes only) do the
+   same arithmetic in the same order, so they must be too. A Morton
+   matrix that takes 3x or more the tiles it uses counts as an error too.
+   Returns the number of wrong elements. */
+long int check_layout(void)
+{
+  static const long int shapes[][3] = {   /* M, K, N */
+    {1, 1, 1}, {3, 3, 3}, {31, 31, 31}, {32, 32, 32}, {33, 33, 33},
+    {70, 70, 70}, {100, 100, 100},
+    {300, 40, 70}, {40, 300, 33}, {33, 70, 300}, {100, 1, 40}, {1, 100, 1}
+  };
+  const int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+  arena_mark_t mark = arena_mark(default_arena());
+  long int x, M, K, N, i, j, errors = 0;
+  int lay, order;
+  mat_ptr a, b, c, ref, ra, at, tref;
+  lmat_ptr la, lb, lc, lt;
+
+  for (x = 0; x < nshapes; x++) {
+    M = shapes[x][0];
+    K = shapes[x][1];
+    N = shapes[x][2];
+    a = new_mat(M, K);
+    b = new_mat(K, N);
+    c = new_mat(M, N);
+    ref = new_mat(M, N);
+    ra = new_mat(M, K);
+    at = new_mat(K, M);
+    tref = new_mat(K, M);
+    if (!a || !b || !c || !ref || !ra || !at || !tref) exit(-1);
+    init_mat_check(a, b);
+
+    for (lay = LAYOUT_TILED; lay <= LAYOUT_MORTON; lay++) {
+      la = new_lmat(M, K, lay);
+      lb = new_lmat(K, N, lay);
+      lc = new_lmat(M, N, lay);
+      lt = new_lmat(K, M, lay);
+      if (!la || !lb || !lc || !lt) exit(-1);
+      if (la->ntiles >= 3 * la->tr * la->tc) errors++;
+      if (lb->ntiles >= 3 * lb->tr * lb->tc) errors++;
+
+      /* round trip */
+      lmat_from_mat(la, a);
+      fill_mat(ra, -1);
+      lmat_to_mat(la, ra);
+      errors += count_mat_diff(ra, a);
+
+      /* MMM */
+      fill_mat(ref, 1);
+      mmm_ijk(a, b, ref);
+      lmat_from_mat(lb, b);
+      for (order = 0; order < 3; order++) {
+        fill_mat(c, 1);
+        lmat_from_mat(lc, c);
+        lmmm(la, lb, lc, order);
+        lmat_to_mat(lc, c);
+        errors += count_mat_diff(c, ref);
+      }
+
+      /* transpose */
+      transpose(a, tref);
+      ltranspose(la, lt);
+      lmat_to_mat(lt, at);
+      errors += count_mat_diff(at, tref);
+
+      /* SOR, one sweep in each order */
+      for (order = 0; M == N && order < 2; order++) {
+        for (i = 0; i < M; i++)
+          for (j = 0; j < N; j++)
+            ref->data[i*ref->ld + j] = (data_t)((i * 7 + j * 3) % 10);
+        lmat_from_mat(lc, ref);
+        sor_sweep_order(ref, lc, order);
+        lsor_sweep(lc, order);
+        lmat_to_mat(lc, c);
+        errors += count_mat_diff(c, ref);
+      }
+
+      free(la); free(lb); free(lc); free(lt);
+    }
+    free(a); free(b); free(c); free(ref);
+    free(ra); free(at); free(tref);
+  }
+
+  arena_release(default_arena(), mark);
+  return errors;
+}
+
+double fRand(double fMin, double fMax)
+{
+  double f = (double)random() / RAND_MAX;
+  return fMin + f * (fMax - fMin);
+}
@@ -0,0 +1,349 @@
+/*****************************************************************************/
+// gcc -O3 -mavx2 -mfma test_mmm_fixed.c -lrt -o test_mmm_fixed
+
+/*
+  Size-specialized small MMM kernels (mmm_fixed.h) against the same loops
+  with the size read at run time, on a batch of small square matrices
+  stored back to back (C_x += A_x * B_x, doubles).
+
+  Options, for each size:
+    kij       one mmm_kij call per pair, on mat_ptr views (as in
+              test_mmm_inter.c)
+    generic   mmm_small_generic: kij on raw pointers, n at run time
+    dispatch  mmm_fixed: looks the size up on every call
+    fixed     the kernel from mmm_fixed_lookup, looked up once per batch
+
+  10 has no specialization, so dispatch and fixed fall back to the generic
+  loop there; it shows what the dispatch itself costs.
+
+  Results are in cycles per matrix product and in GFLOPs. The batch is
+  small enough to stay in the caches and is multiplied REPS_FLOPS / flops
+  times, so every size does about the same work.
+
+  Before timing, check_mmm_fixed compares every size through mmm_fixed
+  with mmm_ijk, on views whose leading dimension isn't the size.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "arena.h"
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GhZ GPU, this would be 3.2 */
+
+#define NUM_TESTS 7   /* Number of different sizes to test */
+
+static const long int sizes[NUM_TESTS] = {4, 8, 10, 12, 16, 24, 32};
+
+#define OPTIONS 4
+#define IDENT 0
+
+#define BATCH_DATA (1L << 18)  /* doubles in A, B and C together (2 MB) */
+#define REPS_FLOPS 4.0e8       /* flops per size and option */
+
+typedef double data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+#include "mmm_fixed.h"
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c);
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c);
+void batch_kij(long int n, double *a, double *b, double *c, long int count);
+void batch_generic(long int n, double *a, double *b, double *c,
+                   long int count);
+void batch_dispatch(long int n, double *a, double *b, double *c,
+                    long int count);
+void batch_fixed(long int n, double *a, double *b, double *c,
+                 long int count);
+long int check_mmm_fixed(void);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  double wakeup_answer;
+  long int x, n, i, r, count, reps[NUM_TESTS], errors;
+  double *a, *b, *c;
+
+  printf("Size-specialized small MMM tests \n\n");
+
+  errors = check_mmm_fixed();
+  printf("check_mmm_fixed: %ld errors\n", errors);
+  if (errors) return -1;
+
+  wakeup_answer = wakeup_delay();
+
+  printf("Doing MMM %d different ways,\n", OPTIONS);
+  printf("for %d different matrix sizes from %ld to %ld\n",
+         NUM_TESTS, sizes[0], sizes[NUM_TESTS-1]);
+
+  a = (double *) arena_alloc(default_arena(), BATCH_DATA * sizeof(double));
+  if (!a) {
+    printf("COULDN'T ALLOCATE batch storage\n");
+    exit(-1);
+  }
+  for (i = 0; i < BATCH_DATA; i++) a[i] = (double)(i % 7 - 3) * 0.125;
+
+  for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+    for (x = 0; x < NUM_TESTS; x++) {
+      n = sizes[x];
+      count = BATCH_DATA / (3 * n * n);
+      b = a + count * n * n;
+      c = b + count * n * n;
+      reps[x] = (long int)(REPS_FLOPS / (2.0 * n * n * n * count)) + 1;
+      printf(" OPT %d, iter %ld, size %ld\n", OPTION, x, n);
+      for (i = 0; i < count * n * n; i++) c[i] = IDENT;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      for (r = 0; r < reps[x]; r++) {
+        switch (OPTION) {
+          case 0: batch_kij(n, a, b, c, count); break;
+          case 1: batch_generic(n, a, b, c, count); break;
+          case 2: batch_dispatch(n, a, b, c, count); break;
+          case 3: batch_fixed(n, a, b, c, count); break;
+        }
+      }
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop)
+                              / (reps[x] * count);
+    }
+  }
+
+  printf("Done collecting measurements.\n\n");
+
+  printf("Cycles per matrix product\n");
+  printf("size, kij, generic, dispatch, fixed\n");
+  {
+    int i, j;
+    for (i = 0; i < NUM_TESTS; i++) {
+      printf("%ld, ", sizes[i]);
+      for (j = 0; j < OPTIONS; j++) {
+        if (j != 0) {
+          printf(", ");
+        }
+        printf("%.1f", (double)(CPNS) * 1.0e9 * time_stamp[j][i]);
+      }
+      printf("\n");
+    }
+  }
+  printf("\n");
+
+  printf("GFLOPs\n");
+  printf("size, kij, generic, dispatch, fixed, fixed speedup over kij\n");
+  {
+    int i, j;
+    double flops;
+    for (i = 0; i < NUM_TESTS; i++) {
+      n = sizes[i];
+      flops = 2.0 * n * n * n;
+      printf("%ld", n);
+      for (j = 0; j < OPTIONS; j++) {
+        printf(", %.2f", flops / time_stamp[j][i] * 1.0e-9);
+      }
+      printf(", %.2f\n", time_stamp[0][i] / time_stamp[OPTIONS-1][i]);
+    }
+  }
+  printf("\n");
+
+  printf("Wakeup delay computed: %g \n", wakeup_answer);
+
+  return 0;
+} /* end main */
+
+/*************************************************/
+
+/* mmm: c += a * b, where a is M x K, b is K x N and c is M x N
+   (as in test_mmm_inter.c) */
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t sum;
+
+  for (i = 0; i < M; i++) {
+    for (j = 0; j < N; j++) {
+      sum = IDENT;
+      for (k = 0; k < K; k++) {
+        sum += a0[i*lda+k] * b0[k*ldb+j];
+      }
+      c0[i*ldc+j] += sum;
+    }
+  }
+}
+
+/* mmm */
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+  for (k = 0; k < K; k++) {
+    for (i = 0; i < M; i++) {
+      r = a0[i*lda+k];
+      for (j = 0; j < N; j++) {
+        c0[i*ldc+j] += r*b0[k*ldb+j];
+      }
+    }
+  }
+}
+
+/* The batches: count n x n matrices back to back in a, b and c */
+void batch_kij(long int n, double *a, double *b, double *c, long int count)
+{
+  mat_rec ma, mb, mc;
+  long int x;
+
+  ma.rows = mb.rows = mc.rows = n;
+  ma.cols = mb.cols = mc.cols = n;
+  ma.ld = mb.ld = mc.ld = n;
+  for (x = 0; x < count; x++) {
+    ma.data = &a[x*n*n];
+    mb.data = &b[x*n*n];
+    mc.data = &c[x*n*n];
+    mmm_kij(&ma, &mb, &mc);
+  }
+}
+
+void batch_generic(long int n, double *a, double *b, double *c,
+                   long int count)
+{
+  long int x;
+
+  for (x = 0; x < count; x++)
+    mmm_small_generic(n, &a[x*n*n], n, &b[x*n*n], n, &c[x*n*n], n);
+}
+
+void batch_dispatch(long int n, double *a, double *b, double *c,
+                    long int count)
+{
+  long int x;
+
+  for (x = 0; x < count; x++)
+    mmm_fixed(n, &a[x*n*n], n, &b[x*n*n], n, &c[x*n*n], n);
+}
+
+void batch_fixed(long int n, double *a, double *b, double *c,
+                 long int count)
+{
+  mmm_fixed_fn f = mmm_fixed_lookup(n);
+  long int x;
+
+  if (!f) {
+    batch_generic(n, a, b, c, count);
+    return;
+  }
+  for (x = 0; x < count; x++)
+    f(&a[x*n*n], n, &b[x*n*n], n, &c[x*n*n], n);
+}
+
+/* mmm_fixed against mmm_ijk for every size from 1 to 33 (specialized or
+   not), on views with leading dimension 40. Returns the number of wrong
+   elements. */
+long int check_mmm_fixed(void)
+{
+  const long int big = 40;
+  mat_ptr a, b, c, ref;
+  mat_rec av, bv, cv, rv;
+  long int n, errors = 0;
+  arena_mark_t mark = arena_mark(default_arena());
+
+  a = new_mat(big, big);
+  b = new_mat(big, big);
+  c = new_mat(big, big);
+  ref = new_mat(big, big);
+  if (!a || !b || !c || !ref) exit(-1);
+  init_mat_check(a, b);
+
+  for (n = 1; n <= 33; n++) {
+    av = mat_view(a, 3, 5, n, n);
+    bv = mat_view(b, 1, 2, n, n);
+    cv = mat_view(c, 2, 1, n, n);
+    rv = mat_view(ref, 2, 1, n, n);
+    fill_mat(ref, 1);
+    mmm_ijk(&av, &bv, &rv);
+    fill_mat(c, 1);
+    mmm_fixed(n, av.data, av.ld, bv.data, bv.ld, cv.data, cv.ld);
+    errors += count_mat_diff(c, ref);
+  }
+
+  free(a); free(b); free(c); free(ref);
+  arena_release(default_arena(), mark);
+  return errors;
+}
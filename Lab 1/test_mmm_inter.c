@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <math.h>
+#include "arena.h"
 
 #define CPNS 4.5    /* Cycles per nanosecond -- Adjust to your computer,
                        for example a 3.2 GhZ GPU, this would be 3.2 */
@@ -23,22 +24,15 @@
 
 typedef double data_t;
 
-/* Create abstract data type for matrix */
-typedef struct {
-  long int len;
-  data_t *data;
-} matrix_rec, *matrix_ptr;
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
 
 /* Prototypes */
 int clock_gettime(clockid_t clk_id, struct timespec *tp);
-matrix_ptr new_matrix(long int row_len);
-int set_matrix_row_length(matrix_ptr m, long int row_len);
-long int get_matrix_row_length(matrix_ptr m);
-int init_matrix(matrix_ptr m, long int row_len);
-int zero_matrix(matrix_ptr m, long int row_len);
-void mmm_ijk(matrix_ptr a, matrix_ptr b, matrix_ptr c);
-void mmm_kij(matrix_ptr a, matrix_ptr b, matrix_ptr c);
-void mmm_jki(matrix_ptr a, matrix_ptr b, matrix_ptr c);
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c);
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c);
+void mmm_jki(mat_ptr a, mat_ptr b, mat_ptr c);
+long int check_mmm(void);
 
 /* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
 /*
@@ -115,6 +109,11 @@ int main(int argc, char *argv[])
 
   printf("Dense MMM tests \n\n");
 
+  if (check_mmm()) {
+    printf("check_mmm: results differ from mmm_ijk\n");
+    exit(-1);
+  }
+
   wakeup_answer = wakeup_delay();
 
   printf("Doing MMM three different ways,\n");
@@ -123,20 +122,21 @@ int main(int argc, char *argv[])
   printf("This may take a while!\n\n");
 
   /* declare and initialize the matrix structure */
-  matrix_ptr a0 = new_matrix(alloc_size);
-  init_matrix(a0, alloc_size);
-  matrix_ptr b0 = new_matrix(alloc_size);
-  init_matrix(b0, alloc_size);
-  matrix_ptr c0 = new_matrix(alloc_size);
-  zero_matrix(c0, alloc_size);
+  mat_ptr a0 = new_mat(alloc_size, alloc_size);
+  mat_ptr b0 = new_mat(alloc_size, alloc_size);
+  mat_ptr c0 = new_mat(alloc_size, alloc_size);
+  if (!a0 || !b0 || !c0) exit(-1);
+  init_mat(a0);
+  init_mat(b0);
+  fill_mat(c0, IDENT);
 
   OPTION = 0;
 
   for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
     printf(" OPT %d, iter %ld, size %ld\n", OPTION, x, n);
-    set_matrix_row_length(a0, n);
-    set_matrix_row_length(b0, n);
-    set_matrix_row_length(c0, n);
+    set_mat_size(a0, n, n);
+    set_mat_size(b0, n, n);
+    set_mat_size(c0, n, n);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
     mmm_ijk(a0, b0, c0);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
@@ -146,9 +146,9 @@ int main(int argc, char *argv[])
   OPTION++;
   for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
     printf(" OPT %d, iter %ld, size %ld\n", OPTION, x, n);
-    set_matrix_row_length(a0, n);
-    set_matrix_row_length(b0, n);
-    set_matrix_row_length(c0, n);
+    set_mat_size(a0, n, n);
+    set_mat_size(b0, n, n);
+    set_mat_size(c0, n, n);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
     mmm_kij(a0, b0, c0);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
@@ -159,9 +159,9 @@ int main(int argc, char *argv[])
   if (OPTIONS > 2) {
     for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
       printf(" OPT %d, iter %ld, size %ld\n", OPTION, x, n);
-      set_matrix_row_length(a0, n);
-      set_matrix_row_length(b0, n);
-      set_matrix_row_length(c0, n);
+      set_mat_size(a0, n, n);
+      set_mat_size(b0, n, n);
+      set_mat_size(c0, n, n);
       clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
       mmm_jki(a0, b0, c0);
       clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
@@ -190,144 +190,118 @@ int main(int argc, char *argv[])
   printf("Wakeup delay computed: %g \n", wakeup_answer);
 } /* end main */
 
-/**********************************************/
-
-/* Create matrix of specified length */
-matrix_ptr new_matrix(long int row_len)
-{
-  long int i;
-  long int alloc;
-
-  /* Allocate and declare header structure */
-  matrix_ptr result = (matrix_ptr) malloc(sizeof(matrix_rec));
-  if (!result) return NULL;  /* Couldn't allocate storage */
-  result->len = row_len;
-
-  /* Allocate and declare array */
-  if (row_len > 0) {
-    alloc = row_len * row_len;
-    data_t *data = (data_t *) calloc(alloc, sizeof(data_t));
-    if (!data) {
-	  free((void *) result);
-	  printf("\n COULDN'T ALLOCATE %ld BYTES STORAGE \n",
-                                                       alloc * sizeof(data_t));
-	  return NULL;  /* Couldn't allocate storage */
-	}
-	result->data = data;
-  } else {
-    result->data = NULL;
-  }
-
-  return result;
-}
-
-/* Set length of matrix */
-int set_matrix_row_length(matrix_ptr m, long int row_len)
-{
-  m->len = row_len;
-  return 1;
-}
-
-/* Return length of matrix */
-long int get_matrix_row_length(matrix_ptr m)
-{
-  return m->len;
-}
-
-/* initialize matrix */
-int init_matrix(matrix_ptr m, long int row_len)
-{
-  long int i;
-
-  if (row_len > 0) {
-    m->len = row_len;
-    for (i = 0; i < row_len*row_len; i++) {
-      m->data[i] = (data_t)(i);
-    }
-    return 1;
-  }
-  else return 0;
-}
-
-/* initialize matrix */
-int zero_matrix(matrix_ptr m, long int row_len)
-{
-  long int i,j;
-
-  if (row_len > 0) {
-    m->len = row_len;
-    for (i = 0; i < row_len*row_len; i++) {
-      m->data[i] = (data_t)(IDENT);
-    }
-    return 1;
-  }
-  else return 0;
-}
-
-data_t *get_matrix_start(matrix_ptr m)
-{
-  return m->data;
-}
-
 /*************************************************/
 
-/* mmm */
-void mmm_ijk(matrix_ptr a, matrix_ptr b, matrix_ptr c)
+/* mmm: c += a * b, where a is M x K, b is K x N and c is M x N. Any of
+   them can be a view into a bigger matrix (see mat_view()). */
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c)
 {
   long int i, j, k;
-  long int length = get_matrix_row_length(a);
-  data_t *a0 = get_matrix_start(a);
-  data_t *b0 = get_matrix_start(b);
-  data_t *c0 = get_matrix_start(c);
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
   data_t sum;
 
-  for (i = 0; i < length; i++) {
-    for (j = 0; j < length; j++) {
+  for (i = 0; i < M; i++) {
+    for (j = 0; j < N; j++) {
       sum = IDENT;
-      for (k = 0; k < length; k++) {
-        sum += a0[i*length+k] * b0[k*length+j];
+      for (k = 0; k < K; k++) {
+        sum += a0[i*lda+k] * b0[k*ldb+j];
       }
-      c0[i*length+j] += sum;
+      c0[i*ldc+j] += sum;
     }
   }
 }
 
 /* mmm */
-void mmm_kij(matrix_ptr a, matrix_ptr b, matrix_ptr c)
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c)
 {
   long int i, j, k;
-  long int length = get_matrix_row_length(a);
-  data_t *a0 = get_matrix_start(a);
-  data_t *b0 = get_matrix_start(b);
-  data_t *c0 = get_matrix_start(c);
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
   data_t r;
 
-  for (k = 0; k < length; k++) {
-    for (i = 0; i < length; i++) {
-      r = a0[i*length+k];
-      for (j = 0; j < length; j++) {
-        c0[i*length+j] += r*b0[k*length+j];
+  for (k = 0; k < K; k++) {
+    for (i = 0; i < M; i++) {
+      r = a0[i*lda+k];
+      for (j = 0; j < N; j++) {
+        c0[i*ldc+j] += r*b0[k*ldb+j];
       }
     }
   }
 }
 
 /* mmm */
-void mmm_jki(matrix_ptr a, matrix_ptr b, matrix_ptr c)
+void mmm_jki(mat_ptr a, mat_ptr b, mat_ptr c)
 {
   long int i, j, k;
-  long int length = get_matrix_row_length(a);
-  data_t *a0 = get_matrix_start(a);
-  data_t *b0 = get_matrix_start(b);
-  data_t *c0 = get_matrix_start(c);
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
   data_t r;
 
-  for (j = 0; j < length; j++) {
-    for (k = 0; k < length; k++) {
-      r = b0[k*length+j];
-      for (i = 0; i < length; i++) {
-        c0[i*length+j] += a0[i*length+k]*r;
+  for (j = 0; j < N; j++) {
+    for (k = 0; k < K; k++) {
+      r = b0[k*ldb+j];
+      for (i = 0; i < M; i++) {
+        c0[i*ldc+j] += a0[i*lda+k]*r;
       }
     }
   }
 }
+
+/* Check mmm_kij and mmm_jki against mmm_ijk on rectangular shapes
+   (including tall-and-skinny ones), with a, b and c as views into bigger
+   matrices. Everything outside the c view must stay untouched. The inputs
+   come from init_mat_check(), so all three orders give exactly the same
+   sums. Returns the number of wrong elements. */
+long int check_mmm(void)
+{
+  static const long int shapes[][3] = {   /* M, K, N */
+    {1, 1, 1}, {5, 3, 7}, {64, 8, 64}, {1000, 16, 8}, {8, 16, 1000},
+    {37, 100, 3}, {100, 37, 50}
+  };
+  const int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+  const long int big = 1010;
+  mat_ptr a, b, c, ref;
+  mat_rec av, bv, cv, rv;
+  long int s, M, K, N, errors = 0;
+  int m;
+  arena_mark_t mark = arena_mark(default_arena());
+
+  a = new_mat(big, big);
+  b = new_mat(big, big);
+  c = new_mat(big, big);
+  ref = new_mat(big, big);
+  if (!a || !b || !c || !ref) exit(-1);
+  init_mat_check(a, b);
+
+  for (s = 0; s < nshapes; s++) {
+    M = shapes[s][0];
+    K = shapes[s][1];
+    N = shapes[s][2];
+    av = mat_view(a, 3, 5, M, K);
+    bv = mat_view(b, 1, 2, K, N);
+    cv = mat_view(c, 2, 1, M, N);
+    rv = mat_view(ref, 2, 1, M, N);
+    fill_mat(ref, 1);
+    mmm_ijk(&av, &bv, &rv);
+    for (m = 1; m < 3; m++) {
+      fill_mat(c, 1);
+      if (m == 1) mmm_kij(&av, &bv, &cv);
+      if (m == 2) mmm_jki(&av, &bv, &cv);
+      errors += count_mat_diff(c, ref);
+    }
+  }
+
+  free(a); free(b); free(c); free(ref);
+  arena_release(default_arena(), mark);
+  return errors;
+}
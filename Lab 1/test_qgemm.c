@@ -0,0 +1,363 @@
+/*****************************************************************************/
+// gcc -O3 -mavx2 -mfma test_qgemm.c -lrt -lm -o test_qgemm
+// gcc -O3 -mavx2 -mfma -mavx512vnni -mavx512vl test_qgemm.c -lrt -lm -o test_qgemm
+
+/*
+  Quantized integer GEMM (qgemm.h) against the double precision packed
+  GEMM (gemm.h). The second compile line builds the VNNI kernels, the
+  first the AVX2 ones.
+
+  Options:
+    gemm       double, C += A * B (gemm.h)
+    u8s8_ref   uint8 x int8 -> int32, scalar loops
+    u8s8       uint8 x int8 -> int32, vector kernel
+    s16        int16 x int16 -> int32, vector kernel
+
+  Results are in cycles and in GOPs (2 N^3 operations, a multiply and an
+  add per term, for all of them). An int8 element is 1/8 the bytes of a
+  double, so the same caches and memory bandwidth feed 8 times as many
+  of them.
+
+  Before timing, check_qgemm compares the vector kernels with the scalar
+  ones on shapes that aren't multiples of the kernel's 4 x 16 block. Then
+  quantization error: float A and B are quantized (A as u8 with a zero
+  point, B as s8 or s16, symmetric), multiplied, dequantized, and
+  compared with the product in double.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "arena.h"
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GhZ GPU, this would be 3.2 */
+
+/* We want to test a wide range of work sizes. We will generate these
+   using the quadratic formula:  A x^2 + B x + C                     */
+#define A   24  /* coefficient of x^2 */
+#define B   40  /* coefficient of x */
+#define C   64  /* constant term */
+
+#define NUM_TESTS 7   /* Number of different sizes to test */
+
+#define OPTIONS 4
+#define IDENT 0
+
+#define ERR_SIZE 256  /* size of the quantization error test */
+
+typedef double data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+#include "gemm.h"
+#include "qgemm.h"
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+int s16_max(long int K);
+long int check_qgemm(void);
+void quant_error(long int n);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  double wakeup_answer;
+  long int x, n, i, alloc_size, errors;
+
+  x = NUM_TESTS-1;
+  alloc_size = A*x*x + B*x + C;
+
+  printf("Quantized GEMM tests, %s kernels\n\n", QGEMM_PATH);
+
+  errors = check_qgemm();
+  printf("check_qgemm: %ld errors\n", errors);
+  if (errors) return -1;
+
+  quant_error(ERR_SIZE);
+
+  wakeup_answer = wakeup_delay();
+
+  printf("\nDoing MMM %d different ways,\n", OPTIONS);
+  printf("for %d different matrix sizes from %d to %ld\n",
+                                                     NUM_TESTS, C, alloc_size);
+  printf("This may take a while!\n\n");
+
+  /* declare and initialize the matrices */
+  mat_ptr a0 = new_mat(alloc_size, alloc_size);
+  mat_ptr b0 = new_mat(alloc_size, alloc_size);
+  mat_ptr c0 = new_mat(alloc_size, alloc_size);
+  uint8_t *a8 = (uint8_t *) arena_alloc(default_arena(),
+                                        alloc_size * alloc_size);
+  int8_t *b8 = (int8_t *) arena_alloc(default_arena(),
+                                      alloc_size * alloc_size);
+  int16_t *a16 = (int16_t *) arena_alloc(default_arena(),
+                                         alloc_size * alloc_size * 2);
+  int16_t *b16 = (int16_t *) arena_alloc(default_arena(),
+                                         alloc_size * alloc_size * 2);
+  int32_t *c32 = (int32_t *) arena_alloc(default_arena(),
+                                         alloc_size * alloc_size * 4);
+  if (!a0 || !b0 || !c0 || !a8 || !b8 || !a16 || !b16 || !c32) exit(-1);
+  init_mat(a0);
+  init_mat(b0);
+  for (i = 0; i < alloc_size * alloc_size; i++) {
+    a8[i] = (uint8_t)(i % 251);
+    b8[i] = (int8_t)(i % (2*QGEMM_S8_MAX + 1) - QGEMM_S8_MAX);
+    a16[i] = (int16_t)(i % 201 - 100);
+    b16[i] = (int16_t)(i % 199 - 99);
+  }
+
+  /* fault in gemm's packing buffers before anything is timed */
+  gemm(C, C, C, a0->data, a0->ld, b0->data, b0->ld, c0->data, c0->ld);
+
+  for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+    for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
+      printf(" OPT %d, iter %ld, size %ld\n", OPTION, x, n);
+      set_mat_size(a0, n, n);
+      set_mat_size(b0, n, n);
+      set_mat_size(c0, n, n);
+      fill_mat(c0, IDENT);
+      for (i = 0; i < n * n; i++) c32[i] = 0;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      switch (OPTION) {
+        case 0: gemm(n, n, n, a0->data, a0->ld, b0->data, b0->ld,
+                     c0->data, c0->ld); break;
+        case 1: qgemm_u8s8_ref(n, n, n, a8, n, b8, n, c32, n); break;
+        case 2: qgemm_u8s8(n, n, n, a8, n, b8, n, c32, n); break;
+        case 3: qgemm_s16(n, n, n, a16, n, b16, n, c32, n); break;
+      }
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop);
+    }
+  }
+
+  printf("Done collecting measurements.\n\n");
+
+  printf("row_len, gemm, u8s8_ref, u8s8, s16\n");
+  {
+    int i, j;
+    for (i = 0; i < NUM_TESTS; i++) {
+      printf("%d, ", A*i*i + B*i + C);
+      for (j = 0; j < OPTIONS; j++) {
+        if (j != 0) {
+          printf(", ");
+        }
+        printf("%ld", (long int) ((double)(CPNS) * 1.0e9 * time_stamp[j][i]));
+      }
+      printf("\n");
+    }
+  }
+  printf("\n");
+
+  printf("GOPs\n");
+  printf("row_len, gemm, u8s8_ref, u8s8, s16, u8s8 / gemm, s16 / gemm\n");
+  {
+    int i, j;
+    double flops;
+    for (i = 0; i < NUM_TESTS; i++) {
+      n = A*i*i + B*i + C;
+      flops = 2.0 * n * n * n;
+      printf("%ld", n);
+      for (j = 0; j < OPTIONS; j++) {
+        printf(", %.2f", flops / time_stamp[j][i] * 1.0e-9);
+      }
+      printf(", %.2f, %.2f\n", time_stamp[0][i] / time_stamp[2][i],
+             time_stamp[0][i] / time_stamp[3][i]);
+    }
+  }
+  printf("\n");
+
+  printf("Wakeup delay computed: %g \n", wakeup_answer);
+
+  return 0;
+} /* end main */
+
+/*************************************************/
+
+/* Largest int16 magnitude with K * max^2 < 2^31, so the int32 sums can't
+   overflow */
+int s16_max(long int K)
+{
+  double m = floor(sqrt(2147483647.0 / K));
+  return (m > 32767.0) ? 32767 : (int) m;
+}
+
+/* Vector kernels against the scalar ones, on shapes that aren't
+   multiples of 4 x 16, with leading dimensions bigger than the width and
+   the full range of values each path allows. Returns the number of wrong
+   elements. */
+long int check_qgemm(void)
+{
+  static const long int shapes[][3] = {   /* M, K, N */
+    {1, 1, 1}, {4, 4, 16}, {5, 3, 7}, {13, 300, 17}, {97, 257, 9},
+    {30, 1001, 50}, {200, 20, 33}
+  };
+  const int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+  const long int ld = 1024 + 8;
+  arena_mark_t mark = arena_mark(default_arena());
+  uint8_t *a8 = (uint8_t *) arena_alloc(default_arena(), ld * ld);
+  int8_t *b8 = (int8_t *) arena_alloc(default_arena(), ld * ld);
+  int16_t *a16 = (int16_t *) arena_alloc(default_arena(), ld * ld * 2);
+  int16_t *b16 = (int16_t *) arena_alloc(default_arena(), ld * ld * 2);
+  int32_t *c = (int32_t *) arena_alloc(default_arena(), ld * ld * 4);
+  int32_t *ref = (int32_t *) arena_alloc(default_arena(), ld * ld * 4);
+  long int s, i, M, K, N, errors = 0;
+  int m16;
+
+  if (!a8 || !b8 || !a16 || !b16 || !c || !ref) exit(-1);
+  srandom(1);
+  for (s = 0; s < nshapes; s++) {
+    M = shapes[s][0];
+    K = shapes[s][1];
+    N = shapes[s][2];
+    m16 = s16_max(K);
+    for (i = 0; i < ld * ld; i++) {
+      a8[i] = (uint8_t)(random() % 256);
+      b8[i] = (int8_t)(random() % (2*QGEMM_S8_MAX + 1) - QGEMM_S8_MAX);
+      a16[i] = (int16_t)(random() % (2*m16 + 1) - m16);
+      b16[i] = (int16_t)(random() % (2*m16 + 1) - m16);
+    }
+
+    for (i = 0; i < ld * ld; i++) c[i] = ref[i] = (int32_t)(i % 3);
+    qgemm_u8s8_ref(M, N, K, a8, ld, b8, ld, ref, ld);
+    qgemm_u8s8(M, N, K, a8, ld, b8, ld, c, ld);
+    for (i = 0; i < ld * ld; i++) if (c[i] != ref[i]) errors++;
+
+    for (i = 0; i < ld * ld; i++) c[i] = ref[i] = (int32_t)(i % 3);
+    qgemm_s16_ref(M, N, K, a16, ld, b16, ld, ref, ld);
+    qgemm_s16(M, N, K, a16, ld, b16, ld, c, ld);
+    for (i = 0; i < ld * ld; i++) if (c[i] != ref[i]) errors++;
+  }
+
+  arena_release(default_arena(), mark);
+  return errors;
+}
+
+/* Quantize random float n x n matrices, multiply in u8 x s8 and in s16,
+   dequantize, and print the largest error relative to max |C| */
+void quant_error(long int n)
+{
+  arena_mark_t mark = arena_mark(default_arena());
+  float *af = (float *) arena_alloc(default_arena(), n * n * sizeof(float));
+  float *bf = (float *) arena_alloc(default_arena(), n * n * sizeof(float));
+  float *cf = (float *) arena_alloc(default_arena(), n * n * sizeof(float));
+  double *cd = (double *) arena_calloc(default_arena(), n * n, sizeof(double));
+  double *ad = (double *) arena_alloc(default_arena(), n * n * sizeof(double));
+  double *bd = (double *) arena_alloc(default_arena(), n * n * sizeof(double));
+  uint8_t *a8 = (uint8_t *) arena_alloc(default_arena(), n * n);
+  int8_t *b8 = (int8_t *) arena_alloc(default_arena(), n * n);
+  int16_t *a16 = (int16_t *) arena_alloc(default_arena(), n * n * 2);
+  int16_t *b16 = (int16_t *) arena_alloc(default_arena(), n * n * 2);
+  int32_t *c32 = (int32_t *) arena_alloc(default_arena(), n * n * 4);
+  int32_t *colsum = (int32_t *) arena_alloc(default_arena(), n * 4);
+  float sa, sb;
+  int32_t za;
+  double cmax = 0.0, err8 = 0.0, err16 = 0.0;
+  long int i;
+  int m16 = s16_max(n);
+
+  if (!af || !bf || !cf || !cd || !ad || !bd || !a8 || !b8 || !a16 || !b16
+      || !c32 || !colsum) exit(-1);
+  srandom(2);
+  for (i = 0; i < n * n; i++) {
+    af[i] = (float) random() / RAND_MAX;          /* activations >= 0 */
+    bf[i] = 2.0f * random() / RAND_MAX - 1.0f;    /* weights in [-1,1] */
+    ad[i] = af[i];
+    bd[i] = bf[i];
+  }
+  for (i = 0; i < n * n; i++) cd[i] = 0.0;
+  gemm(n, n, n, ad, n, bd, n, cd, n);
+  for (i = 0; i < n * n; i++) if (fabs(cd[i]) > cmax) cmax = fabs(cd[i]);
+
+  /* u8 x s8 */
+  sa = quantize_u8(n * n, af, a8, &za);
+  sb = quantize_s8(n * n, bf, b8, QGEMM_S8_MAX);
+  qgemm_col_sums_s8(n, n, b8, n, colsum);
+  for (i = 0; i < n * n; i++) c32[i] = 0;
+  qgemm_u8s8(n, n, n, a8, n, b8, n, c32, n);
+  dequantize_s32(n, n, c32, n, sa * sb, za, colsum, cf, n);
+  for (i = 0; i < n * n; i++)
+    if (fabs(cf[i] - cd[i]) > err8) err8 = fabs(cf[i] - cd[i]);
+
+  /* s16 x s16, both symmetric */
+  sa = quantize_s16(n * n, af, a16, m16);
+  sb = quantize_s16(n * n, bf, b16, m16);
+  for (i = 0; i < n * n; i++) c32[i] = 0;
+  qgemm_s16(n, n, n, a16, n, b16, n, c32, n);
+  dequantize_s32(n, n, c32, n, sa * sb, 0, NULL, cf, n);
+  for (i = 0; i < n * n; i++)
+    if (fabs(cf[i] - cd[i]) > err16) err16 = fabs(cf[i] - cd[i]);
+
+  printf("Quantization error, %ld x %ld, max |C - C_double| / max |C|:\n",
+         n, n);
+  printf("  u8 x s8 (weights to +-%d): %.2e\n", QGEMM_S8_MAX, err8 / cmax);
+  printf("  s16 x s16 (to +-%d):       %.2e\n", m16, err16 / cmax);
+
+  arena_release(default_arena(), mark);
+}
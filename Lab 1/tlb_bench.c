@@ -0,0 +1,409 @@
+/*                         tlb_bench.c
+ *
+ * TLB and page size sensitivity benchmark
+ *
+ * To compile:
+ *
+ *     gcc -O1 tlb_bench.c -lrt -o tlb_bench
+ *
+ * To run:   ./tlb_bench [max_span_bytes]       (default 512 MB)
+ *
+ * mem_bench.c, stream.c and test_align.c measure caches and bandwidth but
+ * can't tell a TLB miss from a cache miss. Here we touch ONE cache line per
+ * 4 KB page, so the number of pages touched grows with the span while the
+ * number of lines (the cache footprint) stays small, and compare:
+ *
+ *   rand 4K  - random pointer chase over the pages, 4 KB pages
+ *              (madvise(MADV_NOHUGEPAGE))
+ *   rand 2M  - the same chase with 2 MB pages: MAP_HUGETLB if the system
+ *              has huge pages reserved, otherwise transparent huge pages
+ *              (madvise(MADV_HUGEPAGE) on a 2 MB aligned mapping)
+ *   seq 4K/2M - the same pages visited in order; still a dependent chase,
+ *              but the hardware prefetchers can follow it (within a page)
+ *   packed   - the same number of lines, packed next to each other: the
+ *              same cache footprint with 64x fewer pages. Its latency is
+ *              the "no TLB problem" reference.
+ *
+ * Identical cache behaviour, different page size, so rand 4K - rand 2M is
+ * the cost of the TLB misses. If perf_event_open() is allowed, the dTLB
+ * load miss counter (on most Intel CPUs this counts misses that needed a
+ * page walk, i.e. STLB misses) is shown per access; otherwise -1.
+ *
+ * At the end we print estimates of where the 4 KB pages outgrow the STLB
+ * (second level TLB), from where the 4K/2M difference and the page walk
+ * count start to rise. A first level dTLB miss that hits in the STLB costs
+ * only a few cycles, so the latency knee shows up at STLB scale (thousands
+ * of pages, several MB), not at the 64-entry first level.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif /* __linux__ */
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GHz GPU, this would be 3.2 */
+
+#define LINE 64L
+#define PAGE_4K 4096L
+#define PAGE_2M (2L << 20)
+
+#define MIN_SPAN (64L << 10)         /* 64 KB = 16 pages */
+#define DEFAULT_MAX_SPAN (512L << 20)
+#define MAX_POINTS 32
+#define ACCESSES (2L << 20)          /* chase steps per measurement */
+
+#define WALK_KNEE_NS 0.5   /* 4K - 2M difference that counts as "walks" */
+#define STLB_KNEE_WALKS 0.1          /* page walks per access */
+
+enum { MODE_4K, MODE_2M };
+
+/* a mapping made for one measurement */
+typedef struct {
+  char *base;          /* 2 MB aligned for MODE_2M */
+  char *map;           /* what to munmap */
+  long int map_len;
+  const char *how;     /* which mechanism gave us the pages */
+} span_rec, *span_ptr;
+
+int alloc_span(span_ptr s, long int bytes, int mode);
+void free_span(span_ptr s);
+long int anon_huge_kb(void);
+void **build_chase(char *base, long int nodes, long int stride, int shuffle);
+double time_chase(void **start, long int nodes, long int steps,
+                  double *walks);
+
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* -=-=-=-=- dTLB miss counter by perf_event_open() -=-=-=-=- */
+
+int tlb_fd = -1;
+
+int tlb_counter_open(void)
+{
+#ifdef __linux__
+  struct perf_event_attr pe;
+
+  memset(&pe, 0, sizeof(pe));
+  pe.type = PERF_TYPE_HW_CACHE;
+  pe.size = sizeof(pe);
+  pe.config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  pe.disabled = 1;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv = 1;
+  tlb_fd = (int) syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+#endif /* __linux__ */
+  return (tlb_fd >= 0);
+}
+
+/* -=-=-=-=- End of counter declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/*****************************************************************************/
+int main(int argc, char ** argv)
+{
+  long int max_span = DEFAULT_MAX_SPAN;
+  long int span, pages, npts = 0, i;
+  double t[MAX_POINTS][5], w[MAX_POINTS][2];
+  long int spans[MAX_POINTS];
+  long int walk_knee = -1, stlb_knee = -1;
+  const char *how_2m = "";
+  long int huge_kb = -1;
+  span_rec s4, s2, sp;
+  double wd;
+
+  if (argc > 1) {
+    sscanf(argv[1], "%ld", &max_span);
+  }
+  if (max_span < MIN_SPAN) {
+    max_span = MIN_SPAN;
+  }
+
+  printf("TLB / page size benchmark, spans %ld KB .. %ld MB\n",
+         MIN_SPAN >> 10, max_span >> 20);
+  if (!tlb_counter_open()) {
+    printf("dTLB miss counter not available, walks columns will be -1\n");
+  }
+  wd = wakeup_delay();
+
+  printf("span KB, pages, rand 4K ns, rand 2M ns, seq 4K ns, seq 2M ns, "
+         "packed ns, 4K-2M cycles, walks/access 4K, walks/access 2M\n");
+  for (span = MIN_SPAN; span <= max_span && npts < MAX_POINTS; span *= 2) {
+    pages = span / PAGE_4K;
+
+    if (alloc_span(&s4, span, MODE_4K) || alloc_span(&s2, span, MODE_2M)
+        || alloc_span(&sp, pages * LINE, MODE_4K)) {
+      printf("COULDN'T ALLOCATE %ld BYTES STORAGE\n", span);
+      break;
+    }
+    how_2m = s2.how;
+
+    /* one line per page, random order */
+    t[npts][0] = time_chase(build_chase(s4.base, pages, PAGE_4K, 1), pages,
+                            ACCESSES, &w[npts][0]);
+    t[npts][1] = time_chase(build_chase(s2.base, pages, PAGE_4K, 1), pages,
+                            ACCESSES, &w[npts][1]);
+    if (huge_kb < 0 || anon_huge_kb() > huge_kb) huge_kb = anon_huge_kb();
+    /* one line per page, in order */
+    t[npts][2] = time_chase(build_chase(s4.base, pages, PAGE_4K, 0), pages,
+                            ACCESSES, NULL);
+    t[npts][3] = time_chase(build_chase(s2.base, pages, PAGE_4K, 0), pages,
+                            ACCESSES, NULL);
+    /* same number of lines, packed, random order */
+    t[npts][4] = time_chase(build_chase(sp.base, pages, LINE, 1), pages,
+                            ACCESSES, NULL);
+
+    spans[npts] = span;
+    printf("%8ld, %7ld, %7.2f, %7.2f, %7.2f, %7.2f, %7.2f, %7.1f, %6.3f, %6.3f\n",
+           span >> 10, pages, t[npts][0], t[npts][1], t[npts][2], t[npts][3],
+           t[npts][4], CPNS * (t[npts][0] - t[npts][1]), w[npts][0], w[npts][1]);
+
+    free_span(&s4);
+    free_span(&s2);
+    free_span(&sp);
+    npts++;
+  }
+
+  /* where do the TLB levels run out? */
+  for (i = 0; i < npts; i++) {
+    if (walk_knee < 0 && t[i][0] - t[i][1] > WALK_KNEE_NS) walk_knee = spans[i];
+    if (stlb_knee < 0 && w[i][0] > STLB_KNEE_WALKS) stlb_knee = spans[i];
+  }
+  printf("\n2 MB pages from: %s", how_2m);
+  if (huge_kb >= 0) printf(" (AnonHugePages seen: %ld KB)", huge_kb);
+  printf("\n");
+  if (walk_knee > 0) {
+    printf("4 KB pages first slower than 2 MB by > %.1f ns at span %ld KB "
+           "(%ld pages): 4K page walks begin, STLB reach exceeded\n",
+           WALK_KNEE_NS, walk_knee >> 10, walk_knee / PAGE_4K);
+  }
+  if (stlb_knee > 0) {
+    printf("page walks > %.2f per access from span %ld KB (%ld pages): "
+           "STLB reach exceeded\n",
+           STLB_KNEE_WALKS, stlb_knee >> 10, stlb_knee / PAGE_4K);
+  }
+  else if (tlb_fd < 0) {
+    printf("(no dTLB counter: only the 4K-2M column shows the STLB "
+           "reach)\n");
+  }
+
+  printf("Wakeup delay calculated %f\n", wd);
+  return 0;
+}
+
+/*****************************************************************************/
+/* Map bytes of memory with 4 KB or 2 MB pages. Returns 0 on success. */
+int alloc_span(span_ptr s, long int bytes, int mode)
+{
+#ifdef __linux__
+  char *p;
+
+  if (mode == MODE_4K) {
+    p = (char *) mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return -1;
+#ifdef MADV_NOHUGEPAGE
+    madvise(p, bytes, MADV_NOHUGEPAGE);
+#endif
+    s->base = s->map = p;
+    s->map_len = bytes;
+    s->how = "4K";
+    return 0;
+  }
+
+  bytes = (bytes + PAGE_2M - 1) & ~(PAGE_2M - 1);
+#ifdef MAP_HUGETLB
+  /* explicit huge pages, only works if some are reserved
+     (/proc/sys/vm/nr_hugepages) */
+  p = (char *) mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED) {
+    s->base = s->map = p;
+    s->map_len = bytes;
+    s->how = "MAP_HUGETLB";
+    return 0;
+  }
+#endif
+  /* transparent huge pages need a 2 MB aligned range */
+  p = (char *) mmap(NULL, bytes + PAGE_2M, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return -1;
+  s->map = p;
+  s->map_len = bytes + PAGE_2M;
+  s->base = (char *)(((uintptr_t) p + PAGE_2M - 1) & ~(uintptr_t)(PAGE_2M - 1));
+  s->how = "4K (no THP)";
+#ifdef MADV_HUGEPAGE
+  if (madvise(s->base, bytes, MADV_HUGEPAGE) == 0) s->how = "THP";
+#endif
+  return 0;
+#else
+  /* no control over page size: both modes get whatever malloc gives */
+  if (posix_memalign((void **) &s->base, PAGE_4K, bytes)) return -1;
+  s->map = s->base;
+  s->map_len = bytes;
+  s->how = "posix_memalign";
+  return 0;
+#endif /* __linux__ */
+}
+
+void free_span(span_ptr s)
+{
+#ifdef __linux__
+  munmap(s->map, s->map_len);
+#else
+  free(s->map);
+#endif
+}
+
+/* AnonHugePages of the whole process in KB, -1 if we can't tell */
+long int anon_huge_kb(void)
+{
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  char line[256];
+  long int kb = -1;
+
+  if (!f) return -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) break;
+  }
+  fclose(f);
+  return kb;
+}
+
+/* Link nodes into one cycle of pointers and return the first node. Node i
+   is at base + i*stride; when stride is a whole page the node also gets a
+   line offset inside its page, so the lines are spread over all the cache
+   sets instead of piling up in one. The offset is a hash of all the bits
+   of i: with 2 MB pages the page number bits are also set index bits, and
+   an offset that only depended on i mod 64 would use just 64 sets.
+   shuffle = 1 visits the nodes in a random order (Sattolo's shuffle: a
+   single cycle through all of them). */
+#define LINE_IN_PAGE(k) \
+  ((((unsigned long)(k) * 2654435761UL) >> 16) & (PAGE_4K/LINE - 1))
+
+void **build_chase(char *base, long int nodes, long int stride, int shuffle)
+{
+  long int *order = (long int *) malloc(nodes * sizeof(long int));
+  long int i, j, tmp;
+  void **node, **next;
+
+  if (!order) {
+    printf("COULDN'T ALLOCATE %ld BYTES STORAGE\n", nodes * sizeof(long int));
+    exit(-1);
+  }
+  for (i = 0; i < nodes; i++) order[i] = i;
+  if (shuffle) {
+    for (i = nodes - 1; i > 0; i--) {
+      j = random() % i;
+      tmp = order[i]; order[i] = order[j]; order[j] = tmp;
+    }
+  }
+
+#define NODE(k) ((void **)(base + (k)*stride + \
+                   ((stride >= PAGE_4K) ? LINE_IN_PAGE(k) * LINE : 0)))
+  for (i = 0; i < nodes; i++) {
+    node = NODE(order[i]);
+    next = NODE(order[(i + 1) % nodes]);
+    *node = (void *) next;
+  }
+  node = NODE(order[0]);
+#undef NODE
+
+  free(order);
+  return node;
+}
+
+/* Follow the chain of nodes for steps accesses, after at least one full
+   untimed pass around it to warm up caches and TLBs. Returns ns per
+   access; *walks gets dTLB misses per access, or -1 without the
+   counter. */
+double time_chase(void **start, long int nodes, long int steps,
+                  double *walks)
+{
+  struct timespec time_start, time_stop;
+  void **p = start;
+  long int warm = nodes > steps / 4 ? nodes : steps / 4;
+  long int i;
+  long long int misses = 0;
+
+  for (i = 0; i < warm; i++) p = (void **) *p;
+
+#ifdef __linux__
+  if (walks && tlb_fd >= 0) {
+    ioctl(tlb_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(tlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  for (i = 0; i < steps; i++) p = (void **) *p;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+#ifdef __linux__
+  if (walks && tlb_fd >= 0) {
+    ioctl(tlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(tlb_fd, &misses, sizeof(misses)) != sizeof(misses)) misses = -1;
+  }
+#endif
+  if (walks) {
+    *walks = (tlb_fd >= 0 && misses >= 0) ? (double) misses / steps : -1.0;
+  }
+  if (p == NULL) printf(" ");   /* keep the chase live */
+
+  return 1.0e9 * interval(time_start, time_stop) / steps;
+}
@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <math.h>
+#include "arena.h"
 
 #define CPNS 2.0    /* Cycles per nanosecond -- Adjust to your computer,
                        for example a 3.2 GHz GPU, this would be 3.2 */
@@ -225,7 +226,7 @@ array_ptr new_array(long int len)
 
   /* Allocate and declare array */
   if (len > 0) {
-    data_t *data = (data_t *) calloc(len, sizeof(data_t));
+    data_t *data = (data_t *) arena_calloc(default_arena(), len, sizeof(data_t));
     if (!data) {
       free((void *) result);
       return NULL;  /* Couldn't allocate storage */
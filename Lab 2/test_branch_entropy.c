@@ -0,0 +1,421 @@
+/***************************************************************************
+
+  gcc -O1 -mavx2 test_branch_entropy.c -lm -lrt -o test_branch_entropy
+
+  Sweeps branch behaviour between the two extremes of init_array_pred and
+  init_array_unpred. The comparison v0[i] > v1[i] is made true with a
+  chosen probability P_TAKEN, and the resulting pattern of outcomes repeats
+  with a chosen PERIOD. Short periods can be learned by the predictor no
+  matter what P_TAKEN is; a period as long as the array looks random.
+
+  Mispredictions and cycles are read from the hardware counters with
+  perf_event_open(). If that is not allowed (check
+  /proc/sys/kernel/perf_event_paranoid, or run on bare metal instead of a
+  VM/container) we fall back to clock_gettime() and CPNS for cycles and
+  print -1 for the mispredict columns.
+
+  Use -mavx2 (see the note in test_branchless.c).
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <immintrin.h>
+#include "arena.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif /* __linux__ */
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GHz GPU, this would be 3.2 */
+
+/* Array length is fixed (small enough to stay in L1/L2 so that memory does
+   not hide the branch effects); we vary the data instead. */
+#define ARR_LEN 8192
+
+#define OUTER_LOOPS 200
+
+/* Probabilities of the comparison being true, and pattern periods, that
+   make up the sweep. A period of ARR_LEN means "no repetition". */
+#define NUM_PROBS 9
+#define NUM_PERIODS 8
+double P_TAKEN[NUM_PROBS] = {0.0, 0.01, 0.02, 0.05, 0.1, 0.2, 0.3, 0.4, 0.5};
+long int PERIOD[NUM_PERIODS] = {2, 8, 32, 128, 512, 2048, 4096, ARR_LEN};
+
+#define OPTIONS 3
+
+typedef float data_t;
+
+/* Number of data_t elements in an AVX vector */
+#define VSIZE 8
+
+/* Create abstract data type for an array in memory */
+typedef struct {
+  long int len;
+  data_t *data;
+} array_rec, *array_ptr;
+
+/* One measurement: cycles, branch instructions and branch misses */
+typedef struct {
+  double cycles;
+  double branches;
+  double misses;
+} counts_rec;
+
+array_ptr new_array(long int len);
+long int get_array_length(array_ptr v);
+data_t *get_array_start(array_ptr v);
+int init_array_entropy(array_ptr v0, array_ptr v1, long int len,
+                                          double p_taken, long int period);
+double fRand(double fMin, double fMax);
+void branch_hard(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit);
+void branch2(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit);
+void avx_max(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit);
+int counters_open(void);
+void counters_start(void);
+void counters_stop(counts_rec *r);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* -=-=-=-=- Hardware counters by perf_event_open() -=-=-=-=- */
+/*
+  We open a group of three counters (cycles, branch instructions, branch
+  misses) on this thread, user mode only. The group leader is cycles, and
+  a single read() returns all three values together.
+ */
+
+int counter_fd[3] = {-1, -1, -1};
+int have_counters = 0;
+struct timespec fallback_start;
+
+#ifdef __linux__
+static int perf_open(unsigned long long config, int group_fd)
+{
+  struct perf_event_attr pe;
+
+  memset(&pe, 0, sizeof(pe));
+  pe.type = PERF_TYPE_HARDWARE;
+  pe.size = sizeof(pe);
+  pe.config = config;
+  pe.disabled = (group_fd == -1);
+  pe.exclude_kernel = 1;
+  pe.exclude_hv = 1;
+  pe.read_format = PERF_FORMAT_GROUP;
+  return (int) syscall(__NR_perf_event_open, &pe, 0, -1, group_fd, 0);
+}
+#endif /* __linux__ */
+
+/* Returns 1 if hardware counters are available, 0 if we have to fall back
+   to timing */
+int counters_open(void)
+{
+#ifdef __linux__
+  counter_fd[0] = perf_open(PERF_COUNT_HW_CPU_CYCLES, -1);
+  if (counter_fd[0] >= 0) {
+    counter_fd[1] = perf_open(PERF_COUNT_HW_BRANCH_INSTRUCTIONS, counter_fd[0]);
+    counter_fd[2] = perf_open(PERF_COUNT_HW_BRANCH_MISSES, counter_fd[0]);
+  }
+  have_counters = (counter_fd[0] >= 0 && counter_fd[1] >= 0
+                                                     && counter_fd[2] >= 0);
+#endif /* __linux__ */
+  return have_counters;
+}
+
+void counters_start(void)
+{
+#ifdef __linux__
+  if (have_counters) {
+    ioctl(counter_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counter_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return;
+  }
+#endif /* __linux__ */
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &fallback_start);
+}
+
+void counters_stop(counts_rec *r)
+{
+  struct timespec fallback_stop;
+
+#ifdef __linux__
+  if (have_counters) {
+    unsigned long long vals[4];   /* nr, then one value per counter */
+    ioctl(counter_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (read(counter_fd[0], vals, sizeof(vals)) == (ssize_t)sizeof(vals)) {
+      r->cycles = (double) vals[1];
+      r->branches = (double) vals[2];
+      r->misses = (double) vals[3];
+      return;
+    }
+  }
+#endif /* __linux__ */
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &fallback_stop);
+  r->cycles = (double)(CPNS) * 1.0e9 * interval(fallback_start, fallback_stop);
+  r->branches = -1;
+  r->misses = -1;
+}
+
+/* -=-=-=-=- End of hardware counter declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION, p, q;
+  counts_rec result[OPTIONS][NUM_PROBS][NUM_PERIODS];
+  double wd, elements;
+
+  printf("Branch predictability sweep\n");
+
+  wd = wakeup_delay();
+
+  if (counters_open()) {
+    printf("Using hardware counters (cycles, branches, branch-misses)\n");
+  } else {
+    printf("Hardware counters not available, cycles estimated with CPNS=%g,"
+           " mispredicts not measured\n", CPNS);
+  }
+
+  /* create array data structures */
+  array_ptr v0 = new_array(ARR_LEN);
+  array_ptr v1 = new_array(ARR_LEN);
+  array_ptr v2 = new_array(ARR_LEN);
+
+  for (p = 0; p < NUM_PROBS; p++) {
+    for (q = 0; q < NUM_PERIODS; q++) {
+      init_array_entropy(v0, v1, ARR_LEN, P_TAKEN[p], PERIOD[q]);
+      for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+        counters_start();
+        switch(OPTION) {
+          case 0:  branch_hard(v0, v1, v2, OUTER_LOOPS); break;
+          case 1:  branch2(v0, v1, v2, OUTER_LOOPS);     break;
+          case 2:  avx_max(v0, v1, v2, OUTER_LOOPS);     break;
+          default: break;
+        }
+        counters_stop(&result[OPTION][p][q]);
+      }
+    }
+    printf("  p_taken %g done\r", P_TAKEN[p]); fflush(stdout);
+  }
+
+  /* output: per element cycles, and misses per element and per branch */
+  elements = (double)ARR_LEN * (double)OUTER_LOOPS;
+  printf("\n");
+  printf("p_taken, period, branchy cyc/elt, branchy miss/elt, branchy miss%%,"
+         " branchless cyc/elt, branchless miss/elt, avx cyc/elt, winner\n");
+  for (p = 0; p < NUM_PROBS; p++) {
+    for (q = 0; q < NUM_PERIODS; q++) {
+      counts_rec *r0 = &result[0][p][q];
+      counts_rec *r1 = &result[1][p][q];
+      counts_rec *r2 = &result[2][p][q];
+      printf("%5.2f, %5ld, %7.3f, %7.4f, %6.2f, %7.3f, %7.4f, %7.3f, %s\n",
+        P_TAKEN[p], PERIOD[q],
+        r0->cycles / elements,
+        (r0->misses < 0) ? -1.0 : r0->misses / elements,
+        (r0->misses < 0) ? -1.0 : 100.0 * r0->misses / r0->branches,
+        r1->cycles / elements,
+        (r1->misses < 0) ? -1.0 : r1->misses / elements,
+        r2->cycles / elements,
+        (r0->cycles <= r1->cycles) ? "branchy" : "branchless");
+    }
+  }
+
+  printf("\n");
+  printf("Wakeup delay calculated %f\n", wd);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+/* Create a memory array of a specified length */
+array_ptr new_array(long int len)
+{
+  /* Allocate and declare header structure */
+  array_ptr result = (array_ptr) malloc(sizeof(array_rec));
+  if (!result) return NULL;  /* Couldn't allocate storage */
+  result->len = len;
+
+  /* Allocate and declare array */
+  if (len > 0) {
+    data_t *data = (data_t *) arena_calloc(default_arena(), len, sizeof(data_t));
+    if (!data) {
+      free((void *) result);
+      return NULL;  /* Couldn't allocate storage */
+    }
+    result->data = data;
+  } else {
+    result->data = NULL;
+  }
+
+  return result;
+}
+
+/* Return length of an array */
+long int get_array_length(array_ptr v)
+{
+  return v->len;
+}
+
+data_t *get_array_start(array_ptr v)
+{
+  return v->data;
+}
+
+/* Initialize v0 and v1 so that (v0[i] > v1[i]) is true with probability
+   p_taken, and the sequence of true/false outcomes repeats every "period"
+   elements. The values themselves are still random, only the outcome of
+   the comparison follows the pattern. */
+int init_array_entropy(array_ptr v0, array_ptr v1, long int len,
+                                          double p_taken, long int period)
+{
+  long int i;
+  char *pattern;
+
+  if (len <= 0 || period <= 0) return 0;
+
+  pattern = (char *) malloc(period);
+  if (!pattern) return 0;
+  srandom(period);   /* same pattern for a given period on every run */
+  for (i = 0; i < period; i++) {
+    pattern[i] = (fRand(0.0, 1.0) < p_taken);
+  }
+
+  v0->len = len;
+  v1->len = len;
+  for (i = 0; i < len; i++) {
+    v1->data[i] = (data_t) 50.0;
+    if (pattern[i % period]) {
+      v0->data[i] = (data_t) fRand(51.0, 100.0);
+    } else {
+      v0->data[i] = (data_t) fRand(0.0, 49.0);
+    }
+  }
+
+  free(pattern);
+  return 1;
+}
+
+/* Returns a random number in the range [fMin, fMax) */
+double fRand(double fMin, double fMax)
+{
+  double f = (double)random() / RAND_MAX;
+  return fMin + f * (fMax - fMin);
+}
+
+/*************************************************/
+/* branch_hard:  same as branch1 in test_branch.c, v2[i] = max(v0[i], v1[i]).
+   gcc turns branch1 into a maxss (no branch at all) even at -O1, which
+   would make this experiment meaningless. The empty asm statement in the
+   "taken" arm cannot be speculated, so it forces a real conditional jump. */
+void branch_hard(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data1 = get_array_start(v1);
+  data_t *data2 = get_array_start(v2);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i < length; i++) {
+      if (data0[i] > data1[i]) {
+        __asm__ volatile("");
+        data2[i] = data0[i];
+      } else {
+        data2[i] = data1[i];
+      }
+    }
+  }
+}
+
+/* branch2:  scalar branch-free version (as in test_branch.c); gcc compiles
+   the conditional expression to maxss. The "winner" column compares this
+   against branch_hard, so both sides do one element per iteration. */
+void branch2(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data1 = get_array_start(v1);
+  data_t *data2 = get_array_start(v2);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i < length; i++) {
+      data2[i] = (data0[i] > data1[i]) ? data0[i] : data1[i];
+    }
+  }
+}
+
+/* avx_max:  vectorized branch-free version, as in test_branchless.c */
+void avx_max(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data1 = get_array_start(v1);
+  data_t *data2 = get_array_start(v2);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i + VSIZE <= length; i += VSIZE) {
+      __m256 a = _mm256_loadu_ps(&data0[i]);
+      __m256 b = _mm256_loadu_ps(&data1[i]);
+      __m256 m = _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+      _mm256_storeu_ps(&data2[i], _mm256_blendv_ps(b, a, m));
+    }
+    for (; i < length; i++) {
+      data2[i] = (data0[i] > data1[i]) ? data0[i] : data1[i];
+    }
+  }
+}
@@ -0,0 +1,534 @@
+/***************************************************************************
+
+  gcc -O1 -mavx2 test_branchless.c -lm -lrt -o test_branchless
+
+  Use -mavx2 even though the kernels only need AVX: with plain -mavx,
+  gcc 12 turns blendv(compare) back into a per-lane branch sequence, which
+  defeats the whole point.
+
+  Branch-free versions of the select-style kernels from test_branch.c.
+  Every kernel makes its choice with an AVX compare that produces a lane
+  mask, followed by a blend (or bitwise and/andnot) that picks the lanes,
+  so there is nothing for the branch predictor to get wrong.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <immintrin.h>
+#include "arena.h"
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GHz GPU, this would be 3.2 */
+
+/* We want to test a range of work sizes. We will generate these
+   using the quadratic formula:  A x^2 + B x + C                     */
+#define A   22  /* coefficient of x^2 */
+#define B   0  /* coefficient of x */
+#define C   1  /* constant term */
+
+#define NUM_TESTS 20   /* Number of different sizes to test */
+
+#define OUTER_LOOPS 2000
+
+#define OPTIONS 16
+
+/* Range used by the clamp kernels */
+#define CLAMP_LO -50.0
+#define CLAMP_HI  50.0
+
+typedef float data_t;
+
+/* Number of data_t elements in an AVX vector */
+#define VSIZE 8
+
+/* Create abstract data type for an array in memory */
+typedef struct {
+  long int len;
+  data_t *data;
+} array_rec, *array_ptr;
+
+array_ptr new_array(long int len);
+long int get_array_length(array_ptr v);
+int set_array_length(array_ptr v, long int index);
+int init_array_pred(array_ptr v, long int len);
+int init_array_unpred(array_ptr v, long int len);
+data_t *get_array_start(array_ptr v);
+double fRand(double fMin, double fMax);
+void branch1(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit);
+void branch2(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit);
+void avx_max(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit);
+void avx_min(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit);
+void avx_clamp(array_ptr v0, array_ptr v2, data_t lo, data_t hi,
+                                                    long int outer_limit);
+void avx_select(array_ptr vm, array_ptr v0, array_ptr v1, array_ptr v2,
+                                                    long int outer_limit);
+void avx_abs(array_ptr v0, array_ptr v2, long int outer_limit);
+void avx_sign(array_ptr v0, array_ptr v2, long int outer_limit);
+long int check_kernels(void);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  double wd;
+  long int x, n, alloc_size;
+
+  printf("Branchless select kernels\n");
+
+  printf("Checking AVX kernels against scalar code: %ld mismatches\n",
+                                                           check_kernels());
+
+  wd = wakeup_delay();
+  x = NUM_TESTS-1;
+  alloc_size = A*x*x + B*x + C;
+
+  printf("Testing %d different ways, on arrays of %d sizes from %d to %ld\n",
+    OPTIONS, NUM_TESTS, C, alloc_size);
+
+  /* create array data structures */
+  array_ptr v0 = new_array(alloc_size);
+  array_ptr v1 = new_array(alloc_size);
+  array_ptr v2 = new_array(alloc_size);
+
+  /* Even options use predictable data, odd options unpredictable. The
+     first four repeat the branch1/branch2 runs from test_branch.c so that
+     everything is measured in the same run. abs and sign have no branchy
+     counterpart there, but they go through the same sizes and data. */
+  for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+    if (OPTION % 2 == 0) {
+      init_array_pred(v0, alloc_size);
+      init_array_pred(v1, alloc_size);
+    } else {
+      init_array_unpred(v0, alloc_size);
+      init_array_unpred(v1, alloc_size);
+    }
+    printf("testing option %d\n", OPTION);
+    for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
+      set_array_length(v0, n);
+      set_array_length(v1, n);
+      set_array_length(v2, n);
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      switch(OPTION) {
+        case 0: case 1:   branch1(v0, v1, v2, OUTER_LOOPS);      break;
+        case 2: case 3:   branch2(v0, v1, v2, OUTER_LOOPS);      break;
+        case 4: case 5:   avx_max(v0, v1, v2, OUTER_LOOPS);      break;
+        case 6: case 7:   avx_min(v0, v1, v2, OUTER_LOOPS);      break;
+        case 8: case 9:   avx_clamp(v0, v2, CLAMP_LO, CLAMP_HI,
+                                                   OUTER_LOOPS); break;
+        case 10: case 11: avx_select(v1, v0, v1, v2, OUTER_LOOPS); break;
+        case 12: case 13: avx_abs(v0, v2, OUTER_LOOPS);          break;
+        case 14: case 15: avx_sign(v0, v2, OUTER_LOOPS);         break;
+        default: break;
+      }
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop);
+    }
+  }
+
+  /* output times */
+  printf("\n");
+  printf("size, pred.branch1, unpred.branch1, pred.branch2, unpred.branch2, "
+         "pred.max, unpred.max, pred.min, unpred.min, "
+         "pred.clamp, unpred.clamp, pred.select, unpred.select, "
+         "pred.abs, unpred.abs, pred.sign, unpred.sign\n");
+  {
+    int i, j;
+    for (i = 0; i < x; i++) {
+      printf("%ld,  ", (long)((A*i*i + B*i + C) * OUTER_LOOPS));
+      for (j = 0; j < OPTIONS; j++) {
+        if (j != 0) {
+          printf(", ");
+        }
+        printf("%ld", (long int) ((double)(CPNS) * 1.0e9 * time_stamp[j][i]));
+      }
+      printf("\n");
+    }
+  }
+
+  printf("\n");
+  printf("Wakeup delay calculated %f\n", wd);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+/* Create a memory array of a specified length */
+array_ptr new_array(long int len)
+{
+  /* Allocate and declare header structure */
+  array_ptr result = (array_ptr) malloc(sizeof(array_rec));
+  if (!result) return NULL;  /* Couldn't allocate storage */
+  result->len = len;
+
+  /* Allocate and declare array */
+  if (len > 0) {
+    data_t *data = (data_t *) arena_calloc(default_arena(), len, sizeof(data_t));
+    if (!data) {
+      free((void *) result);
+      return NULL;  /* Couldn't allocate storage */
+    }
+    result->data = data;
+  } else {
+    result->data = NULL;
+  }
+
+  return result;
+}
+
+/* Return length of an array */
+long int get_array_length(array_ptr v)
+{
+  return v->len;
+}
+
+/* Set length of an array. This does NOT change the amount of memory
+   allocated, it just changes the field that controls how much data is
+   accessed when doing one of the tests. */
+int set_array_length(array_ptr v, long int index)
+{
+  v->len = index;
+  return 1;
+}
+
+/* initialize an array with a "predictable" pattern */
+int init_array_pred(array_ptr v, long int len)
+{
+  long int i;
+
+  if (len > 0) {
+    v->len = len;
+    for (i = 0; i < len; i++) {
+      v->data[i] = (data_t)(i % 100);
+    }
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+/* initialize an array with an "unpredictable" pattern */
+int init_array_unpred(array_ptr v, long int len)
+{
+  long int i;
+
+  if (len > 0) {
+    v->len = len;
+    for (i = 0; i < len; i++) {
+     v->data[i] = (data_t) fRand(0.0, 100.0) * (i % 2 == 0 ? 1 : -1);
+    }
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+data_t *get_array_start(array_ptr v)
+{
+  return v->data;
+}
+
+/* Returns a random number in the range [fMin, fMax) */
+double fRand(double fMin, double fMax)
+{
+  double f = (double)random() / RAND_MAX;
+  return fMin + f * (fMax - fMin);
+}
+
+/* Run every AVX kernel once on a length that is not a multiple of VSIZE
+   and compare against the obvious scalar code. Returns the number of
+   elements that disagree (should be 0). */
+long int check_kernels(void)
+{
+  long int i, len = 8*VSIZE + 5;
+  long int bad = 0;
+  array_ptr v0 = new_array(len);
+  array_ptr v1 = new_array(len);
+  array_ptr v2 = new_array(len);
+  data_t *d0 = get_array_start(v0);
+  data_t *d1 = get_array_start(v1);
+  data_t *d2 = get_array_start(v2);
+
+  init_array_unpred(v0, len);
+  init_array_unpred(v1, len);
+  d0[3] = 0.0;   /* make sure sign() sees a zero */
+
+  avx_max(v0, v1, v2, 1);
+  for (i = 0; i < len; i++) bad += (d2[i] != (d0[i] > d1[i] ? d0[i] : d1[i]));
+  avx_min(v0, v1, v2, 1);
+  for (i = 0; i < len; i++) bad += (d2[i] != (d0[i] < d1[i] ? d0[i] : d1[i]));
+  avx_clamp(v0, v2, CLAMP_LO, CLAMP_HI, 1);
+  for (i = 0; i < len; i++) {
+    data_t t = d0[i] < CLAMP_LO ? CLAMP_LO : d0[i];
+    bad += (d2[i] != (t > CLAMP_HI ? CLAMP_HI : t));
+  }
+  avx_select(v1, v0, v1, v2, 1);
+  for (i = 0; i < len; i++) bad += (d2[i] != (d1[i] > 0 ? d0[i] : d1[i]));
+  avx_abs(v0, v2, 1);
+  for (i = 0; i < len; i++) bad += (d2[i] != fabsf(d0[i]));
+  avx_sign(v0, v2, 1);
+  for (i = 0; i < len; i++) {
+    bad += (d2[i] != (data_t)((d0[i] > 0) - (d0[i] < 0)));
+  }
+
+  return bad;
+}
+
+/*************************************************/
+/* branch1:  test branch, based on example in B&O 5.11
+ * For each element i in arrays v0 and v1, write the
+ * larger into element i of v2. */
+void branch1(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data1 = get_array_start(v1);
+  data_t *data2 = get_array_start(v2);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i < length; i++) {
+      if (data0[i] > data1[i]) {
+        data2[i] = data0[i];
+      } else {
+        data2[i] = data1[i];
+      }
+    }
+  }
+}
+
+/*************************************************/
+/* branch2:  test branch, based on example in B&O 5.11
+ * For each element i in arrays v0 and v1, write the
+ * larger into element i of v2. */
+void branch2(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data1 = get_array_start(v1);
+  data_t *data2 = get_array_start(v2);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i < length; i++) {
+      data2[i] = (data0[i] > data1[i]) ? data0[i] : data1[i];
+    }
+  }
+}
+
+/*************************************************/
+/* The AVX kernels below all follow the same pattern: 8 lanes at a time
+   with unaligned loads/stores (new_array() data is 64-byte aligned from
+   the arena, but the kernels don't rely on it), then the leftover 0..7
+   elements with the equivalent scalar conditional move. */
+
+/* avx_max:  same result as branch1/branch2, v2[i] = max(v0[i], v1[i]).
+   The compare gives all-ones in lanes where v0 > v1, and blendv takes
+   those lanes from v0 and the rest from v1. */
+void avx_max(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data1 = get_array_start(v1);
+  data_t *data2 = get_array_start(v2);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i + VSIZE <= length; i += VSIZE) {
+      __m256 a = _mm256_loadu_ps(&data0[i]);
+      __m256 b = _mm256_loadu_ps(&data1[i]);
+      __m256 m = _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+      _mm256_storeu_ps(&data2[i], _mm256_blendv_ps(b, a, m));
+    }
+    for (; i < length; i++) {
+      data2[i] = (data0[i] > data1[i]) ? data0[i] : data1[i];
+    }
+  }
+}
+
+/* avx_min:  v2[i] = min(v0[i], v1[i]) */
+void avx_min(array_ptr v0, array_ptr v1, array_ptr v2, long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data1 = get_array_start(v1);
+  data_t *data2 = get_array_start(v2);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i + VSIZE <= length; i += VSIZE) {
+      __m256 a = _mm256_loadu_ps(&data0[i]);
+      __m256 b = _mm256_loadu_ps(&data1[i]);
+      __m256 m = _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+      _mm256_storeu_ps(&data2[i], _mm256_blendv_ps(b, a, m));
+    }
+    for (; i < length; i++) {
+      data2[i] = (data0[i] < data1[i]) ? data0[i] : data1[i];
+    }
+  }
+}
+
+/* avx_clamp:  v2[i] = v0[i] limited to the range [lo, hi]. Two
+   compare/blend pairs, one for each end of the range. */
+void avx_clamp(array_ptr v0, array_ptr v2, data_t lo, data_t hi,
+                                                    long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data2 = get_array_start(v2);
+  __m256 vlo = _mm256_set1_ps(lo);
+  __m256 vhi = _mm256_set1_ps(hi);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i + VSIZE <= length; i += VSIZE) {
+      __m256 a = _mm256_loadu_ps(&data0[i]);
+      a = _mm256_blendv_ps(a, vlo, _mm256_cmp_ps(a, vlo, _CMP_LT_OQ));
+      a = _mm256_blendv_ps(a, vhi, _mm256_cmp_ps(a, vhi, _CMP_GT_OQ));
+      _mm256_storeu_ps(&data2[i], a);
+    }
+    for (; i < length; i++) {
+      data_t t = (data0[i] < lo) ? lo : data0[i];
+      data2[i] = (t > hi) ? hi : t;
+    }
+  }
+}
+
+/* avx_select:  v2[i] = (vm[i] > 0) ? v0[i] : v1[i]. The mask array vm
+   may be the same array as v0 or v1. */
+void avx_select(array_ptr vm, array_ptr v0, array_ptr v1, array_ptr v2,
+                                                    long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *datam = get_array_start(vm);
+  data_t *data0 = get_array_start(v0);
+  data_t *data1 = get_array_start(v1);
+  data_t *data2 = get_array_start(v2);
+  __m256 zero = _mm256_setzero_ps();
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i + VSIZE <= length; i += VSIZE) {
+      __m256 m = _mm256_cmp_ps(_mm256_loadu_ps(&datam[i]), zero, _CMP_GT_OQ);
+      __m256 a = _mm256_loadu_ps(&data0[i]);
+      __m256 b = _mm256_loadu_ps(&data1[i]);
+      _mm256_storeu_ps(&data2[i], _mm256_blendv_ps(b, a, m));
+    }
+    for (; i < length; i++) {
+      data2[i] = (datam[i] > 0) ? data0[i] : data1[i];
+    }
+  }
+}
+
+/* avx_abs:  v2[i] = |v0[i]|, by clearing the sign bit (no compare needed) */
+void avx_abs(array_ptr v0, array_ptr v2, long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data2 = get_array_start(v2);
+  __m256 sign_bit = _mm256_set1_ps(-0.0f);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i + VSIZE <= length; i += VSIZE) {
+      __m256 a = _mm256_loadu_ps(&data0[i]);
+      _mm256_storeu_ps(&data2[i], _mm256_andnot_ps(sign_bit, a));
+    }
+    for (; i < length; i++) {
+      data2[i] = fabsf(data0[i]);
+    }
+  }
+}
+
+/* avx_sign:  v2[i] = -1, 0 or +1 according to the sign of v0[i]. Start
+   from zero and blend in +1 and -1 under the two compare masks. */
+void avx_sign(array_ptr v0, array_ptr v2, long int outer_limit)
+{
+  long int i, j;
+  long int length = get_array_length(v0);
+  data_t *data0 = get_array_start(v0);
+  data_t *data2 = get_array_start(v2);
+  __m256 zero = _mm256_setzero_ps();
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 minus_one = _mm256_set1_ps(-1.0f);
+
+  for(j=0; j<outer_limit; j++) {
+    for (i = 0; i + VSIZE <= length; i += VSIZE) {
+      __m256 a = _mm256_loadu_ps(&data0[i]);
+      __m256 r = _mm256_blendv_ps(zero, one, _mm256_cmp_ps(a, zero, _CMP_GT_OQ));
+      r = _mm256_blendv_ps(r, minus_one, _mm256_cmp_ps(a, zero, _CMP_LT_OQ));
+      _mm256_storeu_ps(&data2[i], r);
+    }
+    for (; i < length; i++) {
+      data2[i] = (data_t)((data0[i] > 0) - (data0[i] < 0));
+    }
+  }
+}
@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <math.h>
+#include "arena.h"
 
 /* We want to test a range of work sizes. We will generate these
    using the quadratic formula:  A x^2 + B x + C                     */
@@ -274,7 +275,7 @@ array_ptr new_array(long int len)
 
   /* Allocate and declare array */
   if (len > 0) {
-    data_t *data = (data_t *) calloc(len, sizeof(data_t));
+    data_t *data = (data_t *) arena_calloc(default_arena(), len, sizeof(data_t));
     if (!data) {
       free((void *) result);
       return NULL;  /* Couldn't allocate storage */
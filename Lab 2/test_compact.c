@@ -0,0 +1,437 @@
+/***************************************************************************
+
+  gcc -O1 -mavx2 -mpopcnt -pthread test_compact.c -lpthread -lm -lrt -o test_compact
+
+  Add -mavx512f to also build the AVX-512 vcompress version, e.g.
+
+  gcc -O1 -mavx2 -mavx512f -mpopcnt -pthread test_compact.c -lpthread -lm -lrt -o test_compact
+
+  Stream compaction: keep a[i] wherever a[i] > b[i]. This is branch1 from
+  test_branch.c with a variable output index, so the scalar version pays
+  for both the mispredicts and the k++ dependency. The vector versions
+  compute 8 (or 16) comparisons at once and left-pack the kept elements.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GHz GPU, this would be 3.2 */
+
+#define ARR_LEN (1024*1024)
+
+#define OUTER_LOOPS 20
+
+/* Fractions of elements kept, for the selectivity sweep */
+#define NUM_TESTS 9
+double SELECTIVITY[NUM_TESTS] = {0.0, 0.05, 0.1, 0.25, 0.5, 0.75, 0.9, 0.95, 1.0};
+
+#define OPTIONS 5
+
+typedef float data_t;
+
+/* Number of data_t elements in an AVX vector */
+#define VSIZE 8
+
+int NUM_THREADS = 4;
+
+/* used to pass parameters to worker threads */
+struct thread_data{
+  int thread_id;
+  data_t *a;
+  data_t *b;
+  data_t *out;
+  long int low, high;     /* range of input handled by this thread */
+  long int count;         /* number of elements kept in that range */
+  long int offset;        /* where this thread's output starts */
+};
+
+/* Left-pack permutation table for the AVX2 version: entry m lists the
+   lanes whose bit is set in the 8-bit mask m, lowest first. */
+int perm_table[256][VSIZE];
+
+void build_perm_table(void);
+double fRand(double fMin, double fMax);
+void init_compact(data_t *a, data_t *b, long int n, double selectivity);
+long int compact_branchy(data_t *a, data_t *b, data_t *out, long int n);
+long int compact_scalar(data_t *a, data_t *b, data_t *out, long int n);
+long int count_avx2(data_t *a, data_t *b, long int n);
+long int compact_avx2(data_t *a, data_t *b, data_t *out, long int n,
+                                                             long int cap);
+long int compact_avx512(data_t *a, data_t *b, data_t *out, long int n);
+long int compact_pthr(data_t *a, data_t *b, data_t *out, long int n);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  long int kept[OPTIONS][NUM_TESTS];
+  long int x, i, j, k, errors = 0;
+  double wd;
+  data_t *a, *b, *out, *ref;
+
+  printf("Stream compaction (keep a[i] where a[i] > b[i])\n");
+#ifndef __AVX512F__
+  printf("Built without -mavx512f, the avx512 column will be -1\n");
+#endif
+
+  wd = wakeup_delay();
+  build_perm_table();
+
+  a = (data_t *) malloc(ARR_LEN * sizeof(data_t));
+  b = (data_t *) malloc(ARR_LEN * sizeof(data_t));
+  out = (data_t *) malloc(ARR_LEN * sizeof(data_t));
+  ref = (data_t *) malloc(ARR_LEN * sizeof(data_t));
+  if (!a || !b || !out || !ref) {
+    fprintf(stderr, "COULDN'T ALLOCATE %ld BYTES STORAGE\n",
+                                   4L * ARR_LEN * (long)sizeof(data_t));
+    exit(-1);
+  }
+
+  for (x = 0; x < NUM_TESTS; x++) {
+    init_compact(a, b, ARR_LEN, SELECTIVITY[x]);
+    k = compact_branchy(a, b, ref, ARR_LEN);
+    for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      for (j = 0; j < OUTER_LOOPS; j++) {
+        switch(OPTION) {
+          case 0: kept[OPTION][x] = compact_branchy(a, b, out, ARR_LEN); break;
+          case 1: kept[OPTION][x] = compact_scalar(a, b, out, ARR_LEN); break;
+          case 2: kept[OPTION][x] = compact_avx2(a, b, out, ARR_LEN,
+                                                           ARR_LEN);  break;
+          case 3: kept[OPTION][x] = compact_avx512(a, b, out, ARR_LEN); break;
+          case 4: kept[OPTION][x] = compact_pthr(a, b, out, ARR_LEN);   break;
+          default: break;
+        }
+      }
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop);
+
+      /* every version must produce exactly what the branchy one did */
+      if (kept[OPTION][x] >= 0) {
+        if (kept[OPTION][x] != k) errors++;
+        for (i = 0; i < k && kept[OPTION][x] == k; i++) {
+          if (out[i] != ref[i]) { errors++; break; }
+        }
+      }
+    }
+    printf("  selectivity %g done\r", SELECTIVITY[x]); fflush(stdout);
+  }
+
+  /* output cycles per input element */
+  printf("\n");
+  printf("All times are in cycles per element (if CPNS is set correctly)\n");
+  printf("selectivity, kept, branchy, scalar, avx2, avx512, avx2 %d threads\n",
+                                                               NUM_THREADS);
+  for (x = 0; x < NUM_TESTS; x++) {
+    printf("%5.2f, %8ld", SELECTIVITY[x], kept[0][x]);
+    for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+      if (kept[OPTION][x] < 0) {
+        printf(", %7d", -1);
+      } else {
+        printf(", %7.3f", (double)(CPNS) * 1.0e9 * time_stamp[OPTION][x]
+                                    / ((double)ARR_LEN * OUTER_LOOPS));
+      }
+    }
+    printf("\n");
+  }
+
+  printf("\n");
+  printf("%ld results differed from compact_branchy()\n", errors);
+  printf("Wakeup delay calculated %f\n", wd);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+/* Build perm_table: for each 8-bit mask, the indices of the set bits in
+   increasing order, padded with 0 (the padding lanes are don't-care) */
+void build_perm_table(void)
+{
+  int m, lane, k;
+
+  for (m = 0; m < 256; m++) {
+    k = 0;
+    for (lane = 0; lane < VSIZE; lane++) {
+      if (m & (1 << lane)) perm_table[m][k++] = lane;
+    }
+    while (k < VSIZE) perm_table[m][k++] = 0;
+  }
+}
+
+/* Returns a random number in the range [fMin, fMax) */
+double fRand(double fMin, double fMax)
+{
+  double f = (double)random() / RAND_MAX;
+  return fMin + f * (fMax - fMin);
+}
+
+/* a[] is uniform random in [0, 100) and b[] is a constant threshold, so
+   (a[i] > b[i]) is true for about "selectivity" of the elements, in random
+   order (the worst case for the branch predictor) */
+void init_compact(data_t *a, data_t *b, long int n, double selectivity)
+{
+  long int i;
+
+  srandom(n);
+  for (i = 0; i < n; i++) {
+    a[i] = (data_t) fRand(0.0, 100.0);
+    b[i] = (data_t) (100.0 * (1.0 - selectivity));
+  }
+}
+
+/*************************************************/
+/* compact_branchy:  the obvious loop; returns the number of elements kept */
+long int compact_branchy(data_t *a, data_t *b, data_t *out, long int n)
+{
+  long int i, k = 0;
+
+  for (i = 0; i < n; i++) {
+    if (a[i] > b[i]) {
+      out[k++] = a[i];
+    }
+  }
+  return k;
+}
+
+/* compact_scalar:  branch-free scalar version. Always store, but only
+   advance the output index when the element is kept. */
+long int compact_scalar(data_t *a, data_t *b, data_t *out, long int n)
+{
+  long int i, k = 0;
+
+  for (i = 0; i < n; i++) {
+    out[k] = a[i];
+    k += (a[i] > b[i]);
+  }
+  return k;
+}
+
+/* count_avx2:  just count how many elements would be kept */
+long int count_avx2(data_t *a, data_t *b, long int n)
+{
+  long int i, k = 0;
+
+  for (i = 0; i + VSIZE <= n; i += VSIZE) {
+    __m256 m = _mm256_cmp_ps(_mm256_loadu_ps(&a[i]), _mm256_loadu_ps(&b[i]),
+                                                              _CMP_GT_OQ);
+    k += _mm_popcnt_u32(_mm256_movemask_ps(m));
+  }
+  for (; i < n; i++) {
+    k += (a[i] > b[i]);
+  }
+  return k;
+}
+
+/* compact_avx2:  compare 8 lanes, turn the result into an 8-bit mask,
+   look up the left-pack permutation for that mask and store all 8 lanes
+   at out[k]. Only the first popcount(mask) lanes are meaningful; the rest
+   are overwritten by the next store. "cap" is the size of the output
+   region: near the end of it we switch to a masked store so that we never
+   write past out[cap-1] (this matters when several threads fill adjacent
+   regions of one array). */
+long int compact_avx2(data_t *a, data_t *b, data_t *out, long int n,
+                                                             long int cap)
+{
+  long int i, k = 0;
+  int mask, cnt;
+
+  for (i = 0; i + VSIZE <= n; i += VSIZE) {
+    __m256 va = _mm256_loadu_ps(&a[i]);
+    __m256 m = _mm256_cmp_ps(va, _mm256_loadu_ps(&b[i]), _CMP_GT_OQ);
+    mask = _mm256_movemask_ps(m);
+    cnt = _mm_popcnt_u32(mask);
+    __m256i perm = _mm256_loadu_si256((__m256i *) perm_table[mask]);
+    __m256 packed = _mm256_permutevar8x32_ps(va, perm);
+    if (k + VSIZE <= cap) {
+      _mm256_storeu_ps(&out[k], packed);
+    } else {
+      /* lanes 0..cnt-1 on, the rest off */
+      __m256i keep = _mm256_cmpgt_epi32(_mm256_set1_epi32(cnt),
+                              _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+      _mm256_maskstore_ps(&out[k], keep, packed);
+    }
+    k += cnt;
+  }
+  for (; i < n; i++) {
+    if (k < cap) out[k] = a[i];
+    k += (a[i] > b[i]);
+  }
+  return k;
+}
+
+/* compact_avx512:  AVX-512 has a compress-store instruction (vcompressps)
+   that does the left-pack and writes only the selected lanes, so it needs
+   neither the table nor the capacity check. Returns -1 if not built with
+   AVX-512 support. */
+long int compact_avx512(data_t *a, data_t *b, data_t *out, long int n)
+{
+#ifdef __AVX512F__
+  long int i, k = 0;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m512 va = _mm512_loadu_ps(&a[i]);
+    __mmask16 m = _mm512_cmp_ps_mask(va, _mm512_loadu_ps(&b[i]), _CMP_GT_OQ);
+    _mm512_mask_compressstoreu_ps(&out[k], m, va);
+    k += _mm_popcnt_u32((unsigned int) m);
+  }
+  for (; i < n; i++) {
+    if (a[i] > b[i]) out[k++] = a[i];
+  }
+  return k;
+#else
+  (void) a; (void) b; (void) out; (void) n;
+  return -1;
+#endif /* __AVX512F__ */
+}
+
+/***************************************************************************/
+/* Multithreaded compaction. Each thread owns a contiguous slice of the
+   input. Phase 1: every thread counts its kept elements. An exclusive
+   prefix sum of the counts gives each thread the offset of its output.
+   Phase 2: every thread compacts its slice into out[offset ...]. The
+   output order is the same as the serial version.                      */
+void *count_work(void *threadarg)
+{
+  struct thread_data *my_data = (struct thread_data *) threadarg;
+
+  my_data->count = count_avx2(&my_data->a[my_data->low],
+                              &my_data->b[my_data->low],
+                              my_data->high - my_data->low);
+  pthread_exit(NULL);
+}
+
+void *compact_work(void *threadarg)
+{
+  struct thread_data *my_data = (struct thread_data *) threadarg;
+
+  compact_avx2(&my_data->a[my_data->low], &my_data->b[my_data->low],
+               &my_data->out[my_data->offset],
+               my_data->high - my_data->low, my_data->count);
+  pthread_exit(NULL);
+}
+
+/* Now, the pthread calling function */
+long int compact_pthr(data_t *a, data_t *b, data_t *out, long int n)
+{
+  pthread_t threads[NUM_THREADS];
+  struct thread_data thread_data_array[NUM_THREADS];
+  int rc;
+  long t, total;
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    thread_data_array[t].thread_id = t;
+    thread_data_array[t].a = a;
+    thread_data_array[t].b = b;
+    thread_data_array[t].out = out;
+    thread_data_array[t].low = (t * n)/NUM_THREADS;
+    thread_data_array[t].high = ((t+1) * n)/NUM_THREADS;
+    rc = pthread_create(&threads[t], NULL, count_work,
+                        (void*) &thread_data_array[t]);
+    if (rc) {
+      printf("ERROR; return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+  for (t = 0; t < NUM_THREADS; t++) {
+    if (pthread_join(threads[t], NULL)) {
+      printf("ERROR; code on return from join is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  /* exclusive prefix sum of the per-thread counts */
+  total = 0;
+  for (t = 0; t < NUM_THREADS; t++) {
+    thread_data_array[t].offset = total;
+    total += thread_data_array[t].count;
+  }
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    rc = pthread_create(&threads[t], NULL, compact_work,
+                        (void*) &thread_data_array[t]);
+    if (rc) {
+      printf("ERROR; return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+  for (t = 0; t < NUM_THREADS; t++) {
+    if (pthread_join(threads[t], NULL)) {
+      printf("ERROR; code on return from join is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  return total;
+}
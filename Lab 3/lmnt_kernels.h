@@ -0,0 +1,179 @@
+/* lmnt_kernels.h -- tail-safe, alignment-agnostic AVX elementwise kernels
+
+   Generates float kernels of the form r[i] = f(a[i], b[i], ...) that work
+   for any length and any alignment. The body of a kernel is written once,
+   as an expression on __m256 vectors named va, vb (and vc), e.g.
+
+     LMNT_MAP2(lmnt_distance,
+               _mm256_add_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(va, va),
+                                                          _mm256_mul_ps(vb, vb))),
+                             _mm256_set1_ps(0.5f)))
+
+   The whole expression stays in registers, so a chain of elementwise ops
+   written as one kernel is one pass over memory instead of one pass (and
+   one temporary array) per op.
+
+   Every generated kernel runs in three parts:
+     head - masked load/store of up to 7 elements, until r is 32-byte aligned
+     body - full 8-wide vectors; aligned loads and stores when all pointers
+            are aligned at that point, loadu/storeu otherwise
+     tail - masked load/store of the last 0..7 elements
+   Masked-off lanes are read as 0 and never written, so nothing outside
+   [0, n) is touched, whatever n and the pointer alignments are.
+
+   Needs AVX (-mavx) for _mm256_maskload_ps/_mm256_maskstore_ps. data_t
+   must be float.
+ */
+
+#ifndef _LMNT_KERNELS_H_
+#define _LMNT_KERNELS_H_
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#define LMNT_VSIZE 8    /* floats per __m256 */
+
+#define LMNT_ALIGNED(p) ((((uintptr_t)(p)) & 31) == 0)
+
+/* 8 ones followed by 8 zeros; an unaligned load at &tab[8-k] gives a mask
+   with the first k lanes set */
+static const int lmnt_mask_tab[2*LMNT_VSIZE] = {
+  -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* mask with the first k (0..8) lanes set */
+static inline __m256i lmnt_mask(long int k)
+{
+  return _mm256_loadu_si256((const __m256i *) &lmnt_mask_tab[LMNT_VSIZE - k]);
+}
+
+/* number of elements before p is 32-byte aligned, at most n. If p is not
+   even float aligned we don't peel at all and the body runs unaligned. */
+static inline long int lmnt_head(const float *p, long int n)
+{
+  uintptr_t off = ((uintptr_t) p) & 31;
+  long int h;
+
+  if (off & 3) return 0;
+  h = (long int)(((32 - off) & 31) / sizeof(float));
+  return (h < n) ? h : n;
+}
+
+/* horizontal sum of the 8 lanes */
+static inline float lmnt_hsum(__m256 v)
+{
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+
+/* r[i] = VEXPR(va = a[i], vb = b[i]), i = 0..n-1 */
+#define LMNT_MAP2(name, VEXPR)                                            \
+void name(const data_t *pa, const data_t *pb, data_t *pr, long int n)   \
+{                                                                         \
+  long int i = lmnt_head(pr, n);                                          \
+  __m256 va, vb;                                                          \
+  __m256i m;                                                              \
+                                                                          \
+  if (i > 0) {                                                            \
+    m = lmnt_mask(i);                                                     \
+    va = _mm256_maskload_ps(pa, m);                                       \
+    vb = _mm256_maskload_ps(pb, m);                                       \
+    _mm256_maskstore_ps(pr, m, (VEXPR));                                  \
+  }                                                                       \
+  if (LMNT_ALIGNED(pa + i) && LMNT_ALIGNED(pb + i) && LMNT_ALIGNED(pr + i)) { \
+    for (; i + LMNT_VSIZE <= n; i += LMNT_VSIZE) {                        \
+      va = _mm256_load_ps(pa + i);                                        \
+      vb = _mm256_load_ps(pb + i);                                        \
+      _mm256_store_ps(pr + i, (VEXPR));                                   \
+    }                                                                     \
+  }                                                                       \
+  else {                                                                  \
+    for (; i + LMNT_VSIZE <= n; i += LMNT_VSIZE) {                        \
+      va = _mm256_loadu_ps(pa + i);                                       \
+      vb = _mm256_loadu_ps(pb + i);                                       \
+      _mm256_storeu_ps(pr + i, (VEXPR));                                  \
+    }                                                                     \
+  }                                                                       \
+  if (i < n) {                                                            \
+    m = lmnt_mask(n - i);                                                 \
+    va = _mm256_maskload_ps(pa + i, m);                                   \
+    vb = _mm256_maskload_ps(pb + i, m);                                   \
+    _mm256_maskstore_ps(pr + i, m, (VEXPR));                              \
+  }                                                                       \
+}
+
+/* r[i] = VEXPR(va = a[i], vb = b[i], vc = c[i]), i = 0..n-1 */
+#define LMNT_MAP3(name, VEXPR)                                            \
+void name(const data_t *pa, const data_t *pb, const data_t *pc,         \
+          data_t *pr, long int n)                                         \
+{                                                                         \
+  long int i = lmnt_head(pr, n);                                          \
+  __m256 va, vb, vc;                                                      \
+  __m256i m;                                                              \
+                                                                          \
+  if (i > 0) {                                                            \
+    m = lmnt_mask(i);                                                     \
+    va = _mm256_maskload_ps(pa, m);                                       \
+    vb = _mm256_maskload_ps(pb, m);                                       \
+    vc = _mm256_maskload_ps(pc, m);                                       \
+    _mm256_maskstore_ps(pr, m, (VEXPR));                                  \
+  }                                                                       \
+  if (LMNT_ALIGNED(pa + i) && LMNT_ALIGNED(pb + i) &&                     \
+      LMNT_ALIGNED(pc + i) && LMNT_ALIGNED(pr + i)) {                     \
+    for (; i + LMNT_VSIZE <= n; i += LMNT_VSIZE) {                        \
+      va = _mm256_load_ps(pa + i);                                        \
+      vb = _mm256_load_ps(pb + i);                                        \
+      vc = _mm256_load_ps(pc + i);                                        \
+      _mm256_store_ps(pr + i, (VEXPR));                                   \
+    }                                                                     \
+  }                                                                       \
+  else {                                                                  \
+    for (; i + LMNT_VSIZE <= n; i += LMNT_VSIZE) {                        \
+      va = _mm256_loadu_ps(pa + i);                                       \
+      vb = _mm256_loadu_ps(pb + i);                                       \
+      vc = _mm256_loadu_ps(pc + i);                                       \
+      _mm256_storeu_ps(pr + i, (VEXPR));                                  \
+    }                                                                     \
+  }                                                                       \
+  if (i < n) {                                                            \
+    m = lmnt_mask(n - i);                                                 \
+    va = _mm256_maskload_ps(pa + i, m);                                   \
+    vb = _mm256_maskload_ps(pb + i, m);                                   \
+    vc = _mm256_maskload_ps(pc + i, m);                                   \
+    _mm256_maskstore_ps(pr + i, m, (VEXPR));                              \
+  }                                                                       \
+}
+
+/* returns the sum over i of VEXPR(va = a[i], vb = b[i]). Two accumulators
+   hide the add latency; masked-off lanes are zeroed after VEXPR so that
+   expressions which aren't 0 at 0 still reduce correctly. */
+#define LMNT_REDUCE2(name, VEXPR)                                         \
+data_t name(const data_t *pa, const data_t *pb, long int n)              \
+{                                                                         \
+  long int i = 0;                                                         \
+  __m256 va, vb;                                                          \
+  __m256 acc0 = _mm256_setzero_ps();                                      \
+  __m256 acc1 = _mm256_setzero_ps();                                      \
+  __m256i m;                                                              \
+                                                                          \
+  for (; i + 2*LMNT_VSIZE <= n; i += 2*LMNT_VSIZE) {                      \
+    va = _mm256_loadu_ps(pa + i);                                         \
+    vb = _mm256_loadu_ps(pb + i);                                         \
+    acc0 = _mm256_add_ps(acc0, (VEXPR));                                  \
+    va = _mm256_loadu_ps(pa + i + LMNT_VSIZE);                            \
+    vb = _mm256_loadu_ps(pb + i + LMNT_VSIZE);                            \
+    acc1 = _mm256_add_ps(acc1, (VEXPR));                                  \
+  }                                                                       \
+  for (; i < n; i += LMNT_VSIZE) {                                        \
+    m = lmnt_mask((n - i < LMNT_VSIZE) ? n - i : LMNT_VSIZE);             \
+    va = _mm256_maskload_ps(pa + i, m);                                   \
+    vb = _mm256_maskload_ps(pb + i, m);                                   \
+    acc0 = _mm256_add_ps(acc0,                                            \
+                         _mm256_and_ps((VEXPR), _mm256_castsi256_ps(m))); \
+  }                                                                       \
+  return lmnt_hsum(_mm256_add_ps(acc0, acc1));                            \
+}
+
+#endif /* _LMNT_KERNELS_H_ */
@@ -4,6 +4,9 @@ You must use -O0 for this program to work as intended
 
    gcc -O0 -std=gnu99 test_align.c -lrt -o test_align
 
+   See test_align_suite.c for vector, page-split, store-forwarding and
+   false sharing measurements.
+
  */
 
 #include <stdio.h>
@@ -143,12 +146,23 @@ int main(int argc, char *argv[])
      cache misses! */
   OPTION++;
   temp = (char*)(x2); // reset temp,
+  /* touch the whole array once so page faults aren't counted against k=0 */
+  for (long i = 0; i < ARR_SIZE + BOUNDARY_ALIGNMENT; i++) {
+    x2[i] = 0.0;
+  }
   for (int k = 0; k < BOUNDARY_ALIGNMENT; k++) { 
     x3 = (double*)(temp+k);                  
     gettimeofday(&tv_start, 0);
     for (int j=0; j<OUTER_LOOPS; j++) {
 
-      /* NEW CODE GOES HERE */
+      /* One double per cache block, walking forward through the whole
+         array (OUTER_LOOPS*TEST_SIZE blocks = 64 MB), so every fetch is a
+         miss. temp is block aligned, so for k > 56 each double straddles
+         two blocks and needs both of them. */
+      double *x4 = x3 + (long)j * TEST_SIZE * (BOUNDARY_ALIGNMENT/sizeof(double));
+      for (int i = 0; i < TEST_SIZE; i++) {
+        x4[i * (BOUNDARY_ALIGNMENT/sizeof(double))] += 1.3 + (double)(i);
+      }
 
     }
     gettimeofday(&tv_stop, 0);
@@ -0,0 +1,363 @@
+/*************************************************************
+
+   gcc -O1 -std=gnu99 -mavx2 -pthread test_align_suite.c -lpthread -lrt -o test_align_suite
+
+   Alignment penalties, one experiment per section of the output. Each
+   prints one line per byte offset, in cycles per access (if CPNS is set
+   correctly), so the tables can be compared between machines:
+
+     1. line split   - 8, 16 and 32 byte loads at every byte offset 0..127
+                       from a buffer that stays in L1. Offsets where the
+                       load crosses a 64-byte line cost extra.
+     2. page split   - the same loads at offsets just below and across a
+                       4 KB page boundary (two TLB lookups per load).
+     3. store forwarding - a store followed by a load that overlaps it at
+                       byte distance d. The load gets its data straight from
+                       the store buffer only if it is entirely inside the
+                       store; partial overlap stalls until the store has
+                       gone to L1.
+     4. false sharing - NUM_THREADS threads each incrementing their own
+                       counter, with the counters SPACING bytes apart.
+                       Below 64 bytes they share a line that bounces
+                       between cores.
+
+   Unlike test_align.c this one is compiled with -O1; loads go through
+   pointers the compiler can't see through (volatile, or an empty asm
+   between repetitions) so they aren't removed or hoisted.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GHz GPU, this would be 3.2 */
+
+#define LINE 64               /* cache line size */
+#define PAGE 4096             /* small page size */
+
+#define MAX_OFFSET 128        /* line split: offsets 0 .. MAX_OFFSET-1 */
+#define L1_LINES 64           /* 64 lines = 4 KB, stays in L1 */
+#define LINE_REPS 20000
+
+#define PAGES 32              /* page split: 32 pages = 128 KB, stays in L2 */
+#define PAGE_LOW (PAGE-40)    /* offsets PAGE_LOW .. PAGE_HIGH in each page */
+#define PAGE_HIGH (PAGE+8)
+#define PAGE_REPS 20000
+
+#define SF_ITERS 10000000     /* store forwarding: dependent store/load pairs */
+
+#define FS_ITERS 20000000     /* false sharing: increments per thread */
+#define FS_SPACINGS 6
+
+int NUM_THREADS = 4;
+
+/* Sum of everything line_split() loaded, printed at the end so that the
+   loads can't be optimized away */
+uint64_t load_sum = 0;
+
+/* unaligned integer types, so gcc doesn't assume natural alignment */
+typedef uint64_t u64_una __attribute__((aligned(1), may_alias));
+typedef uint32_t u32_una __attribute__((aligned(1), may_alias));
+
+/* used to pass parameters to worker threads */
+struct thread_data{
+  int thread_id;
+  volatile long int *counter;
+};
+
+double line_split(char *buf, long int off, int width, long int lines,
+                  long int stride, long int reps);
+double store_forward(char *buf, int store_width, int load_width, long int d);
+double false_sharing(char *buf, long int spacing);
+
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (int i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/**************************************************************/
+int main(int argc, char *argv[])
+{
+  char *buf;
+  long int k, d;
+  int w;
+  double wd;
+  const int widths[3] = {8, 16, 32};
+  const long int spacings[FS_SPACINGS] = {8, 16, 32, 64, 128, 256};
+
+  printf("Alignment / line split / page split / store forwarding / "
+         "false sharing suite\n");
+
+  wd = wakeup_delay();
+
+  /* page aligned, big enough for every experiment */
+  if (posix_memalign((void**)&buf, PAGE, (PAGES+2) * PAGE)) {
+    printf("COULDN'T ALLOCATE %d bytes STORAGE\n", (PAGES+2) * PAGE);
+    exit(-1);
+  }
+  memset(buf, 1, (PAGES+2) * PAGE);
+
+  /* 1. line split */
+  printf("\nline split: cycles per load, %d lines in L1\n", L1_LINES);
+  printf("offset, 8 byte, 16 byte, 32 byte\n");
+  for (k = 0; k < MAX_OFFSET; k++) {
+    printf("%4ld", k);
+    for (w = 0; w < 3; w++) {
+      printf(", %6.2f", line_split(buf, k, widths[w], L1_LINES, LINE,
+                                   LINE_REPS));
+    }
+    printf("\n");
+  }
+
+  /* 2. page split */
+  printf("\npage split: cycles per load, offset within each of %d pages\n",
+         PAGES);
+  printf("offset, 8 byte, 16 byte, 32 byte\n");
+  for (k = PAGE_LOW; k <= PAGE_HIGH; k++) {
+    printf("%4ld", k);
+    for (w = 0; w < 3; w++) {
+      printf(", %6.2f", line_split(buf, k, widths[w], PAGES, PAGE,
+                                   PAGE_REPS));
+    }
+    printf("\n");
+  }
+
+  /* 3. store forwarding */
+  printf("\nstore forwarding: cycles per dependent store+load, "
+         "load at byte distance d after the store\n");
+  printf("d, 8B store/8B load, 8B store/4B load, 4B store/8B load, "
+         "32B store/8B load\n");
+  for (d = -8; d <= 32; d++) {
+    printf("%3ld", d);
+    printf(", %6.2f", store_forward(buf, 8, 8, d));
+    printf(", %6.2f", store_forward(buf, 8, 4, d));
+    printf(", %6.2f", store_forward(buf, 4, 8, d));
+    printf(", %6.2f", store_forward(buf, 32, 8, d));
+    printf("\n");
+  }
+
+  /* 4. false sharing */
+  printf("\nfalse sharing: cycles per increment, %d threads\n", NUM_THREADS);
+  printf("spacing, cycles\n");
+  for (k = 0; k < FS_SPACINGS; k++) {
+    printf("%4ld, %6.2f\n", spacings[k], false_sharing(buf, spacings[k]));
+  }
+
+  printf("\n");
+  printf("Line split load sum %lu\n", (unsigned long) load_sum);
+  printf("Wakeup delay calculated %f\n", wd);
+
+  return 0;
+} /* end main */
+
+/**************************************************************/
+/* Load width bytes from buf + off + j*stride, j = 0..lines-1, reps times.
+   The loads are independent (four accumulators, integer adds) so this
+   measures load throughput, which is what a split line costs. Returns
+   cycles per load. */
+double line_split(char *buf, long int off, int width, long int lines,
+                  long int stride, long int reps)
+{
+  struct timespec time_start, time_stop;
+  long int r, j;
+  char *p = buf + off;
+  uint64_t sum;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  if (width == 8) {
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (r = 0; r < reps; r++) {
+      __asm__ volatile("" ::: "memory");
+      for (j = 0; j < lines; j += 4) {
+        s0 += *(u64_una *)(p + (j  )*stride);
+        s1 += *(u64_una *)(p + (j+1)*stride);
+        s2 += *(u64_una *)(p + (j+2)*stride);
+        s3 += *(u64_una *)(p + (j+3)*stride);
+      }
+    }
+    sum = s0 + s1 + s2 + s3;
+  }
+  else if (width == 16) {
+    __m128i s0 = _mm_setzero_si128(), s1 = s0, s2 = s0, s3 = s0;
+    for (r = 0; r < reps; r++) {
+      __asm__ volatile("" ::: "memory");
+      for (j = 0; j < lines; j += 4) {
+        s0 = _mm_add_epi64(s0, _mm_loadu_si128((__m128i *)(p + (j  )*stride)));
+        s1 = _mm_add_epi64(s1, _mm_loadu_si128((__m128i *)(p + (j+1)*stride)));
+        s2 = _mm_add_epi64(s2, _mm_loadu_si128((__m128i *)(p + (j+2)*stride)));
+        s3 = _mm_add_epi64(s3, _mm_loadu_si128((__m128i *)(p + (j+3)*stride)));
+      }
+    }
+    s0 = _mm_add_epi64(_mm_add_epi64(s0, s1), _mm_add_epi64(s2, s3));
+    sum = (uint64_t)_mm_cvtsi128_si64(s0);
+  }
+  else {
+    __m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+    for (r = 0; r < reps; r++) {
+      __asm__ volatile("" ::: "memory");
+      for (j = 0; j < lines; j += 4) {
+        s0 = _mm256_add_epi64(s0, _mm256_loadu_si256((__m256i *)(p + (j  )*stride)));
+        s1 = _mm256_add_epi64(s1, _mm256_loadu_si256((__m256i *)(p + (j+1)*stride)));
+        s2 = _mm256_add_epi64(s2, _mm256_loadu_si256((__m256i *)(p + (j+2)*stride)));
+        s3 = _mm256_add_epi64(s3, _mm256_loadu_si256((__m256i *)(p + (j+3)*stride)));
+      }
+    }
+    s0 = _mm256_add_epi64(_mm256_add_epi64(s0, s1), _mm256_add_epi64(s2, s3));
+    sum = (uint64_t)_mm256_extract_epi64(s0, 0);
+  }
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+  load_sum += sum;
+
+  return CPNS * 1.0e9 * interval(time_start, time_stop) / ((double)reps * lines);
+}
+
+/* Store store_width bytes at buf+64, then load load_width bytes at
+   buf+64+d, and feed the loaded value into the next store so each pair
+   waits for the one before. A forwarded load costs ~5 cycles of latency;
+   a blocked one ~15 or more. Returns cycles per store+load pair. */
+double store_forward(char *buf, int store_width, int load_width, long int d)
+{
+  struct timespec time_start, time_stop;
+  volatile char *base = buf + 64;
+  char *st = (char *) base;
+  char *ld = (char *) base + d;
+  uint64_t v = 1;
+  long int i;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  for (i = 0; i < SF_ITERS; i++) {
+    if (store_width == 8) {
+      *(volatile u64_una *)st = v;
+    }
+    else if (store_width == 4) {
+      *(volatile u32_una *)st = (uint32_t)v;
+    }
+    else {
+      __m256i x = _mm256_set1_epi64x((long long)v);
+      _mm256_storeu_si256((__m256i *)st, x);
+      __asm__ volatile("" ::: "memory");
+    }
+    if (load_width == 8) {
+      v = *(volatile u64_una *)ld + 1;
+    }
+    else {
+      v = *(volatile u32_una *)ld + 1;
+    }
+  }
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+  if (v == 0) printf(" ");   /* keep v live */
+
+  return CPNS * 1.0e9 * interval(time_start, time_stop) / (double)SF_ITERS;
+}
+
+/* false sharing worker: increment this thread's counter FS_ITERS times */
+void *fs_work(void *threadarg)
+{
+  struct thread_data *my_data = (struct thread_data *) threadarg;
+  volatile long int *c = my_data->counter;
+  long int i;
+
+  for (i = 0; i < FS_ITERS; i++) {
+    (*c)++;
+  }
+
+  pthread_exit(NULL);
+}
+
+/* Run NUM_THREADS fs_work() threads on counters spacing bytes apart.
+   Timed with CLOCK_REALTIME (wall clock), since the threads overlap.
+   Returns cycles per increment, per thread. */
+double false_sharing(char *buf, long int spacing)
+{
+  struct timespec time_start, time_stop;
+  pthread_t threads[NUM_THREADS];
+  struct thread_data thread_data_array[NUM_THREADS];
+  int rc;
+  long t;
+
+  clock_gettime(CLOCK_REALTIME, &time_start);
+  for (t = 0; t < NUM_THREADS; t++) {
+    thread_data_array[t].thread_id = t;
+    thread_data_array[t].counter = (volatile long int *)(buf + t*spacing);
+    *thread_data_array[t].counter = 0;
+    rc = pthread_create(&threads[t], NULL, fs_work,
+                        (void*) &thread_data_array[t]);
+    if (rc) {
+      printf("ERROR; return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    if (pthread_join(threads[t],NULL)){
+      printf("ERROR; code on return from join is %d\n", rc);
+      exit(-1);
+    }
+  }
+  clock_gettime(CLOCK_REALTIME, &time_stop);
+
+  return CPNS * 1.0e9 * interval(time_start, time_stop) / (double)FS_ITERS;
+}
@@ -23,6 +23,7 @@ Vector reduction functions:
 #include <xmmintrin.h>
 #include <smmintrin.h>
 #include <immintrin.h>
+#include "arena.h"
 
 #define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
                        for example a 3.2 GHz GPU, this would be 3.2 */
@@ -275,7 +276,7 @@ array_ptr new_array(long int len)
 
   /* Allocate and declare array */
   if (len > 0) {
-    data_t *data = (data_t *) calloc(len + VSIZE, sizeof(data_t));
+    data_t *data = (data_t *) arena_calloc(default_arena(), len + VSIZE, sizeof(data_t));
     if (!data) {
       /* Couldn't allocate storage */
       free((void *) result);
@@ -251,20 +251,19 @@ void SSE_distance(data_t* pArray1,       // [in] 1st source array
   __m128   m1, m2, m3, m4;
   __m128   m0_5 = _mm_set_ps1(0.5f);
 
-  __m128*  pSrc1 = (__m128*) pArray1;
-  __m128*  pSrc2 = (__m128*) pArray2;
-  __m128*  pDest = (__m128*) pResult;
-
+  /* unaligned loads/stores so any pointer works (no slower when it is
+     aligned), and the last nSize%4 elements are done in scalar */
   for (long i = 0; i < nLoop; i++){
-    m1 = _mm_mul_ps(*pSrc1, *pSrc1);
-    m2 = _mm_mul_ps(*pSrc2, *pSrc2);
+    __m128 s1 = _mm_loadu_ps(&pArray1[4*i]);
+    __m128 s2 = _mm_loadu_ps(&pArray2[4*i]);
+    m1 = _mm_mul_ps(s1, s1);
+    m2 = _mm_mul_ps(s2, s2);
     m3 = _mm_add_ps(m1,m2);
     m4 = _mm_sqrt_ps(m3);
-    *pDest = _mm_add_ps(m4,m0_5);
-
-    pSrc1++;
-    pSrc2++;
-    pDest++;
+    _mm_storeu_ps(&pResult[4*i], _mm_add_ps(m4,m0_5));
+  }
+  for (long i = 4*nLoop; i < nSize; i++){
+    pResult[i] = sqrtf(pArray1[i] * pArray1[i] + pArray2[i] * pArray2[i]) + 0.5f;
   }
 }
 
@@ -279,19 +278,19 @@ void AVX_distance(data_t* pArray1,       // [in] 1st source array
   __m256   m1, m2, m3, m4;
   __m256   m0_5 = _mm256_set1_ps(0.5f);
 
-  __m256*  pSrc1 = (__m256*) pArray1;
-  __m256*  pSrc2 = (__m256*) pArray2;
-  __m256*  pDest = (__m256*) pResult;
-
+  /* unaligned loads/stores and a scalar tail, as in SSE_distance(). See
+     lmnt_kernels.h for the masked version that handles both for any
+     elementwise expression. */
   for (long i = 0; i < nLoop; i++){
-    m1 = _mm256_mul_ps(*pSrc1, *pSrc1);
-    m2 = _mm256_mul_ps(*pSrc2, *pSrc2);
+    __m256 s1 = _mm256_loadu_ps(&pArray1[8*i]);
+    __m256 s2 = _mm256_loadu_ps(&pArray2[8*i]);
+    m1 = _mm256_mul_ps(s1, s1);
+    m2 = _mm256_mul_ps(s2, s2);
     m3 = _mm256_add_ps(m1,m2);
     m4 = _mm256_sqrt_ps(m3);
-    *pDest = _mm256_add_ps(m4,m0_5);
-
-    pSrc1++;
-    pSrc2++;
-    pDest++;
+    _mm256_storeu_ps(&pResult[8*i], _mm256_add_ps(m4,m0_5));
+  }
+  for (long i = 8*nLoop; i < nSize; i++){
+    pResult[i] = sqrtf(pArray1[i] * pArray1[i] + pArray2[i] * pArray2[i]) + 0.5f;
   }
 }
@@ -0,0 +1,489 @@
+/*
+  gcc -O3 -std=gnu99 -mavx2 -mfma -pthread test_knn.c -lpthread -lm -lrt -o test_knn
+
+  Brute-force k-nearest-neighbor search: for each of N query points find
+  the K closest of M reference points in DIM dimensions (squared Euclidean
+  distance, same idea as AVX_distance in test_intrinsics.c but summed over
+  all dimensions and for every query/reference pair).
+
+  The AVX version works on the references 8 at a time. They are repacked
+  once into blocks of 8 "structure of arrays" style, so that one coordinate
+  of 8 references is one aligned __m256. For each query we broadcast one
+  coordinate at a time and accumulate (q - r)^2 with FMA, giving 8 distances
+  per vector. The reference set is processed in tiles of REF_TILE points
+  and all queries of a QUERY_TILE go over a tile while it is in cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <immintrin.h>
+#include "arena.h"
+
+/* We want to test a range of reference set sizes. We will generate these
+   using the quadratic formula:  A x^2 + B x + C                     */
+#define A   800  /* coefficient of x^2 */
+#define B   1000  /* coefficient of x */
+#define C   1000  /* constant term */
+
+#define NUM_TESTS 8
+
+#define N_QUERIES 512
+#define DIM 16
+#define K 8
+
+/* Tile sizes, in points. REF_TILE*DIM*4 bytes should fit in L2 */
+#define REF_TILE 1024
+#define QUERY_TILE 64
+
+/* Number of queries checked against the scalar reference */
+#define N_CHECK 16
+
+#define OPTIONS 3
+
+typedef float data_t;
+
+/* Number of data_t elements in an AVX vector */
+#define VSIZE 8
+
+/* Coordinate used for the padding lanes of the last reference block. Its
+   square overflows to +inf, so padding is never one of the K nearest. */
+#define PAD_COORD 1.0e30f
+
+/* Create abstract data type for a set of points, stored one point per row */
+typedef struct {
+  long int npoints;
+  long int dim;
+  data_t *data;
+} points_rec, *points_ptr;
+
+/* Result of a search: for each query, K distances in increasing order and
+   the index of the reference point each belongs to */
+typedef struct {
+  long int nqueries;
+  data_t *dist;
+  long int *idx;
+} knn_rec, *knn_ptr;
+
+int NUM_THREADS = 4;
+
+/* used to pass parameters to worker threads */
+struct thread_data{
+  int thread_id;
+  points_ptr q;
+  data_t *packed;
+  long int m;
+  knn_ptr res;
+};
+
+points_ptr new_points(long int npoints, long int dim);
+int init_points_rand(points_ptr p);
+data_t *pack_refs(points_ptr r, long int m);
+knn_ptr new_knn(long int nqueries);
+void knn_scalar(points_ptr q, points_ptr r, long int m, knn_ptr res,
+                                          long int qlow, long int qhigh);
+void knn_avx(points_ptr q, data_t *packed, long int m, knn_ptr res,
+                                          long int qlow, long int qhigh);
+void knn_pthr(points_ptr q, data_t *packed, long int m, knn_ptr res);
+long int check_knn(knn_ptr res, knn_ptr ref, long int nq);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (int i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/**************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  long int errors[2][NUM_TESTS];   /* avx, avx threads */
+  double wd;
+  long int x, n, alloc_size;
+  data_t *packed;
+
+  printf("Brute-force kNN: %d queries, K=%d, DIM=%d\n", N_QUERIES, K, DIM);
+
+  wd = wakeup_delay();
+
+  x = NUM_TESTS-1;
+  alloc_size = A*x*x + B*x + C;
+
+  points_ptr q0 = new_points(N_QUERIES, DIM);
+  points_ptr r0 = new_points(alloc_size, DIM);
+  init_points_rand(q0);
+  init_points_rand(r0);
+  knn_ptr res = new_knn(N_QUERIES);
+  knn_ptr ref = new_knn(N_QUERIES);
+
+  for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
+    packed = pack_refs(r0, n);
+    for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      switch(OPTION) {
+        case 0: knn_scalar(q0, r0, n, ref, 0, N_QUERIES);       break;
+        case 1: knn_avx(q0, packed, n, res, 0, N_QUERIES);      break;
+        case 2: knn_pthr(q0, packed, n, res);                   break;
+        default: break;
+      }
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop);
+      /* ref holds the scalar result from option 0 */
+      if (OPTION > 0) errors[OPTION-1][x] = check_knn(res, ref, N_CHECK);
+    }
+    free(packed);
+    printf("  M = %ld done\r", n); fflush(stdout);
+  }
+
+  /* output distance evaluations per second */
+  printf("\n");
+  printf("refs, scalar Mdist/s, avx Mdist/s, avx %d threads Mdist/s,"
+         " avx mismatches, threads mismatches\n", NUM_THREADS);
+  {
+    for (int i = 0; i < x; i++) {
+      double evals = (double)N_QUERIES * (double)(A*i*i + B*i + C);
+      printf("%8ld", (long)(A*i*i + B*i + C));
+      for (int j = 0; j < OPTIONS; j++) {
+        printf(", %10.2f", evals / time_stamp[j][i] * 1.0e-6);
+      }
+      printf(", %ld, %ld\n", errors[0][i], errors[1][i]);
+    }
+  }
+
+  printf("\n");
+  printf("Nearest neighbor of query 0 is ref %ld at distance %f\n",
+                                      res->idx[0], sqrtf(res->dist[0]));
+  printf("Wakeup delay calculated %f\n", wd);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+
+/* Create a set of points of the given dimension */
+points_ptr new_points(long int npoints, long int dim)
+{
+  points_ptr result = (points_ptr) malloc(sizeof(points_rec));
+  if (!result) return NULL;  /* Couldn't allocate storage */
+  result->npoints = npoints;
+  result->dim = dim;
+
+  if (npoints > 0) {
+    data_t *data = (data_t *) arena_calloc(default_arena(), npoints*dim,
+                                           sizeof(data_t));
+    if (!data) {
+      free((void *) result);
+      fprintf(stderr, " COULDN'T ALLOCATE %ld BYTES STORAGE \n",
+                                        npoints*dim*(long)sizeof(data_t));
+      exit(-1);
+    }
+    result->data = data;
+  }
+  else result->data = NULL;
+
+  return result;
+}
+
+double fRand(double fMin, double fMax)
+{
+  double f = (double)random() / RAND_MAX;
+  return fMin + f * (fMax - fMin);
+}
+
+/* initialize all coordinates with random values */
+int init_points_rand(points_ptr p)
+{
+  for (long i = 0; i < p->npoints * p->dim; i++) {
+    p->data[i] = (data_t)(fRand((double)(0.0),(double)(10.0)));
+  }
+  return 1;
+}
+
+/* Allocate and initialize a result structure, K slots per query */
+knn_ptr new_knn(long int nqueries)
+{
+  knn_ptr result = (knn_ptr) malloc(sizeof(knn_rec));
+  if (!result) return NULL;  /* Couldn't allocate storage */
+  result->nqueries = nqueries;
+  result->dist = (data_t *) malloc(nqueries * K * sizeof(data_t));
+  result->idx = (long int *) malloc(nqueries * K * sizeof(long int));
+  if (!result->dist || !result->idx) {
+    fprintf(stderr, " COULDN'T ALLOCATE kNN RESULT STORAGE \n");
+    exit(-1);
+  }
+  return result;
+}
+
+/* Repack the first m reference points into blocks of VSIZE points. Block
+   b holds coordinate d of points b*VSIZE .. b*VSIZE+7 at
+   packed[(b*DIM + d)*VSIZE + 0..7]. The last block is padded. */
+data_t *pack_refs(points_ptr r, long int m)
+{
+  long int nblocks = (m + VSIZE - 1) / VSIZE;
+  long int dim = r->dim;
+  data_t *packed;
+
+  if (posix_memalign((void**)&packed, 64,
+                             nblocks * dim * VSIZE * sizeof(data_t))) {
+    fprintf(stderr, " COULDN'T ALLOCATE PACKED REFERENCE STORAGE \n");
+    exit(-1);
+  }
+  for (long b = 0; b < nblocks; b++) {
+    for (long d = 0; d < dim; d++) {
+      for (long lane = 0; lane < VSIZE; lane++) {
+        long p = b*VSIZE + lane;
+        packed[(b*dim + d)*VSIZE + lane] =
+                          (p < m) ? r->data[p*dim + d] : PAD_COORD;
+      }
+    }
+  }
+  return packed;
+}
+
+/* Insert (d, i) into a list of K distances kept in increasing order,
+   dropping the largest. Caller has checked that d < dist[K-1]. */
+static inline void topk_insert(data_t *dist, long int *idx, data_t d, long int i)
+{
+  long int j = K-1;
+
+  while (j > 0 && dist[j-1] > d) {
+    dist[j] = dist[j-1];
+    idx[j] = idx[j-1];
+    j--;
+  }
+  dist[j] = d;
+  idx[j] = i;
+}
+
+static void topk_reset(knn_ptr res, long int qlow, long int qhigh)
+{
+  for (long i = qlow*K; i < qhigh*K; i++) {
+    res->dist[i] = INFINITY;
+    res->idx[i] = -1;
+  }
+}
+
+/* Compare the first nq queries of two results. Distances are computed in
+   a different order by the scalar and vector code, so allow a small
+   relative difference. Returns the number of mismatching entries. */
+long int check_knn(knn_ptr res, knn_ptr ref, long int nq)
+{
+  long int bad = 0;
+
+  for (long i = 0; i < nq*K; i++) {
+    if (fabsf(res->dist[i] - ref->dist[i]) > 1.0e-4f * ref->dist[i]) bad++;
+  }
+  return bad;
+}
+
+/**************************************************************/
+
+/* Simple kNN -- non-vectorised, untiled */
+void knn_scalar(points_ptr q, points_ptr r, long int m, knn_ptr res,
+                                          long int qlow, long int qhigh)
+{
+  long int dim = q->dim;
+
+  topk_reset(res, qlow, qhigh);
+  for (long i = qlow; i < qhigh; i++) {
+    data_t *qi = &q->data[i*dim];
+    data_t *dist = &res->dist[i*K];
+    long int *idx = &res->idx[i*K];
+    for (long j = 0; j < m; j++) {
+      data_t *rj = &r->data[j*dim];
+      data_t sum = 0;
+      for (long d = 0; d < dim; d++) {
+        data_t diff = qi[d] - rj[d];
+        sum += diff * diff;
+      }
+      if (sum < dist[K-1]) topk_insert(dist, idx, sum, j);
+    }
+  }
+}
+
+/* Lanes of acc that beat the current K-th best go into the list. The
+   threshold only gets smaller, so re-check each lane before inserting. */
+static inline void topk_merge8(__m256 acc, long int base, data_t *dist,
+                                                          long int *idx)
+{
+  int mask = _mm256_movemask_ps(_mm256_cmp_ps(acc,
+                            _mm256_set1_ps(dist[K-1]), _CMP_LT_OQ));
+  if (mask) {
+    data_t lanes[VSIZE] __attribute__((aligned(32)));
+    _mm256_store_ps(lanes, acc);
+    while (mask) {
+      int lane = __builtin_ctz(mask);
+      if (lanes[lane] < dist[K-1]) {
+        topk_insert(dist, idx, lanes[lane], base + lane);
+      }
+      mask &= mask - 1;
+    }
+  }
+}
+
+/* Tiled AVX/FMA kNN for queries qlow .. qhigh-1. Four reference blocks
+   (32 references) are done at once so there are four independent FMA
+   chains in flight. */
+void knn_avx(points_ptr q, data_t *packed, long int m, knn_ptr res,
+                                          long int qlow, long int qhigh)
+{
+  long int dim = q->dim;
+  long int nblocks = (m + VSIZE - 1) / VSIZE;
+  long int tile_blocks = REF_TILE / VSIZE;
+
+  topk_reset(res, qlow, qhigh);
+  for (long qq = qlow; qq < qhigh; qq += QUERY_TILE) {
+    long qend = (qq + QUERY_TILE < qhigh) ? qq + QUERY_TILE : qhigh;
+    for (long bb = 0; bb < nblocks; bb += tile_blocks) {
+      long bend = (bb + tile_blocks < nblocks) ? bb + tile_blocks : nblocks;
+      for (long i = qq; i < qend; i++) {
+        data_t *qi = &q->data[i*dim];
+        data_t *dist = &res->dist[i*K];
+        long int *idx = &res->idx[i*K];
+        long b = bb;
+        for (; b + 4 <= bend; b += 4) {
+          data_t *p0 = &packed[b*dim*VSIZE];
+          __m256 acc0 = _mm256_setzero_ps();
+          __m256 acc1 = _mm256_setzero_ps();
+          __m256 acc2 = _mm256_setzero_ps();
+          __m256 acc3 = _mm256_setzero_ps();
+          for (long d = 0; d < dim; d++) {
+            __m256 qd = _mm256_set1_ps(qi[d]);
+            __m256 d0 = _mm256_sub_ps(qd, _mm256_load_ps(&p0[d*VSIZE]));
+            __m256 d1 = _mm256_sub_ps(qd,
+                            _mm256_load_ps(&p0[(dim + d)*VSIZE]));
+            __m256 d2 = _mm256_sub_ps(qd,
+                            _mm256_load_ps(&p0[(2*dim + d)*VSIZE]));
+            __m256 d3 = _mm256_sub_ps(qd,
+                            _mm256_load_ps(&p0[(3*dim + d)*VSIZE]));
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+            acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+            acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+            acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+          }
+          topk_merge8(acc0, b*VSIZE, dist, idx);
+          topk_merge8(acc1, (b+1)*VSIZE, dist, idx);
+          topk_merge8(acc2, (b+2)*VSIZE, dist, idx);
+          topk_merge8(acc3, (b+3)*VSIZE, dist, idx);
+        }
+        for (; b < bend; b++) {
+          data_t *p0 = &packed[b*dim*VSIZE];
+          __m256 acc0 = _mm256_setzero_ps();
+          for (long d = 0; d < dim; d++) {
+            __m256 d0 = _mm256_sub_ps(_mm256_set1_ps(qi[d]),
+                                      _mm256_load_ps(&p0[d*VSIZE]));
+            acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+          }
+          topk_merge8(acc0, b*VSIZE, dist, idx);
+        }
+      }
+    }
+  }
+}
+
+/***************************************************************************/
+/* Multithreaded kNN: every thread gets a contiguous range of queries and
+   runs knn_avx on it. Each query's top-K list belongs to exactly one
+   thread, so no locking is needed.                                    */
+void *knn_work(void *threadarg)
+{
+  struct thread_data *my_data = (struct thread_data *) threadarg;
+  int taskid = my_data->thread_id;
+  long int nq = my_data->q->npoints;
+  long int low = (taskid * nq)/NUM_THREADS;
+  long int high = ((taskid+1) * nq)/NUM_THREADS;
+
+  knn_avx(my_data->q, my_data->packed, my_data->m, my_data->res, low, high);
+  pthread_exit(NULL);
+}
+
+/* Now, the pthread calling function */
+void knn_pthr(points_ptr q, data_t *packed, long int m, knn_ptr res)
+{
+  pthread_t threads[NUM_THREADS];
+  struct thread_data thread_data_array[NUM_THREADS];
+  int rc;
+  long t;
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    thread_data_array[t].thread_id = t;
+    thread_data_array[t].q = q;
+    thread_data_array[t].packed = packed;
+    thread_data_array[t].m = m;
+    thread_data_array[t].res = res;
+    rc = pthread_create(&threads[t], NULL, knn_work,
+                        (void*) &thread_data_array[t]);
+    if (rc) {
+      printf("ERROR; return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    if (pthread_join(threads[t], NULL)) {
+      printf("ERROR; code on return from join is %d\n", rc);
+      exit(-1);
+    }
+  }
+}
@@ -0,0 +1,336 @@
+/*
+  gcc -O1 -std=gnu99 -mavx test_lmnt.c -lm -lrt -o test_lmnt
+
+  Elementwise kernels generated with lmnt_kernels.h. Before timing anything,
+  check_kernels() runs every kernel on all lengths 0..MAX_CHECK_LEN and all
+  pointer offsets 0..7 floats, and checks both the results and that no
+  element past the end of the output was written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <immintrin.h>
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GHz GPU, this would be 3.2 */
+
+/* We want to test a range of work sizes. We will generate these
+   using the quadratic formula:  A x^2 + B x + C                     */
+#define A   120  /* coefficient of x^2 */
+#define B   28  /* coefficient of x */
+#define C   43  /* constant term -- not a multiple of 8, so there's a tail */
+
+#define NUM_TESTS 10
+
+#define OUTER_LOOPS 1000
+
+#define OPTIONS 7
+
+#define MAX_CHECK_LEN 67  /* lengths 0..67 cover every head/body/tail mix */
+#define GUARD 16          /* floats past the end that must stay untouched */
+
+typedef float data_t;
+
+#include "lmnt_kernels.h"
+
+/* Kernels built from lmnt_kernels.h */
+
+/* sqrt(a*a + b*b) + 0.5, same as scalar_distance() */
+LMNT_MAP2(lmnt_distance,
+          _mm256_add_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(va, va),
+                                                     _mm256_mul_ps(vb, vb))),
+                        _mm256_set1_ps(0.5f)))
+
+LMNT_MAP2(lmnt_add_vec, _mm256_add_ps(va, vb))
+
+LMNT_MAP2(lmnt_mult_vec, _mm256_mul_ps(va, vb))
+
+/* (a + b) * c in one pass */
+LMNT_MAP3(lmnt_add_mult, _mm256_mul_ps(_mm256_add_ps(va, vb), vc))
+
+LMNT_REDUCE2(lmnt_dot, _mm256_mul_ps(va, vb))
+
+void InitArray_rand(data_t* pA, long int nSize);
+void ZeroArray(data_t* pA, long int nSize);
+void scalar_distance(data_t* pA1, data_t* pA2, data_t* pR, long int nSize);
+void scalar_add_mult(data_t* pA1, data_t* pA2, data_t* pA3, data_t* pR,
+                     long int nSize);
+double scalar_dot(data_t* pA1, data_t* pA2, long int nSize);
+void unfused_add_mult(data_t* pA1, data_t* pA2, data_t* pA3, data_t* pTmp,
+                      data_t* pR, long int nSize);
+long int check_kernels(void);
+
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (int i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/**************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  data_t*  pArray1;
+  data_t*  pArray2;
+  data_t*  pArray3;
+  data_t*  pTemp;
+  data_t*  pResult;
+  double dot_sum = 0.0;
+  double wd;
+  long int x, n, alloc_size, errors;
+
+  printf("Elementwise kernel framework test\n");
+
+  errors = check_kernels();
+  printf("check_kernels: %ld errors\n", errors);
+  if (errors) return -1;
+
+  wd = wakeup_delay();
+
+  x = NUM_TESTS-1;
+  alloc_size = A*x*x + B*x + C;
+
+  /* one extra vector so the arrays can be used at a 1-float offset */
+  if (posix_memalign((void**)&pArray1, 64, (alloc_size+8)*sizeof(data_t)) ||
+      posix_memalign((void**)&pArray2, 64, (alloc_size+8)*sizeof(data_t)) ||
+      posix_memalign((void**)&pArray3, 64, (alloc_size+8)*sizeof(data_t)) ||
+      posix_memalign((void**)&pTemp, 64, (alloc_size+8)*sizeof(data_t)) ||
+      posix_memalign((void**)&pResult, 64, (alloc_size+8)*sizeof(data_t))) {
+    printf("COULDN'T ALLOCATE %ld BYTES STORAGE\n",
+           5 * (alloc_size+8) * (long) sizeof(data_t));
+    exit(-1);
+  }
+
+  InitArray_rand(pArray1, alloc_size+8);
+  InitArray_rand(pArray2, alloc_size+8);
+  InitArray_rand(pArray3, alloc_size+8);
+  ZeroArray(pTemp, alloc_size+8);
+  ZeroArray(pResult, alloc_size+8);
+
+  for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+    printf("testing option %d\n", OPTION);
+    for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      for (long k=0; k<OUTER_LOOPS; k++) {
+        switch (OPTION) {
+          case 0: scalar_distance(pArray1, pArray2, pResult, n); break;
+          case 1: lmnt_distance(pArray1, pArray2, pResult, n); break;
+          /* every pointer one float off a 32-byte boundary */
+          case 2: lmnt_distance(pArray1+1, pArray2+1, pResult+1, n); break;
+          /* inputs off by one float, output aligned */
+          case 3: lmnt_distance(pArray1+1, pArray2+1, pResult, n); break;
+          case 4: unfused_add_mult(pArray1, pArray2, pArray3, pTemp,
+                                   pResult, n); break;
+          case 5: lmnt_add_mult(pArray1, pArray2, pArray3, pResult, n); break;
+          case 6: dot_sum += lmnt_dot(pArray1+1, pArray2+1, n); break;
+        }
+      }
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop);
+    }
+  }
+
+  /* output times */
+  printf("size, Scalar, dist aligned, dist misaligned, dist mixed, "
+         "add+mult 2 passes, add+mult fused, dot\n");
+  {
+    for (int i = 0; i < x; i++) {
+      printf("%8d, ", (A*i*i + B*i + C) * OUTER_LOOPS);
+      for (int j = 0; j < OPTIONS; j++) {
+        if (j != 0) {
+          printf(", ");
+        }
+        printf("%8ld", (long int)((double)(CPNS) * 1.0e9 * time_stamp[j][i]));
+      }
+      printf("\n");
+    }
+  }
+
+  printf("\n");
+  printf("Sum of dot products: %g\n", dot_sum);
+  printf("Wakeup delay calculated %f\n", wd);
+
+} /* end main */
+
+
+double fRand(double fMin, double fMax)
+{
+  double f = (double)random() / RAND_MAX;
+  return fMin + f * (fMax - fMin);
+}
+
+/* initialize an array with random values */
+void InitArray_rand(data_t* v, long int len)
+{
+  double fRand(double fMin, double fMax);
+
+  for (long i = 0; i < len; i++) {
+    v[i] = (data_t)(fRand((double)(0.0),(double)(10.0)));
+  }
+}
+
+/* initialize an array with 0s */
+void ZeroArray(data_t* v, long int len)
+{
+  for (long i = 0; i < len; i++) {
+    v[i] = (data_t)(0);
+  }
+}
+
+/**************************************************************/
+
+/* Simple distance calc -- non-vectorised version */
+void scalar_distance(data_t* pArray1, data_t* pArray2, data_t* pResult,
+                     long int nSize)
+{
+  for (long i = 0; i < nSize; i++) {
+    pResult[i] = sqrtf(pArray1[i] * pArray1[i] +
+                       pArray2[i] * pArray2[i]) + 0.5f;
+  }
+}
+
+/* (a + b) * c -- non-vectorised version */
+void scalar_add_mult(data_t* pArray1, data_t* pArray2, data_t* pArray3,
+                     data_t* pResult, long int nSize)
+{
+  for (long i = 0; i < nSize; i++) {
+    pResult[i] = (pArray1[i] + pArray2[i]) * pArray3[i];
+  }
+}
+
+/* dot product, accumulated in double for the reference value */
+double scalar_dot(data_t* pArray1, data_t* pArray2, long int nSize)
+{
+  double sum = 0.0;
+
+  for (long i = 0; i < nSize; i++) {
+    sum += (double)pArray1[i] * (double)pArray2[i];
+  }
+  return sum;
+}
+
+/* (a + b) * c as two separate vector kernels, going through a temporary */
+void unfused_add_mult(data_t* pArray1, data_t* pArray2, data_t* pArray3,
+                      data_t* pTemp, data_t* pResult, long int nSize)
+{
+  lmnt_add_vec(pArray1, pArray2, pTemp, nSize);
+  lmnt_mult_vec(pTemp, pArray3, pResult, nSize);
+}
+
+/* Compare every generated kernel against its scalar version for all
+   lengths 0..MAX_CHECK_LEN, input offsets 0..7 and output offsets 0..7
+   floats. The GUARD floats after the output are filled with a sentinel
+   that must survive. Returns the number of failures. */
+long int check_kernels(void)
+{
+  const data_t sentinel = -12345.0f;
+  const long int size = MAX_CHECK_LEN + 8 + GUARD;
+  data_t *a, *b, *c, *r, *ref;
+  long int n, ia, ir, i, errors = 0;
+
+  if (posix_memalign((void**)&a, 64, size*sizeof(data_t)) ||
+      posix_memalign((void**)&b, 64, size*sizeof(data_t)) ||
+      posix_memalign((void**)&c, 64, size*sizeof(data_t)) ||
+      posix_memalign((void**)&r, 64, size*sizeof(data_t)) ||
+      posix_memalign((void**)&ref, 64, size*sizeof(data_t))) {
+    printf("COULDN'T ALLOCATE check arrays\n");
+    exit(-1);
+  }
+  InitArray_rand(a, size);
+  InitArray_rand(b, size);
+  InitArray_rand(c, size);
+
+  for (n = 0; n <= MAX_CHECK_LEN; n++) {
+    for (ia = 0; ia < 8; ia++) {
+      for (ir = 0; ir < 8; ir++) {
+        /* distance */
+        for (i = 0; i < size; i++) r[i] = sentinel;
+        lmnt_distance(a+ia, b+ia, r+ir, n);
+        scalar_distance(a+ia, b+ia, ref, n);
+        for (i = 0; i < n; i++) if (r[ir+i] != ref[i]) errors++;
+        for (i = 0; i < ir; i++) if (r[i] != sentinel) errors++;
+        for (i = ir+n; i < size; i++) if (r[i] != sentinel) errors++;
+
+        /* fused add+mult, with c at yet another offset */
+        for (i = 0; i < size; i++) r[i] = sentinel;
+        lmnt_add_mult(a+ia, b+ir, c+(ia^ir), r+ir, n);
+        scalar_add_mult(a+ia, b+ir, c+(ia^ir), ref, n);
+        for (i = 0; i < n; i++) if (r[ir+i] != ref[i]) errors++;
+        for (i = 0; i < ir; i++) if (r[i] != sentinel) errors++;
+        for (i = ir+n; i < size; i++) if (r[i] != sentinel) errors++;
+      }
+      /* dot: float accumulation in a different order, so compare with a
+         tolerance against the double reference */
+      {
+        double d = scalar_dot(a+ia, b+ia, n);
+        if (fabs(lmnt_dot(a+ia, b+ia, n) - d) > 1e-5 * (fabs(d) + 1.0))
+          errors++;
+      }
+    }
+  }
+
+  free(a); free(b); free(c); free(r); free(ref);
+  return errors;
+}
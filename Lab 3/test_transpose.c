@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <math.h>
+#include "arena.h"
 
 #define CPNS 2.0    /* Cycles per nanosecond -- Adjust to your computer,
                        for example a 3.2 GHz GPU, this would be 3.2 */
@@ -22,26 +23,13 @@
 
 typedef float data_t;
 
-/* Create abstract data type for an array */
-typedef struct {
-  long int rowlen;
-  data_t *data;
-} array_rec, *array_ptr;
+/* M x N arrays with a leading dimension (mat_ptr), see mat.h. Rows start
+   on 64-byte boundaries, so vector loads of a row can be aligned. */
+#include "mat.h"
 
-/* Number of bytes in a vector */
-#define VBYTES 32
-
-/* Number of elements in a vector */
-#define VSIZE (VBYTES/sizeof(data_t))
-
-
-
-array_ptr new_array(long int rowlen);
-int set_array_rowlen(array_ptr v, long int index);
-long int get_array_rowlen(array_ptr v);
-int init_array(array_ptr v, long int len);
-void transpose(array_ptr v0, array_ptr v1);
-void transpose_rev(array_ptr v0, array_ptr v1);
+void transpose(mat_ptr v0, mat_ptr v1);
+void transpose_rev(mat_ptr v0, mat_ptr v1);
+long int check_transpose(void);
 
 
 /* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
@@ -119,19 +107,27 @@ int main(int argc, char *argv[])
 
   printf("Transpose (lab3)\n");
 
+  if (check_transpose()) {
+    printf("check_transpose: wrong results\n");
+    exit(-1);
+  }
+
   wd = wakeup_delay();
   x = NUM_TESTS-1;
   alloc_size = A*x*x + B*x + C;
 
   /* declare and initialize the arrays in memory */
-  array_ptr v0 = new_array(alloc_size);  init_array(v0, alloc_size);
-  array_ptr v1 = new_array(alloc_size);  init_array(v1, alloc_size);
+  mat_ptr v0 = new_mat(alloc_size, alloc_size);
+  mat_ptr v1 = new_mat(alloc_size, alloc_size);
+  if (!v0 || !v1) exit(-1);
+  init_mat(v0);
+  init_mat(v1);
 
   OPTION = 0;
   printf("testing option %d\n", OPTION);
   for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
-    set_array_rowlen(v0, n);
-    set_array_rowlen(v1, n);
+    set_mat_size(v0, n, n);
+    set_mat_size(v1, n, n);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
     transpose(v0, v1);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
@@ -141,8 +137,8 @@ int main(int argc, char *argv[])
   OPTION++;
   printf("testing option %d\n", OPTION);
   for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
-    set_array_rowlen(v0, n);
-    set_array_rowlen(v1, n);
+    set_mat_size(v0, n, n);
+    set_mat_size(v1, n, n);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
     transpose_rev(v0, v1);
     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
@@ -170,108 +166,80 @@ int main(int argc, char *argv[])
 } /* end main */
 /*********************************/
 
-/* Create 2D array in memory, with the specified length per dimension */
-array_ptr new_array(long int rowlen)
-{
-  long int i;
-
-  /* Allocate and declare header structure */
-  array_ptr result = (array_ptr) malloc(sizeof(array_rec));
-  if (!result) return NULL;  /* Couldn't allocate storage */
-  result->rowlen = rowlen;
-
-  if (rowlen % VSIZE) {
-    fprintf(stdout,
-      "new_array: row length %ld is not a multiple of vector size (VSIZE=%d)\n"
-      "to fix this, A, B and C must all be a multiple of %d\n",
-      rowlen, ((int)VSIZE), ((int)VSIZE));
-    exit(-1);
-  }
-
-  /* Allocate and declare array */
-  if (rowlen > 0) {
-    data_t *data = (data_t *) calloc(rowlen*rowlen+VSIZE, sizeof(data_t));
-    if (!data) {
-      /* Couldn't allocate storage */
-      free((void *) result);
-      fprintf(stderr, " COULDN'T ALLOCATE %ld BYTES STORAGE \n",
-                                        (rowlen*rowlen+VSIZE)*sizeof(data_t));
-      exit(-1);
-    }
-    while (((long)data) % (VSIZE * sizeof(data_t)) != 0) {
-      data++;
-    }
-    result->data = data;
-  }
-  else result->data = NULL;
-
-  return result;
-}
-
-/* Set length of an array. This does NOT change the amount of space allocated
-   in memory, it just changes the field that controls how much data we work on
-   in the transpose routines. */
-int set_array_rowlen(array_ptr v, long int index)
-{
-  v->rowlen = index;
-  return 1;
-}
-
-/* Return row length of an array */
-long int get_array_rowlen(array_ptr v)
-{
-  return v->rowlen;
-}
+/************************************/
 
-/* initialize 2D array with consecutive integers (converted to data_t type) */
-int init_array(array_ptr v, long int len)
+/* transpose: v1 = transpose of v0. v0 is rows x cols, v1 must be (at
+   least) cols x rows; either can be a view. */
+void transpose(mat_ptr v0, mat_ptr v1)
 {
-  if (len > 0) {
-    v->rowlen = len;
-    for (long i = 0; i < len*len; i++) {
-      v->data[i] = (data_t)(i);
+  long int rows = get_mat_rows(v0), cols = get_mat_cols(v0);
+  long int ld0 = get_mat_ld(v0), ld1 = get_mat_ld(v1);
+  data_t *data0 = get_mat_start(v0);
+  data_t *data1 = get_mat_start(v1);
+
+  for (long i = 0; i < rows; i++) {
+    for (long j = 0; j < cols; j++) {
+      data1[j*ld1+i] = data0[i*ld0+j];
     }
-    return 1;
   }
-  else return 0;
-}
-
-data_t *get_array_start(array_ptr v)
-{
-  return v->data;
 }
 
-
-/************************************/
-
-/* transpose */
-void transpose(array_ptr v0, array_ptr v1)
+/* transpose with loops interchanged */
+void transpose_rev(mat_ptr v0, mat_ptr v1)
 {
-  long int get_array_rowlen(array_ptr v);
-  data_t *get_array_start(array_ptr v);
-  long int length = get_array_rowlen(v0);
-  data_t *data0 = get_array_start(v0);
-  data_t *data1 = get_array_start(v1);
-
-  for (long i = 0; i < length; i++) {
-    for (long j = 0; j < length; j++) {
-      data1[j*length+i] = data0[i*length+j];
+  long int rows = get_mat_rows(v0), cols = get_mat_cols(v0);
+  long int ld0 = get_mat_ld(v0), ld1 = get_mat_ld(v1);
+  data_t *data0 = get_mat_start(v0);
+  data_t *data1 = get_mat_start(v1);
+
+  for (long j = 0; j < cols; j++) {
+    for (long i = 0; i < rows; i++) {
+      data1[j*ld1+i] = data0[i*ld0+j];
     }
   }
 }
 
-/* transpose with loops interchanged */
-void transpose_rev(array_ptr v0, array_ptr v1)
+/* Both transposes on rectangular views, including tall-and-skinny ones.
+   The elements around the destination view must not change. Returns the
+   number of wrong elements. */
+long int check_transpose(void)
 {
-  long int get_array_rowlen(array_ptr v);
-  data_t *get_array_start(array_ptr v);
-  long int length = get_array_rowlen(v0);
-  data_t *data0 = get_array_start(v0);
-  data_t *data1 = get_array_start(v1);
-
-  for (long j = 0; j < length; j++) {
-    for (long i = 0; i < length; i++) {
-      data1[j*length+i] = data0[i*length+j];
+  static const long int shapes[][2] = {
+    {1, 1}, {3, 5}, {8, 8}, {500, 3}, {3, 500}, {100, 37}
+  };
+  const int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+  const long int big = 512;
+  mat_ptr a, b;
+  mat_rec av, bv;
+  long int s, i, j, rows, cols, errors = 0;
+  int m;
+  arena_mark_t mark = arena_mark(default_arena());
+
+  a = new_mat(big, big);
+  b = new_mat(big, big);
+  if (!a || !b) exit(-1);
+  init_mat(a);
+
+  for (s = 0; s < nshapes; s++) {
+    rows = shapes[s][0];
+    cols = shapes[s][1];
+    av = mat_view(a, 2, 3, rows, cols);
+    bv = mat_view(b, 1, 4, cols, rows);
+    for (m = 0; m < 2; m++) {
+      fill_mat(b, -1);
+      if (m == 0) transpose(&av, &bv);
+      else transpose_rev(&av, &bv);
+      for (i = 0; i < big; i++)
+        for (j = 0; j < big; j++) {
+          data_t expect = -1;
+          if (i >= 1 && i < 1 + cols && j >= 4 && j < 4 + rows)
+            expect = a->data[(j-4+2)*a->ld + (i-1+3)];
+          if (b->data[i*b->ld + j] != expect) errors++;
+        }
     }
   }
+
+  free(a); free(b);
+  arena_release(default_arena(), mark);
+  return errors;
 }
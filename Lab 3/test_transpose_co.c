@@ -0,0 +1,303 @@
+/*****************************************************************************/
+// gcc -O3 -std=gnu99 -mavx test_transpose_co.c -lrt -o test_transpose_co
+
+/*
+  Cache-oblivious transpose. transpose_co() splits the longer side of the
+  matrix in half (at a multiple of 4) until the piece is at most CO_BASE on
+  each side, then transposes the piece with the 4x4 AVX kernel. There is no
+  block size to tune: at some level of the recursion the pieces fit in L1,
+  at a higher level in L2, and so on. It works for any M x N.
+
+  Compared against, for square N x N doubles:
+    ij        - transpose() from test_transpose.c
+    4x4d      - transpose_4x4d() from test_transpose.c, one level of 4x4
+                tiles (N must be a multiple of 4)
+    blocked   - fixed BLOCK x BLOCK cache blocks of 4x4 tiles
+    co        - transpose_co()
+  over sizes from 32 (16 KB for both matrices, L1) to ~4096 (256 MB, DRAM),
+  alternating powers of two (worst case for cache set conflicts) with
+  nearby sizes that aren't. Results are cycles per element.
+
+  Before timing, every method is checked against the scalar transpose,
+  including transpose_co() on rectangular and odd-sized matrices.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "arena.h"
+#include "transpose_kernels.h"
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GHz GPU, this would be 3.2 */
+
+#define NUM_TESTS 8
+#define OPTIONS 4
+
+#define MIN_ELEMENTS (1L << 24)  /* repeat small sizes up to this much work */
+
+#define BLOCK 32     /* fixed cache block for transpose_blocked() */
+#ifndef CO_BASE
+#define CO_BASE 32   /* recursion stops at CO_BASE x CO_BASE or smaller */
+#endif
+
+/* sizes spanning L1 to DRAM */
+static const long int sizes[NUM_TESTS] = {32, 60, 128, 252, 512, 1020,
+                                          2048, 4092};
+
+typedef double data_t;
+
+void transpose_ij(data_t *src, data_t *dst, long int N);
+void transpose_4x4_fixed(data_t *src, data_t *dst, long int N);
+void transpose_blocked(data_t *src, data_t *dst, long int N);
+void transpose_co(data_t *src, data_t *dst, long int rows, long int cols);
+void transpose_co_rec(const data_t *src, long int lds, data_t *dst,
+                      long int ldd, long int rows, long int cols);
+long int check_transposes(void);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (int i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  double wd;
+  long int x, n, i, reps, r, max_n, errors;
+  data_t *src, *dst;
+
+  printf("Cache-oblivious transpose (lab3)\n");
+
+  errors = check_transposes();
+  printf("check_transposes: %ld errors\n", errors);
+  if (errors) return -1;
+
+  wd = wakeup_delay();
+
+  max_n = sizes[NUM_TESTS-1];
+  src = (data_t *) arena_alloc(default_arena(), max_n*max_n*sizeof(data_t));
+  dst = (data_t *) arena_calloc(default_arena(), max_n*max_n, sizeof(data_t));
+  if (!src || !dst) {
+    printf("COULDN'T ALLOCATE %ld BYTES STORAGE\n",
+           2*max_n*max_n*(long)sizeof(data_t));
+    exit(-1);
+  }
+  for (i = 0; i < max_n*max_n; i++) src[i] = (data_t)(i);
+
+  for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+    printf("testing option %d\n", OPTION);
+    for (x=0; x<NUM_TESTS; x++) {
+      n = sizes[x];
+      reps = MIN_ELEMENTS / (n*n);
+      if (reps < 1) reps = 1;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      for (r = 0; r < reps; r++) {
+        switch (OPTION) {
+          case 0: transpose_ij(src, dst, n); break;
+          case 1: transpose_4x4_fixed(src, dst, n); break;
+          case 2: transpose_blocked(src, dst, n); break;
+          case 3: transpose_co(src, dst, n, n); break;
+        }
+      }
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop) / (reps*n*n);
+    }
+  }
+
+  /* output times */
+  printf("All measurements are in cycles per element\n");
+  printf("size, KB (both), ij, 4x4d, blocked, co\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    printf("%ld, %ld", sizes[x], 2*sizes[x]*sizes[x]*(long)sizeof(data_t)/1024);
+    for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+      printf(", %.3f", (double)(CPNS) * 1.0e9 * time_stamp[OPTION][x]);
+    }
+    printf("\n");
+  }
+
+  printf("\n");
+  printf("Wakeup delay calculated %f\n", wd);
+
+  return 0;
+} /* end main */
+
+/*****************************************************************************/
+/* transpose, ij order (same as transpose() in test_transpose.c) */
+void transpose_ij(data_t *src, data_t *dst, long int N)
+{
+  for (long i = 0; i < N; i++) {
+    for (long j = 0; j < N; j++) {
+      dst[j*N+i] = src[i*N+j];
+    }
+  }
+}
+
+/* one level of 4x4 tiles, as transpose_4x4d() in test_transpose.c. The
+   4x4 kernel needs N to be a multiple of 4. */
+void transpose_4x4_fixed(data_t *src, data_t *dst, long int N)
+{
+  for (long i = 0; i < N; i += 4) {
+    for (long j = 0; j < N; j += 4) {
+      transpose_4x4d(&src[i*N + j], N, &dst[j*N + i], N);
+    }
+  }
+}
+
+/* BLOCK x BLOCK cache blocks, each done as 4x4 tiles */
+void transpose_blocked(data_t *src, data_t *dst, long int N)
+{
+  long int i, j, bi, bj;
+
+  for (i = 0; i < N; i += BLOCK) {
+    bi = (N - i < BLOCK) ? N - i : BLOCK;
+    for (j = 0; j < N; j += BLOCK) {
+      bj = (N - j < BLOCK) ? N - j : BLOCK;
+      transpose_block_d(&src[i*N + j], N, &dst[j*N + i], N, bi, bj);
+    }
+  }
+}
+
+/* Cache-oblivious transpose of a rows x cols matrix src into the
+   cols x rows matrix dst */
+void transpose_co(data_t *src, data_t *dst, long int rows, long int cols)
+{
+  transpose_co_rec(src, cols, dst, rows, rows, cols);
+}
+
+/* Split the longer side in two; the split point is rounded to a multiple of
+   4 so that, apart from the last row/column of pieces, the base case gets
+   whole 4x4 tiles. */
+void transpose_co_rec(const data_t *src, long int lds, data_t *dst,
+                      long int ldd, long int rows, long int cols)
+{
+  long int h;
+
+  if (rows <= CO_BASE && cols <= CO_BASE) {
+    transpose_block_d(src, lds, dst, ldd, rows, cols);
+    return;
+  }
+  if (rows >= cols) {
+    h = ((rows / 2) + 3) & ~3L;
+    transpose_co_rec(src, lds, dst, ldd, h, cols);
+    transpose_co_rec(src + h*lds, lds, dst + h, ldd, rows - h, cols);
+  }
+  else {
+    h = ((cols / 2) + 3) & ~3L;
+    transpose_co_rec(src, lds, dst, ldd, rows, h);
+    transpose_co_rec(src + h, lds, dst + h*ldd, ldd, rows, cols - h);
+  }
+}
+
+/* Compare against a scalar transpose: the square methods on a few sizes,
+   and transpose_co() on rectangular shapes, including ones that aren't a
+   multiple of 4 in either direction. Returns the number of wrong
+   elements. */
+long int check_transposes(void)
+{
+  static const long int shapes[][2] = {
+    {1, 1}, {3, 5}, {4, 4}, {7, 33}, {33, 7}, {16, 17}, {100, 37},
+    {37, 100}, {255, 129}, {1000, 13}, {13, 1000}, {517, 509}
+  };
+  const int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+  const long int max_elems = 517 * 509;
+  data_t *src, *dst;
+  long int s, i, j, rows, cols, errors = 0;
+  int m;
+  arena_mark_t mark = arena_mark(default_arena());
+
+  src = (data_t *) arena_alloc(default_arena(), max_elems*sizeof(data_t));
+  dst = (data_t *) arena_alloc(default_arena(), max_elems*sizeof(data_t));
+  if (!src || !dst) {
+    printf("COULDN'T ALLOCATE check arrays\n");
+    exit(-1);
+  }
+  for (i = 0; i < max_elems; i++) src[i] = (data_t)(i);
+
+  for (s = 0; s < nshapes; s++) {
+    rows = shapes[s][0];
+    cols = shapes[s][1];
+    for (i = 0; i < max_elems; i++) dst[i] = -1.0;
+    transpose_co(src, dst, rows, cols);
+    for (i = 0; i < rows; i++)
+      for (j = 0; j < cols; j++)
+        if (dst[j*rows + i] != src[i*cols + j]) errors++;
+  }
+
+  for (s = 0; s < 3; s++) {
+    long int N = (s == 0) ? 4 : (s == 1) ? 60 : 132;
+    for (m = 0; m < 3; m++) {
+      for (i = 0; i < N*N; i++) dst[i] = -1.0;
+      if (m == 0) transpose_ij(src, dst, N);
+      if (m == 1) transpose_4x4_fixed(src, dst, N);
+      if (m == 2) transpose_blocked(src, dst, N);
+      for (i = 0; i < N; i++)
+        for (j = 0; j < N; j++)
+          if (dst[j*N + i] != src[i*N + j]) errors++;
+    }
+  }
+
+  arena_release(default_arena(), mark);
+  return errors;
+}
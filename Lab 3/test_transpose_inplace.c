@@ -0,0 +1,408 @@
+/*****************************************************************************/
+// gcc -O3 -std=gnu99 -mavx -pthread test_transpose_inplace.c -lpthread -lrt -o test_transpose_inplace
+
+/*
+  In-place transpose of a square matrix. The out-of-place transposes need a
+  second N x N array, which doubles the memory for a big matrix. In place,
+  the matrix is cut into BLOCK x BLOCK blocks; block (I,J) above the
+  diagonal is swapped with the transpose of block (J,I), 4x4 (double) or
+  8x8 (float) tiles at a time through AVX registers, and the blocks on the
+  diagonal are transposed on their own. Every block pair is independent, so
+  the threaded version just splits the list of pairs between NUM_THREADS
+  threads.
+
+  Options, for double then float:
+    oop       - out of place, one level of 4x4d / 8x8f tiles (as
+                transpose_4x4d() in test_transpose.c)
+    ip        - in place, 1 thread
+    ip_pthr   - in place, NUM_THREADS threads
+
+  Both kinds read and write every element once, so "bandwidth" counts
+  2 * N * N * sizeof(element) bytes per transpose. Footprint is the memory
+  the matrices need: 2 N^2 elements out of place, N^2 in place. Times are
+  wall clock (CLOCK_REALTIME), since the threaded versions are included.
+
+  Before timing, every method is checked against a scalar transpose, on
+  sizes that are and aren't multiples of the tile and block size.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include "arena.h"
+#include "transpose_kernels.h"
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GHz GPU, this would be 3.2 */
+
+#define NUM_TESTS 6
+#define OPTIONS 6
+
+#define MIN_ELEMENTS (1L << 25)  /* repeat small sizes up to this much work */
+
+#define BLOCK 32     /* block pairs are the unit of work (and of threading) */
+
+/* sizes from L2 to DRAM; 8192 doubles is 512 MB in place, 1 GB out of
+   place */
+static const long int sizes[NUM_TESTS] = {256, 1020, 2048, 4092, 4096, 8192};
+
+int NUM_THREADS = 4;
+
+/* used to pass parameters to worker threads */
+struct thread_data{
+  int thread_id;
+  double *md;    /* one of md/mf is set */
+  float *mf;
+  long int N;
+};
+
+void transpose_oop_d(double *src, double *dst, long int N);
+void transpose_oop_f(float *src, float *dst, long int N);
+void transpose_ip_d(double *m, long int N);
+void transpose_ip_f(float *m, long int N);
+void transpose_ip_pthr(double *md, float *mf, long int N);
+void transpose_ip_pairs(double *md, float *mf, long int N, long int low,
+                        long int high);
+long int check_transposes(void);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (int i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  double wd, sec;
+  long int x, n, i, reps, r, max_n, errors;
+  double *srcd = NULL, *dstd = NULL;
+  float *srcf = NULL, *dstf = NULL;
+  static const char *names[OPTIONS] = {"double oop", "double ip",
+    "double ip_pthr", "float oop", "float ip", "float ip_pthr"};
+
+  printf("In-place transpose (lab3)\n");
+
+  errors = check_transposes();
+  printf("check_transposes: %ld errors\n", errors);
+  if (errors) return -1;
+
+  wd = wakeup_delay();
+
+  /* the doubles take the whole arena; the floats reuse it */
+  max_n = sizes[NUM_TESTS-1];
+  for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+    if (OPTION == 0 || OPTION == 3) {
+      arena_reset(default_arena());
+      srcd = dstd = NULL;
+      srcf = dstf = NULL;
+      if (OPTION == 0) {
+        srcd = (double *) arena_alloc(default_arena(), max_n*max_n*sizeof(double));
+        dstd = (double *) arena_alloc(default_arena(), max_n*max_n*sizeof(double));
+        if (!srcd || !dstd) {
+          printf("COULDN'T ALLOCATE %ld BYTES STORAGE\n",
+                 2*max_n*max_n*(long)sizeof(double));
+          exit(-1);
+        }
+        for (i = 0; i < max_n*max_n; i++) {
+          srcd[i] = (double)(i);
+          dstd[i] = 0;
+        }
+      }
+      else {
+        srcf = (float *) arena_alloc(default_arena(), max_n*max_n*sizeof(float));
+        dstf = (float *) arena_alloc(default_arena(), max_n*max_n*sizeof(float));
+        if (!srcf || !dstf) {
+          printf("COULDN'T ALLOCATE %ld BYTES STORAGE\n",
+                 2*max_n*max_n*(long)sizeof(float));
+          exit(-1);
+        }
+        for (i = 0; i < max_n*max_n; i++) {
+          srcf[i] = (float)(i);
+          dstf[i] = 0;
+        }
+      }
+    }
+
+    printf("testing option %d (%s)\n", OPTION, names[OPTION]);
+    for (x=0; x<NUM_TESTS; x++) {
+      n = sizes[x];
+      reps = MIN_ELEMENTS / (n*n);
+      if (reps < 1) reps = 1;
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      for (r = 0; r < reps; r++) {
+        switch (OPTION) {
+          case 0: transpose_oop_d(srcd, dstd, n); break;
+          case 1: transpose_ip_d(srcd, n); break;
+          case 2: transpose_ip_pthr(srcd, NULL, n); break;
+          case 3: transpose_oop_f(srcf, dstf, n); break;
+          case 4: transpose_ip_f(srcf, n); break;
+          case 5: transpose_ip_pthr(NULL, srcf, n); break;
+        }
+      }
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop) / reps;
+    }
+  }
+
+  /* output times */
+  printf("NUM_THREADS = %d, BLOCK = %d\n", NUM_THREADS, BLOCK);
+  printf("All times are in cycles per element; footprint in MB; "
+         "bandwidth in GB/s (2 N^2 elements moved)\n");
+  for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+    long int esize = (OPTION < 3) ? sizeof(double) : sizeof(float);
+    printf("%s\n", names[OPTION]);
+    printf("size, footprint MB, cycles/element, GB/s\n");
+    for (x = 0; x < NUM_TESTS; x++) {
+      n = sizes[x];
+      sec = time_stamp[OPTION][x];
+      printf("%ld, %.1f, %.3f, %.2f\n", n,
+             (double)((OPTION % 3 == 0) ? 2 : 1) * n * n * esize / (1 << 20),
+             (double)(CPNS) * 1.0e9 * sec / (n*n),
+             2.0 * n * n * esize / sec * 1.0e-9);
+    }
+  }
+
+  printf("\n");
+  printf("Wakeup delay calculated %f\n", wd);
+
+  return 0;
+} /* end main */
+
+/*****************************************************************************/
+/* out of place, one level of tiles (N any size: edges in scalar) */
+void transpose_oop_d(double *src, double *dst, long int N)
+{
+  transpose_block_d(src, N, dst, N, N, N);
+}
+
+void transpose_oop_f(float *src, float *dst, long int N)
+{
+  transpose_block_f(src, N, dst, N, N, N);
+}
+
+/* in place, 1 thread: all the block pairs */
+void transpose_ip_d(double *m, long int N)
+{
+  long int nb = (N + BLOCK - 1) / BLOCK;
+  transpose_ip_pairs(m, NULL, N, 0, nb*(nb+1)/2);
+}
+
+void transpose_ip_f(float *m, long int N)
+{
+  long int nb = (N + BLOCK - 1) / BLOCK;
+  transpose_ip_pairs(NULL, m, N, 0, nb*(nb+1)/2);
+}
+
+/* Do block pairs low..high-1. The pairs (I,J), I <= J, are numbered row by
+   row along the upper triangle of the nb x nb grid of blocks; pairs with
+   I == J are the diagonal blocks. */
+void transpose_ip_pairs(double *md, float *mf, long int N, long int low,
+                        long int high)
+{
+  long int nb = (N + BLOCK - 1) / BLOCK;
+  long int I = 0, J, p = 0, bi, bj;
+
+  /* find the row of the triangle that pair low is in */
+  while (p + (nb - I) <= low) {
+    p += nb - I;
+    I++;
+  }
+  J = I + (low - p);
+
+  for (p = low; p < high; p++) {
+    bi = (N - I*BLOCK < BLOCK) ? N - I*BLOCK : BLOCK;
+    bj = (N - J*BLOCK < BLOCK) ? N - J*BLOCK : BLOCK;
+    if (md) {
+      if (I == J) transpose_diag_block_d(&md[I*BLOCK*N + I*BLOCK], N, bi);
+      else transpose_swap_block_d(&md[I*BLOCK*N + J*BLOCK],
+                                  &md[J*BLOCK*N + I*BLOCK], N, bi, bj);
+    }
+    else {
+      if (I == J) transpose_diag_block_f(&mf[I*BLOCK*N + I*BLOCK], N, bi);
+      else transpose_swap_block_f(&mf[I*BLOCK*N + J*BLOCK],
+                                  &mf[J*BLOCK*N + I*BLOCK], N, bi, bj);
+    }
+    if (++J == nb) {
+      I++;
+      J = I;
+    }
+  }
+}
+
+/***************************************************************************/
+/* in place, multithreaded: each thread gets an equal share of the block
+   pairs. No two pairs touch the same element, so no locking is needed. */
+void *ip_work(void *threadarg)
+{
+  struct thread_data *my_data;
+  my_data = (struct thread_data *) threadarg;
+  int taskid = my_data->thread_id;
+  long int N = my_data->N;
+  long int nb = (N + BLOCK - 1) / BLOCK;
+  long int npairs = nb*(nb+1)/2;
+  long int low, high;
+
+  low = (taskid * npairs)/NUM_THREADS;
+  high = ((taskid+1) * npairs)/NUM_THREADS;
+
+  transpose_ip_pairs(my_data->md, my_data->mf, N, low, high);
+
+  pthread_exit(NULL);
+} /* End of ip_work */
+
+void transpose_ip_pthr(double *md, float *mf, long int N)
+{
+  pthread_t threads[NUM_THREADS];
+  struct thread_data thread_data_array[NUM_THREADS];
+  int rc;
+  long t;
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    thread_data_array[t].thread_id = t;
+    thread_data_array[t].md = md;
+    thread_data_array[t].mf = mf;
+    thread_data_array[t].N = N;
+    rc = pthread_create(&threads[t], NULL, ip_work,
+                        (void*) &thread_data_array[t]);
+    if (rc) {
+      printf("ERROR; return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    if (pthread_join(threads[t],NULL)){
+      printf("ERROR; code on return from join is %d\n", rc);
+      exit(-1);
+    }
+  }
+}
+
+/*****************************************************************************/
+/* Compare every method against a scalar transpose, for sizes that are and
+   aren't multiples of 4, 8 and BLOCK. The in-place ones are compared
+   against a copy of the matrix from before. Returns the number of wrong
+   elements. */
+long int check_transposes(void)
+{
+  static const long int check_sizes[] = {1, 3, 4, 5, 8, 13, 32, 33, 64, 100,
+                                         131, 257};
+  const int nsizes = sizeof(check_sizes) / sizeof(check_sizes[0]);
+  const long int max_elems = 257 * 257;
+  double *d0, *d1;
+  float *f0, *f1;
+  long int s, i, j, N, errors = 0;
+  int m;
+  arena_mark_t mark = arena_mark(default_arena());
+
+  d0 = (double *) arena_alloc(default_arena(), max_elems*sizeof(double));
+  d1 = (double *) arena_alloc(default_arena(), max_elems*sizeof(double));
+  f0 = (float *) arena_alloc(default_arena(), max_elems*sizeof(float));
+  f1 = (float *) arena_alloc(default_arena(), max_elems*sizeof(float));
+  if (!d0 || !d1 || !f0 || !f1) {
+    printf("COULDN'T ALLOCATE check arrays\n");
+    exit(-1);
+  }
+
+  for (s = 0; s < nsizes; s++) {
+    N = check_sizes[s];
+    for (m = 0; m < 3; m++) {
+      for (i = 0; i < N*N; i++) {
+        d0[i] = (double)(i);
+        f0[i] = (float)(i);
+        d1[i] = f1[i] = -1;
+      }
+      if (m == 0) {
+        transpose_oop_d(d0, d1, N);
+        transpose_oop_f(f0, f1, N);
+      }
+      else {
+        if (m == 1) {
+          transpose_ip_d(d0, N);
+          transpose_ip_f(f0, N);
+        }
+        else {
+          transpose_ip_pthr(d0, NULL, N);
+          transpose_ip_pthr(NULL, f0, N);
+        }
+        /* result is in place; move it over and regenerate the original */
+        for (i = 0; i < N*N; i++) {
+          d1[i] = d0[i];
+          f1[i] = f0[i];
+          d0[i] = (double)(i);
+          f0[i] = (float)(i);
+        }
+      }
+      for (i = 0; i < N; i++)
+        for (j = 0; j < N; j++) {
+          if (d1[j*N + i] != d0[i*N + j]) errors++;
+          if (f1[j*N + i] != f0[i*N + j]) errors++;
+        }
+    }
+  }
+
+  arena_release(default_arena(), mark);
+  return errors;
+}
@@ -0,0 +1,474 @@
+/*****************************************************************************/
+// gcc -O3 -std=gnu99 -mavx -pthread test_transpose_mt.c -lpthread -lrt -o test_transpose_mt
+
+/*
+  Multithreaded blocked transpose, doubles and floats, any M x N.
+
+  Three levels:
+    micro   - transpose_4x4d() / transpose_8x8f() from transpose_kernels.h,
+              in AVX registers
+    L1      - L1_BLOCK x L1_BLOCK blocks of micro tiles (transpose_block_d/f,
+              which also does the ragged edges in scalar)
+    L2      - L2_BLOCK x L2_BLOCK tiles of L1 blocks. 128 x 128 doubles is
+              128 KB each for the source and destination tile, so a pair
+              stays in a 256 KB+ L2.
+  The threads split the destination L2 tiles: tiles are numbered row by row
+  across the destination and each thread gets an equal, contiguous range,
+  so a thread writes whole bands of destination rows and no two threads
+  write the same cache line (except at the edge of a ragged last tile).
+
+  Streaming stores: once source + destination are bigger than the last
+  level cache (nt_threshold(), from sysconf, NT_DEFAULT_LLC if that isn't
+  known), the L1 blocks are written with transpose_block_d_nt/f_nt(). A
+  normal store to a line that isn't cached first reads the line
+  (read-for-ownership), so a transpose that misses the cache moves 3 bytes
+  for every 2 it needs; streaming stores skip the read. Each thread does
+  an sfence when it is done. Set NT_STORES to 0 or 1 to force either.
+
+  Compared against one level of micro tiles (transpose_4x4d() in
+  test_transpose.c, and the float version of it): blocked with 1 thread and
+  regular stores, blocked with 1 thread and streaming stores, and blocked
+  with NUM_THREADS threads and automatic selection. Times are wall clock
+  (CLOCK_REALTIME) in cycles per element; a second table gives the
+  bandwidth (2 N^2 elements per transpose) with regular and streaming
+  stores. The sizes include ones that are not multiples of 4, 8 or the
+  block sizes.
+
+  Before timing, the blocked transpose is checked against a scalar
+  transpose on square and rectangular shapes, with 1 and NUM_THREADS
+  threads and with both kinds of stores.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include "arena.h"
+#include "transpose_kernels.h"
+
+#define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
+                       for example a 3.2 GHz GPU, this would be 3.2 */
+
+#define NUM_TESTS 7
+#define OPTIONS 8
+
+#define MIN_ELEMENTS (1L << 25)  /* repeat small sizes up to this much work */
+
+#define L1_BLOCK 32
+#define L2_BLOCK 128
+
+#define NT_DEFAULT_LLC (8L << 20)   /* if sysconf() doesn't know the L3 size */
+
+static const long int sizes[NUM_TESTS] = {252, 1000, 1024, 2044, 4000, 4096,
+                                          8000};
+
+int NUM_THREADS = 4;
+
+int NT_STORES = -1;  /* 0 regular stores, 1 streaming, -1 pick by size */
+
+/* used to pass parameters to worker threads */
+struct thread_data{
+  int thread_id;
+  const double *srcd;   /* either the d or the f pair is set */
+  double *dstd;
+  const float *srcf;
+  float *dstf;
+  long int rows;
+  long int cols;
+};
+
+void transpose_mt_d(const double *src, double *dst, long int rows,
+                    long int cols);
+void transpose_mt_f(const float *src, float *dst, long int rows,
+                    long int cols);
+void transpose_mt(struct thread_data *td);
+void transpose_tiles_d(const double *src, double *dst, long int rows,
+                       long int cols, long int low, long int high);
+void transpose_tiles_f(const float *src, float *dst, long int rows,
+                       long int cols, long int low, long int high);
+long int nt_threshold(void);
+int use_nt(const void *dst, long int rows, long int cols, long int esize);
+long int check_transposes(void);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (int i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  int OPTION, threads = NUM_THREADS;
+  struct timespec time_start, time_stop;
+  double time_stamp[OPTIONS][NUM_TESTS];
+  double wd;
+  long int x, n, i, reps, r, max_n, errors;
+  double *srcd, *dstd;
+  float *srcf, *dstf;
+
+  printf("Multithreaded blocked transpose (lab3)\n");
+  printf("streaming stores above %ld bytes (src + dst)\n", nt_threshold());
+
+  errors = check_transposes();
+  printf("check_transposes: %ld errors\n", errors);
+  if (errors) return -1;
+
+  wd = wakeup_delay();
+
+  max_n = sizes[NUM_TESTS-1];
+  srcd = (double *) arena_alloc(default_arena(), max_n*max_n*sizeof(double));
+  dstd = (double *) arena_calloc(default_arena(), max_n*max_n, sizeof(double));
+  srcf = (float *) arena_alloc(default_arena(), max_n*max_n*sizeof(float));
+  dstf = (float *) arena_calloc(default_arena(), max_n*max_n, sizeof(float));
+  if (!srcd || !dstd || !srcf || !dstf) {
+    printf("COULDN'T ALLOCATE %ld BYTES STORAGE\n",
+           2*max_n*max_n*(long)(sizeof(double) + sizeof(float)));
+    exit(-1);
+  }
+  for (i = 0; i < max_n*max_n; i++) {
+    srcd[i] = (double)(i);
+    srcf[i] = (float)(i);
+  }
+
+  for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+    printf("testing option %d\n", OPTION);
+    NUM_THREADS = (OPTION % 4 == 3) ? threads : 1;
+    NT_STORES = (OPTION % 4 == 3) ? -1 : (OPTION % 4 == 2);
+    for (x=0; x<NUM_TESTS; x++) {
+      n = sizes[x];
+      reps = MIN_ELEMENTS / (n*n);
+      if (reps < 1) reps = 1;
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      for (r = 0; r < reps; r++) {
+        switch (OPTION) {
+          case 0: transpose_block_d(srcd, n, dstd, n, n, n); break;
+          case 1:
+          case 2:
+          case 3: transpose_mt_d(srcd, dstd, n, n); break;
+          case 4: transpose_block_f(srcf, n, dstf, n, n, n); break;
+          case 5:
+          case 6:
+          case 7: transpose_mt_f(srcf, dstf, n, n); break;
+        }
+      }
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      time_stamp[OPTION][x] = interval(time_start, time_stop) / (reps*n*n);
+    }
+  }
+  NUM_THREADS = threads;
+  NT_STORES = -1;
+
+  /* output times */
+  printf("NUM_THREADS = %d, L1_BLOCK = %d, L2_BLOCK = %d\n",
+         NUM_THREADS, L1_BLOCK, L2_BLOCK);
+  printf("All measurements are in cycles per element\n");
+  printf("size, d 4x4, d blocked, d blocked_nt, d blocked_pthr, "
+         "f 8x8, f blocked, f blocked_nt, f blocked_pthr\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    printf("%ld", sizes[x]);
+    for (OPTION = 0; OPTION < OPTIONS; OPTION++) {
+      printf(", %.3f", (double)(CPNS) * 1.0e9 * time_stamp[OPTION][x]);
+    }
+    printf("\n");
+  }
+
+  /* regular vs streaming stores, 1 thread, GB/s */
+  printf("\nBandwidth in GB/s, blocked with regular / streaming stores\n");
+  printf("size, d regular, d nt, d nt/regular, d auto, "
+         "f regular, f nt, f nt/regular, f auto\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    n = sizes[x];
+    printf("%ld", n);
+    for (OPTION = 1; OPTION < OPTIONS; OPTION += 4) {
+      long int esize = (OPTION < 4) ? sizeof(double) : sizeof(float);
+      double t_reg = time_stamp[OPTION][x];      /* per element */
+      double t_nt = time_stamp[OPTION+1][x];
+      printf(", %.2f, %.2f, %.2f, %s",
+             2.0 * esize / t_reg * 1.0e-9,
+             2.0 * esize / t_nt * 1.0e-9,
+             t_reg / t_nt,
+             use_nt((OPTION < 4) ? (void *) dstd : (void *) dstf, n, n, esize)
+               ? "nt" : "regular");
+    }
+    printf("\n");
+  }
+
+  printf("\n");
+  printf("Wakeup delay calculated %f\n", wd);
+
+  return 0;
+} /* end main */
+
+/*****************************************************************************/
+/* Destination L2 tiles low..high-1 of the transpose of the rows x cols
+   matrix src. dst is cols x rows; its tiles are numbered row by row. */
+void transpose_tiles_d(const double *src, double *dst, long int rows,
+                       long int cols, long int low, long int high)
+{
+  long int ntc = (rows + L2_BLOCK - 1) / L2_BLOCK;  /* tiles per dst row */
+  long int t, i0, j0, i1, j1, i, j, bi, bj;
+  int nt = use_nt(dst, rows, cols, sizeof(double));
+
+  for (t = low; t < high; t++) {
+    j0 = (t / ntc) * L2_BLOCK;    /* dst rows j0..j1 = src columns */
+    i0 = (t % ntc) * L2_BLOCK;    /* dst columns i0..i1 = src rows */
+    j1 = (j0 + L2_BLOCK < cols) ? j0 + L2_BLOCK : cols;
+    i1 = (i0 + L2_BLOCK < rows) ? i0 + L2_BLOCK : rows;
+    for (j = j0; j < j1; j += L1_BLOCK) {
+      bj = (j1 - j < L1_BLOCK) ? j1 - j : L1_BLOCK;
+      for (i = i0; i < i1; i += L1_BLOCK) {
+        bi = (i1 - i < L1_BLOCK) ? i1 - i : L1_BLOCK;
+        if (nt)
+          transpose_block_d_nt(&src[i*cols + j], cols, &dst[j*rows + i], rows,
+                               bi, bj);
+        else
+          transpose_block_d(&src[i*cols + j], cols, &dst[j*rows + i], rows,
+                            bi, bj);
+      }
+    }
+  }
+  if (nt) _mm_sfence();
+}
+
+void transpose_tiles_f(const float *src, float *dst, long int rows,
+                       long int cols, long int low, long int high)
+{
+  long int ntc = (rows + L2_BLOCK - 1) / L2_BLOCK;
+  long int t, i0, j0, i1, j1, i, j, bi, bj;
+  int nt = use_nt(dst, rows, cols, sizeof(float));
+
+  for (t = low; t < high; t++) {
+    j0 = (t / ntc) * L2_BLOCK;
+    i0 = (t % ntc) * L2_BLOCK;
+    j1 = (j0 + L2_BLOCK < cols) ? j0 + L2_BLOCK : cols;
+    i1 = (i0 + L2_BLOCK < rows) ? i0 + L2_BLOCK : rows;
+    for (j = j0; j < j1; j += L1_BLOCK) {
+      bj = (j1 - j < L1_BLOCK) ? j1 - j : L1_BLOCK;
+      for (i = i0; i < i1; i += L1_BLOCK) {
+        bi = (i1 - i < L1_BLOCK) ? i1 - i : L1_BLOCK;
+        if (nt)
+          transpose_block_f_nt(&src[i*cols + j], cols, &dst[j*rows + i], rows,
+                               bi, bj);
+        else
+          transpose_block_f(&src[i*cols + j], cols, &dst[j*rows + i], rows,
+                            bi, bj);
+      }
+    }
+  }
+  if (nt) _mm_sfence();
+}
+
+/* Size of the last level cache in bytes */
+long int nt_threshold(void)
+{
+  static long int llc = 0;
+
+  if (!llc) {
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    if (llc <= 0) llc = NT_DEFAULT_LLC;
+  }
+  return llc;
+}
+
+/* Use streaming stores for this transpose? Forced by NT_STORES, otherwise
+   when src + dst don't fit in the last level cache. Either way the
+   destination rows have to be 32-byte aligned for _mm256_stream_*. */
+int use_nt(const void *dst, long int rows, long int cols, long int esize)
+{
+  if (((long) dst) % 32 || (rows * esize) % 32) return 0;
+  if (NT_STORES >= 0) return NT_STORES;
+  return 2 * rows * cols * esize > nt_threshold();
+}
+
+/***************************************************************************/
+/* worker: an equal, contiguous share of the destination tiles */
+void *transpose_work(void *threadarg)
+{
+  struct thread_data *my_data;
+  my_data = (struct thread_data *) threadarg;
+  int taskid = my_data->thread_id;
+  long int rows = my_data->rows, cols = my_data->cols;
+  long int ntiles = ((rows + L2_BLOCK - 1) / L2_BLOCK)
+                    * ((cols + L2_BLOCK - 1) / L2_BLOCK);
+  long int low, high;
+
+  low = (taskid * ntiles)/NUM_THREADS;
+  high = ((taskid+1) * ntiles)/NUM_THREADS;
+
+  if (my_data->srcd)
+    transpose_tiles_d(my_data->srcd, my_data->dstd, rows, cols, low, high);
+  else
+    transpose_tiles_f(my_data->srcf, my_data->dstf, rows, cols, low, high);
+
+  if (NUM_THREADS > 1) pthread_exit(NULL);
+  return NULL;
+} /* End of transpose_work */
+
+/* Run transpose_work() on NUM_THREADS threads; td has everything but the
+   thread_id. With 1 thread it is called directly. */
+void transpose_mt(struct thread_data *td)
+{
+  pthread_t threads[NUM_THREADS];
+  struct thread_data thread_data_array[NUM_THREADS];
+  int rc;
+  long t;
+
+  if (NUM_THREADS == 1) {
+    td->thread_id = 0;
+    transpose_work((void*) td);
+    return;
+  }
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    thread_data_array[t] = *td;
+    thread_data_array[t].thread_id = t;
+    rc = pthread_create(&threads[t], NULL, transpose_work,
+                        (void*) &thread_data_array[t]);
+    if (rc) {
+      printf("ERROR; return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    if (pthread_join(threads[t],NULL)){
+      printf("ERROR; code on return from join is %d\n", rc);
+      exit(-1);
+    }
+  }
+}
+
+/* Transpose the rows x cols matrix src into the cols x rows matrix dst */
+void transpose_mt_d(const double *src, double *dst, long int rows,
+                    long int cols)
+{
+  struct thread_data td = {0, src, dst, NULL, NULL, rows, cols};
+  transpose_mt(&td);
+}
+
+void transpose_mt_f(const float *src, float *dst, long int rows,
+                    long int cols)
+{
+  struct thread_data td = {0, NULL, NULL, src, dst, rows, cols};
+  transpose_mt(&td);
+}
+
+/*****************************************************************************/
+/* Compare against a scalar transpose on square and rectangular shapes that
+   are and aren't multiples of the tile and block sizes, with 1 thread and
+   with NUM_THREADS threads (including more threads than tiles), with
+   regular and with streaming stores (which only apply when the rows of dst
+   are 32-byte aligned, e.g. 136 x 72 and 200 x 104). Returns
+   the number of wrong elements. */
+long int check_transposes(void)
+{
+  static const long int shapes[][2] = {
+    {1, 1}, {3, 5}, {8, 8}, {7, 33}, {33, 7}, {128, 128}, {129, 127},
+    {100, 300}, {300, 100}, {1000, 13}, {13, 1000}, {517, 509},
+    {136, 72}, {200, 104}
+  };
+  const int nshapes = sizeof(shapes) / sizeof(shapes[0]);
+  const long int max_elems = 517 * 509;  /* the biggest shape */
+  double *d0, *d1;
+  float *f0, *f1;
+  long int s, i, j, rows, cols, errors = 0;
+  int pass, threads = NUM_THREADS;
+  arena_mark_t mark = arena_mark(default_arena());
+
+  d0 = (double *) arena_alloc(default_arena(), max_elems*sizeof(double));
+  d1 = (double *) arena_alloc(default_arena(), max_elems*sizeof(double));
+  f0 = (float *) arena_alloc(default_arena(), max_elems*sizeof(float));
+  f1 = (float *) arena_alloc(default_arena(), max_elems*sizeof(float));
+  if (!d0 || !d1 || !f0 || !f1) {
+    printf("COULDN'T ALLOCATE check arrays\n");
+    exit(-1);
+  }
+  for (i = 0; i < max_elems; i++) {
+    d0[i] = (double)(i);
+    f0[i] = (float)(i);
+  }
+
+  /* 1 thread / NUM_THREADS threads, each with regular and streaming
+     stores */
+  for (pass = 0; pass < 4; pass++) {
+    NUM_THREADS = (pass & 1) ? threads : 1;
+    NT_STORES = pass >> 1;
+    for (s = 0; s < nshapes; s++) {
+      rows = shapes[s][0];
+      cols = shapes[s][1];
+      for (i = 0; i < max_elems; i++) d1[i] = f1[i] = -1;
+      transpose_mt_d(d0, d1, rows, cols);
+      transpose_mt_f(f0, f1, rows, cols);
+      for (i = 0; i < rows; i++)
+        for (j = 0; j < cols; j++) {
+          if (d1[j*rows + i] != d0[i*cols + j]) errors++;
+          if (f1[j*rows + i] != f0[i*cols + j]) errors++;
+        }
+    }
+  }
+  NUM_THREADS = threads;
+  NT_STORES = -1;
+
+  arena_release(default_arena(), mark);
+  return errors;
+}
@@ -0,0 +1,368 @@
+/* transpose_kernels.h -- AVX micro-kernels for matrix transposes
+
+   Header-only. Every function works on a block inside a larger row-major
+   matrix, so it takes a leading dimension (elements between the starts of
+   consecutive rows) for the source and the destination:
+
+     dst[j*ldd + i] = src[i*lds + j]   for the rows x cols block
+
+   transpose_4x4d() is the kernel from test_transpose.c
+   (transpose_4x4d(double *src, double *dst, int N)) with the strides
+   separated out. transpose_block_d() tiles a block of any shape with it and
+   does the ragged edges in scalar. transpose_8x8f() and transpose_block_f()
+   are the same for floats.
+
+   In place (square matrices, one leading dimension ld): the transpose of
+   an n x n matrix swaps the tile at (i,j) with the transpose of the tile at
+   (j,i). transpose_swap_4x4d()/transpose_swap_8x8f() load both tiles,
+   transpose them in registers and store each into the other's place; a
+   tile on the diagonal is done by passing it as both arguments.
+   transpose_swap_block_d/f() and transpose_diag_block_d/f() do that for a
+   pair of blocks / one diagonal block of any size.
+
+   Streaming stores: transpose_block_d_nt()/transpose_block_f_nt() write the
+   destination with non-temporal stores (_mm256_stream_pd/ps), which skip
+   the read-for-ownership of each destination line and don't evict the
+   source from the cache. They do two micro tiles at a time so that every
+   destination row gets a whole 64-byte line. The destination rows must be
+   32-byte aligned (dst aligned and ldd a multiple of 4 doubles / 8
+   floats). The stores are weakly ordered: call _mm_sfence() after the last
+   one, before anything else (e.g. another thread) reads dst. Needs -mavx.
+ */
+
+#ifndef _TRANSPOSE_KERNELS_H_
+#define _TRANSPOSE_KERNELS_H_
+
+#include <immintrin.h>
+
+/* 4x4 doubles in registers: 4 unpacks, 4 lane permutes */
+static inline void transpose_4x4d_reg(__m256d r[4])
+{
+  /* unpack low/high pairs */
+  __m256d t0 = _mm256_unpacklo_pd(r[0], r[1]);
+  __m256d t1 = _mm256_unpackhi_pd(r[0], r[1]);
+  __m256d t2 = _mm256_unpacklo_pd(r[2], r[3]);
+  __m256d t3 = _mm256_unpackhi_pd(r[2], r[3]);
+
+  /* swap 128-bit halves into place */
+  r[0] = _mm256_permute2f128_pd(t0, t2, 0x20);
+  r[1] = _mm256_permute2f128_pd(t1, t3, 0x20);
+  r[2] = _mm256_permute2f128_pd(t0, t2, 0x31);
+  r[3] = _mm256_permute2f128_pd(t1, t3, 0x31);
+}
+
+/* 4x4 doubles: 4 loads, 4 unpacks, 4 lane permutes, 4 stores. All loads
+   come before the stores, so src == dst (a diagonal tile) is fine. */
+static inline void transpose_4x4d(const double *src, long int lds,
+                                  double *dst, long int ldd)
+{
+  __m256d r[4];
+  int k;
+
+  for (k = 0; k < 4; k++) r[k] = _mm256_loadu_pd(&src[k*lds]);
+  transpose_4x4d_reg(r);
+  for (k = 0; k < 4; k++) _mm256_storeu_pd(&dst[k*ldd], r[k]);
+}
+
+/* 8x8 floats in registers: unpack pairs, shuffle quads, then swap 128-bit
+   lanes -- 24 shuffles for 8 rows */
+static inline void transpose_8x8f_reg(__m256 r[8])
+{
+  __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+  __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+  __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+  __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+  __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+  __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+  __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+  __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+
+  __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+  __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+  __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+  __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+  __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0));
+  __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2));
+  __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0));
+  __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+
+  r[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+  r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+  r[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+  r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+  r[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+  r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+  r[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+  r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+/* 8x8 floats: 8 loads, 24 shuffles, 8 stores (src == dst is fine) */
+static inline void transpose_8x8f(const float *src, long int lds,
+                                  float *dst, long int ldd)
+{
+  __m256 r[8];
+  int k;
+
+  for (k = 0; k < 8; k++) r[k] = _mm256_loadu_ps(&src[k*lds]);
+  transpose_8x8f_reg(r);
+  for (k = 0; k < 8; k++) _mm256_storeu_ps(&dst[k*ldd], r[k]);
+}
+
+/* rows x cols block of doubles, any shape: 4x4 kernels where they fit,
+   scalar for the last rows%4 rows and cols%4 columns */
+static inline void transpose_block_d(const double *src, long int lds,
+                                     double *dst, long int ldd,
+                                     long int rows, long int cols)
+{
+  long int i, j;
+  long int rows4 = rows & ~3L, cols4 = cols & ~3L;
+
+  for (i = 0; i < rows4; i += 4) {
+    for (j = 0; j < cols4; j += 4) {
+      transpose_4x4d(&src[i*lds + j], lds, &dst[j*ldd + i], ldd);
+    }
+    for (j = cols4; j < cols; j++) {
+      dst[j*ldd + i+0] = src[(i+0)*lds + j];
+      dst[j*ldd + i+1] = src[(i+1)*lds + j];
+      dst[j*ldd + i+2] = src[(i+2)*lds + j];
+      dst[j*ldd + i+3] = src[(i+3)*lds + j];
+    }
+  }
+  for (i = rows4; i < rows; i++) {
+    for (j = 0; j < cols; j++) {
+      dst[j*ldd + i] = src[i*lds + j];
+    }
+  }
+}
+
+/* rows x cols block of floats, any shape: 8x8 kernels where they fit */
+static inline void transpose_block_f(const float *src, long int lds,
+                                     float *dst, long int ldd,
+                                     long int rows, long int cols)
+{
+  long int i, j, k;
+  long int rows8 = rows & ~7L, cols8 = cols & ~7L;
+
+  for (i = 0; i < rows8; i += 8) {
+    for (j = 0; j < cols8; j += 8) {
+      transpose_8x8f(&src[i*lds + j], lds, &dst[j*ldd + i], ldd);
+    }
+    for (j = cols8; j < cols; j++) {
+      for (k = 0; k < 8; k++) dst[j*ldd + i+k] = src[(i+k)*lds + j];
+    }
+  }
+  for (i = rows8; i < rows; i++) {
+    for (j = 0; j < cols; j++) {
+      dst[j*ldd + i] = src[i*lds + j];
+    }
+  }
+}
+
+/* In place: swap the 4x4 tile at a with the transpose of the 4x4 tile at b
+   (and vice versa), both in the same matrix with leading dimension ld */
+static inline void transpose_swap_4x4d(double *a, double *b, long int ld)
+{
+  __m256d ra[4], rb[4];
+  int k;
+
+  for (k = 0; k < 4; k++) {
+    ra[k] = _mm256_loadu_pd(&a[k*ld]);
+    rb[k] = _mm256_loadu_pd(&b[k*ld]);
+  }
+  transpose_4x4d_reg(ra);
+  transpose_4x4d_reg(rb);
+  for (k = 0; k < 4; k++) {
+    _mm256_storeu_pd(&b[k*ld], ra[k]);
+    _mm256_storeu_pd(&a[k*ld], rb[k]);
+  }
+}
+
+static inline void transpose_swap_8x8f(float *a, float *b, long int ld)
+{
+  __m256 ra[8], rb[8];
+  int k;
+
+  for (k = 0; k < 8; k++) {
+    ra[k] = _mm256_loadu_ps(&a[k*ld]);
+    rb[k] = _mm256_loadu_ps(&b[k*ld]);
+  }
+  transpose_8x8f_reg(ra);
+  transpose_8x8f_reg(rb);
+  for (k = 0; k < 8; k++) {
+    _mm256_storeu_ps(&b[k*ld], ra[k]);
+    _mm256_storeu_ps(&a[k*ld], rb[k]);
+  }
+}
+
+/* In place, a pair of off-diagonal blocks: the rows x cols block at a
+   and the cols x rows block at b, where b is a's mirror image across the
+   diagonal. Afterwards each holds the transpose of the other. */
+static inline void transpose_swap_block_d(double *a, double *b, long int ld,
+                                          long int rows, long int cols)
+{
+  long int i, j;
+  long int rows4 = rows & ~3L, cols4 = cols & ~3L;
+  double tmp;
+
+  for (i = 0; i < rows4; i += 4) {
+    for (j = 0; j < cols4; j += 4) {
+      transpose_swap_4x4d(&a[i*ld + j], &b[j*ld + i], ld);
+    }
+  }
+  /* scalar for the ragged right edge and bottom edge of a */
+  for (i = 0; i < rows; i++) {
+    for (j = (i < rows4) ? cols4 : 0; j < cols; j++) {
+      tmp = a[i*ld + j];
+      a[i*ld + j] = b[j*ld + i];
+      b[j*ld + i] = tmp;
+    }
+  }
+}
+
+static inline void transpose_swap_block_f(float *a, float *b, long int ld,
+                                          long int rows, long int cols)
+{
+  long int i, j;
+  long int rows8 = rows & ~7L, cols8 = cols & ~7L;
+  float tmp;
+
+  for (i = 0; i < rows8; i += 8) {
+    for (j = 0; j < cols8; j += 8) {
+      transpose_swap_8x8f(&a[i*ld + j], &b[j*ld + i], ld);
+    }
+  }
+  for (i = 0; i < rows; i++) {
+    for (j = (i < rows8) ? cols8 : 0; j < cols; j++) {
+      tmp = a[i*ld + j];
+      a[i*ld + j] = b[j*ld + i];
+      b[j*ld + i] = tmp;
+    }
+  }
+}
+
+/* In place, an n x n block on the diagonal: swap the tile pairs above and
+   below its diagonal, transpose the diagonal tiles on their own */
+static inline void transpose_diag_block_d(double *a, long int ld, long int n)
+{
+  long int i, j;
+  long int n4 = n & ~3L;
+  double tmp;
+
+  for (i = 0; i < n4; i += 4) {
+    transpose_4x4d(&a[i*ld + i], ld, &a[i*ld + i], ld);
+    for (j = i + 4; j < n4; j += 4) {
+      transpose_swap_4x4d(&a[i*ld + j], &a[j*ld + i], ld);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    for (j = (i < n4) ? n4 : i + 1; j < n; j++) {
+      tmp = a[i*ld + j];
+      a[i*ld + j] = a[j*ld + i];
+      a[j*ld + i] = tmp;
+    }
+  }
+}
+
+static inline void transpose_diag_block_f(float *a, long int ld, long int n)
+{
+  long int i, j;
+  long int n8 = n & ~7L;
+  float tmp;
+
+  for (i = 0; i < n8; i += 8) {
+    transpose_8x8f(&a[i*ld + i], ld, &a[i*ld + i], ld);
+    for (j = i + 8; j < n8; j += 8) {
+      transpose_swap_8x8f(&a[i*ld + j], &a[j*ld + i], ld);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    for (j = (i < n8) ? n8 : i + 1; j < n; j++) {
+      tmp = a[i*ld + j];
+      a[i*ld + j] = a[j*ld + i];
+      a[j*ld + i] = tmp;
+    }
+  }
+}
+
+/* Streaming stores: 8x4 doubles (two 4x4 tiles, one above the other) into
+   4 destination rows of 8 doubles = one 64-byte line each */
+static inline void transpose_8x4d_nt(const double *src, long int lds,
+                                     double *dst, long int ldd)
+{
+  __m256d r[4], s[4];
+  int k;
+
+  for (k = 0; k < 4; k++) {
+    r[k] = _mm256_loadu_pd(&src[k*lds]);
+    s[k] = _mm256_loadu_pd(&src[(k+4)*lds]);
+  }
+  transpose_4x4d_reg(r);
+  transpose_4x4d_reg(s);
+  for (k = 0; k < 4; k++) {
+    _mm256_stream_pd(&dst[k*ldd], r[k]);
+    _mm256_stream_pd(&dst[k*ldd + 4], s[k]);
+  }
+}
+
+/* 16x8 floats (two 8x8 tiles) into 8 destination rows of 16 floats */
+static inline void transpose_16x8f_nt(const float *src, long int lds,
+                                      float *dst, long int ldd)
+{
+  __m256 r[8], s[8];
+  int k;
+
+  for (k = 0; k < 8; k++) {
+    r[k] = _mm256_loadu_ps(&src[k*lds]);
+    s[k] = _mm256_loadu_ps(&src[(k+8)*lds]);
+  }
+  transpose_8x8f_reg(r);
+  transpose_8x8f_reg(s);
+  for (k = 0; k < 8; k++) {
+    _mm256_stream_ps(&dst[k*ldd], r[k]);
+    _mm256_stream_ps(&dst[k*ldd + 8], s[k]);
+  }
+}
+
+/* rows x cols block of doubles with streaming stores; the rows%8 rows and
+   cols%4 columns left over go through transpose_block_d() */
+static inline void transpose_block_d_nt(const double *src, long int lds,
+                                        double *dst, long int ldd,
+                                        long int rows, long int cols)
+{
+  long int i, j;
+  long int rows8 = rows & ~7L, cols4 = cols & ~3L;
+
+  for (i = 0; i < rows8; i += 8) {
+    for (j = 0; j < cols4; j += 4) {
+      transpose_8x4d_nt(&src[i*lds + j], lds, &dst[j*ldd + i], ldd);
+    }
+  }
+  if (cols4 < cols)
+    transpose_block_d(&src[cols4], lds, &dst[cols4*ldd], ldd,
+                      rows8, cols - cols4);
+  if (rows8 < rows)
+    transpose_block_d(&src[rows8*lds], lds, &dst[rows8], ldd,
+                      rows - rows8, cols);
+}
+
+static inline void transpose_block_f_nt(const float *src, long int lds,
+                                        float *dst, long int ldd,
+                                        long int rows, long int cols)
+{
+  long int i, j;
+  long int rows16 = rows & ~15L, cols8 = cols & ~7L;
+
+  for (i = 0; i < rows16; i += 16) {
+    for (j = 0; j < cols8; j += 8) {
+      transpose_16x8f_nt(&src[i*lds + j], lds, &dst[j*ldd + i], ldd);
+    }
+  }
+  if (cols8 < cols)
+    transpose_block_f(&src[cols8], lds, &dst[cols8*ldd], ldd,
+                      rows16, cols - cols8);
+  if (rows16 < rows)
+    transpose_block_f(&src[rows16*lds], lds, &dst[rows16], ldd,
+                      rows - rows16, cols);
+}
+
+#endif /* _TRANSPOSE_KERNELS_H_ */
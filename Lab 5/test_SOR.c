@@ -10,6 +10,7 @@
 #include <time.h>
 #include <math.h>
 #include <pthread.h>
+#include "arena.h"
 
 #ifdef __APPLE__
 /* Shim for Mac OS X (use at your own risk ;-) */
@@ -208,7 +209,7 @@ arr_ptr new_array(long int row_len)
 
   /* Allocate and declare array */
   if (row_len > 0) {
-    data_t *data = (data_t *) calloc(row_len*row_len, sizeof(data_t));
+    data_t *data = (data_t *) arena_calloc(default_arena(), row_len*row_len, sizeof(data_t));
     if (!data) {
       free((void *) result);
       printf("\n COULDN'T ALLOCATE STORAGE \n", result->rowlen);
@@ -11,6 +11,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "arena.h"
 
 #define ARRAY_SIZE 32
 
@@ -100,7 +101,7 @@ arr_ptr new_array(long int row_len)
 
   /* Allocate and declare array */
   if (row_len > 0) {
-    data_t *data = (data_t *) calloc(row_len*row_len, sizeof(data_t));
+    data_t *data = (data_t *) arena_calloc(default_arena(), row_len*row_len, sizeof(data_t));
     if (!data) {
       free((void *) result);
       printf("COULDN'T ALLOCATE %ld bytes STORAGE \n",
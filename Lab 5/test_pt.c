@@ -1,6 +1,10 @@
 /************************************************************************
 
-  gcc -pthread test_pt.c -lpthread -lm -lrt -o test_pt
+  gcc -O1 -mavx2 -mfma -pthread test_pt.c -lpthread -lm -lrt -o test_pt
+
+  The pt_cb_vec*() options use vmath.h; add -mavx512f to get 8 lanes
+  instead of 4, and -DVMATH_ACCURACY=1 for the faster, less accurate
+  polynomials.
 
  */
 
@@ -9,6 +13,8 @@
 #include <pthread.h>
 #include <time.h>
 #include <math.h>
+#include "arena.h"
+#include "vmath.h"
 
 #define CPNS 3.0    /* Cycles per nanosecond -- Adjust to your computer,
                        for example a 3.2 GhZ GPU, this would be 3.2 */
@@ -19,7 +25,7 @@
 
 #define NUM_TESTS 10
 
-#define OPTIONS 3        // Current setting, vary as you wish!
+#define OPTIONS 5        // Current setting, vary as you wish!
 #define IDENT 0
 
 #define INIT_LOW -10.0
@@ -54,6 +60,10 @@ int init_matrix_rand_grad(matrix_ptr m, long int row_len);
 int zero_matrix(matrix_ptr m, long int len);
 void pt_cb_base(matrix_ptr a, matrix_ptr b, matrix_ptr c);
 void pt_cb_pthr(matrix_ptr a, matrix_ptr b, matrix_ptr c);
+void pt_cb_vec(matrix_ptr a, matrix_ptr b, matrix_ptr c);
+void pt_cb_vec_pthr(matrix_ptr a, matrix_ptr b, matrix_ptr c);
+double check_cb_vec(matrix_ptr a, matrix_ptr b, matrix_ptr c, matrix_ptr d);
+double check_vm_trig(double max_x, double *tan_ulp);
 void pt_mb(matrix_ptr a, matrix_ptr b, matrix_ptr c, matrix_ptr d);
 void pt_ob(matrix_ptr a, matrix_ptr b, matrix_ptr c);
 
@@ -132,6 +142,18 @@ int main(int argc, char *argv[])
   alloc_size = A*x*x + B*x + C;
 
   printf("Test SOR pthreads\n");
+
+  /* vm_cos and vm_tan against libm, in ULP, for |x| up to 1e6 */
+  {
+    double cos_ulp, tan_ulp;
+    cos_ulp = check_vm_trig(1.0e6, &tan_ulp);
+    printf("vm_cos max error %g ULP, vm_tan max error %g ULP\n",
+           cos_ulp, tan_ulp);
+    if (VMATH_ACCURACY == 2 && (cos_ulp > 8.0 || tan_ulp > 8.0)) {
+      printf("check_vm_trig FAILED\n");
+      exit(-1);
+    }
+  }
   wd = wakeup_delay();
 
   /* declare and initialize the matrix structure */
@@ -188,6 +210,35 @@ int main(int argc, char *argv[])
     printf("iter %d done\n", x);
   }
 
+  OPTION++;
+  printf("OPTION %d: pt_cb_vec() with %d lanes\n", OPTION, VM_LANES);
+  for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
+    init_matrix_rand(a0, n);
+    set_matrix_rowlen(a0, n);
+    set_matrix_rowlen(b0, n);
+    set_matrix_rowlen(c0, n);
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    pt_cb_vec(a0, b0, c0);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    time_stamp[OPTION][x] = interval(time_start, time_stop);
+    printf("iter %ld done\n", x);
+  }
+
+  NUM_THREADS = 4;
+  OPTION++;
+  printf("OPTION %d: pt_cb_vec_pthr() with %d threads\n", OPTION, NUM_THREADS);
+  for (x=0; x<NUM_TESTS && (n = A*x*x + B*x + C, n<=alloc_size); x++) {
+    init_matrix_rand(a0, n);
+    set_matrix_rowlen(a0, n);
+    set_matrix_rowlen(b0, n);
+    set_matrix_rowlen(c0, n);
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    pt_cb_vec_pthr(a0, b0, c0);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    time_stamp[OPTION][x] = interval(time_start, time_stop);
+    printf("iter %ld done\n", x);
+  }
+
   /* enable this to try the experiment on a machine with 8+ cores, and don't
      forget to also change OPTIONS definition at top! */
   /*
@@ -209,7 +260,7 @@ int main(int argc, char *argv[])
 
   printf("\n");
   printf("All measurements are in cycles (if CPNS is set correctly in the code)\n");
-  printf("row length, 1 thread, 2 threads, 4 threads\n");
+  printf("row length, 1 thread, 2 threads, 4 threads, vec 1 thread, vec 4 threads\n");
   {
     int i, j;
     for (i = 0; i < NUM_TESTS; i++) {
@@ -222,6 +273,15 @@ int main(int argc, char *argv[])
     }
   }
 
+  /* compare the vector version against libm on the largest size */
+  set_matrix_rowlen(a0, alloc_size);
+  set_matrix_rowlen(b0, alloc_size);
+  set_matrix_rowlen(c0, alloc_size);
+  set_matrix_rowlen(d0, alloc_size);
+  init_matrix_rand(a0, alloc_size);
+  printf("\npt_cb_vec() max relative error vs. libm: %g\n",
+         check_cb_vec(a0, b0, c0, d0));
+
   printf("test_pt done\n");
   printf("Wakeup delay calculated %f\n", wd);
 
@@ -243,7 +303,7 @@ matrix_ptr new_matrix(long int row_len)
 
   /* Allocate and declare array */
   if (row_len > 0) {
-    data_t *data = (data_t *) calloc(row_len*row_len, sizeof(data_t));
+    data_t *data = (data_t *) arena_calloc(default_arena(), row_len*row_len, sizeof(data_t));
     if (!data) {
 	  free((void *) result);
 	  printf("COULDN'T ALLOCATE %ld bytes STORAGE \n",
@@ -426,3 +486,153 @@ void pt_cb_pthr(matrix_ptr a, matrix_ptr b, matrix_ptr c)
     }
   }
 }
+
+/***************************************************************************/
+/* CPU bound, vectorized. Same function as pt_cb_base(), but exp, cos,
+   sqrt, tan and cosh come from vmath.h and work on VM_LANES elements at a
+   time. The leftover elements at the end go through libm. */
+void pt_cb_vec(matrix_ptr a, matrix_ptr b, matrix_ptr c)
+{
+  long int i;
+  long int rowlen = get_matrix_rowlen(a);
+  long int len = rowlen*rowlen;
+  data_t *a0 = get_matrix_start(a);
+  data_t *c0 = get_matrix_start(c);
+
+  for (i = 0; i + VM_LANES <= len; i += VM_LANES) {
+    vm_t v = VM_LOADU(&a0[i]);
+    VM_STOREU(&c0[i], vm_cosh(vm_tan(vm_sqrt(vm_cos(vm_exp(v))))));
+  }
+  for (; i < len; i++) {
+    c0[i] = (data_t)(cosh(tan(sqrt(cos(exp((double)(a0[i])))))));
+  }
+}
+
+/* Worker thread for the vectorized version. Each thread's range is rounded
+   down to a multiple of VM_LANES so only the last thread has a tail. */
+void *cb_vec_work(void *threadarg)
+{
+  long int i, low, high;
+  struct thread_data *my_data;
+  my_data = (struct thread_data *) threadarg;
+  int taskid = my_data->thread_id;
+  matrix_ptr a0 = my_data->a;
+  matrix_ptr c0 = my_data->c;
+  long int rowlen = get_matrix_rowlen(a0);
+  long int len = rowlen*rowlen;
+  data_t *aM = get_matrix_start(a0);
+  data_t *cM = get_matrix_start(c0);
+
+  low = ((taskid * len)/NUM_THREADS) / VM_LANES * VM_LANES;
+  high = ((taskid+1) * len)/NUM_THREADS / VM_LANES * VM_LANES;
+  if (taskid == NUM_THREADS-1) high = len;
+
+  for (i = low; i + VM_LANES <= high; i += VM_LANES) {
+    vm_t v = VM_LOADU(&aM[i]);
+    VM_STOREU(&cM[i], vm_cosh(vm_tan(vm_sqrt(vm_cos(vm_exp(v))))));
+  }
+  for (; i < high; i++) {
+    cM[i] = (data_t)(cosh(tan(sqrt(cos(exp((double)(aM[i])))))));
+  }
+
+  pthread_exit(NULL);
+} /* End of cb_vec_work */
+
+/* pthread calling function for the vectorized version */
+void pt_cb_vec_pthr(matrix_ptr a, matrix_ptr b, matrix_ptr c)
+{
+  pthread_t threads[NUM_THREADS];
+  struct thread_data thread_data_array[NUM_THREADS];
+  int rc;
+  long t;
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    thread_data_array[t].thread_id = t;
+    thread_data_array[t].a = a;
+    thread_data_array[t].b = b;
+    thread_data_array[t].c = c;
+    thread_data_array[t].d = 0;
+    rc = pthread_create(&threads[t], NULL, cb_vec_work,
+			(void*) &thread_data_array[t]);
+    if (rc) {
+      printf("ERROR; return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  for (t = 0; t < NUM_THREADS; t++) {
+    if (pthread_join(threads[t],NULL)){
+      printf("ERROR; code on return from join is %d\n", rc);
+      exit(-1);
+    }
+  }
+}
+
+/* Run pt_cb_base() into c and pt_cb_vec() into d and return the largest
+   relative difference. Elements where both are NaN (sqrt of a negative
+   cosine) count as equal; NaN in only one of them returns infinity. */
+double check_cb_vec(matrix_ptr a, matrix_ptr b, matrix_ptr c, matrix_ptr d)
+{
+  long int i;
+  long int rowlen = get_matrix_rowlen(a);
+  data_t *c0 = get_matrix_start(c);
+  data_t *d0 = get_matrix_start(d);
+  double err, max_err = 0.0;
+
+  pt_cb_base(a, b, c);
+  pt_cb_vec(a, b, d);
+  for (i = 0; i < rowlen*rowlen; i++) {
+    if (isnan(c0[i]) || isnan(d0[i])) {
+      if (!(isnan(c0[i]) && isnan(d0[i]))) return INFINITY;
+      continue;
+    }
+    err = fabs(d0[i] - c0[i]) / fabs(c0[i]);
+    if (err > max_err) max_err = err;
+  }
+  return max_err;
+}
+
+/* units in the last place between v and the libm result ref */
+static double ulp_error(double v, double ref)
+{
+  double ulp = nextafter(fabs(ref), INFINITY) - fabs(ref);
+  return fabs(v - ref) / ulp;
+}
+
+/* Largest error in ULP of vm_cos against cos, returned, and of vm_tan
+   against tan, in *tan_ulp: random x with |x| < 1, 10, ... up to max_x,
+   and x within 1e-6 of multiples of pi/2, where the reduced argument is
+   small and any error in the reduction shows up most. */
+double check_vm_trig(double max_x, double *tan_ulp)
+{
+  long int i, l;
+  double in[VM_LANES], out[VM_LANES], e, scale = 1.0;
+  double cos_max = 0.0, tan_max = 0.0;
+
+  srandom(1);
+  for (i = 0; i < 200000; i++) {
+    for (l = 0; l < VM_LANES; l++) {
+      if (l & 1)
+        in[l] = (double)(random() % (long int)(max_x / M_PI_2)) * M_PI_2
+                + ((double)random() / RAND_MAX - 0.5) * 1.0e-6;
+      else
+        in[l] = ((double)random() / RAND_MAX * 2.0 - 1.0) * scale;
+      if (random() & 1) in[l] = -in[l];
+    }
+    scale = (scale * 10.0 > max_x) ? 1.0 : scale * 10.0;
+
+    VM_STOREU(out, vm_cos(VM_LOADU(in)));
+    for (l = 0; l < VM_LANES; l++) {
+      e = ulp_error(out[l], cos(in[l]));
+      if (e > cos_max) cos_max = e;
+    }
+    VM_STOREU(out, vm_tan(VM_LOADU(in)));
+    for (l = 0; l < VM_LANES; l++) {
+      e = ulp_error(out[l], tan(in[l]));
+      if (e > tan_max) tan_max = e;
+    }
+  }
+
+  *tan_ulp = tan_max;
+  return cos_max;
+}
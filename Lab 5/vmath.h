@@ -0,0 +1,288 @@
+/* vmath.h -- vectorized double precision exp, log, cos, tan, cosh, sqrt
+
+   Header-only, for the CPU-bound kernels in test_pt.c. Each function works
+   on one vector of doubles: 8 lanes (__m512d) when compiled with
+   -mavx512f, otherwise 4 lanes (__m256d, needs -mavx2 -mfma). VM_LANES
+   tells the caller which one it got.
+
+   Accuracy is set at compile time with VMATH_ACCURACY:
+
+     2 (default)  "full"   polynomials long enough for a few ULP over the
+                           reduced ranges, comparable to libm
+     1            "fast"   shorter polynomials, about 1e-9 relative error
+                           (still far better than float)
+
+   The methods are the textbook ones: reduce the argument to a small range
+   with an exactly representable multiple of ln2 or pi/2 (Cody-Waite, with
+   FMA), evaluate a Taylor polynomial there with Horner's rule, and put the
+   result back together. NaN inputs give NaN outputs. Things we do *not*
+   try to do like libm: log of a denormal is wrong, and cos/tan lose
+   accuracy for |x| much above 1e6 (the same three-part pi/2 is used for
+   every argument).
+ */
+
+#ifndef _VMATH_H_
+#define _VMATH_H_
+
+#include <immintrin.h>
+
+#ifndef VMATH_ACCURACY
+#define VMATH_ACCURACY 2
+#endif
+
+/* -=-=-=-=- Per-ISA building blocks -=-=-=-=- */
+/*
+  Everything below the building blocks is written only in terms of these
+  macros, so it is compiled once for whichever vector width is selected.
+  VM_SELECT(m, a, b) takes b in lanes where the mask m is set, a elsewhere.
+ */
+#ifdef __AVX512F__
+
+#define VM_LANES 8
+typedef __m512d vm_t;
+typedef __mmask8 vm_mask_t;
+#define VM_SET1(x)        _mm512_set1_pd(x)
+#define VM_LOADU(p)       _mm512_loadu_pd(p)
+#define VM_STOREU(p, a)   _mm512_storeu_pd(p, a)
+#define VM_ADD(a, b)      _mm512_add_pd(a, b)
+#define VM_SUB(a, b)      _mm512_sub_pd(a, b)
+#define VM_MUL(a, b)      _mm512_mul_pd(a, b)
+#define VM_DIV(a, b)      _mm512_div_pd(a, b)
+#define VM_FMA(a, b, c)   _mm512_fmadd_pd(a, b, c)
+#define VM_FNMA(a, b, c)  _mm512_fnmadd_pd(a, b, c)
+#define VM_MAX(a, b)      _mm512_max_pd(a, b)
+#define VM_MIN(a, b)      _mm512_min_pd(a, b)
+#define VM_SQRT(a)        _mm512_sqrt_pd(a)
+#define VM_ROUND(a)       _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT)
+#define VM_FLOOR(a)       _mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF)
+#define VM_ABS(a)         _mm512_abs_pd(a)
+#define VM_CMP(a, b, op)  _mm512_cmp_pd_mask(a, b, op)
+#define VM_OR_MASK(m, n)  ((vm_mask_t)((m) | (n)))
+#define VM_SELECT(m, a, b) _mm512_mask_blend_pd(m, a, b)
+#define VM_CAST_I(a)      _mm512_castpd_si512(a)
+#define VM_CAST_D(i)      _mm512_castsi512_pd(i)
+#define VM_I64_SET1(x)    _mm512_set1_epi64(x)
+#define VM_I64_ADD(a, b)  _mm512_add_epi64(a, b)
+#define VM_I64_SUB(a, b)  _mm512_sub_epi64(a, b)
+#define VM_I64_AND(a, b)  _mm512_and_si512(a, b)
+#define VM_I64_OR(a, b)   _mm512_or_si512(a, b)
+#define VM_I64_SLLI(a, n) _mm512_slli_epi64(a, n)
+#define VM_I64_SRLI(a, n) _mm512_srli_epi64(a, n)
+#define VM_XOR(a, b)      VM_CAST_D(_mm512_xor_si512(VM_CAST_I(a), VM_CAST_I(b)))
+/* whole double (already an integer value) -> int64 lanes */
+#define VM_D2I64(a)       _mm512_cvtepi32_epi64(_mm512_cvtpd_epi32(a))
+typedef __m512i vm_int_t;
+
+#else /* AVX2 */
+
+#define VM_LANES 4
+typedef __m256d vm_t;
+typedef __m256d vm_mask_t;
+#define VM_SET1(x)        _mm256_set1_pd(x)
+#define VM_LOADU(p)       _mm256_loadu_pd(p)
+#define VM_STOREU(p, a)   _mm256_storeu_pd(p, a)
+#define VM_ADD(a, b)      _mm256_add_pd(a, b)
+#define VM_SUB(a, b)      _mm256_sub_pd(a, b)
+#define VM_MUL(a, b)      _mm256_mul_pd(a, b)
+#define VM_DIV(a, b)      _mm256_div_pd(a, b)
+#define VM_FMA(a, b, c)   _mm256_fmadd_pd(a, b, c)
+#define VM_FNMA(a, b, c)  _mm256_fnmadd_pd(a, b, c)
+#define VM_MAX(a, b)      _mm256_max_pd(a, b)
+#define VM_MIN(a, b)      _mm256_min_pd(a, b)
+#define VM_SQRT(a)        _mm256_sqrt_pd(a)
+#define VM_ROUND(a)       _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define VM_FLOOR(a)       _mm256_floor_pd(a)
+#define VM_ABS(a)         _mm256_andnot_pd(_mm256_set1_pd(-0.0), a)
+#define VM_CMP(a, b, op)  _mm256_cmp_pd(a, b, op)
+#define VM_OR_MASK(m, n)  _mm256_or_pd(m, n)
+#define VM_SELECT(m, a, b) _mm256_blendv_pd(a, b, m)
+#define VM_CAST_I(a)      _mm256_castpd_si256(a)
+#define VM_CAST_D(i)      _mm256_castsi256_pd(i)
+#define VM_I64_SET1(x)    _mm256_set1_epi64x(x)
+#define VM_I64_ADD(a, b)  _mm256_add_epi64(a, b)
+#define VM_I64_SUB(a, b)  _mm256_sub_epi64(a, b)
+#define VM_I64_AND(a, b)  _mm256_and_si256(a, b)
+#define VM_I64_OR(a, b)   _mm256_or_si256(a, b)
+#define VM_I64_SLLI(a, n) _mm256_slli_epi64(a, n)
+#define VM_I64_SRLI(a, n) _mm256_srli_epi64(a, n)
+#define VM_XOR(a, b)      _mm256_xor_pd(a, b)
+#define VM_D2I64(a)       _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(a))
+typedef __m256i vm_int_t;
+
+#endif /* __AVX512F__ */
+
+/* -=-=-=-=- End of building blocks -=-=-=-=- */
+
+/* Horner's rule for a Taylor series: sum of c[i] * x^i, i = 0..n-1 */
+static inline vm_t vm_poly(vm_t x, const double *c, int n)
+{
+  vm_t p = VM_SET1(c[n-1]);
+  for (int i = n-2; i >= 0; i--) {
+    p = VM_FMA(p, x, VM_SET1(c[i]));
+  }
+  return p;
+}
+
+/* 1/k!, k = 0..17 */
+static const double vm_inv_fact[18] = {
+  1.0, 1.0, 1.0/2, 1.0/6, 1.0/24, 1.0/120, 1.0/720, 1.0/5040,
+  1.0/40320, 1.0/362880, 1.0/3628800, 1.0/39916800, 1.0/479001600,
+  1.0/6227020800.0, 1.0/87178291200.0, 1.0/1307674368000.0,
+  1.0/20922789888000.0, 1.0/355687428096000.0
+};
+
+#if VMATH_ACCURACY >= 2
+#define VM_EXP_TERMS 14      /* |r| <= ln2/2: error < r^14/14! ~ 4e-18 */
+#define VM_LOG_TERMS 10      /* |f| <= 0.172: error ~ f^21 ~ 1e-16 */
+#define VM_TRIG_TERMS 9      /* |r| <= pi/4: sin to r^17, cos to r^16 */
+#else
+#define VM_EXP_TERMS 9       /* error ~ r^9/9! ~ 3e-10 */
+#define VM_LOG_TERMS 5       /* error ~ f^11 ~ 2e-9 */
+#define VM_TRIG_TERMS 6      /* error ~ r^12/12! ~ 1e-10 */
+#endif
+
+/* exp(x) = 2^n * exp(r), with n = round(x / ln2) and r = x - n*ln2 */
+static inline vm_t vm_exp(vm_t x)
+{
+  const double ln2_hi = 6.93147180369123816490e-01;
+  const double ln2_lo = 1.90821492927058770002e-10;
+  /* Clamp first so that n stays in range. The clamps are written (limit,
+     x) because max/min return their second operand for NaN, so a NaN input
+     is passed through. */
+  vm_t xc = VM_MIN(VM_SET1(709.8), VM_MAX(VM_SET1(-745.2), x));
+  vm_t n = VM_ROUND(VM_MUL(xc, VM_SET1(1.44269504088896340736)));
+  vm_t r = VM_FNMA(n, VM_SET1(ln2_hi), xc);
+  r = VM_FNMA(n, VM_SET1(ln2_lo), r);
+  vm_t p = vm_poly(r, vm_inv_fact, VM_EXP_TERMS);
+  /* 2^n is built directly in the exponent field. n runs from -1075 to
+     1024, which does not fit in a normal exponent, so scale by 2^n1 and
+     2^n2 with n1 + n2 = n, both about n/2. This also gives denormal
+     results near the bottom of the range. */
+  vm_t n1 = VM_FLOOR(VM_MUL(n, VM_SET1(0.5)));
+  vm_t n2 = VM_SUB(n, n1);
+  vm_int_t e1 = VM_I64_SLLI(VM_I64_ADD(VM_D2I64(n1), VM_I64_SET1(1023)), 52);
+  vm_int_t e2 = VM_I64_SLLI(VM_I64_ADD(VM_D2I64(n2), VM_I64_SET1(1023)), 52);
+  vm_t result = VM_MUL(VM_MUL(p, VM_CAST_D(e1)), VM_CAST_D(e2));
+  result = VM_SELECT(VM_CMP(x, VM_SET1(709.782712893384), _CMP_GT_OQ),
+                     result, VM_SET1(__builtin_inf()));
+  result = VM_SELECT(VM_CMP(x, VM_SET1(-745.2), _CMP_LT_OQ),
+                     result, VM_SET1(0.0));
+  return result;
+}
+
+/* log(x) = e*ln2 + log(m), x = 2^e * m with m in [sqrt(1/2), sqrt(2)).
+   log(m) = 2*atanh(f) = 2*(f + f^3/3 + f^5/5 + ...), f = (m-1)/(m+1) */
+static inline vm_t vm_log(vm_t x)
+{
+  static const double c[10] = { 1.0, 1.0/3, 1.0/5, 1.0/7, 1.0/9, 1.0/11,
+                                1.0/13, 1.0/15, 1.0/17, 1.0/19 };
+  vm_int_t bits = VM_CAST_I(x);
+  vm_int_t ebits = VM_I64_SRLI(bits, 52);
+  /* mantissa with the exponent of 1.0, so m is in [1, 2) */
+  vm_t m = VM_CAST_D(VM_I64_OR(VM_I64_AND(bits,
+                                      VM_I64_SET1(0x000fffffffffffffLL)),
+                               VM_I64_SET1(0x3ff0000000000000LL)));
+  /* int64 -> double without AVX-512DQ: put the integer in the mantissa of
+     2^52 and subtract 2^52 */
+  vm_t e = VM_SUB(VM_CAST_D(VM_I64_OR(ebits,
+                                  VM_I64_SET1(0x4330000000000000LL))),
+                  VM_SET1(4503599627370496.0 + 1023.0));
+  vm_mask_t big = VM_CMP(m, VM_SET1(1.41421356237309504880), _CMP_GT_OQ);
+  m = VM_SELECT(big, m, VM_MUL(m, VM_SET1(0.5)));
+  e = VM_SELECT(big, e, VM_ADD(e, VM_SET1(1.0)));
+
+  vm_t f = VM_DIV(VM_SUB(m, VM_SET1(1.0)), VM_ADD(m, VM_SET1(1.0)));
+  vm_t f2 = VM_MUL(f, f);
+  vm_t p = VM_MUL(VM_MUL(VM_SET1(2.0), f), vm_poly(f2, c, VM_LOG_TERMS));
+  vm_t result = VM_FMA(e, VM_SET1(6.93147180559945286227e-01), p);
+
+  /* special cases: log(0) = -inf, log(<0) = NaN, log(inf) = inf, NaN */
+  result = VM_SELECT(VM_CMP(x, VM_SET1(0.0), _CMP_EQ_OQ),
+                     result, VM_SET1(-__builtin_inf()));
+  result = VM_SELECT(VM_OR_MASK(VM_CMP(x, VM_SET1(0.0), _CMP_LT_OQ),
+                                VM_CMP(x, x, _CMP_UNORD_Q)),
+                     result, VM_SET1(__builtin_nan("")));
+  result = VM_SELECT(VM_CMP(x, VM_SET1(__builtin_inf()), _CMP_EQ_OQ),
+                     result, x);
+  return result;
+}
+
+/* Reduce x to r in [-pi/4, pi/4] with x = k*pi/2 + r, and return the
+   quadrant k mod 4 (as a double 0..3) in *quad */
+static inline vm_t vm_trig_reduce(vm_t x, vm_t *quad)
+{
+  /* pi/2 = pio2_1 + pio2_2 + pio2_2t: the first 33 bits, the next 33,
+     and the rest (fdlibm's split) */
+  const double pio2_1 = 1.57079632673412561417e+00;
+  const double pio2_2 = 6.07710050630396597660e-11;
+  const double pio2_2t = 2.02226624879595063154e-21;
+  vm_t k = VM_ROUND(VM_MUL(x, VM_SET1(6.36619772367581382433e-01)));
+  vm_t r = VM_FNMA(k, VM_SET1(pio2_1), x);
+  r = VM_FNMA(k, VM_SET1(pio2_2), r);
+  r = VM_FNMA(k, VM_SET1(pio2_2t), r);
+  *quad = VM_SUB(k, VM_MUL(VM_SET1(4.0),
+                           VM_FLOOR(VM_MUL(k, VM_SET1(0.25)))));
+  return r;
+}
+
+/* sin and cos of a reduced argument |r| <= pi/4 */
+static inline void vm_sincos_reduced(vm_t r, vm_t *s, vm_t *c)
+{
+  static const double sc[9] = {  1.0, -1.0/6, 1.0/120, -1.0/5040,
+    1.0/362880, -1.0/39916800, 1.0/6227020800.0, -1.0/1307674368000.0,
+    1.0/355687428096000.0 };
+  static const double cc[9] = {  1.0, -1.0/2, 1.0/24, -1.0/720,
+    1.0/40320, -1.0/3628800, 1.0/479001600, -1.0/87178291200.0,
+    1.0/20922789888000.0 };
+  vm_t r2 = VM_MUL(r, r);
+  *s = VM_MUL(r, vm_poly(r2, sc, VM_TRIG_TERMS));
+  *c = vm_poly(r2, cc, VM_TRIG_TERMS);
+}
+
+/* cos(x): quadrant 0 cos r, 1 -sin r, 2 -cos r, 3 sin r */
+static inline vm_t vm_cos(vm_t x)
+{
+  vm_t q, s, c;
+  vm_t r = vm_trig_reduce(x, &q);
+  vm_sincos_reduced(r, &s, &c);
+  vm_mask_t odd = VM_OR_MASK(VM_CMP(q, VM_SET1(1.0), _CMP_EQ_OQ),
+                             VM_CMP(q, VM_SET1(3.0), _CMP_EQ_OQ));
+  vm_mask_t neg = VM_OR_MASK(VM_CMP(q, VM_SET1(1.0), _CMP_EQ_OQ),
+                             VM_CMP(q, VM_SET1(2.0), _CMP_EQ_OQ));
+  vm_t result = VM_SELECT(odd, c, s);
+  return VM_SELECT(neg, result, VM_XOR(result, VM_SET1(-0.0)));
+}
+
+/* tan(x): sin r / cos r in even quadrants, -cos r / sin r in odd ones */
+static inline vm_t vm_tan(vm_t x)
+{
+  vm_t q, s, c;
+  vm_t r = vm_trig_reduce(x, &q);
+  vm_sincos_reduced(r, &s, &c);
+  vm_mask_t odd = VM_OR_MASK(VM_CMP(q, VM_SET1(1.0), _CMP_EQ_OQ),
+                             VM_CMP(q, VM_SET1(3.0), _CMP_EQ_OQ));
+  vm_t num = VM_SELECT(odd, s, VM_XOR(c, VM_SET1(-0.0)));
+  vm_t den = VM_SELECT(odd, c, s);
+  return VM_DIV(num, den);
+}
+
+/* cosh(x) = (e + 1/e)/2 with e = exp(|x|). For |x| > 709 exp overflows
+   before cosh does, so there we use (h/2)*h with h = exp(|x|/2) instead
+   (1/e is negligible, and halving |x| is exact). */
+static inline vm_t vm_cosh(vm_t x)
+{
+  vm_t ax = VM_ABS(x);
+  vm_mask_t big = VM_CMP(ax, VM_SET1(709.0), _CMP_GT_OQ);
+  vm_t e = vm_exp(VM_SELECT(big, ax, VM_MUL(ax, VM_SET1(0.5))));
+  vm_t half_e = VM_MUL(VM_SET1(0.5), e);
+  return VM_SELECT(big, VM_FMA(VM_SET1(0.5), VM_DIV(VM_SET1(1.0), e), half_e),
+                   VM_MUL(half_e, e));
+}
+
+/* sqrt is a single (correctly rounded) instruction */
+static inline vm_t vm_sqrt(vm_t x)
+{
+  return VM_SQRT(x);
+}
+
+#endif /* _VMATH_H_ */
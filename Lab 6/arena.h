@@ -0,0 +1,294 @@
+/* arena.h -- aligned arena allocator with transparent huge page support
+
+   Header-only. An arena hands out blocks from a few large mappings instead
+   of calling malloc/calloc for every array, so that
+
+     - every block is aligned to the arena's alignment (64 bytes, a cache
+       line, by default; any power of two up to the 4 KB page size),
+     - big arenas can be backed by 2 MB transparent huge pages (Linux,
+       madvise(MADV_HUGEPAGE)), which cuts TLB misses on large matrices,
+     - all the blocks can be given back at once with arena_reset() and the
+       memory reused, e.g. between sizes of a sweep, without going back to
+       the OS.
+
+   Usage:
+
+     arena_ptr ar = new_arena(0, 64, 1);        // default chunk size, 64-byte
+                                                // alignment, huge pages
+     double *a = arena_calloc(ar, n, sizeof(double));
+     arena_mark_t m = arena_mark(ar);           // stack-like scratch space
+     double *tmp = arena_alloc(ar, n * sizeof(double));
+     ...
+     arena_release(ar, m);                      // frees tmp only
+     arena_reset(ar);                           // frees everything, keeps
+                                                // the pages for reuse
+     free_arena(ar);
+
+   The array/matrix constructors use default_arena(), which is created on
+   first use. Memory from an arena is never freed on its own -- only by
+   arena_release/arena_reset/free_arena. Not thread safe: allocate from one
+   thread (first-touch of the pages still happens wherever the data is
+   initialized).
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define ARENA_CHUNK (64L << 20)     /* default size of one mapping: 64 MB */
+#define ARENA_HUGE_PAGE (2L << 20)  /* 2 MB */
+#define ARENA_ALIGN 64              /* default alignment: one cache line */
+
+/* One mapping. Arenas grow by adding chunks to the list. */
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  char *base;
+  size_t size;      /* usable bytes */
+  size_t used;      /* bytes handed out */
+  size_t dirty;     /* high water mark; bytes above it are still zero */
+  size_t mapped;    /* bytes to give back to the OS */
+  int huge;         /* 1 if madvise(MADV_HUGEPAGE) was accepted */
+} arena_chunk;
+
+typedef struct {
+  arena_chunk *first;
+  arena_chunk *cur;
+  size_t chunk_size;
+  size_t align;
+  int use_huge;
+} arena_rec, *arena_ptr;
+
+/* position to go back to with arena_release() */
+typedef struct {
+  arena_chunk *chunk;
+  size_t used;
+} arena_mark_t;
+
+/* Get a chunk of at least size bytes. With huge pages the mapping is
+   rounded to 2 MB and its start aligned to 2 MB (mmap only guarantees 4 KB,
+   and THP can only use 2 MB aligned ranges), by mapping 2 MB extra and
+   trimming the ends. */
+static inline arena_chunk *arena_new_chunk(size_t size, int use_huge)
+{
+  arena_chunk *c = (arena_chunk *) malloc(sizeof(arena_chunk));
+  if (!c) return NULL;
+  c->next = NULL;
+  c->used = 0;
+  c->dirty = 0;
+  c->huge = 0;
+
+#ifdef __linux__
+  {
+    size_t pad = use_huge ? ARENA_HUGE_PAGE : 0;
+    size_t len;
+    char *p, *start;
+
+    if (use_huge) size = (size + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+    len = size + pad;
+    p = (char *) mmap(NULL, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      free(c);
+      return NULL;
+    }
+    start = p;
+    if (use_huge) {
+      start = (char *)(((uintptr_t) p + ARENA_HUGE_PAGE - 1)
+                       & ~(uintptr_t)(ARENA_HUGE_PAGE - 1));
+      if (start > p) munmap(p, start - p);
+      if (start + size < p + len) munmap(start + size, (p + len) - (start + size));
+#ifdef MADV_HUGEPAGE
+      c->huge = (madvise(start, size, MADV_HUGEPAGE) == 0);
+#endif
+    }
+    c->base = start;
+    c->size = size;
+    c->mapped = size;
+  }
+#else
+  /* no mmap/madvise: plain aligned allocation, zeroed to match mmap */
+  if (posix_memalign((void **) &c->base, 4096, size)) {
+    free(c);
+    return NULL;
+  }
+  memset(c->base, 0, size);
+  c->size = size;
+  c->mapped = 0;
+#endif
+
+  return c;
+}
+
+static inline void arena_free_chunk(arena_chunk *c)
+{
+#ifdef __linux__
+  munmap(c->base, c->mapped);
+#else
+  free(c->base);
+#endif
+  free(c);
+}
+
+/* Create an arena. chunk_size 0 means ARENA_CHUNK, align 0 means
+   ARENA_ALIGN. No memory is mapped until the first allocation. */
+static inline arena_ptr new_arena(size_t chunk_size, size_t align, int use_huge)
+{
+  arena_ptr result = (arena_ptr) malloc(sizeof(arena_rec));
+  if (!result) return NULL;  /* Couldn't allocate storage */
+
+  result->first = NULL;
+  result->cur = NULL;
+  result->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK;
+  result->align = align ? align : ARENA_ALIGN;
+  result->use_huge = use_huge;
+
+  return result;
+}
+
+/* Allocate bytes aligned to the arena's alignment. *dirty is set to how
+   many bytes at the start of the block have been handed out before (since
+   the chunk was mapped); the rest is still zero from mmap. */
+static inline void *arena_alloc_dirty(arena_ptr a, size_t bytes, size_t *dirty)
+{
+  arena_chunk *c = a->cur;
+  size_t off;
+
+  /* try the current chunk, then any chunks left over from before a reset */
+  while (c) {
+    off = (c->used + a->align - 1) & ~(a->align - 1);
+    if (off + bytes <= c->size) {
+      *dirty = (c->dirty > off) ? c->dirty - off : 0;
+      if (*dirty > bytes) *dirty = bytes;
+      c->used = off + bytes;
+      if (c->used > c->dirty) c->dirty = c->used;
+      a->cur = c;
+      return c->base + off;
+    }
+    if (!c->next) break;
+    c = c->next;
+    c->used = 0;
+  }
+
+  /* need a new chunk, big enough for this block on its own */
+  {
+    size_t size = bytes + a->align;
+    arena_chunk *n;
+    if (size < a->chunk_size) size = a->chunk_size;
+    n = arena_new_chunk(size, a->use_huge);
+    if (!n) return NULL;
+    if (c) c->next = n;
+    else a->first = n;
+    a->cur = n;
+    n->used = bytes;
+    n->dirty = bytes;
+    *dirty = 0;
+    return n->base;   /* chunk bases are at least page aligned */
+  }
+}
+
+/* Allocate bytes aligned to the arena's alignment; NULL if the OS runs out.
+   The contents are undefined (use arena_calloc() for zeroed memory). */
+static inline void *arena_alloc(arena_ptr a, size_t bytes)
+{
+  size_t dirty;
+  return arena_alloc_dirty(a, bytes, &dirty);
+}
+
+/* Like calloc(). Only the part of the block that was used before gets
+   cleared, so a fresh arena doesn't touch (and fault in) pages until the
+   caller initializes them. */
+static inline void *arena_calloc(arena_ptr a, size_t count, size_t size)
+{
+  size_t dirty;
+  char *p = (char *) arena_alloc_dirty(a, count * size, &dirty);
+
+  if (p && dirty) memset(p, 0, dirty);
+  return p;
+}
+
+/* Free every block in the arena but keep the chunks for reuse */
+static inline void arena_reset(arena_ptr a)
+{
+  arena_chunk *c;
+
+  for (c = a->first; c; c = c->next) c->used = 0;
+  a->cur = a->first;
+}
+
+/* Remember the current position ... */
+static inline arena_mark_t arena_mark(arena_ptr a)
+{
+  arena_mark_t m;
+  m.chunk = a->cur;
+  m.used = a->cur ? a->cur->used : 0;
+  return m;
+}
+
+/* ... and free everything allocated after it */
+static inline void arena_release(arena_ptr a, arena_mark_t m)
+{
+  arena_chunk *c;
+
+  if (!m.chunk) {
+    arena_reset(a);
+    return;
+  }
+  for (c = m.chunk->next; c; c = c->next) c->used = 0;
+  m.chunk->used = m.used;
+  a->cur = m.chunk;
+}
+
+/* Give all the memory back to the OS */
+static inline void free_arena(arena_ptr a)
+{
+  arena_chunk *c = a->first, *next;
+
+  while (c) {
+    next = c->next;
+    arena_free_chunk(c);
+    c = next;
+  }
+  free(a);
+}
+
+/* total bytes currently handed out, and whether any chunk got huge pages */
+static inline size_t get_arena_used(arena_ptr a)
+{
+  size_t total = 0;
+  arena_chunk *c;
+
+  for (c = a->first; c; c = c->next) total += c->used;
+  return total;
+}
+
+static inline int get_arena_huge(arena_ptr a)
+{
+  arena_chunk *c;
+
+  for (c = a->first; c; c = c->next) if (c->huge) return 1;
+  return 0;
+}
+
+/* The arena used by new_array()/new_matrix(): 64-byte aligned, huge pages */
+static inline arena_ptr default_arena(void)
+{
+  static arena_ptr ar = NULL;
+
+  if (!ar) {
+    ar = new_arena(0, ARENA_ALIGN, 1);
+    if (!ar) {
+      printf("COULDN'T ALLOCATE default arena\n");
+      exit(-1);
+    }
+  }
+  return ar;
+}
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,281 @@
+/* hgemm.h -- packed-panel GEMM on bf16 or fp16 inputs, fp32 accumulation
+
+   Header-only, the same blocking as gemm.h. Needs -mavx2 -mfma -mf16c,
+   and arena.h included first.
+
+   C (M x N, float) += A (M x K) * B (K x N), all row-major with leading
+   dimensions lda, ldb, ldc, where A and B are stored in one of
+
+     HGEMM_F32    float
+     HGEMM_BF16   bfloat16: the top 16 bits of a float (8-bit exponent,
+                  7-bit mantissa); same range as float, ~3 decimal digits
+     HGEMM_F16    IEEE half: 5-bit exponent, 10-bit mantissa; ~4 digits,
+                  but overflows past 65504
+
+   Half the bytes of float, so twice as many elements per cache line and
+   per byte of memory bandwidth. They are converted to float while A and B
+   are packed, which happens once per block anyway (O(n^2) work against
+   O(n^3) for the multiply): bf16 by shifting into the high half of a
+   32-bit lane, fp16 with the F16C vcvtph2ps. The micro-kernel then only
+   ever sees floats, and all the sums are in fp32.
+
+   Micro-kernel: MR x NR = 6 x 16 floats of C in 12 ymm registers; each k
+   step loads 2 vectors of Bp, broadcasts 6 values of Ap and does 12 FMAs
+   (8 flops each, twice the doubles of gemm.h).
+
+   hgemm() allocates the packing buffers from default_arena() for the
+   duration of the call; hgemm_blocked() takes them from the caller,
+   sized by HGEMM_AP_SIZE / HGEMM_BP_SIZE floats. hgemm_convert() makes
+   the bf16 / fp16 copy of a float array (round to nearest even).
+ */
+
+#ifndef _HGEMM_H_
+#define _HGEMM_H_
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#define HGEMM_F32 0
+#define HGEMM_BF16 1
+#define HGEMM_F16 2
+
+#define HGEMM_MR 6
+#define HGEMM_NR 16
+#define HGEMM_MC 96     /* multiple of MR; Ap = 96 x 256 x 4 = 96 KB */
+#define HGEMM_KC 256
+#define HGEMM_NC 2048   /* multiple of NR; Bp = 256 x 2048 x 4 = 2 MB */
+
+#define HGEMM_AP_SIZE ((long)HGEMM_MC * HGEMM_KC)
+#define HGEMM_BP_SIZE ((long)HGEMM_KC * HGEMM_NC)
+
+/* float -> bf16, round to nearest even (no NaN handling) */
+static inline uint16_t float_to_bf16(float x)
+{
+  union { float f; uint32_t u; } v;
+  v.f = x;
+  v.u += 0x7fff + ((v.u >> 16) & 1);
+  return (uint16_t)(v.u >> 16);
+}
+
+static inline float bf16_to_float(uint16_t x)
+{
+  union { float f; uint32_t u; } v;
+  v.u = (uint32_t) x << 16;
+  return v.f;
+}
+
+/* dst = the n floats at src in fmt (HGEMM_BF16 or HGEMM_F16) */
+static inline void hgemm_convert(int fmt, long int n, const float *src,
+                                 uint16_t *dst)
+{
+  long int i = 0;
+
+  if (fmt == HGEMM_F16)
+    for (; i + 8 <= n; i += 8)
+      _mm_storeu_si128((__m128i *) &dst[i],
+                       _mm256_cvtps_ph(_mm256_loadu_ps(&src[i]),
+                                       _MM_FROUND_TO_NEAREST_INT));
+  for (; i < n; i++)
+    dst[i] = (fmt == HGEMM_F16) ? _cvtss_sh(src[i], _MM_FROUND_TO_NEAREST_INT)
+                                : float_to_bf16(src[i]);
+}
+
+/* element idx of p, in fmt, as a float */
+static inline float hgemm_load1(int fmt, const void *p, long int idx)
+{
+  switch (fmt) {
+    case HGEMM_BF16: return bf16_to_float(((const uint16_t *) p)[idx]);
+    case HGEMM_F16:  return _cvtsh_ss(((const uint16_t *) p)[idx]);
+    default:         return ((const float *) p)[idx];
+  }
+}
+
+/* elements idx .. idx+7 of p, in fmt, as floats */
+static inline __m256 hgemm_load8(int fmt, const void *p, long int idx)
+{
+  __m128i h;
+
+  if (fmt == HGEMM_F32) return _mm256_loadu_ps(&((const float *) p)[idx]);
+  h = _mm_loadu_si128((const __m128i *) &((const uint16_t *) p)[idx]);
+  if (fmt == HGEMM_F16) return _mm256_cvtph_ps(h);
+  return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+}
+
+/* Pack (and convert) the mc x kc block of A at element offset off of a
+   into MR-row micro-panels */
+static inline void hgemm_pack_a(int fmt, long int mc, long int kc,
+                                const void *a, long int off, long int lda,
+                                float *ap)
+{
+  float tmp[8] __attribute__ ((aligned (32)));
+  long int i, k, ir, m, t;
+
+  for (ir = 0; ir < mc; ir += HGEMM_MR) {
+    m = (mc - ir < HGEMM_MR) ? mc - ir : HGEMM_MR;
+    for (i = 0; i < m; i++) {
+      long int row = off + (ir+i)*lda;
+      for (k = 0; k + 8 <= kc; k += 8) {
+        _mm256_store_ps(tmp, hgemm_load8(fmt, a, row + k));
+        for (t = 0; t < 8; t++) ap[(k+t)*HGEMM_MR + i] = tmp[t];
+      }
+      for (; k < kc; k++) ap[k*HGEMM_MR + i] = hgemm_load1(fmt, a, row + k);
+    }
+    for (; i < HGEMM_MR; i++)
+      for (k = 0; k < kc; k++) ap[k*HGEMM_MR + i] = 0.0f;
+    ap += HGEMM_MR * kc;
+  }
+}
+
+/* Pack (and convert) the kc x nc block of B at element offset off of b
+   into NR-column micro-panels */
+static inline void hgemm_pack_b(int fmt, long int kc, long int nc,
+                                const void *b, long int off, long int ldb,
+                                float *bp)
+{
+  long int j, k, jr, n;
+
+  for (jr = 0; jr < nc; jr += HGEMM_NR) {
+    n = (nc - jr < HGEMM_NR) ? nc - jr : HGEMM_NR;
+    for (k = 0; k < kc; k++) {
+      long int row = off + k*ldb + jr;
+      if (n == HGEMM_NR) {
+        _mm256_store_ps(&bp[0], hgemm_load8(fmt, b, row));
+        _mm256_store_ps(&bp[8], hgemm_load8(fmt, b, row + 8));
+      } else {
+        for (j = 0; j < n; j++) bp[j] = hgemm_load1(fmt, b, row + j);
+        for (; j < HGEMM_NR; j++) bp[j] = 0.0f;
+      }
+      bp += HGEMM_NR;
+    }
+  }
+}
+
+/* c (6 x 16, leading dimension ldc) += ap (6 x kc micro-panel) times
+   bp (kc x 16 micro-panel). bp must be 32-byte aligned. */
+static inline void hgemm_ukernel(long int kc, const float *ap,
+                                 const float *bp, float *c, long int ldc)
+{
+  __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+  __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+  __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+  __m256 b0, b1, a;
+  long int k;
+
+  for (k = 0; k < kc; k++) {
+    b0 = _mm256_load_ps(&bp[0]);
+    b1 = _mm256_load_ps(&bp[8]);
+    a = _mm256_broadcast_ss(&ap[0]);
+    c00 = _mm256_fmadd_ps(a, b0, c00);  c01 = _mm256_fmadd_ps(a, b1, c01);
+    a = _mm256_broadcast_ss(&ap[1]);
+    c10 = _mm256_fmadd_ps(a, b0, c10);  c11 = _mm256_fmadd_ps(a, b1, c11);
+    a = _mm256_broadcast_ss(&ap[2]);
+    c20 = _mm256_fmadd_ps(a, b0, c20);  c21 = _mm256_fmadd_ps(a, b1, c21);
+    a = _mm256_broadcast_ss(&ap[3]);
+    c30 = _mm256_fmadd_ps(a, b0, c30);  c31 = _mm256_fmadd_ps(a, b1, c31);
+    a = _mm256_broadcast_ss(&ap[4]);
+    c40 = _mm256_fmadd_ps(a, b0, c40);  c41 = _mm256_fmadd_ps(a, b1, c41);
+    a = _mm256_broadcast_ss(&ap[5]);
+    c50 = _mm256_fmadd_ps(a, b0, c50);  c51 = _mm256_fmadd_ps(a, b1, c51);
+    ap += HGEMM_MR;
+    bp += HGEMM_NR;
+  }
+
+#define HGEMM_ACC_ROW(i, lo, hi)                                          \
+  _mm256_storeu_ps(&c[(i)*ldc],                                           \
+                   _mm256_add_ps(_mm256_loadu_ps(&c[(i)*ldc]), lo));      \
+  _mm256_storeu_ps(&c[(i)*ldc + 8],                                       \
+                   _mm256_add_ps(_mm256_loadu_ps(&c[(i)*ldc + 8]), hi));
+  HGEMM_ACC_ROW(0, c00, c01)
+  HGEMM_ACC_ROW(1, c10, c11)
+  HGEMM_ACC_ROW(2, c20, c21)
+  HGEMM_ACC_ROW(3, c30, c31)
+  HGEMM_ACC_ROW(4, c40, c41)
+  HGEMM_ACC_ROW(5, c50, c51)
+#undef HGEMM_ACC_ROW
+}
+
+/* Same for an m x n (m <= 6, n <= 16) block at the edge of C, through a
+   zeroed scratch block */
+static inline void hgemm_ukernel_edge(long int kc, const float *ap,
+                                      const float *bp, float *c,
+                                      long int ldc, long int m, long int n)
+{
+  float tmp[HGEMM_MR * HGEMM_NR] __attribute__ ((aligned (32)));
+  long int i, j;
+
+  for (i = 0; i < HGEMM_MR * HGEMM_NR; i++) tmp[i] = 0.0f;
+  hgemm_ukernel(kc, ap, bp, tmp, HGEMM_NR);
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      c[i*ldc + j] += tmp[i*HGEMM_NR + j];
+}
+
+/* One packed mc x kc block of A times one packed kc x nc panel of B, into
+   the mc x nc block of C at c */
+static inline void hgemm_macro(long int mc, long int nc, long int kc,
+                               const float *ap, const float *bp,
+                               float *c, long int ldc)
+{
+  long int ir, jr, m, n;
+
+  for (jr = 0; jr < nc; jr += HGEMM_NR) {
+    n = (nc - jr < HGEMM_NR) ? nc - jr : HGEMM_NR;
+    for (ir = 0; ir < mc; ir += HGEMM_MR) {
+      m = (mc - ir < HGEMM_MR) ? mc - ir : HGEMM_MR;
+      if (m == HGEMM_MR && n == HGEMM_NR)
+        hgemm_ukernel(kc, &ap[ir*kc], &bp[jr*kc], &c[ir*ldc + jr], ldc);
+      else
+        hgemm_ukernel_edge(kc, &ap[ir*kc], &bp[jr*kc], &c[ir*ldc + jr],
+                           ldc, m, n);
+    }
+  }
+}
+
+/* C += A * B, A and B in fmt, with caller-supplied packing buffers: ap
+   holds HGEMM_AP_SIZE floats and bp HGEMM_BP_SIZE, both 64-byte aligned */
+static inline void hgemm_blocked(int fmt, long int M, long int N, long int K,
+                                 const void *a, long int lda,
+                                 const void *b, long int ldb,
+                                 float *c, long int ldc,
+                                 float *ap, float *bp)
+{
+  long int jc, pc, ic, nc, kc, mc;
+
+  for (jc = 0; jc < N; jc += HGEMM_NC) {
+    nc = (N - jc < HGEMM_NC) ? N - jc : HGEMM_NC;
+    for (pc = 0; pc < K; pc += HGEMM_KC) {
+      kc = (K - pc < HGEMM_KC) ? K - pc : HGEMM_KC;
+      hgemm_pack_b(fmt, kc, nc, b, pc*ldb + jc, ldb, bp);
+      for (ic = 0; ic < M; ic += HGEMM_MC) {
+        mc = (M - ic < HGEMM_MC) ? M - ic : HGEMM_MC;
+        hgemm_pack_a(fmt, mc, kc, a, ic*lda + pc, lda, ap);
+        hgemm_macro(mc, nc, kc, ap, bp, &c[ic*ldc + jc], ldc);
+      }
+    }
+  }
+}
+
+/* C += A * B, A and B in fmt, packing buffers from default_arena() */
+static inline void hgemm(int fmt, long int M, long int N, long int K,
+                         const void *a, long int lda,
+                         const void *b, long int ldb,
+                         float *c, long int ldc)
+{
+  arena_mark_t mark = arena_mark(default_arena());
+  float *ap = (float *) arena_alloc(default_arena(),
+                                    HGEMM_AP_SIZE * sizeof(float));
+  float *bp = (float *) arena_alloc(default_arena(),
+                                    HGEMM_BP_SIZE * sizeof(float));
+
+  if (!ap || !bp) {
+    printf("COULDN'T ALLOCATE hgemm packing buffers\n");
+    exit(-1);
+  }
+  hgemm_blocked(fmt, M, N, K, a, lda, b, ldb, c, ldc, ap, bp);
+  arena_release(default_arena(), mark);
+}
+
+#endif /* _HGEMM_H_ */
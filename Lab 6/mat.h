@@ -0,0 +1,162 @@
+/* mat.h -- M x N matrices with a leading dimension
+
+   Header-only. Include after arena.h and after the typedef of data_t:
+
+     typedef double data_t;
+     #include "arena.h"
+     #include "mat.h"
+
+   A mat_rec is rows x cols elements in row-major order, with ld elements
+   (the leading dimension, ld >= cols) between the starts of consecutive
+   rows, so element (i,j) is data[i*ld + j]. new_mat() rounds ld up to a
+   whole number of cache lines, so every row starts 64-byte aligned.
+
+   Because of the separate ld, a submatrix is just another mat_rec that
+   points into the same storage -- mat_view() makes one without copying
+   anything. Kernels that take a mat_ptr work the same on a whole matrix
+   and on a view:
+
+     mat_ptr a = new_mat(10000, 64);             // tall and skinny
+     mat_rec top = mat_view(a, 0, 0, 5000, 64);  // rows 0..4999, no copy
+     mmm_kij(&top, b, c);
+
+   As with the old square types, set_mat_size() changes the size that the
+   kernels work on without reallocating, so a benchmark can allocate the
+   biggest size once and sweep down. Like set_row_length() did, it packs
+   the smaller matrix densely (ld back to cols, rounded up to a cache
+   line) at the start of the storage, so each size of a sweep has the
+   footprint of that size; only a view keeps the ld of its parent.
+   Storage comes from default_arena() and is freed with it.
+ */
+
+#ifndef _MAT_H_
+#define _MAT_H_
+
+#define MAT_LD_ALIGN 64   /* row starts are aligned to this many bytes */
+
+typedef struct {
+  long int rows;
+  long int cols;
+  long int ld;      /* elements between the starts of consecutive rows */
+  long int alloc;   /* elements of storage owned; 0 for a view */
+  data_t *data;
+} mat_rec, *mat_ptr;
+
+/* Create a rows x cols matrix, zeroed. Returns NULL if there is no
+   memory. */
+static inline mat_ptr new_mat(long int rows, long int cols)
+{
+  long int per_line = MAT_LD_ALIGN / sizeof(data_t);
+  data_t *data;
+
+  /* Allocate and declare header structure */
+  mat_ptr result = (mat_ptr) malloc(sizeof(mat_rec));
+  if (!result) return NULL;  /* Couldn't allocate storage */
+  result->rows = rows;
+  result->cols = cols;
+  result->ld = (cols + per_line - 1) / per_line * per_line;
+  result->alloc = rows * result->ld;
+  result->data = NULL;
+
+  /* Allocate and declare array */
+  if (rows > 0 && cols > 0) {
+    data = (data_t *) arena_calloc(default_arena(), rows * result->ld,
+                                   sizeof(data_t));
+    if (!data) {
+      printf("\n COULDN'T ALLOCATE %ld BYTES STORAGE \n",
+             rows * result->ld * (long) sizeof(data_t));
+      free((void *) result);
+      return NULL;  /* Couldn't allocate storage */
+    }
+    result->data = data;
+  }
+
+  return result;
+}
+
+/* The rows x cols submatrix of m starting at (r0,c0). Shares m's storage
+   and leading dimension; nothing is copied. */
+static inline mat_rec mat_view(mat_ptr m, long int r0, long int c0,
+                               long int rows, long int cols)
+{
+  mat_rec v;
+  v.rows = rows;
+  v.cols = cols;
+  v.ld = m->ld;
+  v.alloc = 0;
+  v.data = m->data + r0 * m->ld + c0;
+  return v;
+}
+
+/* Change the size that kernels work on, without reallocating. A matrix
+   from new_mat() is repacked densely: ld becomes cols rounded up to a
+   cache line, and rows x ld must fit in the storage (the contents are
+   reinterpreted, not moved). A view keeps its ld (cols <= ld). Returns 0
+   if the size doesn't fit. */
+static inline int set_mat_size(mat_ptr m, long int rows, long int cols)
+{
+  long int per_line = MAT_LD_ALIGN / sizeof(data_t);
+  long int ld = (cols + per_line - 1) / per_line * per_line;
+
+  if (m->alloc) {
+    if (rows * ld > m->alloc) return 0;
+    m->ld = ld;
+  } else if (cols > m->ld) return 0;
+  m->rows = rows;
+  m->cols = cols;
+  return 1;
+}
+
+static inline long int get_mat_rows(mat_ptr m) { return m->rows; }
+static inline long int get_mat_cols(mat_ptr m) { return m->cols; }
+static inline long int get_mat_ld(mat_ptr m) { return m->ld; }
+static inline data_t *get_mat_start(mat_ptr m) { return m->data; }
+
+/* initialize with consecutive integers, row by row */
+static inline void init_mat(mat_ptr m)
+{
+  long int i, j;
+
+  for (i = 0; i < m->rows; i++)
+    for (j = 0; j < m->cols; j++)
+      m->data[i*m->ld + j] = (data_t)(i*m->cols + j);
+}
+
+/* set every element (not the padding) to val */
+static inline void fill_mat(mat_ptr m, data_t val)
+{
+  long int i, j;
+
+  for (i = 0; i < m->rows; i++)
+    for (j = 0; j < m->cols; j++)
+      m->data[i*m->ld + j] = val;
+}
+
+/* Test data for the correctness checks: small integers, -3..3 in a and
+   -2..2 in b. Every partial sum of a product of these is an integer that
+   data_t holds exactly, so any order of summation gives the same result
+   and a kernel can be compared with a reference element for element. */
+static inline void init_mat_check(mat_ptr a, mat_ptr b)
+{
+  long int i, j;
+
+  for (i = 0; i < a->rows; i++)
+    for (j = 0; j < a->cols; j++)
+      a->data[i*a->ld + j] = (data_t)((i + 2*j) % 7 - 3);
+  for (i = 0; i < b->rows; i++)
+    for (j = 0; j < b->cols; j++)
+      b->data[i*b->ld + j] = (data_t)((3*i + j) % 5 - 2);
+}
+
+/* number of elements of m (not the padding) that differ from ref */
+static inline long int count_mat_diff(mat_ptr m, mat_ptr ref)
+{
+  long int i, j, diff = 0;
+
+  for (i = 0; i < m->rows; i++)
+    for (j = 0; j < m->cols; j++)
+      if (m->data[i*m->ld + j] != ref->data[i*ref->ld + j]) diff++;
+  return diff;
+}
+
+#endif /* _MAT_H_ */
@@ -0,0 +1,311 @@
+/* spmm.h -- sparse (CSR and BSR) times dense matrix multiply
+
+   Header-only. Needs -mavx2 -mfma (and -fopenmp for more than one
+   thread), and arena.h included first.
+
+   C (M x N) += A (M x K, sparse) * B (K x N, dense), with B and C
+   row-major with leading dimensions ldb and ldc, doubles.
+
+     CSR   compressed sparse rows: the nonzeros of row i are
+           val[row_ptr[i] .. row_ptr[i+1]-1], in columns col[...]. One
+           index per nonzero.
+     BSR   blocked CSR: the same over SPMM_BR x SPMM_BC dense blocks. A
+           block is stored (row-major, zero-filled) if any element in it is
+           nonzero, so a scattered matrix stores mostly zeros, but a matrix
+           whose nonzeros come in blocks needs one index per block instead
+           of one per element.
+
+   Row i of C is a sum of rows of B, c(i,:) += a(i,k) * b(k,:) for every
+   nonzero a(i,k), so the kernels accumulate rows, not dot products:
+
+     - csr_spmm keeps SPMM_NV ymm accumulators (SPMM_NV * 4 columns of
+       c(i,:)) in registers across all the nonzeros of row i, one
+       broadcast of a(i,k) and SPMM_NV loads of b(k,:) each, then stores
+       them; then the next SPMM_NV * 4 columns.
+     - bsr_spmm does the same for the SPMM_BR rows of a block row at once,
+       so each vector of B loaded serves SPMM_BR rows instead of one.
+
+   Threads take rows (block rows) with schedule(dynamic): the number of
+   nonzeros per row varies, and each row is written by one thread only.
+
+   Storage comes from default_arena(), like new_mat().
+ */
+
+#ifndef _SPMM_H_
+#define _SPMM_H_
+
+#include <immintrin.h>
+
+#define SPMM_NV 4       /* ymm accumulators per row: 16 columns of C */
+#define SPMM_BR 4       /* BSR block rows */
+#define SPMM_BC 4       /* BSR block columns */
+#define SPMM_CHUNK 16   /* rows per dynamic chunk (block rows for BSR) */
+
+typedef struct {
+  long int rows;
+  long int cols;
+  long int nnz;
+  long int *row_ptr;   /* rows + 1 */
+  int *col;            /* nnz */
+  double *val;         /* nnz */
+} csr_rec, *csr_ptr;
+
+typedef struct {
+  long int rows;
+  long int cols;
+  long int brows;      /* block rows, rows / SPMM_BR rounded up */
+  long int nblocks;
+  long int *row_ptr;   /* brows + 1 */
+  int *bcol;           /* nblocks: block column of each block */
+  double *val;         /* nblocks * SPMM_BR * SPMM_BC */
+} bsr_rec, *bsr_ptr;
+
+/* CSR copy of the M x K dense matrix at a (leading dimension lda). Returns
+   NULL if there is no memory. */
+static inline csr_ptr csr_from_dense(long int M, long int K, const double *a,
+                                     long int lda)
+{
+  csr_ptr result = (csr_ptr) malloc(sizeof(csr_rec));
+  long int i, k, nnz = 0;
+
+  if (!result) return NULL;  /* Couldn't allocate storage */
+  for (i = 0; i < M; i++)
+    for (k = 0; k < K; k++)
+      if (a[i*lda + k] != 0.0) nnz++;
+
+  result->rows = M;
+  result->cols = K;
+  result->nnz = nnz;
+  result->row_ptr = (long int *) arena_alloc(default_arena(),
+                                             (M + 1) * sizeof(long int));
+  result->col = (int *) arena_alloc(default_arena(), (nnz + 1) * sizeof(int));
+  result->val = (double *) arena_alloc(default_arena(),
+                                       (nnz + 1) * sizeof(double));
+  if (!result->row_ptr || !result->col || !result->val) {
+    printf("\n COULDN'T ALLOCATE CSR STORAGE (%ld nonzeros)\n", nnz);
+    free((void *) result);
+    return NULL;  /* Couldn't allocate storage */
+  }
+
+  nnz = 0;
+  for (i = 0; i < M; i++) {
+    result->row_ptr[i] = nnz;
+    for (k = 0; k < K; k++)
+      if (a[i*lda + k] != 0.0) {
+        result->col[nnz] = (int) k;
+        result->val[nnz] = a[i*lda + k];
+        nnz++;
+      }
+  }
+  result->row_ptr[M] = nnz;
+
+  return result;
+}
+
+/* BSR copy of the M x K dense matrix at a; blocks past the edges of A are
+   zero-filled. Returns NULL if there is no memory. */
+static inline bsr_ptr bsr_from_dense(long int M, long int K, const double *a,
+                                     long int lda)
+{
+  bsr_ptr result = (bsr_ptr) malloc(sizeof(bsr_rec));
+  long int bi, bk, i, k, n, nb = 0, kb = (K + SPMM_BC - 1) / SPMM_BC;
+  int nz;
+
+  if (!result) return NULL;  /* Couldn't allocate storage */
+  result->rows = M;
+  result->cols = K;
+  result->brows = (M + SPMM_BR - 1) / SPMM_BR;
+
+  /* is any element of block (bi,bk) nonzero */
+#define SPMM_BLOCK_NZ(bi, bk, nz)                                          \
+  do {                                                                     \
+    nz = 0;                                                                \
+    for (i = (bi)*SPMM_BR; i < M && i < ((bi)+1)*SPMM_BR; i++)             \
+      for (k = (bk)*SPMM_BC; k < K && k < ((bk)+1)*SPMM_BC; k++)           \
+        if (a[i*lda + k] != 0.0) nz = 1;                                   \
+  } while (0)
+
+  for (bi = 0; bi < result->brows; bi++)
+    for (bk = 0; bk < kb; bk++) {
+      SPMM_BLOCK_NZ(bi, bk, nz);
+      nb += nz;
+    }
+
+  result->nblocks = nb;
+  result->row_ptr = (long int *) arena_alloc(default_arena(),
+                                   (result->brows + 1) * sizeof(long int));
+  result->bcol = (int *) arena_alloc(default_arena(), (nb + 1) * sizeof(int));
+  result->val = (double *) arena_calloc(default_arena(),
+                                        (nb + 1) * SPMM_BR * SPMM_BC,
+                                        sizeof(double));
+  if (!result->row_ptr || !result->bcol || !result->val) {
+    printf("\n COULDN'T ALLOCATE BSR STORAGE (%ld blocks)\n", nb);
+    free((void *) result);
+    return NULL;  /* Couldn't allocate storage */
+  }
+
+  nb = 0;
+  for (bi = 0; bi < result->brows; bi++) {
+    result->row_ptr[bi] = nb;
+    for (bk = 0; bk < kb; bk++) {
+      SPMM_BLOCK_NZ(bi, bk, nz);
+      if (!nz) continue;
+      result->bcol[nb] = (int) bk;
+      for (n = 0; n < SPMM_BR * SPMM_BC; n++) {
+        i = bi*SPMM_BR + n / SPMM_BC;
+        k = bk*SPMM_BC + n % SPMM_BC;
+        result->val[nb*SPMM_BR*SPMM_BC + n] =
+          (i < M && k < K) ? a[i*lda + k] : 0.0;
+      }
+      nb++;
+    }
+  }
+  result->row_ptr[result->brows] = nb;
+#undef SPMM_BLOCK_NZ
+
+  return result;
+}
+
+/* c(i,:) += A(i,:) * B for the rows of A in CSR from r0 to r1 */
+static inline void csr_spmm_rows(csr_ptr a, long int r0, long int r1,
+                                 long int N, const double *b, long int ldb,
+                                 double *c, long int ldc)
+{
+  long int i, j, p, p0, p1, v;
+  __m256d acc[SPMM_NV], s;
+  double sum;
+
+  for (i = r0; i < r1; i++) {
+    p0 = a->row_ptr[i];
+    p1 = a->row_ptr[i+1];
+    if (p0 == p1) continue;
+
+    for (j = 0; j + 4*SPMM_NV <= N; j += 4*SPMM_NV) {
+      for (v = 0; v < SPMM_NV; v++)
+        acc[v] = _mm256_loadu_pd(&c[i*ldc + j + 4*v]);
+      for (p = p0; p < p1; p++) {
+        const double *bk = &b[a->col[p]*ldb + j];
+        s = _mm256_set1_pd(a->val[p]);
+        for (v = 0; v < SPMM_NV; v++)
+          acc[v] = _mm256_fmadd_pd(s, _mm256_loadu_pd(&bk[4*v]), acc[v]);
+      }
+      for (v = 0; v < SPMM_NV; v++)
+        _mm256_storeu_pd(&c[i*ldc + j + 4*v], acc[v]);
+    }
+    for (; j + 4 <= N; j += 4) {
+      acc[0] = _mm256_loadu_pd(&c[i*ldc + j]);
+      for (p = p0; p < p1; p++)
+        acc[0] = _mm256_fmadd_pd(_mm256_set1_pd(a->val[p]),
+                                 _mm256_loadu_pd(&b[a->col[p]*ldb + j]),
+                                 acc[0]);
+      _mm256_storeu_pd(&c[i*ldc + j], acc[0]);
+    }
+    for (; j < N; j++) {
+      sum = c[i*ldc + j];
+      for (p = p0; p < p1; p++) sum += a->val[p] * b[a->col[p]*ldb + j];
+      c[i*ldc + j] = sum;
+    }
+  }
+}
+
+/* C += A * B, A in CSR, on nthreads threads */
+static inline void csr_spmm(csr_ptr a, long int N, const double *b,
+                            long int ldb, double *c, long int ldc,
+                            int nthreads)
+{
+  long int r;
+
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (r = 0; r < a->rows; r += SPMM_CHUNK)
+    csr_spmm_rows(a, r, (r + SPMM_CHUNK < a->rows) ? r + SPMM_CHUNK : a->rows,
+                  N, b, ldb, c, ldc);
+}
+
+/* c += A * B for block row bi of A in BSR, columns j to j + 4 * nv of C
+   (nv of 1 or 2). Rows and columns of a block past the edges of A are
+   skipped. */
+static inline void bsr_spmm_block_row(bsr_ptr a, long int bi, long int j,
+                                      int nv, const double *b, long int ldb,
+                                      double *c, long int ldc)
+{
+  long int p, kk, k0, kmax, r, rmax = a->rows - bi*SPMM_BR;
+  __m256d acc[SPMM_BR][2], b0, b1 = _mm256_setzero_pd();
+  const double *blk;
+
+  if (rmax > SPMM_BR) rmax = SPMM_BR;
+  for (r = 0; r < SPMM_BR; r++) {
+    acc[r][0] = acc[r][1] = _mm256_setzero_pd();
+    if (r < rmax) {
+      acc[r][0] = _mm256_loadu_pd(&c[(bi*SPMM_BR + r)*ldc + j]);
+      if (nv == 2)
+        acc[r][1] = _mm256_loadu_pd(&c[(bi*SPMM_BR + r)*ldc + j + 4]);
+    }
+  }
+
+  for (p = a->row_ptr[bi]; p < a->row_ptr[bi+1]; p++) {
+    blk = &a->val[p*SPMM_BR*SPMM_BC];
+    k0 = (long int) a->bcol[p] * SPMM_BC;
+    kmax = (a->cols - k0 < SPMM_BC) ? a->cols - k0 : SPMM_BC;
+    for (kk = 0; kk < kmax; kk++) {
+      b0 = _mm256_loadu_pd(&b[(k0 + kk)*ldb + j]);
+      if (nv == 2) b1 = _mm256_loadu_pd(&b[(k0 + kk)*ldb + j + 4]);
+      for (r = 0; r < SPMM_BR; r++) {
+        __m256d s = _mm256_set1_pd(blk[r*SPMM_BC + kk]);
+        acc[r][0] = _mm256_fmadd_pd(s, b0, acc[r][0]);
+        if (nv == 2) acc[r][1] = _mm256_fmadd_pd(s, b1, acc[r][1]);
+      }
+    }
+  }
+
+  for (r = 0; r < rmax; r++) {
+    _mm256_storeu_pd(&c[(bi*SPMM_BR + r)*ldc + j], acc[r][0]);
+    if (nv == 2)
+      _mm256_storeu_pd(&c[(bi*SPMM_BR + r)*ldc + j + 4], acc[r][1]);
+  }
+}
+
+/* C += A * B for the block rows of A in BSR from b0 to b1 */
+static inline void bsr_spmm_rows(bsr_ptr a, long int b0, long int b1,
+                                 long int N, const double *b, long int ldb,
+                                 double *c, long int ldc)
+{
+  long int bi, j, p, r, kk, i, k;
+  double sum;
+
+  for (bi = b0; bi < b1; bi++) {
+    if (a->row_ptr[bi] == a->row_ptr[bi+1]) continue;
+    for (j = 0; j + 8 <= N; j += 8)
+      bsr_spmm_block_row(a, bi, j, 2, b, ldb, c, ldc);
+    for (; j + 4 <= N; j += 4)
+      bsr_spmm_block_row(a, bi, j, 1, b, ldb, c, ldc);
+    for (; j < N; j++)   /* last 0..3 columns */
+      for (r = 0; r < SPMM_BR; r++) {
+        i = bi*SPMM_BR + r;
+        if (i >= a->rows) break;
+        sum = c[i*ldc + j];
+        for (p = a->row_ptr[bi]; p < a->row_ptr[bi+1]; p++)
+          for (kk = 0; kk < SPMM_BC; kk++) {
+            k = (long int) a->bcol[p] * SPMM_BC + kk;
+            if (k < a->cols)
+              sum += a->val[(p*SPMM_BR + r)*SPMM_BC + kk] * b[k*ldb + j];
+          }
+        c[i*ldc + j] = sum;
+      }
+  }
+}
+
+/* C += A * B, A in BSR, on nthreads threads */
+static inline void bsr_spmm(bsr_ptr a, long int N, const double *b,
+                            long int ldb, double *c, long int ldc,
+                            int nthreads)
+{
+  long int r;
+
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (r = 0; r < a->brows; r += SPMM_CHUNK)
+    bsr_spmm_rows(a, r,
+                  (r + SPMM_CHUNK < a->brows) ? r + SPMM_CHUNK : a->brows,
+                  N, b, ldb, c, ldc);
+}
+
+#endif /* _SPMM_H_ */
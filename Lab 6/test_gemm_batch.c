@@ -0,0 +1,429 @@
+/***********************************************************************
+
+ gcc -O3 -mavx2 -mfma -fopenmp test_gemm_batch.c -lrt -o test_gemm_batch
+ ./test_gemm_batch [max_threads]
+
+ Batched GEMM for many small matrices of the same shape (C_i += A_i * B_i,
+ doubles): square 4x4 up to 32x32, and two shapes with m, n and k all
+ different.
+
+ Calling mmm_kij once per pair costs more in setup and short loops than
+ in arithmetic: a 4x4 product is only 128 flops. The batch calls take the
+ whole batch at once, in one of two layouts:
+
+   - gemm_batch(): the matrices are stored back to back (matrix b of A
+     starts at a + b*m*k, and so on), and each product is a small kij loop
+     with the sizes known for the whole batch. Vectorizes along the rows of
+     B and C, so small n leaves most of each vector empty.
+   - gemm_batch_il(): interleaved. The batch is cut into groups of
+     BATCH_W matrices (BATCH_W = 4 doubles per ymm register) and element
+     (i,j) of the BATCH_W matrices of a group are stored next to each
+     other: element (i,j) of matrix b is at
+         grp[(i*cols + j) * BATCH_W + b % BATCH_W]     grp = group b / BATCH_W
+     so each SIMD lane works on a different matrix, every vector is full
+     whatever the matrix size, and there is no shuffling. The last group is
+     padded with zero matrices. batch_interleave()/batch_deinterleave()
+     convert from and to the back-to-back layout.
+
+ Both are multithreaded over the batch with OpenMP (each thread gets a
+ contiguous range of matrices or groups, so no C is shared).
+
+ Every version is checked element by element against a scalar ijk on
+ each pair. The inputs are small integers, so the sums are exact.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <immintrin.h>
+#include <omp.h>
+#include "arena.h"
+
+/* We do *not* use CPNS (cycles per nanosecond) because when multiple
+   cores are each executing with their own clock speeds, sometimes overlapping
+   in time, measuring "how many cycles" a program takes does not reflect
+   how much time it takes. We care about time more than about cycles. */
+
+#define NUM_TESTS 7
+
+/* m, n, k: C is m x n, A is m x k, B is k x n. The square sizes, then two
+   shapes where all three differ. */
+static const long int shapes[NUM_TESTS][3] = {
+  {4, 4, 4}, {8, 8, 8}, {12, 12, 12}, {16, 16, 16}, {32, 32, 32},
+  {4, 8, 12}, {12, 4, 8}
+};
+
+#define BATCH_DATA (1L << 22)   /* doubles in A, B and C together, per size */
+#define BATCH_W 4               /* matrices per interleaved group */
+
+#define IDENT 0
+
+typedef double data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c);
+void mmm_kij_each(long int m, long int n, long int k, double *a, double *b,
+                  double *c, long int count);
+void gemm_batch(long int m, long int n, long int k, const double *a,
+                const double *b, double *c, long int count, int nthreads);
+void gemm_batch_il(long int m, long int n, long int k, const double *a,
+                   const double *b, double *c, long int count, int nthreads);
+long int il_size(long int rows, long int cols, long int count);
+void batch_interleave(long int rows, long int cols, long int count,
+                      const double *src, double *dst);
+void batch_deinterleave(long int rows, long int cols, long int count,
+                        const double *src, double *dst);
+long int count_errors(long int m, long int n, long int k, const double *a,
+                      const double *b, const double *c, long int count);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+
+/************************************************************************/
+int main(int argc, char *argv[])
+{
+  struct timespec time_start, time_stop;
+  double final_answer, flops, t_each, t_aos, t_il, t_aos_mt, t_il_mt, t_conv;
+  double *a, *b, *c, *ail, *bil, *cil;
+  long int x, m, n, k, i, count, errors;
+  int max_threads;
+
+  printf("Batched small-matrix GEMM\n");
+
+  max_threads = omp_get_num_procs();
+  if (argc > 1) max_threads = atoi(argv[1]);
+  if (max_threads < 1) max_threads = 1;
+  printf("Multithreaded versions on %d threads (%d processors)\n",
+         max_threads, omp_get_num_procs());
+
+  final_answer = wakeup_delay();
+
+  /* the same amount of data for every shape, so the smallest matrices
+     give the biggest batch */
+  a = (double *) arena_alloc(default_arena(), BATCH_DATA * sizeof(double));
+  ail = (double *) arena_alloc(default_arena(),
+                               (BATCH_DATA + 3 * BATCH_W * 32 * 32)
+                               * sizeof(double));
+  if (!a || !ail) {
+    printf("COULDN'T ALLOCATE batch storage\n");
+    exit(-1);
+  }
+  /* touch every page now, not in the first timed run */
+  for (i = 0; i < BATCH_DATA; i++) a[i] = IDENT;
+  for (i = 0; i < BATCH_DATA + 3 * BATCH_W * 32 * 32; i++) ail[i] = IDENT;
+
+  printf("\nTimes are in ns per matrix product\n");
+  printf("m, n, k, count, each_kij, batch, batch_il, batch mt, batch_il mt, "
+         "GFLOPs il mt, interleave, errors\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    m = shapes[x][0];
+    n = shapes[x][1];
+    k = shapes[x][2];
+    count = BATCH_DATA / (m*k + k*n + m*n);
+    flops = 2.0 * m * n * k * count;
+    b = a + count * m * k;
+    c = b + count * k * n;
+    bil = ail + il_size(m, k, count);
+    cil = bil + il_size(k, n, count);
+
+    for (i = 0; i < count * m * k; i++) a[i] = (double)(i % 7 - 3);
+    for (i = 0; i < count * k * n; i++) b[i] = (double)((3*i) % 5 - 2);
+
+    /* one mmm_kij call per pair */
+    for (i = 0; i < count * m * n; i++) c[i] = IDENT;
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    mmm_kij_each(m, n, k, a, b, c, count);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_each = interval(time_start, time_stop);
+    errors = count_errors(m, n, k, a, b, c, count);
+
+    /* back to back, 1 thread and max_threads */
+    for (i = 0; i < count * m * n; i++) c[i] = IDENT;
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    gemm_batch(m, n, k, a, b, c, count, 1);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_aos = interval(time_start, time_stop);
+    errors += count_errors(m, n, k, a, b, c, count);
+
+    for (i = 0; i < count * m * n; i++) c[i] = IDENT;
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    gemm_batch(m, n, k, a, b, c, count, max_threads);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_aos_mt = interval(time_start, time_stop);
+    errors += count_errors(m, n, k, a, b, c, count);
+
+    /* interleaved; converting A and B is timed separately */
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    batch_interleave(m, k, count, a, ail);
+    batch_interleave(k, n, count, b, bil);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_conv = interval(time_start, time_stop);
+
+    for (i = 0; i < il_size(m, n, count); i++) cil[i] = IDENT;
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    gemm_batch_il(m, n, k, ail, bil, cil, count, 1);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_il = interval(time_start, time_stop);
+    batch_deinterleave(m, n, count, cil, c);
+    errors += count_errors(m, n, k, a, b, c, count);
+
+    for (i = 0; i < il_size(m, n, count); i++) cil[i] = IDENT;
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    gemm_batch_il(m, n, k, ail, bil, cil, count, max_threads);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_il_mt = interval(time_start, time_stop);
+    batch_deinterleave(m, n, count, cil, c);
+    errors += count_errors(m, n, k, a, b, c, count);
+
+    printf("%2ld, %2ld, %2ld, %7ld,%9.2f,%9.2f,%9.2f,%9.2f,%9.2f,%8.2f,%9.2f, %ld\n",
+           m, n, k, count, t_each / count * 1.0e9, t_aos / count * 1.0e9,
+           t_il / count * 1.0e9, t_aos_mt / count * 1.0e9,
+           t_il_mt / count * 1.0e9, flops / t_il_mt * 1.0e-9,
+           t_conv / count * 1.0e9, errors);
+  }
+
+  printf("\n");
+  printf("Initial delay was calculating: %g \n", final_answer);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+
+/* MMM kij, c += a * b (as mmm_kij in test_mmm_inter.c) */
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+  for (k = 0; k < K; k++) {
+    for (i = 0; i < M; i++) {
+      r = a0[i*lda+k];
+      for (j = 0; j < N; j++)
+        c0[i*ldc+j] += r*b0[k*ldb+j];
+    }
+  }
+}
+
+/* The batch the old way: one mmm_kij call per pair */
+void mmm_kij_each(long int m, long int n, long int k, double *a, double *b,
+                  double *c, long int count)
+{
+  mat_rec ma, mb, mc;
+  long int x;
+
+  ma.rows = m;  ma.cols = k;  ma.ld = k;
+  mb.rows = k;  mb.cols = n;  mb.ld = n;
+  mc.rows = m;  mc.cols = n;  mc.ld = n;
+  for (x = 0; x < count; x++) {
+    ma.data = &a[x*m*k];
+    mb.data = &b[x*k*n];
+    mc.data = &c[x*m*n];
+    mmm_kij(&ma, &mb, &mc);
+  }
+}
+
+/* C_x += A_x * B_x for count matrices stored back to back: A_x is m x k
+   at a + x*m*k, B_x is k x n at b + x*k*n, C_x is m x n at c + x*m*n */
+void gemm_batch(long int m, long int n, long int k, const double *a,
+                const double *b, double *c, long int count, int nthreads)
+{
+  long int x;
+
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+  for (x = 0; x < count; x++) {
+    const double *ax = &a[x*m*k], *bx = &b[x*k*n];
+    double *cx = &c[x*m*n];
+    long int i, j, p;
+    double r;
+
+    for (i = 0; i < m; i++)
+      for (p = 0; p < k; p++) {
+        r = ax[i*k + p];
+        for (j = 0; j < n; j++)
+          cx[i*n + j] += r * bx[p*n + j];
+      }
+  }
+}
+
+/* One interleaved group: BATCH_W products at once, one per lane. Four
+   columns of C at a time, so there are four independent FMA chains. */
+static inline void gemm_group_il(long int m, long int n, long int k,
+                                 const double *a, const double *b, double *c)
+{
+  long int i, j, p;
+  __m256d c0, c1, c2, c3, av;
+
+  for (i = 0; i < m; i++) {
+    for (j = 0; j + 4 <= n; j += 4) {
+      c0 = _mm256_load_pd(&c[(i*n + j) * BATCH_W]);
+      c1 = _mm256_load_pd(&c[(i*n + j+1) * BATCH_W]);
+      c2 = _mm256_load_pd(&c[(i*n + j+2) * BATCH_W]);
+      c3 = _mm256_load_pd(&c[(i*n + j+3) * BATCH_W]);
+      for (p = 0; p < k; p++) {
+        av = _mm256_load_pd(&a[(i*k + p) * BATCH_W]);
+        c0 = _mm256_fmadd_pd(av, _mm256_load_pd(&b[(p*n + j) * BATCH_W]), c0);
+        c1 = _mm256_fmadd_pd(av, _mm256_load_pd(&b[(p*n + j+1) * BATCH_W]), c1);
+        c2 = _mm256_fmadd_pd(av, _mm256_load_pd(&b[(p*n + j+2) * BATCH_W]), c2);
+        c3 = _mm256_fmadd_pd(av, _mm256_load_pd(&b[(p*n + j+3) * BATCH_W]), c3);
+      }
+      _mm256_store_pd(&c[(i*n + j) * BATCH_W], c0);
+      _mm256_store_pd(&c[(i*n + j+1) * BATCH_W], c1);
+      _mm256_store_pd(&c[(i*n + j+2) * BATCH_W], c2);
+      _mm256_store_pd(&c[(i*n + j+3) * BATCH_W], c3);
+    }
+    for (; j < n; j++) {
+      c0 = _mm256_load_pd(&c[(i*n + j) * BATCH_W]);
+      for (p = 0; p < k; p++)
+        c0 = _mm256_fmadd_pd(_mm256_load_pd(&a[(i*k + p) * BATCH_W]),
+                             _mm256_load_pd(&b[(p*n + j) * BATCH_W]), c0);
+      _mm256_store_pd(&c[(i*n + j) * BATCH_W], c0);
+    }
+  }
+}
+
+/* Same as gemm_batch() on interleaved storage (see the top of the file).
+   a, b and c must be 32-byte aligned. */
+void gemm_batch_il(long int m, long int n, long int k, const double *a,
+                   const double *b, double *c, long int count, int nthreads)
+{
+  long int g, groups = (count + BATCH_W - 1) / BATCH_W;
+
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+  for (g = 0; g < groups; g++)
+    gemm_group_il(m, n, k, &a[g*m*k*BATCH_W], &b[g*k*n*BATCH_W],
+                  &c[g*m*n*BATCH_W]);
+}
+
+/* doubles needed for count rows x cols matrices, interleaved */
+long int il_size(long int rows, long int cols, long int count)
+{
+  return (count + BATCH_W - 1) / BATCH_W * BATCH_W * rows * cols;
+}
+
+/* back to back -> interleaved; the padding of the last group is zeroed.
+   Writes go in storage order, one group at a time. */
+void batch_interleave(long int rows, long int cols, long int count,
+                      const double *src, double *dst)
+{
+  long int g, e, l, x, size = rows * cols;
+  const double *s0, *s1, *s2, *s3;
+
+  for (g = 0; g < count / BATCH_W; g++) {
+    s0 = &src[g * BATCH_W * size];
+    s1 = s0 + size;
+    s2 = s1 + size;
+    s3 = s2 + size;
+    for (e = 0; e < size; e++)
+      _mm256_store_pd(&dst[(g*size + e) * BATCH_W],
+                      _mm256_set_pd(s3[e], s2[e], s1[e], s0[e]));
+  }
+  if (count % BATCH_W)   /* last, partial group */
+    for (e = 0; e < size; e++)
+      for (l = 0; l < BATCH_W; l++) {
+        x = g * BATCH_W + l;
+        dst[(g*size + e) * BATCH_W + l] = (x < count) ? src[x*size + e] : 0.0;
+      }
+}
+
+/* interleaved -> back to back */
+void batch_deinterleave(long int rows, long int cols, long int count,
+                        const double *src, double *dst)
+{
+  long int g, e, l, x, size = rows * cols;
+
+  for (g = 0; g < (count + BATCH_W - 1) / BATCH_W; g++)
+    for (e = 0; e < size; e++)
+      for (l = 0; l < BATCH_W; l++) {
+        x = g * BATCH_W + l;
+        if (x < count) dst[x*size + e] = src[(g*size + e) * BATCH_W + l];
+      }
+}
+
+/* number of elements of the back-to-back C that differ from a scalar ijk
+   on each pair */
+long int count_errors(long int m, long int n, long int k, const double *a,
+                      const double *b, const double *c, long int count)
+{
+  long int x, i, j, p, errors = 0;
+  double sum;
+
+  for (x = 0; x < count; x++)
+    for (i = 0; i < m; i++)
+      for (j = 0; j < n; j++) {
+        sum = IDENT;
+        for (p = 0; p < k; p++)
+          sum += a[x*m*k + i*k + p] * b[x*k*n + p*n + j];
+        if (c[x*m*n + i*n + j] != sum) errors++;
+      }
+  return errors;
+}
@@ -0,0 +1,353 @@
+/***********************************************************************
+
+ gcc -O3 -mavx2 -mfma -fopenmp test_gemm_omp.c -lrt -lm -o test_gemm_omp
+ ./test_gemm_omp [max_threads]
+
+ Race-free multithreaded GEMM (C += A * B, doubles), with strong scaling
+ from 1 thread up to max_threads (default: the number of processors).
+
+ mmm_kij_omp() (here and in Deliverables/mmm_optimized.c) splits the k
+ loop between threads. Every thread then adds into every element of C, so
+ the threads race on C (updates get lost) and the lines of C bounce
+ between the cores' caches. gemm_omp() splits the output instead:
+
+   - C is cut into a pr x pc grid of 2D tiles, one per thread (pr * pc =
+     number of threads, picked so the tiles are close to square), on
+     micro-kernel boundaries. Each element of C is written by exactly one
+     thread, so there is nothing to race on and no line of C is shared.
+   - For each KC x NC panel of B, all threads pack it together into one
+     shared buffer (an omp for over the NR-wide micro-panels), then wait at
+     the barrier at the end of the omp for. Each thread packs the rows of
+     A for its own tiles into its own buffer and runs the gemm.h
+     macro-kernel on its part of the shared B panel.
+   - A second barrier keeps the B buffer from being repacked while a
+     thread is still using it.
+
+ For every size and thread count, gemm_omp and mmm_kij_omp are compared
+ element by element against the serial mmm_ijk. The inputs come from
+ init_mat_check() in mat.h, so any difference is a real error.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <omp.h>
+#include "arena.h"
+
+/* We do *not* use CPNS (cycles per nanosecond) because when multiple
+   cores are each executing with their own clock speeds, sometimes overlapping
+   in time, measuring "how many cycles" a program takes does not reflect
+   how much time it takes. We care about time more than about cycles. */
+
+#define NUM_TESTS 3
+
+static const long int sizes[NUM_TESTS] = {384, 1000, 1600};
+
+#define IDENT 0
+
+typedef double data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+#include "gemm.h"
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c);
+void mmm_kij_omp(mat_ptr a, mat_ptr b, mat_ptr c);
+void gemm_omp(long int M, long int N, long int K, const double *a,
+              long int lda, const double *b, long int ldb, double *c,
+              long int ldc, int nthreads);
+void gemm_omp_mat(mat_ptr a, mat_ptr b, mat_ptr c, int nthreads);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+
+/************************************************************************/
+int main(int argc, char *argv[])
+{
+  struct timespec time_start, time_stop;
+  double final_answer, t_ijk, t_gemm, t_gemm1 = 0, t_kij, flops;
+  long int x, n, max_n, err_gemm, err_kij;
+  int max_threads, nt;
+
+  printf("OpenMP 2D-partitioned GEMM, strong scaling\n");
+
+  max_threads = omp_get_num_procs();
+  if (argc > 1) max_threads = atoi(argv[1]);
+  if (max_threads < 1) max_threads = 1;
+  printf("Testing 1 to %d threads (%d processors)\n", max_threads,
+         omp_get_num_procs());
+
+  final_answer = wakeup_delay();
+
+  /* declare and initialize the matrix structures */
+  max_n = sizes[NUM_TESTS-1];
+  mat_ptr a0 = new_mat(max_n, max_n);
+  mat_ptr b0 = new_mat(max_n, max_n);
+  mat_ptr c0 = new_mat(max_n, max_n);
+  mat_ptr ref = new_mat(max_n, max_n);
+  if (!a0 || !b0 || !c0 || !ref) exit(-1);
+  init_mat_check(a0, b0);
+
+  printf("\nAll times are in seconds\n");
+  printf("rowlen, threads, gemm_omp, GFLOPs, speedup, efficiency, errors, "
+         "kij_omp, kij_omp errors\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    n = sizes[x];
+    flops = 2.0 * n * n * n;
+    set_mat_size(a0, n, n);
+    set_mat_size(b0, n, n);
+    set_mat_size(c0, n, n);
+    set_mat_size(ref, n, n);
+
+    /* serial reference */
+    fill_mat(ref, IDENT);
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    mmm_ijk(a0, b0, ref);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_ijk = interval(time_start, time_stop);
+    printf("%4ld, ijk (serial reference), %10.4g\n", n, t_ijk);
+
+    /* one untimed run with the most threads first: gemm_omp takes its
+       packing buffers from the arena, and the first call would otherwise
+       pay for faulting their pages in and make 1 thread look slow */
+    fill_mat(c0, IDENT);
+    gemm_omp_mat(a0, b0, c0, max_threads);
+
+    /* 1, 2, 4, ... threads, and max_threads */
+    for (nt = 1; nt <= max_threads;
+         nt = (nt < max_threads && nt*2 > max_threads) ? max_threads : nt*2) {
+      fill_mat(c0, IDENT);
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      gemm_omp_mat(a0, b0, c0, nt);
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      t_gemm = interval(time_start, time_stop);
+      err_gemm = count_mat_diff(c0, ref);
+      if (nt == 1) t_gemm1 = t_gemm;
+
+      fill_mat(c0, IDENT);
+      omp_set_num_threads(nt);
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      mmm_kij_omp(a0, b0, c0);
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      t_kij = interval(time_start, time_stop);
+      err_kij = count_mat_diff(c0, ref);
+
+      printf("%4ld, %3d,%10.4g,%8.2f,%7.2f,%7.2f, %ld,%10.4g, %ld\n",
+             n, nt, t_gemm, flops / t_gemm * 1.0e-9, t_gemm1 / t_gemm,
+             t_gemm1 / t_gemm / nt, err_gemm, t_kij, err_kij);
+    }
+  }
+
+  printf("\n");
+  printf("Initial delay was calculating: %g \n", final_answer);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+
+/* serial MMM ijk, c += a * b (as mmm_ijk in test_mmm_inter_omp.c) */
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t sum;
+
+  for (i = 0; i < M; i++) {
+    for (j = 0; j < N; j++) {
+      sum = IDENT;
+      for (k = 0; k < K; k++)
+        sum += a0[i*lda+k] * b0[k*ldb+j];
+      c0[i*ldc+j] += sum;
+    }
+  }
+}
+
+/* MMM kij w/ OMP (as in test_mmm_inter_omp.c): the k loop is split
+   between threads, which all update the same rows of c -- a race */
+void mmm_kij_omp(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+#pragma omp parallel shared(a0,b0,c0,M,N,K) private(i,j,k,r)
+  {
+#pragma omp for
+    for (k = 0; k < K; k++) {
+      for (i = 0; i < M; i++) {
+        r = a0[i*lda+k];
+        for (j = 0; j < N; j++)
+          c0[i*ldc+j] += r*b0[k*ldb+j];
+      }
+    }
+  }
+}
+
+/* Rows of the pr x (nt/pr) grid of C tiles, for nt threads, whose tiles
+   are closest to square */
+static int gemm_grid_rows(long int M, long int N, int nt)
+{
+  int p, best_pr = 1;
+  double aspect, best = 1e30;
+
+  for (p = 1; p <= nt; p++) {
+    if (nt % p) continue;
+    aspect = fabs(log(((double) M / p) /
+                      ((double) (N < GEMM_NC ? N : GEMM_NC) / (nt / p))));
+    if (aspect < best) {
+      best = aspect;
+      best_pr = p;
+    }
+  }
+  return best_pr;
+}
+
+/* C += A * B on nthreads threads, each owning a 2D tile of C. See the
+   top of the file. */
+void gemm_omp(long int M, long int N, long int K, const double *a,
+              long int lda, const double *b, long int ldb, double *c,
+              long int ldc, int nthreads)
+{
+  arena_mark_t mark = arena_mark(default_arena());
+  double *bp, *ap_all;
+
+  /* A is packed per thread, B once for everybody */
+  bp = (double *) arena_alloc(default_arena(), GEMM_BP_SIZE * sizeof(double));
+  ap_all = (double *) arena_alloc(default_arena(),
+                                  nthreads * GEMM_AP_SIZE * sizeof(double));
+  if (!bp || !ap_all) {
+    printf("COULD NOT ALLOCATE gemm_omp packing buffers\n");
+    exit(-1);
+  }
+
+#pragma omp parallel num_threads(nthreads)
+  {
+    /* the grid is for the threads we actually got, which can be fewer
+       than nthreads (OMP_THREAD_LIMIT, OMP_DYNAMIC) */
+    int t = omp_get_thread_num(), nt = omp_get_num_threads();
+    int pr = gemm_grid_rows(M, N, nt);
+    int pc = nt / pr;
+    int ti = t / pc, tj = t % pc;
+    double *ap = &ap_all[t * GEMM_AP_SIZE];
+    long int jc, pk, ic, jr, nc, kc, mc, r0, r1, c0, c1;
+    long int units_m = (M + GEMM_MR - 1) / GEMM_MR;
+
+    /* my rows of C, on MR boundaries; the same for every B panel */
+    r0 = (ti * units_m / pr) * GEMM_MR;
+    r1 = ((ti + 1) * units_m / pr) * GEMM_MR;
+    if (r1 > M) r1 = M;
+
+    for (jc = 0; jc < N; jc += GEMM_NC) {
+      long int units_n;
+      nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+
+      /* my columns of this panel, on NR boundaries */
+      units_n = (nc + GEMM_NR - 1) / GEMM_NR;
+      c0 = (tj * units_n / pc) * GEMM_NR;
+      c1 = ((tj + 1) * units_n / pc) * GEMM_NR;
+      if (c1 > nc) c1 = nc;
+
+      for (pk = 0; pk < K; pk += GEMM_KC) {
+        kc = (K - pk < GEMM_KC) ? K - pk : GEMM_KC;
+
+        /* pack the shared B panel together; implicit barrier at the end */
+#pragma omp for schedule(static)
+        for (jr = 0; jr < nc; jr += GEMM_NR) {
+          gemm_pack_b(kc, (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR,
+                      &b[pk*ldb + jc + jr], ldb, &bp[jr*kc]);
+        }
+
+        for (ic = r0; ic < r1 && c0 < c1; ic += GEMM_MC) {
+          mc = (r1 - ic < GEMM_MC) ? r1 - ic : GEMM_MC;
+          gemm_pack_a(mc, kc, &a[ic*lda + pk], lda, ap);
+          gemm_macro(mc, c1 - c0, kc, ap, &bp[c0*kc],
+                     &c[ic*ldc + jc + c0], ldc);
+        }
+
+        /* nobody repacks bp until everyone is done with it */
+#pragma omp barrier
+      }
+    }
+  }
+
+  arena_release(default_arena(), mark);
+}
+
+void gemm_omp_mat(mat_ptr a, mat_ptr b, mat_ptr c, int nthreads)
+{
+  gemm_omp(get_mat_rows(a), get_mat_cols(b), get_mat_cols(a),
+           get_mat_start(a), get_mat_ld(a), get_mat_start(b), get_mat_ld(b),
+           get_mat_start(c), get_mat_ld(c), nthreads);
+}
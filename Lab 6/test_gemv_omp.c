@@ -0,0 +1,532 @@
+/***********************************************************************
+
+ gcc -O3 -mavx2 -mfma -fopenmp test_gemv_omp.c -lrt -o test_gemv_omp
+ ./test_gemv_omp [max_threads]
+
+ Matrix-vector multiply, y += A x (gemv) and y += A^T x (gemv_t), doubles,
+ A M x N row-major with leading dimension lda, multithreaded by blocks of
+ rows with OpenMP.
+
+ GEMV does 2 flops per element of A and reads each element once, so it is
+ limited by memory bandwidth, not arithmetic; the kernels are written to
+ keep the loads streaming:
+
+   - gemv: 4 rows of A per pass, each with two ymm accumulators (8
+     independent FMA chains). Each load of x serves 4 rows; the
+     accumulators are summed across lanes once per row at the end.
+   - gemv_t: y += a(i,:) * x(i) for 4 rows at a time, so y is loaded and
+     stored once per 4 rows instead of once per row, and over GEMVT_NB
+     columns at a time, so that piece of y stays in L1 while the rows go
+     by. With row blocks, every thread has its own copy of y, and the
+     copies are added at the end (a reduction over threads, split by
+     columns).
+   - A is read exactly once, so it can be prefetched with the
+     non-temporal hint (prefetchnta), which brings it in close to the core
+     without pushing x and y out of the outer cache levels. That is a
+     compile-time option (-DGEMV_NTA=1) and off by default: on the
+     machine this was tuned on, the hardware prefetcher alone was 2x
+     faster than with prefetchnta, which skips L2 and throttles it.
+
+ The old way -- mmm_ijk with a one-column B -- is timed for comparison.
+ Rates are in GB/s (the bytes of A plus x and y, counted once), next to
+ the STREAM triad bandwidth (a[i] = b[i] + s * c[i]) measured here with
+ the same number of threads, which is the ceiling for any kernel that
+ streams from memory. A that fits in the caches can go past it.
+
+ Before timing, check_gemv compares both kernels against scalar loops on
+ ragged shapes; the inputs are small integers, so the sums are exact.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <immintrin.h>
+#include <omp.h>
+#include "arena.h"
+
+/* We do *not* use CPNS (cycles per nanosecond) because when multiple
+   cores are each executing with their own clock speeds, sometimes overlapping
+   in time, measuring "how many cycles" a program takes does not reflect
+   how much time it takes. We care about time more than about cycles. */
+
+#define NUM_TESTS 6
+
+/* M x N: in L2, in L3, in memory, and tall and wide in memory */
+static const long int shapes[NUM_TESTS][2] = {
+  {256, 256}, {1024, 1024}, {4096, 4096}, {8192, 4096},
+  {131072, 128}, {128, 131072}
+};
+
+#define MIN_BYTES (1L << 30)   /* repeat small sizes to move this much */
+#define STREAM_SIZE (1L << 24) /* doubles per STREAM array (128 MB) */
+#define GEMVT_NB 1024          /* columns of y per block in gemv_t */
+
+/* -DGEMV_NTA=1 adds prefetchnta of A, PF_DIST bytes ahead (see top) */
+#ifndef GEMV_NTA
+#define GEMV_NTA 0
+#endif
+#define PF_DIST 512
+#if GEMV_NTA
+#define GEMV_PF(p) _mm_prefetch((const char *)(p) + PF_DIST, _MM_HINT_NTA)
+#else
+#define GEMV_PF(p)
+#endif
+
+#define IDENT 0
+
+typedef double data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c);
+void gemv(long int M, long int N, const double *a, long int lda,
+          const double *x, double *y, int nthreads);
+void gemv_t(long int M, long int N, const double *a, long int lda,
+            const double *x, double *y, int nthreads);
+double stream_triad(int nthreads);
+long int check_gemv(void);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+
+/************************************************************************/
+int main(int argc, char *argv[])
+{
+  struct timespec time_start, time_stop;
+  double final_answer, bytes, t_mmm, t_gemv, t_gemvt, stream_bw[2];
+  long int x, r, reps, M, N, i, max_elems = 0, max_vec = 0;
+  int max_threads, nt, ti;
+  double *a, *xv, *y;
+
+  printf("GEMV and transposed GEMV\n");
+
+  max_threads = omp_get_num_procs();
+  if (argc > 1) max_threads = atoi(argv[1]);
+  if (max_threads < 1) max_threads = 1;
+  printf("Testing 1 and %d threads (%d processors)\n", max_threads,
+         omp_get_num_procs());
+
+  if (check_gemv()) {
+    printf("check_gemv FAILED\n");
+    exit(-1);
+  }
+  printf("check_gemv passed\n");
+
+  final_answer = wakeup_delay();
+
+  for (x = 0; x < NUM_TESTS; x++) {
+    if (shapes[x][0] * shapes[x][1] > max_elems)
+      max_elems = shapes[x][0] * shapes[x][1];
+    if (shapes[x][0] > max_vec) max_vec = shapes[x][0];
+    if (shapes[x][1] > max_vec) max_vec = shapes[x][1];
+  }
+  a = (double *) arena_alloc(default_arena(), max_elems * sizeof(double));
+  xv = (double *) arena_alloc(default_arena(), max_vec * sizeof(double));
+  y = (double *) arena_alloc(default_arena(), max_vec * sizeof(double));
+  if (!a || !xv || !y) {
+    printf("COULDN'T ALLOCATE gemv storage\n");
+    exit(-1);
+  }
+  for (i = 0; i < max_elems; i++) a[i] = (double)(i % 7 - 3) * 0.5;
+  for (i = 0; i < max_vec; i++) xv[i] = (double)(i % 5 - 2) * 0.25;
+
+  stream_bw[0] = stream_triad(1);
+  stream_bw[1] = stream_triad(max_threads);
+  printf("\nSTREAM triad: %.2f GB/s on 1 thread, %.2f GB/s on %d\n",
+         stream_bw[0], stream_bw[1], max_threads);
+
+  printf("\nRates in GB/s (%% of STREAM triad with as many threads)\n");
+  printf("M, N, threads, mmm_ijk 1-col, gemv, %%, gemv_t, %%\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    M = shapes[x][0];
+    N = shapes[x][1];
+    bytes = (double)(M * N + M + N) * sizeof(double);
+    reps = (long int)(MIN_BYTES / bytes) + 1;
+
+    for (ti = 0; ti < 2; ti++) {
+      nt = ti ? max_threads : 1;
+      if (ti && max_threads == 1) break;
+
+      /* y = A x the old way, with x as an N x 1 matrix (1 thread) */
+      t_mmm = 0.0;
+      if (ti == 0) {
+        mat_rec ma, mx, my;
+        ma.rows = M;  ma.cols = N;  ma.ld = N;  ma.data = a;
+        mx.rows = N;  mx.cols = 1;  mx.ld = 1;  mx.data = xv;
+        my.rows = M;  my.cols = 1;  my.ld = 1;  my.data = y;
+        clock_gettime(CLOCK_REALTIME, &time_start);
+        for (r = 0; r < reps; r++) mmm_ijk(&ma, &mx, &my);
+        clock_gettime(CLOCK_REALTIME, &time_stop);
+        t_mmm = interval(time_start, time_stop) / reps;
+      }
+
+      for (i = 0; i < M; i++) y[i] = IDENT;
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      for (r = 0; r < reps; r++) gemv(M, N, a, N, xv, y, nt);
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      t_gemv = interval(time_start, time_stop) / reps;
+
+      /* A^T is N x M: x has M elements, y has N */
+      for (i = 0; i < N; i++) y[i] = IDENT;
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      for (r = 0; r < reps; r++) gemv_t(M, N, a, N, xv, y, nt);
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      t_gemvt = interval(time_start, time_stop) / reps;
+
+      if (ti == 0)
+        printf("%6ld, %6ld, %2d, %7.2f, %7.2f, %5.1f, %7.2f, %5.1f\n",
+               M, N, nt, bytes / t_mmm * 1.0e-9, bytes / t_gemv * 1.0e-9,
+               100.0 * bytes / t_gemv * 1.0e-9 / stream_bw[0],
+               bytes / t_gemvt * 1.0e-9,
+               100.0 * bytes / t_gemvt * 1.0e-9 / stream_bw[0]);
+      else
+        printf("%6ld, %6ld, %2d,        , %7.2f, %5.1f, %7.2f, %5.1f\n",
+               M, N, nt, bytes / t_gemv * 1.0e-9,
+               100.0 * bytes / t_gemv * 1.0e-9 / stream_bw[1],
+               bytes / t_gemvt * 1.0e-9,
+               100.0 * bytes / t_gemvt * 1.0e-9 / stream_bw[1]);
+    }
+  }
+
+  printf("\n");
+  printf("Initial delay was calculating: %g \n", final_answer);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+
+/* serial MMM ijk, c += a * b (as mmm_ijk in test_mmm_inter_omp.c) */
+void mmm_ijk(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t sum;
+
+  for (i = 0; i < M; i++) {
+    for (j = 0; j < N; j++) {
+      sum = IDENT;
+      for (k = 0; k < K; k++)
+        sum += a0[i*lda+k] * b0[k*ldb+j];
+      c0[i*ldc+j] += sum;
+    }
+  }
+}
+
+/* sum of the 4 lanes */
+static inline double hsum(__m256d v)
+{
+  __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v),
+                         _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+/* y(r0:r1) += A(r0:r1, :) x, 4 rows at a time */
+static void gemv_rows(long int r0, long int r1, long int N, const double *a,
+                      long int lda, const double *x, double *y)
+{
+  long int i, j;
+
+  for (i = r0; i + 4 <= r1; i += 4) {
+    const double *a0 = &a[i*lda], *a1 = a0 + lda, *a2 = a1 + lda,
+                 *a3 = a2 + lda;
+    __m256d s0 = _mm256_setzero_pd(), t0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd(), t1 = _mm256_setzero_pd();
+    __m256d s2 = _mm256_setzero_pd(), t2 = _mm256_setzero_pd();
+    __m256d s3 = _mm256_setzero_pd(), t3 = _mm256_setzero_pd();
+    __m256d xa, xb;
+    double y0, y1, y2, y3;
+
+    for (j = 0; j + 8 <= N; j += 8) {
+      GEMV_PF(&a0[j]);
+      GEMV_PF(&a1[j]);
+      GEMV_PF(&a2[j]);
+      GEMV_PF(&a3[j]);
+      xa = _mm256_loadu_pd(&x[j]);
+      xb = _mm256_loadu_pd(&x[j+4]);
+      s0 = _mm256_fmadd_pd(_mm256_loadu_pd(&a0[j]), xa, s0);
+      t0 = _mm256_fmadd_pd(_mm256_loadu_pd(&a0[j+4]), xb, t0);
+      s1 = _mm256_fmadd_pd(_mm256_loadu_pd(&a1[j]), xa, s1);
+      t1 = _mm256_fmadd_pd(_mm256_loadu_pd(&a1[j+4]), xb, t1);
+      s2 = _mm256_fmadd_pd(_mm256_loadu_pd(&a2[j]), xa, s2);
+      t2 = _mm256_fmadd_pd(_mm256_loadu_pd(&a2[j+4]), xb, t2);
+      s3 = _mm256_fmadd_pd(_mm256_loadu_pd(&a3[j]), xa, s3);
+      t3 = _mm256_fmadd_pd(_mm256_loadu_pd(&a3[j+4]), xb, t3);
+    }
+    y0 = hsum(_mm256_add_pd(s0, t0));
+    y1 = hsum(_mm256_add_pd(s1, t1));
+    y2 = hsum(_mm256_add_pd(s2, t2));
+    y3 = hsum(_mm256_add_pd(s3, t3));
+    for (; j < N; j++) {
+      y0 += a0[j] * x[j];
+      y1 += a1[j] * x[j];
+      y2 += a2[j] * x[j];
+      y3 += a3[j] * x[j];
+    }
+    y[i] += y0;
+    y[i+1] += y1;
+    y[i+2] += y2;
+    y[i+3] += y3;
+  }
+  for (; i < r1; i++) {   /* last 0..3 rows */
+    double sum = IDENT;
+    for (j = 0; j < N; j++) sum += a[i*lda + j] * x[j];
+    y[i] += sum;
+  }
+}
+
+/* y += A x; every thread takes a contiguous block of rows (a multiple of
+   4, so only the last block has a ragged end) */
+void gemv(long int M, long int N, const double *a, long int lda,
+          const double *x, double *y, int nthreads)
+{
+  if (nthreads == 1) {
+    gemv_rows(0, M, N, a, lda, x, y);
+    return;
+  }
+#pragma omp parallel num_threads(nthreads)
+  {
+    int t = omp_get_thread_num(), nt = omp_get_num_threads();
+    long int quads = (M + 3) / 4;
+    long int r0 = (t * quads / nt) * 4, r1 = ((t + 1) * quads / nt) * 4;
+
+    if (r1 > M) r1 = M;
+    gemv_rows(r0, r1, N, a, lda, x, y);
+  }
+}
+
+/* y(0:N) += A(r0:r1, :)^T x(r0:r1), in column blocks of GEMVT_NB and 4
+   rows at a time */
+static void gemv_t_rows(long int r0, long int r1, long int N,
+                        const double *a, long int lda, const double *x,
+                        double *y)
+{
+  long int i, j, jb, je;
+
+  for (jb = 0; jb < N; jb = je) {
+    je = (jb + GEMVT_NB < N) ? jb + GEMVT_NB : N;
+    for (i = r0; i + 4 <= r1; i += 4) {
+      const double *a0 = &a[i*lda], *a1 = a0 + lda, *a2 = a1 + lda,
+                   *a3 = a2 + lda;
+      __m256d x0 = _mm256_set1_pd(x[i]), x1 = _mm256_set1_pd(x[i+1]);
+      __m256d x2 = _mm256_set1_pd(x[i+2]), x3 = _mm256_set1_pd(x[i+3]);
+      __m256d acc;
+
+      for (j = jb; j + 4 <= je; j += 4) {
+        GEMV_PF(&a0[j]);
+        GEMV_PF(&a1[j]);
+        GEMV_PF(&a2[j]);
+        GEMV_PF(&a3[j]);
+        acc = _mm256_loadu_pd(&y[j]);
+        acc = _mm256_fmadd_pd(_mm256_loadu_pd(&a0[j]), x0, acc);
+        acc = _mm256_fmadd_pd(_mm256_loadu_pd(&a1[j]), x1, acc);
+        acc = _mm256_fmadd_pd(_mm256_loadu_pd(&a2[j]), x2, acc);
+        acc = _mm256_fmadd_pd(_mm256_loadu_pd(&a3[j]), x3, acc);
+        _mm256_storeu_pd(&y[j], acc);
+      }
+      for (; j < je; j++)
+        y[j] += a0[j]*x[i] + a1[j]*x[i+1] + a2[j]*x[i+2] + a3[j]*x[i+3];
+    }
+    for (; i < r1; i++)   /* last 0..3 rows */
+      for (j = jb; j < je; j++) y[j] += a[i*lda + j] * x[i];
+  }
+}
+
+/* y += A^T x (A is M x N, x has M elements, y has N). Threads take blocks
+   of rows into their own copy of y; the copies are then added into y,
+   each thread doing a range of columns. */
+void gemv_t(long int M, long int N, const double *a, long int lda,
+            const double *x, double *y, int nthreads)
+{
+  arena_mark_t mark;
+  double *part;
+
+  if (nthreads == 1) {
+    gemv_t_rows(0, M, N, a, lda, x, y);
+    return;
+  }
+
+  mark = arena_mark(default_arena());
+  part = (double *) arena_alloc(default_arena(),
+                                nthreads * N * sizeof(double));
+  if (!part) {
+    printf("COULDN'T ALLOCATE gemv_t partial sums\n");
+    exit(-1);
+  }
+
+#pragma omp parallel num_threads(nthreads)
+  {
+    int t = omp_get_thread_num(), nt = omp_get_num_threads();
+    long int quads = (M + 3) / 4;
+    long int r0 = (t * quads / nt) * 4, r1 = ((t + 1) * quads / nt) * 4;
+    double *mine = &part[t * N];
+    long int j;
+    int p;
+
+    if (r1 > M) r1 = M;
+    for (j = 0; j < N; j++) mine[j] = 0.0;
+    gemv_t_rows(r0, r1, N, a, lda, x, mine);
+
+    /* all the partial y's are done at the barrier at the end of the for */
+#pragma omp barrier
+#pragma omp for schedule(static)
+    for (j = 0; j < N; j++)
+      for (p = 0; p < nt; p++) y[j] += part[p*N + j];
+  }
+
+  arena_release(default_arena(), mark);
+}
+
+/* STREAM triad, a[i] = b[i] + s * c[i], on nthreads threads; best of 5,
+   in GB/s (24 bytes per element) */
+double stream_triad(int nthreads)
+{
+  arena_mark_t mark = arena_mark(default_arena());
+  double *sa = (double *) arena_alloc(default_arena(),
+                                      STREAM_SIZE * sizeof(double));
+  double *sb = (double *) arena_alloc(default_arena(),
+                                      STREAM_SIZE * sizeof(double));
+  double *sc = (double *) arena_alloc(default_arena(),
+                                      STREAM_SIZE * sizeof(double));
+  struct timespec time_start, time_stop;
+  double t, best = 1e30, s = 3.0;
+  long int i;
+  int r;
+
+  if (!sa || !sb || !sc) {
+    printf("COULDN'T ALLOCATE STREAM arrays\n");
+    exit(-1);
+  }
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+  for (i = 0; i < STREAM_SIZE; i++) {
+    sa[i] = 1.0;
+    sb[i] = 2.0;
+    sc[i] = 0.5;
+  }
+  for (r = 0; r < 5; r++) {
+    clock_gettime(CLOCK_REALTIME, &time_start);
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+    for (i = 0; i < STREAM_SIZE; i++) sa[i] = sb[i] + s * sc[i];
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t = interval(time_start, time_stop);
+    if (t < best) best = t;
+  }
+
+  arena_release(default_arena(), mark);
+  return 3.0 * STREAM_SIZE * sizeof(double) / best * 1.0e-9;
+}
+
+/* gemv and gemv_t against scalar loops, on shapes that aren't multiples
+   of 4 or 8 and with lda > N, on 1 and 3 threads. Returns the number of
+   wrong elements. */
+long int check_gemv(void)
+{
+  static const long int sh[][2] = {   /* M, N */
+    {1, 1}, {3, 5}, {4, 8}, {17, 33}, {100, 3}, {5, 2051}, {257, 129}
+  };
+  const int nsh = sizeof(sh) / sizeof(sh[0]);
+  const long int lda = 2060;
+  arena_mark_t mark = arena_mark(default_arena());
+  double *a = (double *) arena_alloc(default_arena(),
+                                     260 * lda * sizeof(double));
+  double *x = (double *) arena_alloc(default_arena(), lda * sizeof(double));
+  double *y = (double *) arena_alloc(default_arena(), lda * sizeof(double));
+  double *ref = (double *) arena_alloc(default_arena(),
+                                       lda * sizeof(double));
+  long int s, i, j, M, N, errors = 0;
+  int nt;
+
+  if (!a || !x || !y || !ref) exit(-1);
+  for (i = 0; i < 260 * lda; i++) a[i] = (double)(i % 7 - 3);
+  for (i = 0; i < lda; i++) x[i] = (double)(i % 5 - 2);
+
+  for (s = 0; s < nsh; s++) {
+    M = sh[s][0];
+    N = sh[s][1];
+    for (nt = 1; nt <= 3; nt += 2) {
+      for (i = 0; i < M; i++) {
+        ref[i] = y[i] = 1.0;
+        for (j = 0; j < N; j++) ref[i] += a[i*lda + j] * x[j];
+      }
+      gemv(M, N, a, lda, x, y, nt);
+      for (i = 0; i < M; i++) if (y[i] != ref[i]) errors++;
+
+      for (j = 0; j < N; j++) {
+        ref[j] = y[j] = 1.0;
+        for (i = 0; i < M; i++) ref[j] += a[i*lda + j] * x[i];
+      }
+      gemv_t(M, N, a, lda, x, y, nt);
+      for (j = 0; j < N; j++) if (y[j] != ref[j]) errors++;
+    }
+  }
+
+  arena_release(default_arena(), mark);
+  return errors;
+}
@@ -0,0 +1,358 @@
+/***********************************************************************
+
+ gcc -O3 -mavx2 -mfma -mf16c -fopenmp test_hgemm_omp.c -lrt -lm -o test_hgemm_omp
+ ./test_hgemm_omp [max_threads]
+
+ Mixed-precision GEMM (hgemm.h): A and B stored in bf16 or fp16,
+ converted to float while they are packed, sums in fp32, C float. The
+ same kernel on float A and B (fp32) shows what the conversion costs,
+ and the float mmm_kij of test_mmm_inter_omp.c (1 thread) is the
+ reference for both the speed and the error.
+
+ Every thread takes a block of rows of A and C (on MR boundaries) and
+ runs hgemm_blocked() with its own packing buffers.
+
+ The inputs are uniform in [0,1), so every element of C is a sum of K
+ positive products, well away from zero, and the relative error
+ |c - ref| / |ref| means something for every element. The error of the
+ bf16 and fp16 paths is mostly from rounding the inputs (2^-9 and 2^-12
+ relative for each), not from the sums; the fp32 path only differs from
+ mmm_kij in the order of the sums.
+
+ Before timing, check_hgemm compares all three formats against a scalar
+ loop on ragged shapes, with small integers, which bf16 and fp16 hold
+ exactly, so the results must be identical.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <omp.h>
+#include "arena.h"
+
+/* We do *not* use CPNS (cycles per nanosecond) because when multiple
+   cores are each executing with their own clock speeds, sometimes overlapping
+   in time, measuring "how many cycles" a program takes does not reflect
+   how much time it takes. We care about time more than about cycles. */
+
+#define NUM_TESTS 4
+
+static const long int sizes[NUM_TESTS] = {256, 512, 1024, 1536};
+
+#define IDENT 0
+
+typedef float data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+#include "hgemm.h"
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c);
+void hgemm_omp(int fmt, long int M, long int N, long int K, const void *a,
+               long int lda, const void *b, long int ldb, float *c,
+               long int ldc, float *bufs, int nthreads);
+double max_rel_error(mat_ptr c, mat_ptr ref);
+long int check_hgemm(void);
+double fRand(double fMin, double fMax);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+
+/************************************************************************/
+int main(int argc, char *argv[])
+{
+  struct timespec time_start, time_stop;
+  double final_answer, flops, t, err;
+  long int x, n, i, j, ld;
+  int max_threads, fmt;
+  mat_ptr a, b, c, ref;
+  uint16_t *ah, *bh;
+  float *bufs;
+  arena_mark_t mark;
+
+  printf("Mixed-precision GEMM, fp32 accumulation\n");
+
+  max_threads = omp_get_num_procs();
+  if (argc > 1) max_threads = atoi(argv[1]);
+  if (max_threads < 1) max_threads = 1;
+  printf("hgemm on %d threads (%d processors), mmm_kij on 1\n",
+         max_threads, omp_get_num_procs());
+
+  if (check_hgemm()) {
+    printf("check_hgemm FAILED\n");
+    exit(-1);
+  }
+  printf("check_hgemm passed\n");
+
+  final_answer = wakeup_delay();
+
+  bufs = (float *) arena_alloc(default_arena(), max_threads *
+                               (HGEMM_AP_SIZE + HGEMM_BP_SIZE) *
+                               sizeof(float));
+  if (!bufs) {
+    printf("COULDN'T ALLOCATE hgemm packing buffers\n");
+    exit(-1);
+  }
+  for (i = 0; i < max_threads * (HGEMM_AP_SIZE + HGEMM_BP_SIZE); i++)
+    bufs[i] = 0.0f;
+
+  printf("\nGFLOP/s (max relative error against mmm_kij)\n");
+  printf("size, mmm_kij, A and B in fp32, bf16, fp16\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    n = sizes[x];
+    flops = 2.0 * n * n * n;
+    mark = arena_mark(default_arena());
+    a = new_mat(n, n);
+    b = new_mat(n, n);
+    c = new_mat(n, n);
+    ref = new_mat(n, n);
+    if (!a || !b || !c || !ref) exit(-1);
+    ld = get_mat_ld(a);
+    ah = (uint16_t *) arena_alloc(default_arena(),
+                                  n * ld * sizeof(uint16_t));
+    bh = (uint16_t *) arena_alloc(default_arena(),
+                                  n * ld * sizeof(uint16_t));
+    if (!ah || !bh) {
+      printf("COULDN'T ALLOCATE bf16/fp16 copies\n");
+      exit(-1);
+    }
+    srandom(1);
+    for (i = 0; i < n; i++)
+      for (j = 0; j < n; j++) {
+        a->data[i*ld + j] = (float) fRand(0.0, 1.0);
+        b->data[i*ld + j] = (float) fRand(0.0, 1.0);
+      }
+
+    fill_mat(ref, IDENT);
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    mmm_kij(a, b, ref);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    printf("%4ld, %7.2f", n, flops / interval(time_start, time_stop) * 1.0e-9);
+
+    for (fmt = HGEMM_F32; fmt <= HGEMM_F16; fmt++) {
+      const void *pa = a->data, *pb = b->data;
+      if (fmt != HGEMM_F32) {
+        /* the bf16 / fp16 copies are the stored matrices; not timed */
+        hgemm_convert(fmt, n * ld, a->data, ah);
+        hgemm_convert(fmt, n * ld, b->data, bh);
+        pa = ah;
+        pb = bh;
+      }
+      fill_mat(c, IDENT);
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      hgemm_omp(fmt, n, n, n, pa, ld, pb, ld, c->data, ld, bufs,
+                max_threads);
+      clock_gettime(CLOCK_REALTIME, &time_stop);
+      t = interval(time_start, time_stop);
+      err = max_rel_error(c, ref);
+      printf(", %7.2f (%.1e)", flops / t * 1.0e-9, err);
+    }
+    printf("\n");
+
+    free(a); free(b); free(c); free(ref);
+    arena_release(default_arena(), mark);
+  }
+
+  printf("\n");
+  printf("Initial delay was calculating: %g \n", final_answer);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+
+/* MMM kij, c += a * b (as mmm_kij in test_mmm_inter_omp.c) */
+void mmm_kij(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int i, j, k;
+  long int M = get_mat_rows(a), K = get_mat_cols(a), N = get_mat_cols(b);
+  long int lda = get_mat_ld(a), ldb = get_mat_ld(b), ldc = get_mat_ld(c);
+  data_t *a0 = get_mat_start(a);
+  data_t *b0 = get_mat_start(b);
+  data_t *c0 = get_mat_start(c);
+  data_t r;
+
+  for (k = 0; k < K; k++) {
+    for (i = 0; i < M; i++) {
+      r = a0[i*lda+k];
+      for (j = 0; j < N; j++)
+        c0[i*ldc+j] += r*b0[k*ldb+j];
+    }
+  }
+}
+
+/* C += A * B in fmt with every thread doing a block of rows (on MR
+   boundaries) with hgemm_blocked() and its own packing buffers from bufs
+   (nthreads * (HGEMM_AP_SIZE + HGEMM_BP_SIZE) floats, 64-byte aligned) */
+void hgemm_omp(int fmt, long int M, long int N, long int K, const void *a,
+               long int lda, const void *b, long int ldb, float *c,
+               long int ldc, float *bufs, int nthreads)
+{
+  long int esize = (fmt == HGEMM_F32) ? sizeof(float) : sizeof(uint16_t);
+
+#pragma omp parallel num_threads(nthreads)
+  {
+    int t = omp_get_thread_num(), nt = omp_get_num_threads();
+    long int units = (M + HGEMM_MR - 1) / HGEMM_MR;
+    long int r0 = (t * units / nt) * HGEMM_MR;
+    long int r1 = ((t + 1) * units / nt) * HGEMM_MR;
+    float *ap = &bufs[t * (HGEMM_AP_SIZE + HGEMM_BP_SIZE)];
+
+    if (r1 > M) r1 = M;
+    if (r0 < r1)
+      hgemm_blocked(fmt, r1 - r0, N, K,
+                    (const char *) a + r0 * lda * esize, lda, b, ldb,
+                    &c[r0*ldc], ldc, ap, ap + HGEMM_AP_SIZE);
+  }
+}
+
+/* max over the elements of |c - ref| / |ref| */
+double max_rel_error(mat_ptr c, mat_ptr ref)
+{
+  long int i, j;
+  double e, worst = 0.0;
+
+  for (i = 0; i < get_mat_rows(c); i++)
+    for (j = 0; j < get_mat_cols(c); j++) {
+      e = fabs((double) c->data[i*c->ld + j] - ref->data[i*ref->ld + j]);
+      if (ref->data[i*ref->ld + j] != 0.0f)
+        e /= fabs((double) ref->data[i*ref->ld + j]);
+      if (e > worst) worst = e;
+    }
+  return worst;
+}
+
+/* hgemm_omp in every format against a scalar loop, on shapes that aren't
+   multiples of MR, NR or 8 and with ld > N, on 1 and 3 threads. The
+   inputs are integers in -8..8, exact in bf16 and fp16, and the sums stay
+   far below 2^24, so they are exact in float too. Returns the number of
+   wrong elements. */
+long int check_hgemm(void)
+{
+  static const long int sh[][3] = {   /* M, N, K */
+    {1, 1, 1}, {5, 7, 3}, {6, 16, 8}, {13, 35, 17}, {100, 33, 260},
+    {97, 300, 41}
+  };
+  const int nsh = sizeof(sh) / sizeof(sh[0]);
+  const long int ld = 304;
+  arena_mark_t mark = arena_mark(default_arena());
+  float *a = (float *) arena_alloc(default_arena(), ld*ld * sizeof(float));
+  float *b = (float *) arena_alloc(default_arena(), ld*ld * sizeof(float));
+  float *c = (float *) arena_alloc(default_arena(), ld*ld * sizeof(float));
+  float *ref = (float *) arena_alloc(default_arena(), ld*ld * sizeof(float));
+  uint16_t *ah = (uint16_t *) arena_alloc(default_arena(),
+                                          ld*ld * sizeof(uint16_t));
+  uint16_t *bh = (uint16_t *) arena_alloc(default_arena(),
+                                          ld*ld * sizeof(uint16_t));
+  float *bufs = (float *) arena_alloc(default_arena(), 3 *
+                                      (HGEMM_AP_SIZE + HGEMM_BP_SIZE) *
+                                      sizeof(float));
+  long int s, i, j, k, M, N, K, errors = 0;
+  int nt, fmt;
+
+  if (!a || !b || !c || !ref || !ah || !bh || !bufs) exit(-1);
+  for (i = 0; i < ld*ld; i++) {
+    a[i] = (float)(i % 17 - 8);
+    b[i] = (float)((3*i) % 11 - 5);
+  }
+
+  for (s = 0; s < nsh; s++) {
+    M = sh[s][0];
+    N = sh[s][1];
+    K = sh[s][2];
+    for (i = 0; i < M; i++)
+      for (j = 0; j < N; j++) {
+        ref[i*ld + j] = 1.0f;
+        for (k = 0; k < K; k++) ref[i*ld + j] += a[i*ld + k] * b[k*ld + j];
+      }
+    for (fmt = HGEMM_F32; fmt <= HGEMM_F16; fmt++) {
+      const void *pa = a, *pb = b;
+      if (fmt != HGEMM_F32) {
+        hgemm_convert(fmt, ld*ld, a, ah);
+        hgemm_convert(fmt, ld*ld, b, bh);
+        pa = ah;
+        pb = bh;
+      }
+      for (nt = 1; nt <= 3; nt += 2) {
+        for (i = 0; i < M; i++)
+          for (j = 0; j < N; j++) c[i*ld + j] = 1.0f;
+        hgemm_omp(fmt, M, N, K, pa, ld, pb, ld, c, ld, bufs, nt);
+        for (i = 0; i < M; i++)
+          for (j = 0; j < N; j++)
+            if (c[i*ld + j] != ref[i*ld + j]) errors++;
+      }
+    }
+  }
+
+  arena_release(default_arena(), mark);
+  return errors;
+}
+
+double fRand(double fMin, double fMax)
+{
+  double f = (double)random() / RAND_MAX;
+  return fMin + f * (fMax - fMin);
+}
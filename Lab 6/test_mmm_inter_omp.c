@@ -10,6 +10,7 @@
 #include <time.h>
 #include <math.h>
 #include <omp.h>
+#include "arena.h"
 
 /* We do *not* use CPNS (cycles per nanosecond) because when multiple
    cores are each executing with their own clock speeds, sometimes overlapping
@@ -229,7 +230,7 @@ matrix_ptr new_matrix(long int rowlen)
 
   /* Allocate and declare array */
   if (rowlen > 0) {
-    data_t *data = (data_t *) calloc(rowlen*rowlen, sizeof(data_t));
+    data_t *data = (data_t *) arena_calloc(default_arena(), rowlen*rowlen, sizeof(data_t));
     if (!data) {
       free((void *) result);
       printf("COULD NOT ALLOCATE %ld BYTES STORAGE \n",
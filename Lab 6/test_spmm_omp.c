@@ -0,0 +1,356 @@
+/***********************************************************************
+
+ gcc -O3 -mavx2 -mfma -fopenmp test_spmm_omp.c -lrt -o test_spmm_omp
+ ./test_spmm_omp [max_threads]
+
+ Sparse A times dense B (spmm.h), C += A * B, doubles, against the dense
+ packed GEMM (gemm.h) on the same matrices, over a sweep of densities, to
+ find where sparse stops paying off.
+
+ A is SPMM_N x SPMM_N, B and C are SPMM_N x SPMM_NB. Two nonzero patterns:
+
+   - scattered: every element nonzero with probability d. BSR has to
+     store whole 4 x 4 blocks around the nonzeros, so it does up to 16x
+     the arithmetic of CSR at low densities.
+   - blocked: every 4 x 4 block nonzero (all of it) with probability d,
+     the way matrices from meshes and FEM come. Same density, but BSR
+     stores no zeros and needs 1/16 of the indices.
+
+ The dense multiply runs every thread on its own block of rows of A and C
+ with gemm_blocked() and its own packing buffers (B is packed by every
+ thread). Its time doesn't depend on d; the sparse ones go with the
+ number of nonzeros. Times are in ms for max_threads threads. "fill" is
+ the elements BSR stores per nonzero. The crossover is the first density
+ at which dense beats the faster sparse kernel.
+
+ Before timing, check_spmm compares both sparse kernels against a scalar
+ dense loop on ragged shapes; the inputs are small integers, so the sums
+ are exact.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <omp.h>
+#include "arena.h"
+
+/* We do *not* use CPNS (cycles per nanosecond) because when multiple
+   cores are each executing with their own clock speeds, sometimes overlapping
+   in time, measuring "how many cycles" a program takes does not reflect
+   how much time it takes. We care about time more than about cycles. */
+
+#define SPMM_N 2048     /* A is SPMM_N x SPMM_N */
+#define SPMM_NB 512     /* columns of B and C */
+
+#define NUM_TESTS 10
+
+static const double densities[NUM_TESTS] = {
+  0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.35, 0.5
+};
+
+#define MIN_TIME 0.2    /* repeat fast kernels for at least this long (s) */
+
+#define IDENT 0
+
+typedef double data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+#include "gemm.h"
+#include "spmm.h"
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+void make_sparse(long int M, long int K, double *a, long int lda, double d,
+                 int blocked);
+void gemm_rows_omp(long int M, long int N, long int K, const double *a,
+                   long int lda, const double *b, long int ldb, double *c,
+                   long int ldc, double *bufs, int nthreads);
+long int check_spmm(void);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+/* average time of call, repeated until that takes MIN_TIME */
+#define TIME_REPS(result, call)                                         \
+  do {                                                                  \
+    struct timespec ts_, te_;                                           \
+    long int n_ = 0;                                                    \
+    double t_ = 0.0;                                                    \
+    clock_gettime(CLOCK_REALTIME, &ts_);                                \
+    while (t_ < MIN_TIME) {                                             \
+      call;                                                             \
+      n_++;                                                             \
+      clock_gettime(CLOCK_REALTIME, &te_);                              \
+      t_ = interval(ts_, te_);                                          \
+    }                                                                   \
+    result = t_ / n_;                                                   \
+  } while (0)
+
+
+/************************************************************************/
+int main(int argc, char *argv[])
+{
+  double final_answer, t_dense, t_csr, t_bsr;
+  long int x, i, crossover_x;
+  int max_threads, pat;
+  double *a, *b, *c, *bufs;
+  arena_mark_t mark;
+  csr_ptr sa;
+  bsr_ptr sb;
+  static const char *pat_name[2] = {"scattered", "blocked 4x4"};
+
+  printf("Sparse (CSR, BSR) x dense against dense GEMM, A %d x %d, "
+         "B %d x %d\n", SPMM_N, SPMM_N, SPMM_N, SPMM_NB);
+
+  max_threads = omp_get_num_procs();
+  if (argc > 1) max_threads = atoi(argv[1]);
+  if (max_threads < 1) max_threads = 1;
+  printf("Using %d threads (%d processors)\n", max_threads,
+         omp_get_num_procs());
+
+  if (check_spmm()) {
+    printf("check_spmm FAILED\n");
+    exit(-1);
+  }
+  printf("check_spmm passed\n");
+
+  final_answer = wakeup_delay();
+
+  a = (double *) arena_alloc(default_arena(),
+                             (long) SPMM_N * SPMM_N * sizeof(double));
+  b = (double *) arena_alloc(default_arena(),
+                             (long) SPMM_N * SPMM_NB * sizeof(double));
+  c = (double *) arena_alloc(default_arena(),
+                             (long) SPMM_N * SPMM_NB * sizeof(double));
+  bufs = (double *) arena_alloc(default_arena(), max_threads *
+                                (GEMM_AP_SIZE + GEMM_BP_SIZE) *
+                                sizeof(double));
+  if (!a || !b || !c || !bufs) {
+    printf("COULDN'T ALLOCATE spmm storage\n");
+    exit(-1);
+  }
+  for (i = 0; i < (long) SPMM_N * SPMM_NB; i++) {
+    b[i] = (double)(i % 7 - 3) * 0.5;
+    c[i] = IDENT;
+  }
+  for (i = 0; i < max_threads * (GEMM_AP_SIZE + GEMM_BP_SIZE); i++)
+    bufs[i] = 0.0;
+
+  /* the dense time is the same at every density */
+  make_sparse(SPMM_N, SPMM_N, a, SPMM_N, 0.5, 0);
+  TIME_REPS(t_dense, gemm_rows_omp(SPMM_N, SPMM_NB, SPMM_N, a, SPMM_N, b,
+                                   SPMM_NB, c, SPMM_NB, bufs, max_threads));
+  printf("\ndense gemm: %.3f ms, %.2f GFLOP/s\n", t_dense * 1.0e3,
+         2.0 * SPMM_N * SPMM_N * SPMM_NB / t_dense * 1.0e-9);
+
+  for (pat = 0; pat < 2; pat++) {
+    printf("\n%s: times in ms (speedup over dense)\n", pat_name[pat]);
+    printf("density, nnz, CSR, BSR, BSR fill, dense\n");
+    crossover_x = -1;
+    for (x = 0; x < NUM_TESTS; x++) {
+      mark = arena_mark(default_arena());
+      make_sparse(SPMM_N, SPMM_N, a, SPMM_N, densities[x], pat);
+      sa = csr_from_dense(SPMM_N, SPMM_N, a, SPMM_N);
+      sb = bsr_from_dense(SPMM_N, SPMM_N, a, SPMM_N);
+      if (!sa || !sb) exit(-1);
+
+      TIME_REPS(t_csr, csr_spmm(sa, SPMM_NB, b, SPMM_NB, c, SPMM_NB,
+                                max_threads));
+      TIME_REPS(t_bsr, bsr_spmm(sb, SPMM_NB, b, SPMM_NB, c, SPMM_NB,
+                                max_threads));
+      printf("%5.3f, %8ld, %8.3f (%6.2f), %8.3f (%6.2f), %5.2f, %8.3f\n",
+             densities[x], sa->nnz, t_csr * 1.0e3, t_dense / t_csr,
+             t_bsr * 1.0e3, t_dense / t_bsr,
+             (double) sb->nblocks * SPMM_BR * SPMM_BC / sa->nnz,
+             t_dense * 1.0e3);
+      if (crossover_x < 0 && t_dense < ((t_csr < t_bsr) ? t_csr : t_bsr))
+        crossover_x = x;
+
+      free(sa);
+      free(sb);
+      arena_release(default_arena(), mark);
+    }
+    if (crossover_x < 0)
+      printf("crossover: sparse is faster at every density tested\n");
+    else
+      printf("crossover: dense is faster from density %.3f\n",
+             densities[crossover_x]);
+  }
+
+  printf("\n");
+  printf("Initial delay was calculating: %g \n", final_answer);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+
+/* M x K matrix a with density d of nonzeros, each element (blocked = 0) or
+   each 4 x 4 block (blocked = 1) nonzero with probability d; the values
+   are small nonzero integers */
+void make_sparse(long int M, long int K, double *a, long int lda, double d,
+                 int blocked)
+{
+  long int i, k, bi, bk, threshold = (long int)(d * RAND_MAX);
+
+  srandom(1);
+  for (i = 0; i < M; i++)
+    for (k = 0; k < K; k++) a[i*lda + k] = 0.0;
+
+  if (!blocked) {
+    for (i = 0; i < M; i++)
+      for (k = 0; k < K; k++)
+        if (random() < threshold)
+          a[i*lda + k] = (double)((i + k) % 5 + 1) * ((k & 1) ? -1 : 1);
+    return;
+  }
+  for (bi = 0; bi < M; bi += SPMM_BR)
+    for (bk = 0; bk < K; bk += SPMM_BC) {
+      if (random() >= threshold) continue;
+      for (i = bi; i < M && i < bi + SPMM_BR; i++)
+        for (k = bk; k < K && k < bk + SPMM_BC; k++)
+          a[i*lda + k] = (double)((i + k) % 5 + 1) * ((k & 1) ? -1 : 1);
+    }
+}
+
+/* C += A * B with every thread doing a block of rows (on MR boundaries)
+   with gemm_blocked() and its own packing buffers from bufs
+   (nthreads * (GEMM_AP_SIZE + GEMM_BP_SIZE) doubles, 64-byte aligned) */
+void gemm_rows_omp(long int M, long int N, long int K, const double *a,
+                   long int lda, const double *b, long int ldb, double *c,
+                   long int ldc, double *bufs, int nthreads)
+{
+#pragma omp parallel num_threads(nthreads)
+  {
+    int t = omp_get_thread_num(), nt = omp_get_num_threads();
+    long int units = (M + GEMM_MR - 1) / GEMM_MR;
+    long int r0 = (t * units / nt) * GEMM_MR;
+    long int r1 = ((t + 1) * units / nt) * GEMM_MR;
+    double *ap = &bufs[t * (GEMM_AP_SIZE + GEMM_BP_SIZE)];
+
+    if (r1 > M) r1 = M;
+    if (r0 < r1)
+      gemm_blocked(r1 - r0, N, K, &a[r0*lda], lda, b, ldb, &c[r0*ldc], ldc,
+                   ap, ap + GEMM_AP_SIZE);
+  }
+}
+
+/* csr_spmm and bsr_spmm against a scalar dense loop, on shapes that
+   aren't multiples of the block or vector sizes, both patterns, on 1 and
+   3 threads. Returns the number of wrong elements. */
+long int check_spmm(void)
+{
+  static const long int sh[][3] = {   /* M, K, N */
+    {1, 1, 1}, {3, 5, 7}, {4, 4, 8}, {17, 13, 33}, {37, 70, 45},
+    {64, 64, 64}, {101, 90, 19}
+  };
+  const int nsh = sizeof(sh) / sizeof(sh[0]);
+  const long int ld = 128;
+  arena_mark_t mark = arena_mark(default_arena());
+  double *a = (double *) arena_alloc(default_arena(), ld*ld * sizeof(double));
+  double *b = (double *) arena_alloc(default_arena(), ld*ld * sizeof(double));
+  double *c = (double *) arena_alloc(default_arena(), ld*ld * sizeof(double));
+  double *ref = (double *) arena_alloc(default_arena(),
+                                       ld*ld * sizeof(double));
+  long int s, i, j, k, M, K, N, errors = 0;
+  int nt, pat, kind;
+  double d;
+  csr_ptr sa;
+  bsr_ptr sb;
+
+  if (!a || !b || !c || !ref) exit(-1);
+  for (i = 0; i < ld*ld; i++) b[i] = (double)(i % 7 - 3);
+
+  for (s = 0; s < nsh; s++) {
+    M = sh[s][0];
+    K = sh[s][1];
+    N = sh[s][2];
+    for (pat = 0; pat < 2; pat++)
+      for (d = 0.1; d < 1.0; d += 0.4) {
+        make_sparse(M, K, a, ld, d, pat);
+        for (i = 0; i < M; i++)
+          for (j = 0; j < N; j++) {
+            ref[i*ld + j] = 1.0;
+            for (k = 0; k < K; k++) ref[i*ld + j] += a[i*ld + k] * b[k*ld + j];
+          }
+        sa = csr_from_dense(M, K, a, ld);
+        sb = bsr_from_dense(M, K, a, ld);
+        if (!sa || !sb) exit(-1);
+        for (kind = 0; kind < 2; kind++)
+          for (nt = 1; nt <= 3; nt += 2) {
+            for (i = 0; i < M; i++)
+              for (j = 0; j < N; j++) c[i*ld + j] = 1.0;
+            if (kind == 0) csr_spmm(sa, N, b, ld, c, ld, nt);
+            else bsr_spmm(sb, N, b, ld, c, ld, nt);
+            for (i = 0; i < M; i++)
+              for (j = 0; j < N; j++)
+                if (c[i*ld + j] != ref[i*ld + j]) errors++;
+          }
+        free(sa);
+        free(sb);
+      }
+  }
+
+  arena_release(default_arena(), mark);
+  return errors;
+}
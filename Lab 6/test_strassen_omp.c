@@ -0,0 +1,641 @@
+/***********************************************************************
+
+ gcc -O3 -mavx2 -mfma -fopenmp test_strassen_omp.c -lrt -lm -o test_strassen_omp
+ ./test_strassen_omp [max_threads]
+
+ Strassen-Winograd matrix multiply (C = A * B, square, doubles), compared
+ with the classical gemm.h kernel for time and for accuracy.
+
+ Each level splits A, B and C into 2 x 2 blocks of size n/2 and does 7
+ half-size products instead of 8 (Winograd's variant, 15 block additions
+ instead of Strassen's 18):
+
+   S1 = A21 + A22   S2 = S1 - A11    S3 = A11 - A21   S4 = A12 - S2
+   T1 = B12 - B11   T2 = B22 - T1    T3 = B22 - B12   T4 = T2 - B21
+   P1 = A11 B11     P2 = A12 B21     P3 = S4 B22      P4 = A22 T4
+   P5 = S1 T1       P6 = S2 T2       P7 = S3 T3
+   C11 = P1 + P2             C12 = P1 + P6 + P5 + P3
+   C21 = P1 + P6 + P7 - P4   C22 = P1 + P6 + P7 + P5
+
+ - Below the cutoff the recursion stops and the block goes to the packed
+   gemm.h kernel, which is faster than Strassen on small blocks. The cutoff
+   is tuned at the start of the run by timing a few candidates.
+ - Odd sizes are handled by peeling: the even (n-1) x (n-1) part goes
+   through the recursion, and the last row, the last column and the rank-1
+   update they contribute to the rest are done with gemm.
+ - strassen_seq() uses the schedule of Douglas et al. (1994), which keeps
+   the S's, T's and P's in two temporaries of size n/2 x n/2 plus the four
+   blocks of C, so the whole recursion needs about 2/3 n^2 of workspace.
+ - strassen_omp() runs the 7 products of the top level as OpenMP tasks.
+   They need their own S's, T's and P's (15 blocks of n/2 x n/2), and each
+   task runs strassen_seq below that.
+ - No level calls malloc. Every task owns a workspace arena (arena.h) that
+   is created and faulted in once, before any timing, at the size the
+   recursion needs; each level takes its temporaries and the gemm packing
+   buffers with arena_mark()/arena_alloc() and gives them back with
+   arena_release(). The top-level blocks come from default_arena() the same
+   way.
+
+ Accuracy: for a sample of rows, every element is compared with a long
+ double dot product, and the error is divided by sum_k |a_ik| |b_kj| (the
+ bound for the classical algorithm is about n times the unit roundoff of
+ that). Strassen is only normwise stable, so its error is larger and grows
+ with the number of levels.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <omp.h>
+#include "arena.h"
+
+/* We do *not* use CPNS (cycles per nanosecond) because when multiple
+   cores are each executing with their own clock speeds, sometimes overlapping
+   in time, measuring "how many cycles" a program takes does not reflect
+   how much time it takes. We care about time more than about cycles. */
+
+#define NUM_TESTS 5
+
+static const long int sizes[NUM_TESTS] = {512, 1000, 1024, 1537, 2048};
+
+#define NUM_CUTOFFS 5   /* candidates for the cutoff, tuned at TUNE_SIZE */
+
+static const long int cutoffs[NUM_CUTOFFS] = {64, 128, 256, 512, 1024};
+
+#define TUNE_SIZE 2048
+#define STRASSEN_TASKS 7
+#define ERR_ROWS 16     /* rows sampled for the accuracy check */
+
+#define IDENT 0
+
+typedef double data_t;
+
+/* M x N matrices with a leading dimension (mat_ptr), see mat.h */
+#include "mat.h"
+#include "gemm.h"
+
+/* Prototypes */
+int clock_gettime(clockid_t clk_id, struct timespec *tp);
+size_t strassen_seq_bytes(long int n, long int cutoff);
+arena_ptr new_workspace(size_t bytes);
+void strassen_seq(long int n, const double *a, long int lda, const double *b,
+                  long int ldb, double *c, long int ldc, long int cutoff,
+                  arena_ptr ws);
+void strassen_omp(long int n, const double *a, long int lda, const double *b,
+                  long int ldb, double *c, long int ldc, long int cutoff,
+                  int nthreads, arena_ptr *ws);
+void gemm_mat(mat_ptr a, mat_ptr b, mat_ptr c);
+void strassen_seq_mat(mat_ptr a, mat_ptr b, mat_ptr c, long int cutoff,
+                      arena_ptr ws);
+void strassen_omp_mat(mat_ptr a, mat_ptr b, mat_ptr c, long int cutoff,
+                      int nthreads, arena_ptr *ws);
+double max_rel_error(mat_ptr a, mat_ptr b, mat_ptr c);
+long int check_strassen(arena_ptr *ws);
+double fRand(double fMin, double fMax);
+
+/* -=-=-=-=- Time measurement by clock_gettime() -=-=-=-=- */
+/*
+  As described in the clock_gettime manpage (type "man clock_gettime" at the
+  shell prompt), a "timespec" is a structure that looks like this:
+
+        struct timespec {
+          time_t   tv_sec;   // seconds
+          long     tv_nsec;  // and nanoseconds
+        };
+ */
+
+double interval(struct timespec start, struct timespec end)
+{
+  struct timespec temp;
+  temp.tv_sec = end.tv_sec - start.tv_sec;
+  temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+  if (temp.tv_nsec < 0) {
+    temp.tv_sec = temp.tv_sec - 1;
+    temp.tv_nsec = temp.tv_nsec + 1000000000;
+  }
+  return (((double)temp.tv_sec) + ((double)temp.tv_nsec)*1.0e-9);
+}
+/*
+     This method does not require adjusting a #define constant
+
+  How to use this method:
+
+      struct timespec time_start, time_stop;
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+      // DO SOMETHING THAT TAKES TIME
+      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+      measurement = interval(time_start, time_stop);
+
+ */
+
+
+/* -=-=-=-=- End of time measurement declarations =-=-=-=- */
+
+/* This routine "wastes" a little time to make sure the machine gets
+   out of power-saving mode (800 MHz) and switches to normal speed. */
+double wakeup_delay()
+{
+  double meas = 0; int i, j;
+  struct timespec time_start, time_stop;
+  double quasi_random = 0;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_start);
+  j = 100;
+  while (meas < 1.0) {
+    for (i=1; i<j; i++) {
+      /* This iterative calculation uses a chaotic map function, specifically
+         the complex quadratic map (as in Julia and Mandelbrot sets), which is
+         unpredictable enough to prevent compiler optimisation. */
+      quasi_random = quasi_random*quasi_random - 1.923432;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time_stop);
+    meas = interval(time_start, time_stop);
+    j *= 2; /* Twice as much delay next time, until we've taken 1 second */
+  }
+  return quasi_random;
+}
+
+
+/************************************************************************/
+int main(int argc, char *argv[])
+{
+  struct timespec time_start, time_stop;
+  double final_answer, t_gemm, t_seq, t_omp, t_best = 1e30, flops;
+  double e_gemm, e_seq, e_omp;
+  long int x, n, i, j, max_n, cutoff, best_cutoff = cutoffs[0];
+  size_t ws_bytes, bytes;
+  arena_ptr ws[STRASSEN_TASKS];
+  int max_threads;
+
+  printf("Strassen-Winograd vs. classical GEMM\n");
+
+  max_threads = omp_get_num_procs();
+  if (argc > 1) max_threads = atoi(argv[1]);
+  if (max_threads < 1) max_threads = 1;
+  printf("Parallel version on %d threads (%d processors)\n", max_threads,
+         omp_get_num_procs());
+
+  final_answer = wakeup_delay();
+
+  /* one workspace per task, big enough for every size and cutoff */
+  max_n = (sizes[NUM_TESTS-1] > TUNE_SIZE) ? sizes[NUM_TESTS-1] : TUNE_SIZE;
+  ws_bytes = 0;
+  for (i = 0; i < NUM_CUTOFFS; i++) {
+    bytes = strassen_seq_bytes(max_n, cutoffs[i]);
+    if (bytes > ws_bytes) ws_bytes = bytes;
+  }
+  for (i = 0; i < STRASSEN_TASKS; i++) ws[i] = new_workspace(ws_bytes);
+  printf("Workspace: %d arenas of %.1f MB\n", STRASSEN_TASKS,
+         ws_bytes / 1048576.0);
+
+  if (check_strassen(ws)) {
+    printf("check_strassen FAILED\n");
+    exit(-1);
+  }
+  printf("check_strassen passed\n");
+
+  /* declare and initialize the matrix structures */
+  mat_ptr a0 = new_mat(max_n, max_n);
+  mat_ptr b0 = new_mat(max_n, max_n);
+  mat_ptr c0 = new_mat(max_n, max_n);
+  if (!a0 || !b0 || !c0) exit(-1);
+  srandom(1);
+  for (i = 0; i < max_n; i++)
+    for (j = 0; j < max_n; j++) {
+      a0->data[i*a0->ld + j] = fRand(-1.0, 1.0);
+      b0->data[i*b0->ld + j] = fRand(-1.0, 1.0);
+    }
+
+  /* tune the cutoff on one thread */
+  printf("\nTuning the cutoff at n = %d (seconds, 1 thread)\n", TUNE_SIZE);
+  printf("cutoff, strassen_seq\n");
+  set_mat_size(a0, TUNE_SIZE, TUNE_SIZE);
+  set_mat_size(b0, TUNE_SIZE, TUNE_SIZE);
+  set_mat_size(c0, TUNE_SIZE, TUNE_SIZE);
+  for (i = 0; i < NUM_CUTOFFS; i++) {
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    strassen_seq_mat(a0, b0, c0, cutoffs[i], ws[0]);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_seq = interval(time_start, time_stop);
+    printf("%5ld, %10.4g\n", cutoffs[i], t_seq);
+    if (t_seq < t_best) {
+      t_best = t_seq;
+      best_cutoff = cutoffs[i];
+    }
+  }
+  cutoff = best_cutoff;
+  printf("Using cutoff %ld\n", cutoff);
+
+  printf("\nAll times are in seconds; speedups are over the classical gemm "
+         "on 1 thread.\nError: max |c - exact| / (|A||B|) over %d sampled "
+         "rows\n", ERR_ROWS);
+  printf("rowlen, gemm, GFLOPs, strassen_seq, speedup, strassen_omp, "
+         "speedup, gemm err, seq err, omp err\n");
+  for (x = 0; x < NUM_TESTS; x++) {
+    n = sizes[x];
+    flops = 2.0 * n * n * n;   /* classical flop count, for comparison */
+    set_mat_size(a0, n, n);
+    set_mat_size(b0, n, n);
+    set_mat_size(c0, n, n);
+
+    fill_mat(c0, IDENT);
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    gemm_mat(a0, b0, c0);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_gemm = interval(time_start, time_stop);
+    e_gemm = max_rel_error(a0, b0, c0);
+
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    strassen_seq_mat(a0, b0, c0, cutoff, ws[0]);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_seq = interval(time_start, time_stop);
+    e_seq = max_rel_error(a0, b0, c0);
+
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    strassen_omp_mat(a0, b0, c0, cutoff, max_threads, ws);
+    clock_gettime(CLOCK_REALTIME, &time_stop);
+    t_omp = interval(time_start, time_stop);
+    e_omp = max_rel_error(a0, b0, c0);
+
+    printf("%4ld,%10.4g,%7.2f,%10.4g,%6.2f,%10.4g,%6.2f, %9.2e, %9.2e, "
+           "%9.2e\n", n, t_gemm, flops / t_gemm * 1.0e-9, t_seq,
+           t_gemm / t_seq, t_omp, t_gemm / t_omp, e_gemm, e_seq, e_omp);
+  }
+
+  printf("\n");
+  printf("Initial delay was calculating: %g \n", final_answer);
+
+  return 0;
+} /* end main */
+
+/**********************************************/
+
+/* c = a + b and c = a - b on m x n blocks; c may be a or b */
+static void blk_add(long int m, long int n, const double *a, long int lda,
+                    const double *b, long int ldb, double *c, long int ldc)
+{
+  long int i, j;
+
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      c[i*ldc + j] = a[i*lda + j] + b[i*ldb + j];
+}
+
+static void blk_sub(long int m, long int n, const double *a, long int lda,
+                    const double *b, long int ldb, double *c, long int ldc)
+{
+  long int i, j;
+
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      c[i*ldc + j] = a[i*lda + j] - b[i*ldb + j];
+}
+
+static void blk_zero(long int m, long int n, double *c, long int ldc)
+{
+  long int i, j;
+
+  for (i = 0; i < m; i++)
+    for (j = 0; j < n; j++)
+      c[i*ldc + j] = 0.0;
+}
+
+/* bytes of n x n doubles, rounded the way the arena rounds them */
+static size_t blk_bytes(long int n)
+{
+  return ((size_t) n * n * sizeof(double) + ARENA_ALIGN - 1)
+         & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static size_t pack_bytes(void)
+{
+  return (GEMM_AP_SIZE + GEMM_BP_SIZE) * sizeof(double);
+}
+
+/* Workspace strassen_seq() takes from its arena at its deepest point */
+size_t strassen_seq_bytes(long int n, long int cutoff)
+{
+  size_t rest;
+
+  if (n <= cutoff) return pack_bytes();
+  if (n % 2) {
+    rest = strassen_seq_bytes(n - 1, cutoff);
+    return (rest > pack_bytes()) ? rest : pack_bytes();
+  }
+  return 2 * blk_bytes(n / 2) + strassen_seq_bytes(n / 2, cutoff);
+}
+
+/* A workspace arena of the given size, faulted in now so that no timed
+   run pays for the page faults */
+arena_ptr new_workspace(size_t bytes)
+{
+  arena_ptr ar = new_arena(bytes, ARENA_ALIGN, 1);
+  char *p;
+
+  if (!ar || !(p = (char *) arena_alloc(ar, bytes))) {
+    printf("COULDN'T ALLOCATE %zu BYTES of Strassen workspace\n", bytes);
+    exit(-1);
+  }
+  memset(p, 0, bytes);
+  arena_reset(ar);
+  return ar;
+}
+
+/* C = A * B with the packed gemm kernel, packing buffers from ws */
+static void base_gemm(long int m, long int n, long int k, const double *a,
+                      long int lda, const double *b, long int ldb, double *c,
+                      long int ldc, arena_ptr ws)
+{
+  arena_mark_t mark = arena_mark(ws);
+  double *ap = (double *) arena_alloc(ws, GEMM_AP_SIZE * sizeof(double));
+  double *bp = (double *) arena_alloc(ws, GEMM_BP_SIZE * sizeof(double));
+
+  if (!ap || !bp) {
+    printf("COULDN'T ALLOCATE gemm packing buffers\n");
+    exit(-1);
+  }
+  blk_zero(m, n, c, ldc);
+  gemm_blocked(m, n, k, a, lda, b, ldb, c, ldc, ap, bp);
+  arena_release(ws, mark);
+}
+
+/* Finish an odd n x n product after the leading (n-1) x (n-1) block of C
+   holds A(0:m,0:m) * B(0:m,0:m), m = n - 1 */
+static void peel_fixup(long int n, const double *a, long int lda,
+                       const double *b, long int ldb, double *c, long int ldc,
+                       arena_ptr ws)
+{
+  long int m = n - 1;
+  arena_mark_t mark = arena_mark(ws);
+  double *ap = (double *) arena_alloc(ws, GEMM_AP_SIZE * sizeof(double));
+  double *bp = (double *) arena_alloc(ws, GEMM_BP_SIZE * sizeof(double));
+
+  if (!ap || !bp) {
+    printf("COULDN'T ALLOCATE gemm packing buffers\n");
+    exit(-1);
+  }
+  /* rank-1 update from the last column of A and last row of B */
+  gemm_blocked(m, m, 1, &a[m], lda, &b[m*ldb], ldb, c, ldc, ap, bp);
+  /* last column of C, then the whole last row */
+  blk_zero(m, 1, &c[m], ldc);
+  gemm_blocked(m, 1, n, a, lda, &b[m], ldb, &c[m], ldc, ap, bp);
+  blk_zero(1, n, &c[m*ldc], ldc);
+  gemm_blocked(1, n, n, &a[m*lda], lda, b, ldb, &c[m*ldc], ldc, ap, bp);
+  arena_release(ws, mark);
+}
+
+/* C = A * B (n x n), recursively, on one thread. Two n/2 x n/2
+   temporaries per level, X and Y; the comments give what they hold. */
+void strassen_seq(long int n, const double *a, long int lda, const double *b,
+                  long int ldb, double *c, long int ldc, long int cutoff,
+                  arena_ptr ws)
+{
+  long int h = n / 2;
+  arena_mark_t mark;
+  double *x, *y;
+
+  if (n <= cutoff) {
+    base_gemm(n, n, n, a, lda, b, ldb, c, ldc, ws);
+    return;
+  }
+  if (n % 2) {
+    strassen_seq(n - 1, a, lda, b, ldb, c, ldc, cutoff, ws);
+    peel_fixup(n, a, lda, b, ldb, c, ldc, ws);
+    return;
+  }
+
+  const double *a11 = a, *a12 = a + h, *a21 = a + h*lda, *a22 = a + h*lda + h;
+  const double *b11 = b, *b12 = b + h, *b21 = b + h*ldb, *b22 = b + h*ldb + h;
+  double *c11 = c, *c12 = c + h, *c21 = c + h*ldc, *c22 = c + h*ldc + h;
+
+  mark = arena_mark(ws);
+  x = (double *) arena_alloc(ws, h * h * sizeof(double));
+  y = (double *) arena_alloc(ws, h * h * sizeof(double));
+  if (!x || !y) {
+    printf("COULDN'T ALLOCATE Strassen temporaries\n");
+    exit(-1);
+  }
+
+  blk_sub(h, h, a11, lda, a21, lda, x, h);                /* X = S3 */
+  blk_sub(h, h, b22, ldb, b12, ldb, y, h);                /* Y = T3 */
+  strassen_seq(h, x, h, y, h, c21, ldc, cutoff, ws);      /* C21 = P7 */
+  blk_add(h, h, a21, lda, a22, lda, x, h);                /* X = S1 */
+  blk_sub(h, h, b12, ldb, b11, ldb, y, h);                /* Y = T1 */
+  strassen_seq(h, x, h, y, h, c22, ldc, cutoff, ws);      /* C22 = P5 */
+  blk_sub(h, h, x, h, a11, lda, x, h);                    /* X = S2 */
+  blk_sub(h, h, b22, ldb, y, h, y, h);                    /* Y = T2 */
+  strassen_seq(h, x, h, y, h, c12, ldc, cutoff, ws);      /* C12 = P6 */
+  blk_sub(h, h, a12, lda, x, h, x, h);                    /* X = S4 */
+  strassen_seq(h, x, h, b22, ldb, c11, ldc, cutoff, ws);  /* C11 = P3 */
+  strassen_seq(h, a11, lda, b11, ldb, x, h, cutoff, ws);  /* X = P1 */
+  blk_add(h, h, x, h, c12, ldc, c12, ldc);                /* C12 = P1+P6 */
+  blk_add(h, h, c12, ldc, c21, ldc, c21, ldc);            /* C21 += P1+P6 */
+  blk_add(h, h, c12, ldc, c22, ldc, c12, ldc);            /* C12 += P5 */
+  blk_add(h, h, c21, ldc, c22, ldc, c22, ldc);            /* C22 done */
+  blk_add(h, h, c12, ldc, c11, ldc, c12, ldc);            /* C12 done */
+  blk_sub(h, h, y, h, b21, ldb, y, h);                    /* Y = T4 */
+  strassen_seq(h, a22, lda, y, h, c11, ldc, cutoff, ws);  /* C11 = P4 */
+  blk_sub(h, h, c21, ldc, c11, ldc, c21, ldc);            /* C21 done */
+  strassen_seq(h, a12, lda, b21, ldb, c11, ldc, cutoff, ws); /* C11 = P2 */
+  blk_add(h, h, x, h, c11, ldc, c11, ldc);                /* C11 done */
+
+  arena_release(ws, mark);
+}
+
+/* C = A * B (n x n) with the 7 top-level products as OpenMP tasks on
+   nthreads threads. Task t takes its workspace from ws[t]; the top-level
+   blocks come from default_arena(). */
+void strassen_omp(long int n, const double *a, long int lda, const double *b,
+                  long int ldb, double *c, long int ldc, long int cutoff,
+                  int nthreads, arena_ptr *ws)
+{
+  long int h = n / 2;
+  arena_mark_t mark;
+  double *s[4], *t[4], *p[7];
+  int q;
+
+  if (n <= cutoff || nthreads == 1) {
+    strassen_seq(n, a, lda, b, ldb, c, ldc, cutoff, ws[0]);
+    return;
+  }
+  if (n % 2) {
+    strassen_omp(n - 1, a, lda, b, ldb, c, ldc, cutoff, nthreads, ws);
+    peel_fixup(n, a, lda, b, ldb, c, ldc, ws[0]);
+    return;
+  }
+
+  const double *a11 = a, *a12 = a + h, *a21 = a + h*lda, *a22 = a + h*lda + h;
+  const double *b11 = b, *b12 = b + h, *b21 = b + h*ldb, *b22 = b + h*ldb + h;
+
+  mark = arena_mark(default_arena());
+  for (q = 0; q < 4; q++) {
+    s[q] = (double *) arena_alloc(default_arena(), h * h * sizeof(double));
+    t[q] = (double *) arena_alloc(default_arena(), h * h * sizeof(double));
+    if (!s[q] || !t[q]) {
+      printf("COULDN'T ALLOCATE Strassen top-level blocks\n");
+      exit(-1);
+    }
+  }
+  for (q = 0; q < 7; q++) {
+    p[q] = (double *) arena_alloc(default_arena(), h * h * sizeof(double));
+    if (!p[q]) {
+      printf("COULDN'T ALLOCATE Strassen top-level blocks\n");
+      exit(-1);
+    }
+  }
+
+#pragma omp parallel num_threads(nthreads)
+  {
+    long int i, j;
+
+    /* the S's and T's, one row at a time */
+#pragma omp for schedule(static)
+    for (i = 0; i < h; i++) {
+      for (j = 0; j < h; j++) {
+        double s1 = a21[i*lda+j] + a22[i*lda+j];
+        double s2 = s1 - a11[i*lda+j];
+        double t1 = b12[i*ldb+j] - b11[i*ldb+j];
+        double t2 = b22[i*ldb+j] - t1;
+        s[0][i*h+j] = s1;
+        s[1][i*h+j] = s2;
+        s[2][i*h+j] = a11[i*lda+j] - a21[i*lda+j];
+        s[3][i*h+j] = a12[i*lda+j] - s2;
+        t[0][i*h+j] = t1;
+        t[1][i*h+j] = t2;
+        t[2][i*h+j] = b22[i*ldb+j] - b12[i*ldb+j];
+        t[3][i*h+j] = t2 - b21[i*ldb+j];
+      }
+    }
+
+    /* the 7 products; the tasks are done at the barrier after single */
+#pragma omp single
+    {
+#pragma omp task
+      strassen_seq(h, a11, lda, b11, ldb, p[0], h, cutoff, ws[0]);
+#pragma omp task
+      strassen_seq(h, a12, lda, b21, ldb, p[1], h, cutoff, ws[1]);
+#pragma omp task
+      strassen_seq(h, s[3], h, b22, ldb, p[2], h, cutoff, ws[2]);
+#pragma omp task
+      strassen_seq(h, a22, lda, t[3], h, p[3], h, cutoff, ws[3]);
+#pragma omp task
+      strassen_seq(h, s[0], h, t[0], h, p[4], h, cutoff, ws[4]);
+#pragma omp task
+      strassen_seq(h, s[1], h, t[1], h, p[5], h, cutoff, ws[5]);
+#pragma omp task
+      strassen_seq(h, s[2], h, t[2], h, p[6], h, cutoff, ws[6]);
+    }
+
+    /* put C together */
+#pragma omp for schedule(static)
+    for (i = 0; i < h; i++) {
+      for (j = 0; j < h; j++) {
+        long int k = i*h + j;
+        double u2 = p[0][k] + p[5][k];
+        double u3 = u2 + p[6][k];
+        c[i*ldc + j] = p[0][k] + p[1][k];
+        c[i*ldc + h+j] = u2 + p[4][k] + p[2][k];
+        c[(h+i)*ldc + j] = u3 - p[3][k];
+        c[(h+i)*ldc + h+j] = u3 + p[4][k];
+      }
+    }
+  }
+
+  arena_release(default_arena(), mark);
+}
+
+/* mat_ptr wrappers. gemm adds into c; the Strassen versions overwrite it. */
+void gemm_mat(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  gemm(get_mat_rows(a), get_mat_cols(b), get_mat_cols(a), get_mat_start(a),
+       get_mat_ld(a), get_mat_start(b), get_mat_ld(b), get_mat_start(c),
+       get_mat_ld(c));
+}
+
+void strassen_seq_mat(mat_ptr a, mat_ptr b, mat_ptr c, long int cutoff,
+                      arena_ptr ws)
+{
+  strassen_seq(get_mat_rows(a), get_mat_start(a), get_mat_ld(a),
+               get_mat_start(b), get_mat_ld(b), get_mat_start(c),
+               get_mat_ld(c), cutoff, ws);
+}
+
+void strassen_omp_mat(mat_ptr a, mat_ptr b, mat_ptr c, long int cutoff,
+                      int nthreads, arena_ptr *ws)
+{
+  strassen_omp(get_mat_rows(a), get_mat_start(a), get_mat_ld(a),
+               get_mat_start(b), get_mat_ld(b), get_mat_start(c),
+               get_mat_ld(c), cutoff, nthreads, ws);
+}
+
+/* Largest |c_ij - exact_ij| / sum_k |a_ik| |b_kj| over ERR_ROWS rows
+   spread over c, with the exact value from a long double dot product */
+double max_rel_error(mat_ptr a, mat_ptr b, mat_ptr c)
+{
+  long int r, i, j, k, n = get_mat_rows(c), K = get_mat_cols(a);
+  long double sum, mag;
+  double err, worst = 0.0;
+
+  for (r = 0; r < ERR_ROWS; r++) {
+    i = r * (n - 1) / (ERR_ROWS - 1);
+    for (j = 0; j < get_mat_cols(c); j++) {
+      sum = 0.0L;
+      mag = 0.0L;
+      for (k = 0; k < K; k++) {
+        sum += (long double) a->data[i*a->ld + k] * b->data[k*b->ld + j];
+        mag += fabsl((long double) a->data[i*a->ld + k] * b->data[k*b->ld + j]);
+      }
+      if (mag > 0.0L) {
+        err = (double)(fabsl((long double) c->data[i*c->ld + j] - sum) / mag);
+        if (err > worst) worst = err;
+      }
+    }
+  }
+  return worst;
+}
+
+/* Compare both Strassen versions with gemm on init_mat_check() data, where
+   every sum is exact, for even and odd sizes around a small cutoff.
+   Returns the number of wrong elements. */
+long int check_strassen(arena_ptr *ws)
+{
+  static const long int n_check[] = {16, 17, 40, 63, 64, 100, 129};
+  arena_mark_t mark = arena_mark(default_arena());
+  long int x, n, errors = 0, max_n = 129;
+  mat_ptr a = new_mat(max_n, max_n);
+  mat_ptr b = new_mat(max_n, max_n);
+  mat_ptr ref = new_mat(max_n, max_n);
+  mat_ptr c = new_mat(max_n, max_n);
+
+  if (!a || !b || !ref || !c) exit(-1);
+  init_mat_check(a, b);
+
+  for (x = 0; x < (long int)(sizeof(n_check) / sizeof(n_check[0])); x++) {
+    n = n_check[x];
+    set_mat_size(a, n, n);
+    set_mat_size(b, n, n);
+    set_mat_size(ref, n, n);
+    set_mat_size(c, n, n);
+    fill_mat(ref, IDENT);
+    gemm_mat(a, b, ref);
+
+    fill_mat(c, -1);
+    strassen_seq_mat(a, b, c, 8, ws[0]);
+    errors += count_mat_diff(c, ref);
+
+    fill_mat(c, -1);
+    strassen_omp_mat(a, b, c, 8, 4, ws);
+    errors += count_mat_diff(c, ref);
+  }
+
+  free(a); free(b); free(ref); free(c);
+  arena_release(default_arena(), mark);
+  return errors;
+}
+
+double fRand(double fMin, double fMax)
+{
+  double f = (double)random() / RAND_MAX;
+  return fMin + f * (fMax - fMin);
+}